@@ -8,6 +8,12 @@ add_compile_flags(LD
         -Wl,--no-whole-archive
         -Wl,--end-group
         -Wl,-EL
+        -Wl,--wrap=_malloc_r
+        -Wl,--wrap=_free_r
+        -Wl,--wrap=_realloc_r
+        -Wl,--wrap=_calloc_r
+        -Wl,--wrap=_memalign_r
+        -Wl,--wrap=_malloc_usable_size_r
         "-T \"${SDK_ROOT}/lds/kendryte.ld\""
         )
 
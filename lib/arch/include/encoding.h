@@ -35,6 +35,11 @@
 #define MSTATUS32_SD        0x80000000
 #define MSTATUS64_SD        0x8000000000000000
 
+#define MSTATUS_FS_OFF      0x00000000
+#define MSTATUS_FS_INITIAL  0x00002000
+#define MSTATUS_FS_CLEAN    0x00004000
+#define MSTATUS_FS_DIRTY    0x00006000
+
 #define SSTATUS_UIE         0x00000001
 #define SSTATUS_SIE         0x00000002
 #define SSTATUS_UPIE        0x00000010
@@ -167,6 +172,7 @@
 #define REG_SP 2
 #define REG_T0 5
 #define REG_T1 6
+#define REG_S0 8
 #define REG_A0 10
 #define REG_A1 11
 #define REG_A2 12
@@ -177,8 +183,10 @@
 #define REG_A7 17
 #define REG_APC_PROC 64
 #define REG_APC_RET 65
+#define REG_FSTATUS 66
+#define REG_FCSR 67
 
-#define NUM_XCEPT_REGS (66)
+#define NUM_XCEPT_REGS (68)
 
 #ifdef __riscv
 
@@ -24,12 +24,18 @@
 #include <string.h>
 #include <sysctl.h>
 #include <task.h>
+#include <trace_recorder.h>
 #include <utility.h>
+#include <workqueue.h>
 #include <iomem.h>
 #include <printf.h>
 
 using namespace sys;
 
+#ifndef CONFIG_DMA_IRQ_CORE_MASK
+#define CONFIG_DMA_IRQ_CORE_MASK 1
+#endif
+
 /* DMAC */
 
 class k_dmac_driver : public dmac_driver, public static_object, public free_object_access
@@ -107,12 +113,14 @@ public:
     k_dma_driver(k_dmac_driver &dmac, uint32_t channel)
         : dmac_(dmac), channel_(channel)
     {
+        work_init(&completion_work_, dma_completion_work, this);
     }
 
     virtual void install() override
     {
         pic_set_irq_handler(IRQN_DMA0_INTERRUPT + channel_, dma_completion_isr, this);
         pic_set_irq_priority(IRQN_DMA0_INTERRUPT + channel_, 1);
+        pic_set_irq_affinity(IRQN_DMA0_INTERRUPT + channel_, CONFIG_DMA_IRQ_CORE_MASK);
         pic_set_irq_enable(IRQN_DMA0_INTERRUPT + channel_, 1);
     }
 
@@ -179,7 +187,10 @@ public:
 #endif
         if (count == 0)
         {
-            xSemaphoreGive(completion_event);
+            if (completion_event)
+                xSemaphoreGive(completion_event);
+            else
+                session_.completion_handler(session_.completion_handler_data);
             return;
         }
 
@@ -385,9 +396,18 @@ public:
         writeq(ctl_u.data, &dma.ctl);
 
         session_.completion_event = completion_event;
+        TRACE_RECORD(TRACE_EVENT_DMA_START, channel_, 0, count);
         dmac.chen |= 0x101 << channel_;
     }
 
+    virtual void transmit_async(const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_completion_handler_t completion_handler, void *userdata) override
+    {
+        /* Without a completion event the handler is called instead */
+        session_.completion_handler = completion_handler;
+        session_.completion_handler_data = userdata;
+        transmit_async(src, dest, src_inc, dest_inc, element_size, count, burst_size, nullptr);
+    }
+
     virtual void loop_async(const volatile void **srcs, size_t src_num, volatile void **dests, size_t dest_num, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_stage_completion_handler_t stage_completion_handler, void *stage_completion_handler_data, SemaphoreHandle_t completion_event, int *stop_signal) override
     {
         C_COMMON_ENTRY;
@@ -527,6 +547,7 @@ public:
         for (i = 0; i < dest_num; i++)
             session_.dests[i] = dests[i];
 
+        TRACE_RECORD(TRACE_EVENT_DMA_START, channel_, 1, count);
         dmac.chen |= 0x101 << channel_;
     }
 
@@ -543,6 +564,7 @@ private:
 
         configASSERT(dma.intstatus & 0x2);
         dma.intclear = 0xFFFFFFFF;
+        TRACE_RECORD(TRACE_EVENT_DMA_COMPLETE, driver.channel_, driver.session_.is_loop, 0);
 
         BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
@@ -573,65 +595,100 @@ private:
                 dmac.chen |= 0x101 << driver.channel_;
             }
         }
+        else if (driver.needs_copy_back())
+        {
+            /* Copying back takes time proportional to the transfer, the
+             * worker finishes it and wakes the waiting task */
+            work_queue(&driver.completion_work_);
+        }
         else
         {
-            if (driver.session_.flow_control != DMAC_MEM2MEM_DMA && driver.session_.element_size < 4)
+            driver.finish_transfer(iomem_free_isr);
+            if (driver.session_.completion_event)
+                xSemaphoreGiveFromISR(driver.session_.completion_event, &xHigherPriorityTaskWoken);
+            else
+                driver.session_.completion_handler(driver.session_.completion_handler_data);
+        }
+
+        if (xHigherPriorityTaskWoken)
+            portYIELD_FROM_ISR();
+    }
+
+    bool needs_copy_back() const
+    {
+#if FIX_CACHE
+        if (session_.buf_len)
+            return true;
+#endif
+        return session_.flow_control == DMAC_PRF2MEM_DMA && session_.alloc_mem;
+    }
+
+    /* Copies the bounce buffers back to the caller and frees them */
+    void finish_transfer(void (*free_mem)(void *))
+    {
+        if (session_.flow_control != DMAC_MEM2MEM_DMA && session_.element_size < 4)
+        {
+            if (session_.flow_control == DMAC_PRF2MEM_DMA)
             {
-                if (driver.session_.flow_control == DMAC_PRF2MEM_DMA)
+                if (session_.element_size == 1)
+                {
+                    size_t i;
+                    uint32_t *p_src = reinterpret_cast<uint32_t *>(session_.alloc_mem);
+                    uint8_t *p_dst = (uint8_t *)session_.dest;
+                    for (i = 0; i < session_.count; i++)
+                        p_dst[i] = p_src[i];
+                }
+                else if (session_.element_size == 2)
                 {
-                    if (driver.session_.element_size == 1)
-                    {
-                        size_t i;
-                        uint32_t *p_src = reinterpret_cast<uint32_t *>(driver.session_.alloc_mem);
-                        uint8_t *p_dst = (uint8_t *)driver.session_.dest;
-                        for (i = 0; i < driver.session_.count; i++)
-                            p_dst[i] = p_src[i];
-                    }
-                    else if (driver.session_.element_size == 2)
-                    {
-                        size_t i;
-                        uint32_t *p_src = reinterpret_cast<uint32_t *>(driver.session_.alloc_mem);
-                        uint16_t *p_dst = (uint16_t *)driver.session_.dest;
-                        for (i = 0; i < driver.session_.count; i++)
-                            p_dst[i] = p_src[i];
-                    }
-                    else
-                    {
-                        configASSERT(!"invalid element size");
-                    }
+                    size_t i;
+                    uint32_t *p_src = reinterpret_cast<uint32_t *>(session_.alloc_mem);
+                    uint16_t *p_dst = (uint16_t *)session_.dest;
+                    for (i = 0; i < session_.count; i++)
+                        p_dst[i] = p_src[i];
                 }
-                else if (driver.session_.flow_control == DMAC_MEM2PRF_DMA)
-                    ;
                 else
                 {
-                    configASSERT(!"Impossible");
+                    configASSERT(!"invalid element size");
                 }
-                iomem_free_isr(driver.session_.alloc_mem);
-                driver.session_.alloc_mem = NULL;
             }
-#if FIX_CACHE
+            else if (session_.flow_control == DMAC_MEM2PRF_DMA)
+                ;
             else
             {
-                if(driver.session_.buf_len)
-                {
-                    memcpy(driver.session_.dest_buffer, driver.session_.dest_malloc, driver.session_.buf_len);
-                    iomem_free_isr(driver.session_.dest_malloc);
-                    driver.session_.dest_malloc = NULL;
-                    driver.session_.dest_buffer = NULL;
-                    driver.session_.buf_len = 0;
-                }
-                if(driver.session_.src_malloc)
-                {
-                    iomem_free_isr(driver.session_.src_malloc);
-                    driver.session_.src_malloc = NULL;
-                }
+                configASSERT(!"Impossible");
             }
-#endif
-            xSemaphoreGiveFromISR(driver.session_.completion_event, &xHigherPriorityTaskWoken);
+            free_mem(session_.alloc_mem);
+            session_.alloc_mem = NULL;
         }
+#if FIX_CACHE
+        else
+        {
+            if(session_.buf_len)
+            {
+                memcpy(session_.dest_buffer, session_.dest_malloc, session_.buf_len);
+                free_mem(session_.dest_malloc);
+                session_.dest_malloc = NULL;
+                session_.dest_buffer = NULL;
+                session_.buf_len = 0;
+            }
+            if(session_.src_malloc)
+            {
+                free_mem(session_.src_malloc);
+                session_.src_malloc = NULL;
+            }
+        }
+#endif
+    }
 
-        if (xHigherPriorityTaskWoken)
-            portYIELD_FROM_ISR();
+    static void dma_completion_work(work_t *work, void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_dma_driver *>(userdata);
+
+        driver.finish_transfer(iomem_free);
+        if (driver.session_.completion_event)
+            xSemaphoreGive(driver.session_.completion_event);
+        else
+            driver.session_.completion_handler(driver.session_.completion_handler_data);
     }
 
     static int is_memory(uintptr_t address)
@@ -647,10 +704,13 @@ private:
 private:
     k_dmac_driver &dmac_;
     uint32_t channel_;
+    work_t completion_work_;
 
     struct
     {
         SemaphoreHandle_t completion_event;
+        dma_completion_handler_t completion_handler;
+        void *completion_handler_data;
         int is_loop;
         union {
             struct
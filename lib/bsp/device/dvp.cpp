@@ -26,6 +26,10 @@
 
 using namespace sys;
 
+#ifndef CONFIG_DVP_IRQ_CORE_MASK
+#define CONFIG_DVP_IRQ_CORE_MASK 1
+#endif
+
 class k_dvp_driver : public dvp_driver, public static_object, public exclusive_object_access
 {
 public:
@@ -40,6 +44,7 @@ public:
 
         pic_set_irq_handler(IRQN_DVP_INTERRUPT, dvp_frame_event_isr, this);
         pic_set_irq_priority(IRQN_DVP_INTERRUPT, 1);
+        pic_set_irq_affinity(IRQN_DVP_INTERRUPT, CONFIG_DVP_IRQ_CORE_MASK);
     }
 
     virtual void on_first_open() override
@@ -25,6 +25,10 @@
 
 using namespace sys;
 
+#ifndef CONFIG_GPIOHS_IRQ_CORE_MASK
+#define CONFIG_GPIOHS_IRQ_CORE_MASK 1
+#endif
+
 class k_gpiohs_driver : public gpio_driver, public static_object, public free_object_access
 {
 public:
@@ -48,6 +52,7 @@ public:
             pin_context_[i].pin = i;
             pic_set_irq_handler(IRQN_GPIOHS0_INTERRUPT + i, gpiohs_pin_on_change_isr, pin_context_ + i);
             pic_set_irq_priority(IRQN_GPIOHS0_INTERRUPT + i, 1);
+            pic_set_irq_affinity(IRQN_GPIOHS0_INTERRUPT + i, CONFIG_GPIOHS_IRQ_CORE_MASK);
         }
     }
 
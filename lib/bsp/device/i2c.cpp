@@ -13,6 +13,7 @@
  * limitations under the License.
  */
 #include <FreeRTOS.h>
+#include <errno.h>
 #include <fpioa.h>
 #include <hal.h>
 #include <i2c.h>
@@ -24,13 +25,20 @@
 #include <string.h>
 #include <sysctl.h>
 #include <utility.h>
+#include <workqueue.h>
 
 using namespace sys;
 
+#ifndef CONFIG_I2C_IRQ_CORE_MASK
+#define CONFIG_I2C_IRQ_CORE_MASK 1
+#endif
+
 /* I2C Controller */
 
-#define COMMON_ENTRY \
-    semaphore_lock locker(free_mutex_);
+/* Also waits for the DMA transfer of an io_submit request to finish */
+#define COMMON_ENTRY                    \
+    semaphore_lock locker(free_mutex_); \
+    semaphore_lock async_locker(async_idle_);
 
 class k_i2c_device_driver;
 
@@ -40,11 +48,14 @@ public:
     k_i2c_driver(uintptr_t base_addr, sysctl_clock_t clock, sysctl_threshold_t threshold, sysctl_dma_select_t dma_req)
         : i2c_(*reinterpret_cast<volatile i2c_t *>(base_addr)), clock_(clock), threshold_(threshold), dma_req_(dma_req)
     {
+        work_init(&async_work_, on_async_done, this);
     }
 
     virtual void install() override
     {
         free_mutex_ = xSemaphoreCreateMutex();
+        async_idle_ = xSemaphoreCreateBinary();
+        xSemaphoreGive(async_idle_);
         sysctl_clock_disable(clock_);
         sysctl_clock_set_threshold(threshold_, 3);
     }
@@ -77,6 +88,7 @@ public:
 
         int i2c_idx = clock_ - SYSCTL_CLOCK_I2C0;
         pic_set_irq_priority(IRQN_I2C0_INTERRUPT + i2c_idx, 1);
+        pic_set_irq_affinity(IRQN_I2C0_INTERRUPT + i2c_idx, CONFIG_I2C_IRQ_CORE_MASK);
         pic_set_irq_handler(IRQN_I2C0_INTERRUPT + i2c_idx, on_i2c_irq, this);
         pic_set_irq_enable(IRQN_I2C0_INTERRUPT + i2c_idx, 1);
 
@@ -149,6 +161,23 @@ public:
         return buffer.size();
     }
 
+    /* Writes only, reads are driven by the CPU and stay on the I/O workers */
+    bool submit_async(k_i2c_device_driver &device, io_request_t &request)
+    {
+        if (request.op != IO_REQUEST_WRITE)
+            return false;
+
+        semaphore_lock locker(free_mutex_);
+        configASSERT(xSemaphoreTake(async_idle_, portMAX_DELAY) == pdTRUE);
+        setup_device(device);
+        async_request_ = &request;
+        async_dma_ = dma_open_free();
+
+        dma_set_request_source(async_dma_, dma_req_ + 1);
+        dma_transmit_notify(async_dma_, request.buffer, &i2c_.data_cmd, 1, 0, 1, request.len, 4, on_async_dma_done, this);
+        return true;
+    }
+
     int transfer_sequential(k_i2c_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer)
     {
         COMMON_ENTRY;
@@ -196,6 +225,38 @@ private:
         return v_i2c_freq / v_period_clk_cnt * 2;
     }
 
+    static void on_async_dma_done(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_i2c_driver *>(userdata);
+        work_queue(&driver.async_work_);
+    }
+
+    /* Runs on the work queue, frees the bus before the owner may submit again */
+    static void on_async_done(work_t *work, void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_i2c_driver *>(userdata);
+        auto &i2c = driver.i2c_;
+        io_request_t *request = driver.async_request_;
+        int aborted = 0;
+
+        dma_close(driver.async_dma_);
+        while (i2c.status & I2C_STATUS_ACTIVITY)
+        {
+            if (i2c.tx_abrt_source != 0)
+            {
+                aborted = 1;
+                break;
+            }
+        }
+
+        driver.async_request_ = nullptr;
+        xSemaphoreGive(driver.async_idle_);
+        if (aborted)
+            io_request_complete(request, -1, EIO);
+        else
+            io_request_complete(request, (int)request->len, 0);
+    }
+
     static void on_i2c_irq(void *userdata)
     {
         auto &driver = *reinterpret_cast<k_i2c_driver *>(userdata);
@@ -232,6 +293,12 @@ private:
 
     SemaphoreHandle_t free_mutex_;
     i2c_slave_handler_t slave_handler_;
+
+    /* Taken while an io_submit request owns the bus, given back from the work queue */
+    SemaphoreHandle_t async_idle_;
+    work_t async_work_;
+    io_request_t *async_request_ = nullptr;
+    uintptr_t async_dma_ = 0;
 };
 
 /* I2C Device */
@@ -269,6 +336,11 @@ public:
         return i2c_->transfer_sequential(*this, write_buffer, read_buffer);
     }
 
+    virtual bool submit_async(io_request_t &request) override
+    {
+        return i2c_->submit_async(*this, request);
+    }
+
 private:
     friend class k_i2c_driver;
 
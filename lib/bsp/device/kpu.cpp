@@ -21,6 +21,7 @@
 #include <kernel/driver_impl.hpp>
 #include <kpu.h>
 #include <sysctl.h>
+#include <trace_recorder.h>
 #include <math.h>
 #include <float.h>
 #include <time.h>
@@ -31,6 +32,10 @@
 
 using namespace sys;
 
+#ifndef CONFIG_KPU_IRQ_CORE_MASK
+#define CONFIG_KPU_IRQ_CORE_MASK 1
+#endif
+
 #define KPU_DEBUG 0
 #define NNCASE_DEBUG 0
 #define USE_CACHED_AI_RAM 0
@@ -154,6 +159,7 @@ public:
         kpu_.interrupt_mask.reg = 0b110;
 
         pic_set_irq_priority(IRQN_AI_INTERRUPT, 2);
+        pic_set_irq_affinity(IRQN_AI_INTERRUPT, CONFIG_KPU_IRQ_CORE_MASK);
         pic_set_irq_handler(IRQN_AI_INTERRUPT, kpu_isr_handle, this);
         pic_set_irq_enable(IRQN_AI_INTERRUPT, 1);
 
@@ -933,6 +939,7 @@ private:
 
     int kpu_done()
     {
+        TRACE_RECORD(TRACE_EVENT_KPU_DONE, 0, 0, ctx_.current_layer);
         kpu_.interrupt_clear.reg = 0b111;
 
         kpu_.interrupt_mask.reg = 0b111;
@@ -958,6 +965,7 @@ private:
         const uint8_t *layer_body = ctx_.current_body;
         const kpu_model_layer_header_t *cnt_layer_header = ctx_.layer_headers + cnt_layer_id;
         ctx_.current_body += cnt_layer_header->body_size;
+        TRACE_RECORD(TRACE_EVENT_KPU_LAYER, 0, cnt_layer_header->type, cnt_layer_id);
 
 #if KPU_DEBUG
         uint64_t layer_time;
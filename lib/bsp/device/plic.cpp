@@ -13,14 +13,21 @@
  * limitations under the License.
  */
 #include <FreeRTOS.h>
+#include <atomic.h>
 #include <kernel/driver_impl.hpp>
 #include <plic.h>
 #include <semphr.h>
 #include <stdio.h>
 #include <sysctl.h>
+#include <trace_recorder.h>
 
 using namespace sys;
 
+/* Let higher priority PLIC sources preempt a running handler */
+#ifndef CONFIG_PLIC_NESTED_IRQ
+#define CONFIG_PLIC_NESTED_IRQ 0
+#endif
+
 volatile plic_t &plic = *reinterpret_cast<volatile plic_t *>(PLIC_BASE_ADDR);
 
 class k_plic_driver : public pic_driver, public static_object, public free_object_access
@@ -38,9 +45,13 @@ public:
                 plic.target_enables.target[core_id].enable[i] = 0;
         }
 
-        /* Set priorities to zero. */
+        /* Set priorities to zero and route every source to core 0. */
         for (i = 0; i < PLIC_NUM_SOURCES; i++)
             plic.source_priorities.priority[i] = 0;
+        for (i = 0; i <= PLIC_NUM_SOURCES; i++)
+            affinity_[i] = 1;
+        for (i = 0; i < ((PLIC_NUM_SOURCES + 32u) / 32u); i++)
+            enabled_[i] = 0;
 
         /* Set the threshold to zero. */
         for (core_id = 0; core_id < PLIC_NUM_CORES; core_id++)
@@ -56,15 +67,25 @@ public:
     {
         configASSERT(irq <= PLIC_NUM_SOURCES);
 
-        /* Get current enable bit array by IRQ number */
-        uint32_t current = plic.target_enables.target[0].enable[irq / 32];
+        uintptr_t flags = lock();
         /* Set enable bit in enable bit array */
         if (enable)
-            current |= (uint32_t)1 << (irq % 32);
+            enabled_[irq / 32] |= (uint32_t)1 << (irq % 32);
         else
-            current &= ~((uint32_t)1 << (irq % 32));
-        /* Write back the enable bit array */
-        plic.target_enables.target[0].enable[irq / 32] = current;
+            enabled_[irq / 32] &= ~((uint32_t)1 << (irq % 32));
+        write_enables(irq);
+        unlock(flags);
+    }
+
+    virtual void set_irq_affinity(uint32_t irq, uint32_t core_mask) override
+    {
+        configASSERT(irq <= PLIC_NUM_SOURCES);
+        configASSERT(core_mask && !(core_mask >> PLIC_NUM_CORES));
+
+        uintptr_t flags = lock();
+        affinity_[irq] = core_mask;
+        write_enables(irq);
+        unlock(flags);
     }
 
     virtual void set_irq_priority(uint32_t irq, uint32_t priority) override
@@ -73,6 +94,45 @@ public:
         /* Set interrupt priority by IRQ number */
         plic.source_priorities.priority[irq] = priority;
     }
+
+private:
+    uintptr_t lock()
+    {
+        uintptr_t flags = clear_csr(mstatus, MSTATUS_MIE);
+        spinlock_lock(&lock_);
+        return flags;
+    }
+
+    void unlock(uintptr_t flags)
+    {
+        spinlock_unlock(&lock_);
+        set_csr(mstatus, flags & MSTATUS_MIE);
+    }
+
+    /* An enabled source is enabled on every core of its affinity, call locked */
+    void write_enables(uint32_t irq)
+    {
+        uint32_t bit = (uint32_t)1 << (irq % 32);
+        bool enabled = enabled_[irq / 32] & bit;
+
+        for (size_t core_id = 0; core_id < PLIC_NUM_CORES; core_id++)
+        {
+            /* Get current enable bit array by IRQ number */
+            uint32_t current = plic.target_enables.target[core_id].enable[irq / 32];
+            if (enabled && (affinity_[irq] & (1u << core_id)))
+                current |= bit;
+            else
+                current &= ~bit;
+            /* Write back the enable bit array */
+            plic.target_enables.target[core_id].enable[irq / 32] = current;
+        }
+    }
+
+private:
+    spinlock_t lock_ = SPINLOCK_INIT;
+    uint32_t enabled_[(PLIC_NUM_SOURCES + 32u) / 32u];
+    /* Cores each source is routed to, core 0 unless set otherwise */
+    uint8_t affinity_[PLIC_NUM_SOURCES + 1];
 };
 
 static void plic_complete_irq(uint32_t source)
@@ -85,32 +145,34 @@ static void plic_complete_irq(uint32_t source)
 /* Entry Point for PLIC Interrupt Handler */
 extern "C" void handle_irq_m_ext(uintptr_t *regs, uintptr_t cause)
 {
-    /**
-     * After the highest-priority pending interrupt is claimed by a target
-     * and the corresponding IP bit is cleared, other lower-priority
-     * pending interrupts might then become visible to the target, and so
-     * the PLIC EIP bit might not be cleared after a claim. The interrupt
-     * handler can check the local meip/heip/seip/ueip bits before exiting
-     * the handler, to allow more efficient service of other interrupts
-     * without first restoring the interrupted context and taking another
-     * interrupt trap.
-     */
-    //if (read_csr(mip) & MIP_MEIP)
-    {
-        /* Get current core id */
-        uint64_t core_id = read_csr(mhartid);
-       // uint64_t ie_flag = read_csr(mie);
-        uint32_t int_num = plic.targets.target[core_id].claim_complete;
-        uint32_t int_threshold = plic.targets.target[core_id].priority_threshold;
+    /* Get current core id */
+    uint64_t core_id = read_csr(mhartid);
+    uint32_t int_threshold = plic.targets.target[core_id].priority_threshold;
+    uint32_t int_num;
+#if CONFIG_PLIC_NESTED_IRQ
+    uintptr_t ie_flag = read_csr(mie);
+#endif
 
+    /* Keep claiming until nothing above the threshold is pending, a burst of
+     * interrupts then costs one trap entry and exit. A source routed to
+     * several cores is claimed by one of them, the others read 0. */
+    while ((int_num = plic.targets.target[core_id].claim_complete) != 0)
+    {
+        /* Only sources of a higher priority may preempt this one */
         plic.targets.target[core_id].priority_threshold = plic.source_priorities.priority[int_num];
-        //clear_csr(mie, MIP_MTIP | MIP_MSIP);
-        //set_csr(mstatus, MSTATUS_MIE);
+#if CONFIG_PLIC_NESTED_IRQ
+        /* Keep the tick and IPIs out, they expect to interrupt a task */
+        clear_csr(mie, MIP_MTIP | MIP_MSIP);
+        set_csr(mstatus, MSTATUS_MIE);
+#endif
+        TRACE_RECORD(TRACE_EVENT_PIC_IRQ_ENTER, 0, 0, int_num);
         kernel_iface_pic_on_irq(int_num);
+        TRACE_RECORD(TRACE_EVENT_PIC_IRQ_EXIT, 0, 0, int_num);
+#if CONFIG_PLIC_NESTED_IRQ
+        clear_csr(mstatus, MSTATUS_MIE);
+        write_csr(mie, ie_flag);
+#endif
         plic_complete_irq(int_num);
-        //clear_csr(mstatus, MSTATUS_MIE);
-        //set_csr(mstatus, MSTATUS_MPIE | MSTATUS_MPP);
-        //write_csr(mie, ie_flag);
         plic.targets.target[core_id].priority_threshold = int_threshold;
     }
 }
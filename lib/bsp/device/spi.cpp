@@ -26,19 +26,27 @@
 #include <string.h>
 #include <sysctl.h>
 #include <utility.h>
+#include <workqueue.h>
 #include <printf.h>
 
 using namespace sys;
 
+#ifndef CONFIG_SPI_IRQ_CORE_MASK
+#define CONFIG_SPI_IRQ_CORE_MASK 1
+#endif
+
 #define SPI_TRANSMISSION_THRESHOLD  0x800UL
 #define SPI_DMA_BLOCK_TIME          1000UL
+#define SPI_FIFO_DEPTH              32UL
 
 /* SPI Controller */
 
 #define TMOD_MASK (3 << tmod_off_)
 #define TMOD_VALUE(value) (value << tmod_off_)
-#define COMMON_ENTRY \
-    semaphore_lock locker(free_mutex_);
+/* Also waits for the DMA transfer of an io_submit request to finish */
+#define COMMON_ENTRY                    \
+    semaphore_lock locker(free_mutex_); \
+    semaphore_lock async_locker(async_idle_);
 
 typedef struct _spi_slave_instance
 {
@@ -69,11 +77,14 @@ public:
     k_spi_driver(uintptr_t base_addr, sysctl_clock_t clock, sysctl_dma_select_t dma_req, uint8_t mod_off, uint8_t dfs_off, uint8_t tmod_off, uint8_t frf_off)
         : spi_(*reinterpret_cast<volatile spi_t *>(base_addr)), clock_(clock), dma_req_(dma_req), mod_off_(mod_off), dfs_off_(dfs_off), tmod_off_(tmod_off), frf_off_(frf_off)
     {
+        work_init(&async_work_, on_async_done, this);
     }
 
     virtual void install() override
     {
         free_mutex_ = xSemaphoreCreateMutex();
+        async_idle_ = xSemaphoreCreateBinary();
+        xSemaphoreGive(async_idle_);
         sysctl_clock_disable(clock_);
     }
 
@@ -93,10 +104,13 @@ public:
     void set_endian(k_spi_device_driver &device, uint32_t endian);
     int read(k_spi_device_driver &device, gsl::span<uint8_t> buffer);
     int write(k_spi_device_driver &device, gsl::span<const uint8_t> buffer);
+    int readv(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers);
+    int writev(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers);
     int transfer_full_duplex(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
     int transfer_sequential(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
     int read_write(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer);
     void fill(k_spi_device_driver &device, uint32_t instruction, uint32_t address, uint32_t value, size_t count);
+    bool submit_async(k_spi_device_driver &device, io_request_t &request);
     void slave_config(handle_t gpio_handle, uint8_t int_pin, uint8_t ready_pin, size_t data_bit_length, uint8_t *data, uint32_t len, spi_slave_receive_callback_t callback)
     {
         slave_instance_.s_gpio_driver = system_handle_to_object(gpio_handle).get_object().as<gpio_driver>();
@@ -138,6 +152,7 @@ public:
         slave_instance_.s_gpio->set_on_changed(int_pin, (gpio_on_changed_t)spi_slave_cs_irq, this);
 
         pic_set_irq_priority(IRQN_SPI_SLAVE_INTERRUPT, 4);
+        pic_set_irq_affinity(IRQN_SPI_SLAVE_INTERRUPT, CONFIG_SPI_IRQ_CORE_MASK);
         pic_set_irq_enable(IRQN_SPI_SLAVE_INTERRUPT, 1);
         pic_set_irq_handler(IRQN_SPI_SLAVE_INTERRUPT, spi_slave_irq, this);
         TaskHandle_t h1, h2;
@@ -149,6 +164,7 @@ public:
 
 private:
     void setup_device(k_spi_device_driver &device);
+    int write_segments(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers, size_t tx_frames);
 
     static void spi_slave_irq_thread(void *userdata)
     {
@@ -502,6 +518,62 @@ private:
         }
     }
 
+    /* Push frames to the TX FIFO as it has room */
+    static void write_frames(volatile spi_t &spi, const uint8_t *buffer, size_t frames, size_t width)
+    {
+        while (frames)
+        {
+            size_t index, fifo_len = SPI_FIFO_DEPTH - spi.txflr;
+            fifo_len = fifo_len < frames ? fifo_len : frames;
+            switch (width)
+            {
+            case 4:
+                for (index = 0; index < fifo_len; index++)
+                    spi.dr[0] = ((const uint32_t *)buffer)[index];
+                break;
+            case 2:
+                for (index = 0; index < fifo_len; index++)
+                    spi.dr[0] = ((const uint16_t *)buffer)[index];
+                break;
+            default:
+                for (index = 0; index < fifo_len; index++)
+                    spi.dr[0] = buffer[index];
+                break;
+            }
+
+            buffer += fifo_len * width;
+            frames -= fifo_len;
+        }
+    }
+
+    static void on_async_dma_done(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
+        work_queue(&driver.async_work_);
+    }
+
+    /* Runs on the work queue, frees the bus before the owner may submit again */
+    static void on_async_done(work_t *work, void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_spi_driver *>(userdata);
+        auto &spi = driver.spi_;
+        io_request_t *request = driver.async_request_;
+
+        if (request->op == IO_REQUEST_WRITE)
+        {
+            while ((spi.sr & 0x05) != 0x04)
+                ;
+        }
+
+        spi.ser = 0x00;
+        spi.ssienr = 0x00;
+        spi.dmacr = 0x00;
+        dma_close(driver.async_dma_);
+        driver.async_request_ = nullptr;
+        xSemaphoreGive(driver.async_idle_);
+        io_request_complete(request, (int)request->len, 0);
+    }
+
 private:
     volatile spi_t &spi_;
     sysctl_clock_t clock_;
@@ -513,6 +585,12 @@ private:
 
     SemaphoreHandle_t free_mutex_;
     spi_slave_instance_t slave_instance_;
+
+    /* Taken while an io_submit request owns the bus, given back from the work queue */
+    SemaphoreHandle_t async_idle_;
+    work_t async_work_;
+    io_request_t *async_request_ = nullptr;
+    uintptr_t async_dma_ = 0;
 };
 
 /* SPI Device */
@@ -578,6 +656,16 @@ public:
         return spi_->write(*this, buffer);
     }
 
+    virtual int readv(gsl::span<const io_vec_t> buffers) override
+    {
+        return spi_->readv(*this, buffers);
+    }
+
+    virtual int writev(gsl::span<const io_vec_t> buffers) override
+    {
+        return spi_->writev(*this, buffers);
+    }
+
     virtual int transfer_full_duplex(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override
     {
         return spi_->transfer_full_duplex(*this, write_buffer, read_buffer);
@@ -593,6 +681,11 @@ public:
         spi_->fill(*this, instruction, address, value, count);
     }
 
+    virtual bool submit_async(io_request_t &request) override
+    {
+        return spi_->submit_async(*this, request);
+    }
+
 private:
     static int get_buffer_width(size_t data_bit_length)
     {
@@ -804,6 +897,200 @@ int k_spi_driver::write(k_spi_device_driver &device, gsl::span<const uint8_t> bu
     return buffer.size();
 }
 
+int k_spi_driver::readv(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers)
+{
+    if (buffers.size() == 1)
+        return read(device, { reinterpret_cast<uint8_t *>(buffers[0].base), std::ptrdiff_t(buffers[0].len) });
+
+    size_t total = 0;
+    for (auto &vec : buffers)
+        total += vec.len;
+    if (!total)
+        return 0;
+
+    /* A receive can't be split without the clock stopping, so it goes to one
+     * buffer and is scattered afterwards. The instruction and address are
+     * taken from the start of the buffer, as in read. */
+    std::unique_ptr<uint8_t[]> staging(new uint8_t[total]);
+    size_t inst_addr_len = device.inst_width_ + device.addr_width_;
+    uint8_t *it = staging.get();
+    for (auto &vec : buffers)
+    {
+        size_t len = std::min(vec.len, inst_addr_len);
+        if (!len)
+            break;
+        memcpy(it, vec.base, len);
+        it += len;
+        inst_addr_len -= len;
+    }
+
+    read(device, { staging.get(), std::ptrdiff_t(total) });
+
+    it = staging.get();
+    for (auto &vec : buffers)
+    {
+        memcpy(vec.base, it, vec.len);
+        it += vec.len;
+    }
+
+    return total;
+}
+
+int k_spi_driver::writev(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers)
+{
+    if (buffers.empty())
+        return 0;
+    if (buffers.size() == 1)
+        return write(device, { reinterpret_cast<const uint8_t *>(buffers[0].base), std::ptrdiff_t(buffers[0].len) });
+
+    size_t inst_addr_len = device.inst_width_ + device.addr_width_;
+    configASSERT(buffers[0].len >= inst_addr_len);
+
+    size_t total = 0;
+    for (auto &vec : buffers)
+    {
+        total += vec.len;
+        configASSERT((total - inst_addr_len) % device.buffer_width_ == 0);
+    }
+
+    size_t tx_frames = (total - inst_addr_len) / device.buffer_width_;
+    size_t head_frames = tx_frames - buffers[buffers.size() - 1].len / device.buffer_width_;
+
+    /* The instruction, address and every buffer but the last are preloaded
+     * into the FIFO ahead of the DMA, which needs them to fit. Otherwise the
+     * buffers are gathered into one. */
+    if (tx_frames < SPI_TRANSMISSION_THRESHOLD || head_frames + 2 <= SPI_FIFO_DEPTH)
+        return write_segments(device, buffers, tx_frames);
+
+    std::unique_ptr<uint8_t[]> staging(new uint8_t[total]);
+    uint8_t *it = staging.get();
+    for (auto &vec : buffers)
+    {
+        memcpy(it, vec.base, vec.len);
+        it += vec.len;
+    }
+
+    return write(device, { staging.get(), std::ptrdiff_t(total) });
+}
+
+int k_spi_driver::write_segments(k_spi_device_driver &device, gsl::span<const io_vec_t> buffers, size_t tx_frames)
+{
+    COMMON_ENTRY;
+
+    setup_device(device);
+
+    size_t total = 0;
+    auto buffer_write = reinterpret_cast<const uint8_t *>(buffers[0].base);
+    set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(1));
+
+    /* The slave stays selected as long as the FIFO does not run empty */
+    if (tx_frames < SPI_TRANSMISSION_THRESHOLD)
+    {
+        vTaskEnterCritical();
+        spi_.ssienr = 0x01;
+        write_inst_addr(spi_.dr, &buffer_write, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_write, device.addr_width_);
+        spi_.ser = device.chip_select_mask_;
+        for (auto &vec : buffers)
+        {
+            auto begin = reinterpret_cast<const uint8_t *>(vec.base);
+            if (&vec == &buffers[0])
+                begin = buffer_write;
+            write_frames(spi_, begin, (reinterpret_cast<const uint8_t *>(vec.base) + vec.len - begin) / device.buffer_width_, device.buffer_width_);
+            total += vec.len;
+        }
+
+        vTaskExitCritical();
+    }
+    else
+    {
+        auto &last = buffers[buffers.size() - 1];
+        uintptr_t dma_write = dma_open_free();
+        dma_set_request_source(dma_write, dma_req_ + 1);
+        spi_.dmacr = 0x2;
+        spi_.ssienr = 0x01;
+        write_inst_addr(spi_.dr, &buffer_write, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_write, device.addr_width_);
+        for (auto &vec : buffers)
+        {
+            auto begin = reinterpret_cast<const uint8_t *>(vec.base);
+            if (&vec == &buffers[0])
+                begin = buffer_write;
+            if (&vec != &last)
+                write_frames(spi_, begin, (reinterpret_cast<const uint8_t *>(vec.base) + vec.len - begin) / device.buffer_width_, device.buffer_width_);
+            total += vec.len;
+        }
+
+        SemaphoreHandle_t event_write = xSemaphoreCreateBinary();
+
+        dma_transmit_async(dma_write, last.base, &spi_.dr[0], 1, 0, device.buffer_width_, last.len / device.buffer_width_, 4, event_write);
+        spi_.ser = device.chip_select_mask_;
+        configASSERT(pdTRUE == xSemaphoreTake(event_write, SPI_DMA_BLOCK_TIME));
+
+        dma_close(dma_write);
+        vSemaphoreDelete(event_write);
+    }
+    while ((spi_.sr & 0x05) != 0x04)
+        ;
+    spi_.ser = 0x00;
+    spi_.ssienr = 0x00;
+    spi_.dmacr = 0x00;
+
+    return total;
+}
+
+/* Same transfers as the DMA paths of read and write, the work queue finishes them */
+bool k_spi_driver::submit_async(k_spi_device_driver &device, io_request_t &request)
+{
+    size_t prefix = device.inst_width_ + device.addr_width_;
+    size_t frames;
+    if (request.op == IO_REQUEST_WRITE && request.len >= prefix)
+        frames = (request.len - prefix) / device.buffer_width_;
+    else if (request.op == IO_REQUEST_READ)
+        frames = request.len / device.buffer_width_;
+    else
+        return false;
+
+    /* The FIFO paths are over before a worker would even run */
+    if (frames < SPI_TRANSMISSION_THRESHOLD)
+        return false;
+
+    semaphore_lock locker(free_mutex_);
+    configASSERT(xSemaphoreTake(async_idle_, portMAX_DELAY) == pdTRUE);
+    setup_device(device);
+    async_request_ = &request;
+    async_dma_ = dma_open_free();
+
+    const uint8_t *buffer_it = reinterpret_cast<const uint8_t *>(request.buffer);
+    if (request.op == IO_REQUEST_WRITE)
+    {
+        set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(1));
+        dma_set_request_source(async_dma_, dma_req_ + 1);
+        spi_.dmacr = 0x2;
+        spi_.ssienr = 0x01;
+        write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
+        dma_transmit_notify(async_dma_, buffer_it, &spi_.dr[0], 1, 0, device.buffer_width_, frames, 4, on_async_dma_done, this);
+        spi_.ser = device.chip_select_mask_;
+    }
+    else
+    {
+        set_bit_mask(&spi_.ctrlr0, TMOD_MASK, TMOD_VALUE(2));
+        spi_.ctrlr1 = frames - 1;
+        spi_.ssienr = 0x01;
+        if (device.frame_format_ == SPI_FF_STANDARD)
+            spi_.dr[0] = 0xFFFFFFFF;
+        dma_set_request_source(async_dma_, dma_req_);
+        spi_.dmacr = 0x1;
+        dma_transmit_notify(async_dma_, &spi_.dr[0], request.buffer, 0, 1, device.buffer_width_, frames, 1, on_async_dma_done, this);
+        write_inst_addr(spi_.dr, &buffer_it, device.inst_width_);
+        write_inst_addr(spi_.dr, &buffer_it, device.addr_width_);
+        spi_.ser = device.chip_select_mask_;
+    }
+
+    return true;
+}
+
 int k_spi_driver::transfer_full_duplex(k_spi_device_driver &device, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer)
 {
     COMMON_ENTRY;
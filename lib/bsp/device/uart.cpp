@@ -21,9 +21,14 @@
 #include <stdlib.h>
 #include <sysctl.h>
 #include <uart.h>
+#include <workqueue.h>
 
 using namespace sys;
 
+#ifndef CONFIG_UART_IRQ_CORE_MASK
+#define CONFIG_UART_IRQ_CORE_MASK 1
+#endif
+
 #define UART_BRATE_CONST 16
 #define RINGBUFF_LEN 64
 
@@ -38,14 +43,17 @@ typedef struct
 class k_uart_driver : public uart_driver, public static_object, public free_object_access
 {
 public:
-    k_uart_driver(uintptr_t base_addr, sysctl_clock_t clock, plic_irq_t irq)
-        : uart_(*reinterpret_cast<volatile uart_t *>(base_addr)), clock_(clock), irq_(irq)
+    k_uart_driver(uintptr_t base_addr, sysctl_clock_t clock, plic_irq_t irq, sysctl_dma_select_t dma_tx_req)
+        : uart_(*reinterpret_cast<volatile uart_t *>(base_addr)), clock_(clock), irq_(irq), dma_tx_req_(dma_tx_req)
     {
+        work_init(&async_work_, on_async_done, this);
     }
 
     virtual void install() override
     {
         receive_event_ = xSemaphoreCreateBinary();
+        tx_idle_ = xSemaphoreCreateBinary();
+        xSemaphoreGive(tx_idle_);
         sysctl_clock_disable(clock_);
     }
 
@@ -60,6 +68,7 @@ public:
         recv_buf_ = ring_buff;
         pic_set_irq_handler(irq_, on_irq_apbuart_recv, this);
         pic_set_irq_priority(irq_, 1);
+        pic_set_irq_affinity(irq_, CONFIG_UART_IRQ_CORE_MASK);
         pic_set_irq_enable(irq_, 1);
     }
 
@@ -127,6 +136,7 @@ public:
 
     virtual int write(gsl::span<const uint8_t> buffer) override
     {
+        semaphore_lock locker(tx_idle_);
         auto it = buffer.begin();
         int write = 0;
         while (write < buffer.size())
@@ -143,6 +153,20 @@ public:
         read_timeout_ = millisecond / portTICK_PERIOD_MS;
     }
 
+    /* Writes only, the DMA feeds THR and no task waits for the bytes to go out */
+    virtual bool submit_async(io_request_t &request) override
+    {
+        if (request.op != IO_REQUEST_WRITE)
+            return false;
+
+        configASSERT(xSemaphoreTake(tx_idle_, portMAX_DELAY) == pdTRUE);
+        async_request_ = &request;
+        async_dma_ = dma_open_free();
+        dma_set_request_source(async_dma_, dma_tx_req_);
+        dma_transmit_notify(async_dma_, request.buffer, &uart_.THR, 1, 0, 1, request.len, 1, on_async_dma_done, this);
+        return true;
+    }
+
 private:
     int uart_putc(char c)
     {
@@ -195,6 +219,23 @@ private:
         return cnt;
     }
 
+    static void on_async_dma_done(void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_uart_driver *>(userdata);
+        work_queue(&driver.async_work_);
+    }
+
+    static void on_async_done(work_t *work, void *userdata)
+    {
+        auto &driver = *reinterpret_cast<k_uart_driver *>(userdata);
+        io_request_t *request = driver.async_request_;
+
+        dma_close(driver.async_dma_);
+        driver.async_request_ = nullptr;
+        xSemaphoreGive(driver.tx_idle_);
+        io_request_complete(request, (int)request->len, 0);
+    }
+
     static void on_irq_apbuart_recv(void *userdata)
     {
         auto &driver = *reinterpret_cast<k_uart_driver *>(userdata);
@@ -216,15 +257,22 @@ private:
     volatile uart_t &uart_;
     sysctl_clock_t clock_;
     plic_irq_t irq_;
+    sysctl_dma_select_t dma_tx_req_;
     SemaphoreHandle_t receive_event_;
 
+    /* Taken by write and by an io_submit write until its DMA is done */
+    SemaphoreHandle_t tx_idle_;
+    work_t async_work_;
+    io_request_t *async_request_ = nullptr;
+    uintptr_t async_dma_ = 0;
+
     ringbuffer_t *recv_buf_;
     size_t read_timeout_ = portMAX_DELAY;
 };
 
-static k_uart_driver dev0_driver(UART1_BASE_ADDR, SYSCTL_CLOCK_UART1, IRQN_UART1_INTERRUPT);
-static k_uart_driver dev1_driver(UART2_BASE_ADDR, SYSCTL_CLOCK_UART2, IRQN_UART2_INTERRUPT);
-static k_uart_driver dev2_driver(UART3_BASE_ADDR, SYSCTL_CLOCK_UART3, IRQN_UART3_INTERRUPT);
+static k_uart_driver dev0_driver(UART1_BASE_ADDR, SYSCTL_CLOCK_UART1, IRQN_UART1_INTERRUPT, SYSCTL_DMA_SELECT_UART1_TX_REQ);
+static k_uart_driver dev1_driver(UART2_BASE_ADDR, SYSCTL_CLOCK_UART2, IRQN_UART2_INTERRUPT, SYSCTL_DMA_SELECT_UART2_TX_REQ);
+static k_uart_driver dev2_driver(UART3_BASE_ADDR, SYSCTL_CLOCK_UART3, IRQN_UART3_INTERRUPT, SYSCTL_DMA_SELECT_UART3_TX_REQ);
 
 driver &g_uart_driver_uart0 = dev0_driver;
 driver &g_uart_driver_uart1 = dev1_driver;
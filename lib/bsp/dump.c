@@ -120,7 +120,8 @@ void dump_core(const char *reason, uintptr_t *regs, uintptr_t cause)
                 i * 2 + 1, reg_usage[i * 2 + 1][0], regs[i * 2 + 1]);
         }
 
-        for (i = 0; i < 32 / 2; i++)
+        /* The FP registers are only saved when the trapped code had written them */
+        for (i = 0; i < 32 / 2 && (regs[REG_FSTATUS] & MSTATUS_FS) == MSTATUS_FS_DIRTY; i++)
         {
             DUMP_PRINTF(
                 "freg[%02d](%s) = 0x%016lx, freg[%02d](%s) = 0x%016lx\n",
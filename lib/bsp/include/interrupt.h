@@ -41,6 +41,9 @@ extern "C" {
 /* Supervisor interrupt reason mask for 64 bit system, 0x7FFF FFFF FFFF FFFF */
 #define CAUSE_SUPERVISOR_IRQ_REASON_MASK  (CAUSE_SUPERVISOR_IRQ_MASK - 1)
 
+/* Register frame of the interrupt each core is handling, NULL outside of one */
+extern uintptr_t *g_irq_regs[];
+
 void handle_except(uintptr_t *regs, uintptr_t cause);
 void handle_irq_m_soft(uintptr_t *regs, uintptr_t cause);
 void handle_irq_m_timer(uintptr_t *regs, uintptr_t cause);
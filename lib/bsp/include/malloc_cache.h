@@ -0,0 +1,112 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BSP_MALLOC_CACHE_H
+#define _BSP_MALLOC_CACHE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Small allocations (<= MALLOC_CACHE_MAX_SIZE) are served from per-core
+ * magazines carved out of a dedicated arena, everything else goes to newlib.
+ * The arena is reserved from newlib one segment at a time as blocks run out,
+ * up to MALLOC_CACHE_ARENA_SIZE, and handed back once the cache sat idle with
+ * no block in use for MALLOC_CACHE_IDLE_TICKS. */
+#ifndef MALLOC_CACHE_ARENA_SIZE
+#define MALLOC_CACHE_ARENA_SIZE (256 * 1024)
+#endif
+#ifndef MALLOC_CACHE_SEGMENT_SIZE
+#define MALLOC_CACHE_SEGMENT_SIZE (32 * 1024)
+#endif
+#ifndef MALLOC_CACHE_IDLE_TICKS
+#define MALLOC_CACHE_IDLE_TICKS configTICK_RATE_HZ
+#endif
+#define MALLOC_CACHE_PAGE_SIZE 4096
+#define MALLOC_CACHE_MAGAZINE_SIZE 32
+#define MALLOC_CACHE_CLASSES 10
+#define MALLOC_CACHE_MAX_SIZE 512
+
+typedef struct _malloc_cache_class_stats
+{
+    /* Size of the blocks in this class */
+    size_t block_size;
+    /* Allocations served from the core magazine */
+    size_t hits;
+    /* Allocations that refilled the magazine from the depot or the arena */
+    size_t misses;
+    /* Blocks returned to the core magazine */
+    size_t frees;
+    /* Magazine overflows flushed back to the shared depot */
+    size_t flushes;
+    /* Blocks currently held by the core magazine */
+    size_t cached;
+} malloc_cache_class_stats_t;
+
+typedef struct _malloc_cache_stats
+{
+    /* Bytes currently reserved from newlib */
+    size_t arena_size;
+    /* Bytes of the reserved segments carved into blocks */
+    size_t arena_used;
+    /* Requests passed through to newlib malloc */
+    size_t fallbacks;
+    /* Times the core had to spin on the shared depot lock */
+    size_t depot_waits;
+    malloc_cache_class_stats_t classes[MALLOC_CACHE_CLASSES];
+} malloc_cache_stats_t;
+
+/**
+ * @brief       Get the allocator statistics of one core
+ *
+ * @param[in]   core        The core id
+ * @param[out]  stats       The statistics
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail
+ */
+int malloc_cache_get_stats(uint32_t core, malloc_cache_stats_t *stats);
+
+/**
+ * @brief       Return all blocks cached by the current core to the shared depot
+ */
+void malloc_cache_flush(void);
+
+/**
+ * @brief       Give the arena back to newlib if no cached block is in use
+ *
+ * @return      result
+ *     - 0      Success, or nothing was reserved
+ *     - other  Fail, blocks are still in use
+ */
+int malloc_cache_trim(void);
+
+/**
+ * @brief       Trim the arena once the cache stayed unused for MALLOC_CACHE_IDLE_TICKS,
+ *              called from the idle hook. Never blocks, the trim is skipped while
+ *              another task holds newlib's malloc lock
+ */
+void malloc_cache_idle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BSP_MALLOC_CACHE_H */
@@ -18,9 +18,12 @@
 #include <stdlib.h>
 #include <syslog.h>
 #include <task.h>
+#include <trace_recorder.h>
 
 static const char *TAG = "INTERRUPT";
 
+uintptr_t *g_irq_regs[portNUM_PROCESSORS];
+
 void __attribute__((weak)) handle_irq_dummy(uintptr_t *regs, uintptr_t cause)
 {
     LOGE(TAG, "unhandled interrupt: Cause 0x%016lx, EPC 0x%016lx\n", cause, regs[REG_EPC]);
@@ -47,7 +50,14 @@ uintptr_t *handle_irq(uintptr_t *regs, uintptr_t cause)
 #if defined(__GNUC__)
 #pragma GCC diagnostic warning "-Woverride-init"
 #endif
+        uintptr_t core_id = read_csr(mhartid);
+        uintptr_t *saved_regs = g_irq_regs[core_id];
+
+        g_irq_regs[core_id] = regs;
+        TRACE_RECORD(TRACE_EVENT_ISR_ENTER, cause & CAUSE_HYPERVISOR_IRQ_REASON_MASK, 0, 0);
         irq_table[cause & CAUSE_HYPERVISOR_IRQ_REASON_MASK](regs, cause);
+        TRACE_RECORD(TRACE_EVENT_ISR_EXIT, cause & CAUSE_HYPERVISOR_IRQ_REASON_MASK, 0, 0);
+        g_irq_regs[core_id] = saved_regs;
     }
     else if (cause > CAUSE_USER_ECALL)
     {
@@ -0,0 +1,608 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include <atomic.h>
+#include <encoding.h>
+#include <malloc_cache.h>
+#include <reent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/lock.h>
+
+/*
+ * Per-core caching front end for newlib malloc.
+ *
+ * newlib's _malloc_r/_free_r/_realloc_r/_calloc_r are wrapped at link time
+ * (-Wl,--wrap), malloc and friends as well as newlib's own stdio buffers all
+ * end up there, so every block goes through one allocator. Small
+ * requests are rounded up to a size class and served from the magazine of the
+ * calling core with local interrupts masked, no lock is taken on that path.
+ * An empty magazine is refilled from the shared depot of its class, and the
+ * depot in turn carves fresh pages out of the arena. A full magazine flushes
+ * half of its blocks back to the depot, which is also how blocks freed on the
+ * other core find their way back.
+ *
+ * The arena is a set of segments reserved from newlib when no page is left,
+ * outside the masked section since newlib may block on its lock. Allocated
+ * blocks are counted per core, by the core that takes or returns them, so a
+ * core's count may go negative but the sum is the number of blocks in use.
+ * The trim raises s_trimming before it sums the counts and allocations check
+ * it after counting themselves, so no block is in use nor being handed out
+ * while the segments go back to newlib. Magazines of both cores are dropped
+ * lazily, when their core sees the generation moved on.
+ *
+ * newlib's malloc lock is s_heap_lock here (__malloc_lock/__malloc_unlock), so
+ * the trim can hold it across the frees of the segments. The idle hook only
+ * tries it and skips the trim while another task is in newlib malloc, the
+ * idle task must never block. The lock also tells who is inside newlib:
+ * newlib's memalign and realloc allocate through _malloc_r and then treat the
+ * result as a chunk of their own, so a task holding the lock always gets a
+ * newlib chunk.
+ */
+
+#define SEGMENT_PAGES (MALLOC_CACHE_SEGMENT_SIZE / MALLOC_CACHE_PAGE_SIZE)
+#define ARENA_SEGMENTS (MALLOC_CACHE_ARENA_SIZE / MALLOC_CACHE_SEGMENT_SIZE)
+#define ARENA_PAGES (ARENA_SEGMENTS * SEGMENT_PAGES)
+#define ARENA_ALIGN 16
+
+typedef struct _cache_block
+{
+    struct _cache_block *next;
+} cache_block_t;
+
+typedef struct _magazine
+{
+    cache_block_t *head;
+    size_t count;
+} magazine_t;
+
+typedef struct _core_cache
+{
+    magazine_t magazines[MALLOC_CACHE_CLASSES];
+    size_t generation;
+    malloc_cache_stats_t stats;
+    size_t idle_activity;
+    TickType_t idle_since;
+    long live_blocks;
+} __attribute__((aligned(64))) core_cache_t;
+
+typedef struct _depot
+{
+    spinlock_t lock;
+    cache_block_t *head;
+    size_t count;
+} depot_t;
+
+void *__real__malloc_r(struct _reent *reent, size_t size);
+void __real__free_r(struct _reent *reent, void *ptr);
+void *__real__realloc_r(struct _reent *reent, void *ptr, size_t size);
+void *__real__calloc_r(struct _reent *reent, size_t nmemb, size_t size);
+void *__real__memalign_r(struct _reent *reent, size_t align, size_t size);
+size_t __real__malloc_usable_size_r(struct _reent *reent, void *ptr);
+void __malloc_lock(struct _reent *reent);
+void __malloc_unlock(struct _reent *reent);
+
+static const size_t s_class_sizes[MALLOC_CACHE_CLASSES] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+
+static core_cache_t s_core_caches[portNUM_PROCESSORS];
+static depot_t s_depots[MALLOC_CACHE_CLASSES];
+
+static _lock_t s_heap_lock;
+static TaskHandle_t s_heap_owner;
+static size_t s_heap_depth;
+static int s_trimming;
+static size_t s_generation;
+static int s_growing;
+static size_t s_segments_used;
+static uint8_t *s_segments[ARENA_SEGMENTS];
+static void *s_segment_allocs[ARENA_SEGMENTS];
+static size_t s_arena_pages_used;
+static uint8_t s_page_classes[ARENA_PAGES];
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+    if (flags & MSTATUS_MIE)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+/* The calling task holds newlib's malloc lock */
+static inline int heap_owned(void)
+{
+    TaskHandle_t owner = atomic_read(&s_heap_owner);
+    return owner && owner == xTaskGetCurrentTaskHandle();
+}
+
+/* Count a block the calling core is about to hand out, fails while the arena is trimmed */
+static inline int live_get(void)
+{
+    long *live = &s_core_caches[uxPortGetProcessorId()].live_blocks;
+    atomic_add(live, 1);
+    if (atomic_read(&s_trimming))
+    {
+        atomic_add(live, -1);
+        return 0;
+    }
+
+    return 1;
+}
+
+static inline void live_put(void)
+{
+    atomic_add(&s_core_caches[uxPortGetProcessorId()].live_blocks, -1);
+}
+
+static long live_total(void)
+{
+    long total = 0;
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+        total += atomic_read(&s_core_caches[core].live_blocks);
+    return total;
+}
+
+/* Reserve one more segment, must run with interrupts enabled. Returns 1 if a new page may be free */
+static int arena_grow(struct _reent *reent)
+{
+    size_t segments = atomic_read(&s_segments_used);
+    if (segments >= ARENA_SEGMENTS || atomic_cas(&s_growing, 0, 1) != 0)
+        return 0;
+
+    int grown = 0;
+    /* The other core may have grown the arena meanwhile */
+    if (atomic_read(&s_segments_used) == segments)
+    {
+        void *alloc = __real__malloc_r(reent, MALLOC_CACHE_SEGMENT_SIZE + ARENA_ALIGN);
+        if (alloc)
+        {
+            s_segment_allocs[segments] = alloc;
+            s_segments[segments] = (uint8_t *)(((uintptr_t)alloc + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+            mb();
+            atomic_set(&s_segments_used, segments + 1);
+            grown = 1;
+        }
+    }
+    else
+    {
+        grown = 1;
+    }
+
+    atomic_set(&s_growing, 0);
+    return grown;
+}
+
+/* Page index of an arena pointer, or -1 */
+static inline int arena_page(const void *ptr)
+{
+    size_t segments = atomic_read(&s_segments_used);
+    for (size_t i = 0; i < segments; i++)
+    {
+        const uint8_t *base = s_segments[i];
+        if ((const uint8_t *)ptr >= base && (const uint8_t *)ptr < base + MALLOC_CACHE_SEGMENT_SIZE)
+            return i * SEGMENT_PAGES + ((const uint8_t *)ptr - base) / MALLOC_CACHE_PAGE_SIZE;
+    }
+
+    return -1;
+}
+
+static inline size_t size_to_class(size_t size)
+{
+    size_t i = 0;
+    while (s_class_sizes[i] < size)
+        i++;
+    return i;
+}
+
+/* Current core's cache, interrupts must be masked. Drops blocks of a trimmed arena */
+static core_cache_t *core_cache(void)
+{
+    core_cache_t *cache = &s_core_caches[uxPortGetProcessorId()];
+    size_t generation = atomic_read(&s_generation);
+    if (cache->generation != generation)
+    {
+        for (size_t i = 0; i < MALLOC_CACHE_CLASSES; i++)
+        {
+            cache->magazines[i].head = NULL;
+            cache->magazines[i].count = 0;
+        }
+
+        cache->generation = generation;
+    }
+
+    return cache;
+}
+
+static void depot_lock(core_cache_t *cache, depot_t *depot)
+{
+    if (spinlock_trylock(&depot->lock))
+    {
+        cache->stats.depot_waits++;
+        spinlock_lock(&depot->lock);
+    }
+}
+
+/* Carve a fresh arena page into blocks of the given class, depot must be locked */
+static void depot_carve(depot_t *depot, size_t cls)
+{
+    size_t page = atomic_read(&s_arena_pages_used);
+    for (;;)
+    {
+        if (page >= atomic_read(&s_segments_used) * SEGMENT_PAGES)
+            return;
+
+        size_t old = atomic_cas(&s_arena_pages_used, page, page + 1);
+        if (old == page)
+            break;
+        page = old;
+    }
+
+    s_page_classes[page] = cls;
+    size_t block_size = s_class_sizes[cls];
+    uint8_t *base = s_segments[page / SEGMENT_PAGES] + (page % SEGMENT_PAGES) * MALLOC_CACHE_PAGE_SIZE;
+    for (size_t offset = 0; offset + block_size <= MALLOC_CACHE_PAGE_SIZE; offset += block_size)
+    {
+        cache_block_t *block = (cache_block_t *)(base + offset);
+        block->next = depot->head;
+        depot->head = block;
+        depot->count++;
+    }
+}
+
+static void magazine_refill(core_cache_t *cache, size_t cls)
+{
+    depot_t *depot = &s_depots[cls];
+    magazine_t *mag = &cache->magazines[cls];
+
+    depot_lock(cache, depot);
+    if (!depot->head)
+        depot_carve(depot, cls);
+
+    size_t count = MALLOC_CACHE_MAGAZINE_SIZE / 2;
+    while (count-- && depot->head)
+    {
+        cache_block_t *block = depot->head;
+        depot->head = block->next;
+        depot->count--;
+        block->next = mag->head;
+        mag->head = block;
+        mag->count++;
+    }
+
+    spinlock_unlock(&depot->lock);
+}
+
+static void magazine_flush(core_cache_t *cache, size_t cls, size_t count)
+{
+    magazine_t *mag = &cache->magazines[cls];
+    if (!count || !mag->head)
+        return;
+
+    cache_block_t *first = mag->head;
+    cache_block_t *last = first;
+    size_t flushed = 1;
+    while (flushed < count && last->next)
+    {
+        last = last->next;
+        flushed++;
+    }
+
+    mag->head = last->next;
+    mag->count -= flushed;
+
+    depot_t *depot = &s_depots[cls];
+    depot_lock(cache, depot);
+    last->next = depot->head;
+    depot->head = first;
+    depot->count += flushed;
+    spinlock_unlock(&depot->lock);
+    cache->stats.classes[cls].flushes++;
+}
+
+static cache_block_t *cache_pop(size_t cls)
+{
+    uintptr_t flags = irq_save();
+    core_cache_t *cache = core_cache();
+    magazine_t *mag = &cache->magazines[cls];
+
+    if (mag->head)
+    {
+        cache->stats.classes[cls].hits++;
+    }
+    else
+    {
+        magazine_refill(cache, cls);
+        cache->stats.classes[cls].misses++;
+    }
+
+    cache_block_t *block = mag->head;
+    if (block)
+    {
+        mag->head = block->next;
+        mag->count--;
+    }
+
+    irq_restore(flags);
+    return block;
+}
+
+static void *cache_alloc(struct _reent *reent, size_t size)
+{
+    /* Counted before the block is taken, so the arena cannot be trimmed under it */
+    if (size > MALLOC_CACHE_MAX_SIZE || !live_get())
+        return NULL;
+
+    size_t cls = size_to_class(size);
+    cache_block_t *block = cache_pop(cls);
+    if (!block && arena_grow(reent))
+        block = cache_pop(cls);
+
+    if (!block)
+        live_put();
+    return block;
+}
+
+static void cache_free(void *ptr, int page)
+{
+    size_t cls = s_page_classes[page];
+    uintptr_t flags = irq_save();
+    core_cache_t *cache = core_cache();
+    magazine_t *mag = &cache->magazines[cls];
+
+    if (mag->count >= MALLOC_CACHE_MAGAZINE_SIZE)
+        magazine_flush(cache, cls, MALLOC_CACHE_MAGAZINE_SIZE / 2);
+
+    cache_block_t *block = (cache_block_t *)ptr;
+    block->next = mag->head;
+    mag->head = block;
+    mag->count++;
+    cache->stats.classes[cls].frees++;
+    irq_restore(flags);
+
+    /* Only once the block is back, the trim may take it with the rest */
+    live_put();
+}
+
+static void count_fallback(void)
+{
+    uintptr_t flags = irq_save();
+    s_core_caches[uxPortGetProcessorId()].stats.fallbacks++;
+    irq_restore(flags);
+}
+
+void *__wrap__malloc_r(struct _reent *reent, size_t size)
+{
+    if (heap_owned())
+        return __real__malloc_r(reent, size);
+
+    void *ptr = cache_alloc(reent, size);
+    if (ptr)
+        return ptr;
+
+    count_fallback();
+    return __real__malloc_r(reent, size);
+}
+
+void __wrap__free_r(struct _reent *reent, void *ptr)
+{
+    int page = arena_page(ptr);
+    if (page >= 0)
+        cache_free(ptr, page);
+    else
+        __real__free_r(reent, ptr);
+}
+
+void *__wrap__realloc_r(struct _reent *reent, void *ptr, size_t size)
+{
+    if (!ptr)
+        return __wrap__malloc_r(reent, size);
+
+    int page = arena_page(ptr);
+    if (page < 0)
+    {
+        __malloc_lock(reent);
+        void *new_ptr = __real__realloc_r(reent, ptr, size);
+        __malloc_unlock(reent);
+        return new_ptr;
+    }
+
+    if (size == 0)
+    {
+        cache_free(ptr, page);
+        return NULL;
+    }
+
+    size_t old_size = s_class_sizes[s_page_classes[page]];
+    if (size <= old_size && size > old_size / 2)
+        return ptr;
+
+    void *new_ptr = __wrap__malloc_r(reent, size);
+    if (new_ptr)
+    {
+        memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+        cache_free(ptr, page);
+    }
+
+    return new_ptr;
+}
+
+void *__wrap__calloc_r(struct _reent *reent, size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total))
+        return __real__calloc_r(reent, nmemb, size);
+
+    void *ptr = cache_alloc(reent, total);
+    if (ptr)
+    {
+        memset(ptr, 0, total);
+        return ptr;
+    }
+
+    count_fallback();
+    __malloc_lock(reent);
+    ptr = __real__calloc_r(reent, nmemb, size);
+    __malloc_unlock(reent);
+    return ptr;
+}
+
+void *__wrap__memalign_r(struct _reent *reent, size_t align, size_t size)
+{
+    __malloc_lock(reent);
+    void *ptr = __real__memalign_r(reent, align, size);
+    __malloc_unlock(reent);
+    return ptr;
+}
+
+size_t __wrap__malloc_usable_size_r(struct _reent *reent, void *ptr)
+{
+    int page = arena_page(ptr);
+    if (page >= 0)
+        return s_class_sizes[s_page_classes[page]];
+    return __real__malloc_usable_size_r(reent, ptr);
+}
+
+int malloc_cache_get_stats(uint32_t core, malloc_cache_stats_t *stats)
+{
+    if (core >= portNUM_PROCESSORS || !stats)
+        return -1;
+
+    core_cache_t *cache = &s_core_caches[core];
+    *stats = cache->stats;
+    for (size_t i = 0; i < MALLOC_CACHE_CLASSES; i++)
+    {
+        stats->classes[i].block_size = s_class_sizes[i];
+        stats->classes[i].cached = cache->generation == atomic_read(&s_generation) ? atomic_read(&cache->magazines[i].count) : 0;
+    }
+
+    stats->arena_size = atomic_read(&s_segments_used) * MALLOC_CACHE_SEGMENT_SIZE;
+    stats->arena_used = atomic_read(&s_arena_pages_used) * MALLOC_CACHE_PAGE_SIZE;
+    return 0;
+}
+
+void malloc_cache_flush(void)
+{
+    if (!live_get())
+        return;
+
+    uintptr_t flags = irq_save();
+    core_cache_t *cache = core_cache();
+    for (size_t i = 0; i < MALLOC_CACHE_CLASSES; i++)
+        magazine_flush(cache, i, cache->magazines[i].count);
+    irq_restore(flags);
+    live_put();
+}
+
+/* Give the segments back, waiting for newlib's lock or giving up if it is held */
+static int arena_trim(int wait)
+{
+    if (!atomic_read(&s_segments_used))
+        return 0;
+    if (wait)
+        _lock_acquire_recursive(&s_heap_lock);
+    else if (_lock_try_acquire_recursive(&s_heap_lock) != 0)
+        return -1;
+    /* The heap lock keeps trims apart. Allocations count themselves before they
+     * look at s_trimming, so the sum sees every one that went on */
+    atomic_set(&s_trimming, 1);
+    mb();
+    if (live_total() != 0)
+    {
+        atomic_set(&s_trimming, 0);
+        _lock_release_recursive(&s_heap_lock);
+        return -1;
+    }
+
+    /* Every block is free now, in a magazine or a depot, and none can be handed out */
+    atomic_add(&s_generation, 1);
+    for (size_t i = 0; i < MALLOC_CACHE_CLASSES; i++)
+    {
+        depot_t *depot = &s_depots[i];
+        uintptr_t flags = irq_save();
+        spinlock_lock(&depot->lock);
+        depot->head = NULL;
+        depot->count = 0;
+        spinlock_unlock(&depot->lock);
+        irq_restore(flags);
+    }
+
+    /* Nothing grows the arena either, that takes a counted allocation */
+    size_t segments = atomic_read(&s_segments_used);
+    atomic_set(&s_arena_pages_used, 0);
+    atomic_set(&s_segments_used, 0);
+    mb();
+
+    /* The heap lock is held, newlib takes it again without blocking */
+    for (size_t i = 0; i < segments; i++)
+        __real__free_r(_REENT, s_segment_allocs[i]);
+
+    mb();
+    atomic_set(&s_trimming, 0);
+    _lock_release_recursive(&s_heap_lock);
+    return 0;
+}
+
+void __malloc_lock(struct _reent *reent)
+{
+    _lock_acquire_recursive(&s_heap_lock);
+    if (s_heap_depth++ == 0)
+        atomic_set(&s_heap_owner, xTaskGetCurrentTaskHandle());
+}
+
+void __malloc_unlock(struct _reent *reent)
+{
+    if (--s_heap_depth == 0)
+        atomic_set(&s_heap_owner, NULL);
+    _lock_release_recursive(&s_heap_lock);
+}
+
+int malloc_cache_trim(void)
+{
+    return arena_trim(1);
+}
+
+void malloc_cache_idle(void)
+{
+    if (!atomic_read(&s_segments_used) || live_total())
+        return;
+
+    uintptr_t flags = irq_save();
+    core_cache_t *cache = &s_core_caches[uxPortGetProcessorId()];
+    size_t activity = 0;
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        for (size_t i = 0; i < MALLOC_CACHE_CLASSES; i++)
+            activity += atomic_read(&s_core_caches[core].stats.classes[i].hits) + atomic_read(&s_core_caches[core].stats.classes[i].misses);
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    int trim = 0;
+    if (activity != cache->idle_activity)
+    {
+        cache->idle_activity = activity;
+        cache->idle_since = now;
+    }
+    else
+    {
+        trim = now - cache->idle_since >= MALLOC_CACHE_IDLE_TICKS;
+    }
+
+    irq_restore(flags);
+    if (trim)
+        arena_trim(0);
+}
@@ -13,31 +13,71 @@
  * limitations under the License.
  */
 #include <FreeRTOS.h>
+#include <errno.h>
+#include <hrtimer.h>
+#include <semphr.h>
 #include <task.h>
 #include <sleep.h>
-#include <sysctl.h>
+
+/* Sleeps end with a spin on the clock for this long, which covers the timer
+ * interrupt, the semaphore give and the context switch back to the caller */
+#define SLEEP_SPIN_NS 10000
+
+static void sleep_timer_callback(hrtimer_t *timer, void *userdata, BaseType_t *higher_priority_task_woken)
+{
+    xSemaphoreGiveFromISR((SemaphoreHandle_t)userdata, higher_priority_task_woken);
+}
+
+static void sleep_block_until(uint64_t deadline)
+{
+    StaticSemaphore_t semaphore_buffer;
+    SemaphoreHandle_t semaphore;
+    hrtimer_t timer;
+    uint64_t now = hrtimer_now_ns();
+
+    /* Preempted past the deadline already, the caller spins the rest */
+    if (now >= deadline)
+        return;
+
+    semaphore = xSemaphoreCreateBinaryStatic(&semaphore_buffer);
+    /* The timer is rescaled if the cpu frequency changes while it is pending */
+    hrtimer_init(&timer, sleep_timer_callback, semaphore);
+    if (hrtimer_start_at(&timer, hrtimer_now() + hrtimer_ns_to_ticks(deadline - now), 0) == 0)
+    {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+    }
+    else
+    {
+        /* No timer slot left, fall back to whole ticks */
+        uint64_t tick = 1000000000ULL / configTICK_RATE_HZ;
+        while (hrtimer_now_ns() + tick < deadline)
+            vTaskDelay(1);
+    }
+
+    vSemaphoreDelete(semaphore);
+}
 
 int nanosleep(const struct timespec* req, struct timespec* rem)
 {
-    uint64_t clock_sleep_ms = (uint64_t)req->tv_sec * 1000;
-    uint64_t nsec_ms = req->tv_nsec / 1000000;
-    uint64_t nsec_trailing = req->tv_nsec % 1000000;
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t duration = (uint64_t)req->tv_sec * 1000000000ULL + req->tv_nsec;
+    uint64_t deadline = hrtimer_now_ns() + duration;
 
-    clock_sleep_ms += nsec_ms;
+    if (duration > SLEEP_SPIN_NS && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+        sleep_block_until(deadline - SLEEP_SPIN_NS);
 
-    if (clock_sleep_ms)
-        vTaskDelay(pdMS_TO_TICKS(clock_sleep_ms));
+    while (hrtimer_now_ns() < deadline)
+        ;
 
-    uint64_t microsecs = nsec_trailing / 1000;
-    if (microsecs)
+    if (rem)
     {
-        uint32_t cycles_per_microsec = sysctl_clock_get_freq(SYSCTL_CLOCK_CPU) / 3000000;
-        while (microsecs--)
-        {
-            int i = cycles_per_microsec;
-            while (i--)
-                asm volatile("nop");
-        }
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
     }
 
     return 0;
@@ -48,8 +88,8 @@ int usleep(useconds_t usec)
     /* clang-format off */
     struct timespec req =
     {
-        .tv_sec = 0,
-        .tv_nsec = usec * 1000
+        .tv_sec = usec / 1000000,
+        .tv_nsec = (usec % 1000000) * 1000
     };
     /* clang-format on */
 
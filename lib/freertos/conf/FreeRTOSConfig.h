@@ -65,14 +65,23 @@
 #define configUSE_NEWLIB_REENTRANT				1
 
 #define configUSE_PREEMPTION					1
-#define configUSE_PORT_OPTIMISED_TASK_SELECTION	0
-#define configMAX_PRIORITIES					( 5 )
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION	1
+#define configMAX_PRIORITIES					( 32 )
 #define configMAX_TASK_NAME_LEN					( 16 )
 #define configUSE_TRACE_FACILITY				1
+/* The recorder costs 2 x TRACE_BUFFER_EVENTS x 16 bytes of rings and a check
+on every context switch and interrupt, enable it for debugging */
+#ifndef configUSE_TRACE_RECORDER
+#define configUSE_TRACE_RECORDER				0
+#endif
 #define configUSE_16_BIT_TICKS					0
 #define configIDLE_SHOULD_YIELD					0
 #define configQUEUE_REGISTRY_SIZE				8
 
+/* SMP */
+#define configUSE_TASK_LOAD_BALANCING			0
+#define configLOAD_BALANCE_PERIOD				( ( TickType_t ) 10 )
+
 /* TLS */
 enum
 {
@@ -100,7 +109,8 @@ enum
 #define configUSE_APPLICATION_TASK_TAG			1
 #define configUSE_COUNTING_SEMAPHORES			1
 #define configUSE_TICKLESS_IDLE					1
-#define configGENERATE_RUN_TIME_STATS			0
+#define configGENERATE_RUN_TIME_STATS			1
+#define configLOAD_SAMPLE_PERIOD				( ( TickType_t ) 100 )
 #define configUSE_STATS_FORMATTING_FUNCTIONS	1
 
 /* Co-routine definitions. */
@@ -142,4 +152,21 @@ extern void vPortFatal(const char* file, int line, const char* message);
     vPortFatal(__FILE__, __LINE__, #x);				   \
 }
 
+/* Task and queue names are kept for the trace decoder and the profiler, also
+without the recorder */
+#include "trace_recorder.h"
+
+#define traceTASK_CREATE( pxNewTCB )				trace_set_name( pxNewTCB, ( pxNewTCB )->pcTaskName )
+#define traceQUEUE_REGISTRY_ADD( xQueue, pcQueueName )	trace_set_name( xQueue, pcQueueName )
+
+#if ( configUSE_TRACE_RECORDER == 1 )
+/* Record scheduler events with trace_recorder, started by trace_start() */
+#define traceTASK_SWITCHED_IN()						TRACE_RECORD( TRACE_EVENT_TASK_SWITCH_IN, 0, pxCurrentTCB[uxPsrId]->uxPriority, TRACE_OBJECT_ID( pxCurrentTCB[uxPsrId] ) )
+#define traceTASK_SWITCHED_OUT()					TRACE_RECORD( TRACE_EVENT_TASK_SWITCH_OUT, 0, pxCurrentTCB[uxPsrId]->uxPriority, TRACE_OBJECT_ID( pxCurrentTCB[uxPsrId] ) )
+#define traceMOVED_TASK_TO_READY_STATE( pxTCB )		TRACE_RECORD( TRACE_EVENT_TASK_READY, 0, ( pxTCB )->uxPriority, TRACE_OBJECT_ID( pxTCB ) )
+#define traceBLOCKING_ON_QUEUE_SEND( pxQueue )		TRACE_RECORD( TRACE_EVENT_QUEUE_BLOCK_SEND, 0, 0, TRACE_OBJECT_ID( pxQueue ) )
+#define traceBLOCKING_ON_QUEUE_RECEIVE( pxQueue )	TRACE_RECORD( TRACE_EVENT_QUEUE_BLOCK_RECEIVE, 0, 0, TRACE_OBJECT_ID( pxQueue ) )
+#define traceBLOCKING_ON_QUEUE_PEEK( pxQueue )		TRACE_RECORD( TRACE_EVENT_QUEUE_BLOCK_PEEK, 0, 0, TRACE_OBJECT_ID( pxQueue ) )
+#endif
+
 #endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,301 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include <atomic.h>
+#include <core_channel.h>
+#include <core_sync.h>
+#include <encoding.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Bounded ring of sequenced slots. Each slot carries a sequence number that
+ * tells whether it is free for the sender at position pos (sequence == pos) or
+ * holds the message for the receiver at pos (sequence == pos + 1). Single
+ * sender channels claim slots with a plain store of the tail, multi sender
+ * channels with a CAS. The receiver never takes a lock.
+ *
+ * The receiver publishes itself in waiter before it sleeps. A sender that
+ * finds a waiter after publishing its batch claims it with a swap and wakes
+ * it once, through a core_sync doorbell when the receiver lives on the other
+ * core.
+ */
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct _channel_slot
+{
+    volatile size_t sequence;
+    uint8_t data[];
+} channel_slot_t;
+
+struct _core_channel
+{
+    /* Receiver side */
+    volatile size_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t received;
+
+    /* Sender side */
+    volatile size_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t sent;
+    size_t dropped;
+
+    /* Only touched when the receiver sleeps */
+    volatile TaskHandle_t waiter __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile TaskHandle_t wake_task;
+    size_t doorbells;
+    core_sync_doorbell_t doorbell;
+
+    /* Read only after creation */
+    core_channel_mode_t mode __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t mask;
+    size_t item_size;
+    size_t slot_size;
+    uint8_t *slots;
+    void *memory;
+};
+
+static void channel_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken);
+
+static inline channel_slot_t *channel_slot(core_channel_t *channel, size_t pos)
+{
+    return (channel_slot_t *)(channel->slots + (pos & channel->mask) * channel->slot_size);
+}
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+    if (flags & MSTATUS_MIE)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+core_channel_t *core_channel_create(core_channel_mode_t mode, size_t item_size, size_t capacity)
+{
+    configASSERT(item_size && capacity);
+
+    size_t slots = 1;
+    while (slots < capacity)
+        slots <<= 1;
+    size_t slot_size = (offsetof(channel_slot_t, data) + item_size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+
+    void *memory = pvPortMalloc(sizeof(core_channel_t) + slots * slot_size + CACHE_LINE_SIZE);
+    if (!memory)
+        return NULL;
+
+    core_channel_t *channel = (core_channel_t *)(((uintptr_t)memory + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+    memset(channel, 0, sizeof(core_channel_t));
+    channel->doorbell.handler = channel_doorbell;
+    channel->mode = mode;
+    channel->mask = slots - 1;
+    channel->item_size = item_size;
+    channel->slot_size = slot_size;
+    channel->slots = (uint8_t *)(channel + 1);
+    channel->memory = memory;
+
+    for (size_t i = 0; i < slots; i++)
+        channel_slot(channel, i)->sequence = i;
+    mb();
+    return channel;
+}
+
+void core_channel_delete(core_channel_t *channel)
+{
+    configASSERT(!atomic_read(&channel->doorbell.queued));
+    vPortFree(channel->memory);
+}
+
+/* Wake the receiver on the core that holds it, interrupts must be masked */
+static void channel_notify(core_channel_t *channel, TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+    UBaseType_t core_id = uxTaskProcessorIdGet(task);
+    if (core_id == uxPortGetProcessorId())
+    {
+        vTaskNotifyGiveFromISR(task, higher_priority_task_woken);
+    }
+    else
+    {
+        atomic_set(&channel->wake_task, task);
+        atomic_add(&channel->doorbells, 1);
+        core_sync_ring_doorbell(core_id, &channel->doorbell);
+    }
+}
+
+static void channel_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken)
+{
+    core_channel_t *channel = (core_channel_t *)((uint8_t *)bell - offsetof(core_channel_t, doorbell));
+    TaskHandle_t task = atomic_swap(&channel->wake_task, NULL);
+
+    /* The receiver may have moved since the doorbell was rung, notify forwards it */
+    if (task)
+        channel_notify(channel, task, higher_priority_task_woken);
+}
+
+static void channel_wake(core_channel_t *channel)
+{
+    mb();
+    if (!atomic_read(&channel->waiter))
+        return;
+
+    TaskHandle_t task = atomic_swap(&channel->waiter, NULL);
+    if (!task)
+        return;
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    uintptr_t flags = irq_save();
+    channel_notify(channel, task, &higher_priority_task_woken);
+    irq_restore(flags);
+
+    if (higher_priority_task_woken)
+    {
+        if (uxPortIsInISR())
+            portYIELD_FROM_ISR();
+        else
+            portYIELD();
+    }
+}
+
+size_t core_channel_send(core_channel_t *channel, const void *items, size_t count)
+{
+    const uint8_t *src = (const uint8_t *)items;
+    size_t sent = 0;
+
+    while (sent < count)
+    {
+        size_t pos = atomic_read(&channel->tail);
+        channel_slot_t *slot;
+
+        while (1)
+        {
+            slot = channel_slot(channel, pos);
+            intptr_t diff = (intptr_t)atomic_read(&slot->sequence) - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (channel->mode == CORE_CHANNEL_SPSC)
+                {
+                    atomic_set(&channel->tail, pos + 1);
+                    break;
+                }
+
+                size_t old = atomic_cas(&channel->tail, pos, pos + 1);
+                if (old == pos)
+                    break;
+                pos = old;
+            }
+            else if (diff < 0)
+            {
+                /* The receiver has not consumed this slot yet, channel is full */
+                slot = NULL;
+                break;
+            }
+            else
+            {
+                pos = atomic_read(&channel->tail);
+            }
+        }
+
+        if (!slot)
+            break;
+
+        mb();
+        memcpy(slot->data, src + sent * channel->item_size, channel->item_size);
+        mb();
+        atomic_set(&slot->sequence, pos + 1);
+        sent++;
+    }
+
+    if (sent)
+    {
+        atomic_add(&channel->sent, sent);
+        channel_wake(channel);
+    }
+
+    if (sent < count)
+        atomic_add(&channel->dropped, count - sent);
+    return sent;
+}
+
+static size_t channel_pop(core_channel_t *channel, uint8_t *dest, size_t max_count)
+{
+    size_t pos = channel->head;
+    size_t count = 0;
+
+    while (count < max_count)
+    {
+        channel_slot_t *slot = channel_slot(channel, pos);
+        if (atomic_read(&slot->sequence) != pos + 1)
+            break;
+
+        mb();
+        memcpy(dest + count * channel->item_size, slot->data, channel->item_size);
+        mb();
+        atomic_set(&slot->sequence, pos + channel->mask + 1);
+        pos++;
+        count++;
+    }
+
+    if (count)
+    {
+        atomic_set(&channel->head, pos);
+        channel->received += count;
+    }
+
+    return count;
+}
+
+static int channel_empty(core_channel_t *channel)
+{
+    size_t pos = channel->head;
+    return atomic_read(&channel_slot(channel, pos)->sequence) != pos + 1;
+}
+
+size_t core_channel_receive(core_channel_t *channel, void *items, size_t max_count, TickType_t timeout)
+{
+    TimeOut_t time_out;
+    size_t count;
+
+    vTaskSetTimeOutState(&time_out);
+    while (1)
+    {
+        count = channel_pop(channel, (uint8_t *)items, max_count);
+        if (count || xTaskCheckForTimeOut(&time_out, &timeout) != pdFALSE)
+            break;
+
+        atomic_set(&channel->waiter, xTaskGetCurrentTaskHandle());
+        mb();
+
+        /* A sender may have published before it could see the waiter */
+        if (channel_empty(channel))
+            ulTaskNotifyTake(pdTRUE, timeout);
+
+        /* Withdraw if nobody claimed the wake-up. If a sender did, its
+         * notification may arrive late and only causes one extra loop. */
+        (void)atomic_swap(&channel->waiter, NULL);
+    }
+
+    return count;
+}
+
+void core_channel_get_stats(core_channel_t *channel, core_channel_stats_t *stats)
+{
+    stats->sent = atomic_read(&channel->sent);
+    stats->received = atomic_read(&channel->received);
+    stats->dropped = atomic_read(&channel->dropped);
+    stats->doorbells = atomic_read(&channel->doorbells);
+}
@@ -22,52 +22,160 @@
 
 extern volatile uintptr_t g_wake_address;
 
-static volatile core_sync_event_t s_core_sync_events[portNUM_PROCESSORS];
-static corelock_t s_core_sync_locks[portNUM_PROCESSORS] = { CORELOCK_INIT, CORELOCK_INIT };
-static volatile TaskHandle_t s_pending_to_add_tasks[portNUM_PROCESSORS];
+typedef struct _core_sync_entry
+{
+    core_sync_event_t event;
+    void *arg;
+} core_sync_entry_t;
+
+/* Filled by any sender under the lock, drained by the owning core alone */
+typedef struct _core_sync_queue
+{
+    spinlock_t lock;
+    volatile size_t head;
+    volatile size_t tail;
+    volatile int switch_pending;
+    core_sync_entry_t entries[CORE_SYNC_QUEUE_SIZE];
+    core_sync_stats_t stats;
+} __attribute__((aligned(64))) core_sync_queue_t;
+
+static core_sync_queue_t s_core_sync_queues[portNUM_PROCESSORS];
+static core_sync_doorbell_t *volatile s_core_sync_doorbells[portNUM_PROCESSORS];
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+    if (flags & MSTATUS_MIE)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+static void core_sync_drain_doorbells(uint64_t core_id)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    core_sync_doorbell_t *bell = atomic_swap(&s_core_sync_doorbells[core_id], NULL);
+
+    while (bell)
+    {
+        core_sync_doorbell_t *next = bell->next;
+        /* Allow the handler (or anyone else) to ring it again */
+        atomic_set(&bell->queued, 0);
+        mb();
+        bell->handler(bell, &higher_priority_task_woken);
+        bell = next;
+    }
+
+    if (higher_priority_task_woken)
+        vTaskSwitchContext();
+}
+
+static int core_sync_pop(core_sync_queue_t *queue, core_sync_entry_t *entry)
+{
+    size_t head = queue->head;
+    if (head == atomic_read(&queue->tail))
+        return 0;
+
+    mb();
+    *entry = queue->entries[head % CORE_SYNC_QUEUE_SIZE];
+    mb();
+    atomic_set(&queue->head, head + 1);
+    return 1;
+}
 
 void handle_irq_m_soft(uintptr_t *regs, uintptr_t cause)
 {
     uint64_t core_id = uxPortGetProcessorId();
+    core_sync_queue_t *queue = &s_core_sync_queues[core_id];
+    core_sync_entry_t entry;
+
     clint_ipi_clear(core_id);
-    switch (s_core_sync_events[core_id])
-    {
-    case CORE_SYNC_ADD_TCB:
+    core_sync_drain_doorbells(core_id);
+
+    while (core_sync_pop(queue, &entry))
     {
-        TaskHandle_t newTask = atomic_read(&s_pending_to_add_tasks[core_id]);
-        if (newTask)
+        switch (entry.event)
         {
-            vAddNewTaskToCurrentReadyList(newTask);
-            atomic_set(&s_pending_to_add_tasks[core_id], NULL);
+        case CORE_SYNC_ADD_TCB:
+            vAddNewTaskToCurrentReadyList(entry.arg);
+            break;
+        case CORE_SYNC_MIGRATE_TCB:
+            vAddMigratedTaskToCurrentReadyList(entry.arg);
+            break;
+        default:
+            break;
         }
     }
-    break;
-    case CORE_SYNC_SWITCH_CONTEXT:
-        vTaskSwitchContext();
-        break;
-    default:
-        break;
-    }
 
-    core_sync_complete(core_id);
+    /* All switch requests since the last IPI collapse into one */
+    if (atomic_swap(&queue->switch_pending, 0))
+        vTaskSwitchContext();
 }
 
-void core_sync_request(uint64_t core_id, int event)
+/* Returns 0 if queued, -1 if the queue was full and wait is false */
+static int core_sync_post(uint64_t core_id, core_sync_event_t event, void *arg, int wait)
 {
-    vTaskEnterCritical();
+    core_sync_queue_t *queue = &s_core_sync_queues[core_id];
+    int waited = 0;
 
-    corelock_lock(&s_core_sync_locks[core_id]);
-    while (s_core_sync_events[core_id] != CORE_SYNC_NONE)
-        ;
-    s_core_sync_events[core_id] = event;
-    clint_ipi_send(core_id);
-    corelock_unlock(&s_core_sync_locks[core_id]);
-    vTaskExitCritical();
+    while (1)
+    {
+        uintptr_t flags = irq_save();
+        spinlock_lock(&queue->lock);
+
+        size_t tail = queue->tail;
+        if (tail - atomic_read(&queue->head) < CORE_SYNC_QUEUE_SIZE)
+        {
+            queue->entries[tail % CORE_SYNC_QUEUE_SIZE].event = event;
+            queue->entries[tail % CORE_SYNC_QUEUE_SIZE].arg = arg;
+            mb();
+            atomic_set(&queue->tail, tail + 1);
+            queue->stats.sent++;
+            spinlock_unlock(&queue->lock);
+            irq_restore(flags);
+            clint_ipi_send(core_id);
+            return 0;
+        }
+
+        if (!waited)
+        {
+            queue->stats.waits++;
+            waited = 1;
+        }
+        spinlock_unlock(&queue->lock);
+        irq_restore(flags);
+
+        if (!wait)
+            return -1;
+
+        /* Queue is full, wait for the target core to drain it */
+        while (atomic_read(&queue->tail) - atomic_read(&queue->head) >= CORE_SYNC_QUEUE_SIZE)
+            ;
+    }
 }
 
-void core_sync_complete(uint64_t core_id)
+void core_sync_request(uint64_t core_id, int event)
 {
-    atomic_set(&s_core_sync_events[core_id], CORE_SYNC_NONE);
+    core_sync_queue_t *queue = &s_core_sync_queues[core_id];
+
+    if (event == CORE_SYNC_SWITCH_CONTEXT)
+    {
+        if (atomic_swap(&queue->switch_pending, 1))
+        {
+            /* An IPI is already on its way */
+            atomic_add(&queue->stats.coalesced, 1);
+            return;
+        }
+
+        atomic_add(&queue->stats.sent, 1);
+        clint_ipi_send(core_id);
+    }
+    else
+    {
+        core_sync_post(core_id, event, NULL, 1);
+    }
 }
 
 void core_sync_awaken(uintptr_t address)
@@ -75,13 +183,41 @@ void core_sync_awaken(uintptr_t address)
     g_wake_address = address;
 }
 
-void vPortAddNewTaskToReadyListAsync(UBaseType_t core_id, void *pxNewTaskHandle)
+int core_sync_get_stats(uint64_t core_id, core_sync_stats_t *stats)
+{
+    if (core_id >= portNUM_PROCESSORS || !stats)
+        return -1;
+
+    core_sync_queue_t *queue = &s_core_sync_queues[core_id];
+    stats->sent = atomic_read(&queue->stats.sent);
+    stats->coalesced = atomic_read(&queue->stats.coalesced);
+    stats->waits = atomic_read(&queue->stats.waits);
+    stats->pending = atomic_read(&queue->tail) - atomic_read(&queue->head);
+    return 0;
+}
+
+void core_sync_ring_doorbell(uint64_t core_id, core_sync_doorbell_t *bell)
 {
-    corelock_lock(&s_core_sync_locks[core_id]);
-    while (s_core_sync_events[core_id] != CORE_SYNC_NONE)
-        ;
-    s_pending_to_add_tasks[core_id] = pxNewTaskHandle;
-    s_core_sync_events[core_id] = CORE_SYNC_ADD_TCB;
+    if (atomic_cas(&bell->queued, 0, 1) != 0)
+        return;
+
+    core_sync_doorbell_t *head;
+    do
+    {
+        head = atomic_read(&s_core_sync_doorbells[core_id]);
+        bell->next = head;
+    } while (atomic_cas(&s_core_sync_doorbells[core_id], head, bell) != head);
+
     clint_ipi_send(core_id);
-    corelock_unlock(&s_core_sync_locks[core_id]);
+}
+
+void vPortAddNewTaskToReadyListAsync(UBaseType_t core_id, void *pxNewTaskHandle)
+{
+    core_sync_post(core_id, CORE_SYNC_ADD_TCB, pxNewTaskHandle, 1);
+}
+
+BaseType_t xPortMigrateTaskToReadyListAsync(UBaseType_t core_id, void *pxTaskHandle)
+{
+    /* Called from vTaskSwitchContext, must not wait for the other core */
+    return core_sync_post(core_id, CORE_SYNC_MIGRATE_TCB, pxTaskHandle, 0) == 0 ? pdTRUE : pdFALSE;
 }
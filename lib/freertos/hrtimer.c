@@ -0,0 +1,330 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include <atomic.h>
+#include <clint.h>
+#include <encoding.h>
+#include <hrtimer.h>
+
+/*
+ * Each core keeps its pending timers in a binary min-heap ordered by expiry.
+ * The port programs mtimecmp of the core with the earlier of the next tick
+ * and the top of the heap, so timers fire with mtime resolution instead of
+ * being rounded to the tick. The heap is protected by a per-core spinlock
+ * taken with local interrupts masked, callbacks run without it.
+ */
+
+#define NSEC_PER_SEC 1000000000ULL
+
+typedef struct _hrtimer_core
+{
+    spinlock_t lock;
+    size_t count;
+    hrtimer_t *heap[HRTIMER_MAX_PER_CORE];
+} __attribute__((aligned(64))) hrtimer_core_t;
+
+static hrtimer_core_t s_hrtimer_cores[portNUM_PROCESSORS];
+
+/* mtime follows the cpu clock, so the nanosecond clock is rebased whenever
+ * the frequency changes. Readers retry while seq is odd or has moved. */
+static struct
+{
+    volatile uint32_t seq;
+    uint64_t base_ticks;
+    uint64_t base_ns;
+    uint64_t hz;
+} s_hrtimer_clock;
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+    if (flags & MSTATUS_MIE)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+static void heap_set(hrtimer_core_t *hc, size_t index, hrtimer_t *timer)
+{
+    hc->heap[index] = timer;
+    timer->heap_index = (int32_t)index;
+}
+
+static void heap_sift_up(hrtimer_core_t *hc, size_t index)
+{
+    hrtimer_t *timer = hc->heap[index];
+    while (index)
+    {
+        size_t parent = (index - 1) / 2;
+        if (hc->heap[parent]->expires <= timer->expires)
+            break;
+        heap_set(hc, index, hc->heap[parent]);
+        index = parent;
+    }
+
+    heap_set(hc, index, timer);
+}
+
+static void heap_sift_down(hrtimer_core_t *hc, size_t index)
+{
+    hrtimer_t *timer = hc->heap[index];
+    while (1)
+    {
+        size_t child = index * 2 + 1;
+        if (child >= hc->count)
+            break;
+        if (child + 1 < hc->count && hc->heap[child + 1]->expires < hc->heap[child]->expires)
+            child++;
+        if (timer->expires <= hc->heap[child]->expires)
+            break;
+        heap_set(hc, index, hc->heap[child]);
+        index = child;
+    }
+
+    heap_set(hc, index, timer);
+}
+
+static void heap_insert(hrtimer_core_t *hc, hrtimer_t *timer)
+{
+    hc->heap[hc->count] = timer;
+    heap_sift_up(hc, hc->count++);
+}
+
+static void heap_remove(hrtimer_core_t *hc, size_t index)
+{
+    hrtimer_t *timer = hc->heap[index];
+    hrtimer_t *last = hc->heap[--hc->count];
+
+    timer->heap_index = -1;
+    if (index == hc->count)
+        return;
+
+    heap_set(hc, index, last);
+    if (index && hc->heap[(index - 1) / 2]->expires > last->expires)
+        heap_sift_up(hc, index);
+    else
+        heap_sift_down(hc, index);
+}
+
+uint64_t hrtimer_now(void)
+{
+    return clint->mtime;
+}
+
+uint64_t hrtimer_clock_hz(void)
+{
+    return configTICK_CLOCK_HZ;
+}
+
+static uint64_t ns_to_ticks(uint64_t ns, uint64_t hz)
+{
+    return (ns / NSEC_PER_SEC) * hz + ((ns % NSEC_PER_SEC) * hz + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks, uint64_t hz)
+{
+    return (ticks / hz) * NSEC_PER_SEC + (ticks % hz) * NSEC_PER_SEC / hz;
+}
+
+/* Scale a duration in mtime ticks to a new clock rate */
+static uint64_t rescale_ticks(uint64_t ticks, uint64_t old_hz, uint64_t new_hz)
+{
+    return (ticks / old_hz) * new_hz + (ticks % old_hz) * new_hz / old_hz;
+}
+
+uint64_t hrtimer_ns_to_ticks(uint64_t ns)
+{
+    return ns_to_ticks(ns, hrtimer_clock_hz());
+}
+
+uint64_t hrtimer_ticks_to_ns(uint64_t ticks)
+{
+    return ticks_to_ns(ticks, hrtimer_clock_hz());
+}
+
+uint64_t hrtimer_now_ns(void)
+{
+    uint32_t seq;
+    uint64_t ns;
+
+    do
+    {
+        seq = atomic_read(&s_hrtimer_clock.seq);
+        mb();
+        uint64_t hz = s_hrtimer_clock.hz ? s_hrtimer_clock.hz : hrtimer_clock_hz();
+        ns = s_hrtimer_clock.base_ns + ticks_to_ns(hrtimer_now() - s_hrtimer_clock.base_ticks, hz);
+        mb();
+    } while ((seq & 1) || seq != atomic_read(&s_hrtimer_clock.seq));
+
+    return ns;
+}
+
+void hrtimer_clock_changed(uint64_t now, uint64_t old_hz, uint64_t new_hz)
+{
+    atomic_add(&s_hrtimer_clock.seq, 1);
+    mb();
+    s_hrtimer_clock.base_ns += ticks_to_ns(now - s_hrtimer_clock.base_ticks, old_hz);
+    s_hrtimer_clock.base_ticks = now;
+    s_hrtimer_clock.hz = new_hz;
+    mb();
+    atomic_add(&s_hrtimer_clock.seq, 1);
+
+    /* Keep the remaining time of pending timers. The mapping is monotonic,
+     * so the heap order does not change. */
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        hrtimer_core_t *hc = &s_hrtimer_cores[core];
+
+        spinlock_lock(&hc->lock);
+        for (size_t i = 0; i < hc->count; i++)
+        {
+            hrtimer_t *timer = hc->heap[i];
+            if (timer->expires > now)
+                timer->expires = now + rescale_ticks(timer->expires - now, old_hz, new_hz);
+            if (timer->period)
+            {
+                timer->period = rescale_ticks(timer->period, old_hz, new_hz);
+                if (!timer->period)
+                    timer->period = 1;
+            }
+        }
+        spinlock_unlock(&hc->lock);
+    }
+}
+
+void hrtimer_init(hrtimer_t *timer, hrtimer_callback_t callback, void *userdata)
+{
+    timer->expires = 0;
+    timer->period = 0;
+    timer->callback = callback;
+    timer->userdata = userdata;
+    timer->state = HRTIMER_IDLE;
+    timer->core = 0;
+    timer->heap_index = -1;
+}
+
+int hrtimer_cancel(hrtimer_t *timer)
+{
+    hrtimer_core_t *hc = &s_hrtimer_cores[timer->core];
+    int ret = 0;
+
+    uintptr_t flags = irq_save();
+    spinlock_lock(&hc->lock);
+    if (timer->state == HRTIMER_PENDING)
+    {
+        heap_remove(hc, timer->heap_index);
+        ret = 1;
+    }
+
+    /* A running periodic timer is not re-armed either */
+    timer->state = HRTIMER_IDLE;
+    spinlock_unlock(&hc->lock);
+    irq_restore(flags);
+    return ret;
+}
+
+int hrtimer_start_at(hrtimer_t *timer, uint64_t expires, uint64_t period)
+{
+    int ret = 0;
+
+    uintptr_t flags = irq_save();
+    hrtimer_cancel(timer);
+
+    UBaseType_t core_id = uxPortGetProcessorId();
+    hrtimer_core_t *hc = &s_hrtimer_cores[core_id];
+    spinlock_lock(&hc->lock);
+    if (hc->count < HRTIMER_MAX_PER_CORE)
+    {
+        timer->expires = expires;
+        timer->period = period;
+        timer->core = core_id;
+        timer->state = HRTIMER_PENDING;
+        heap_insert(hc, timer);
+    }
+    else
+    {
+        ret = -1;
+    }
+
+    int first = ret == 0 && timer->heap_index == 0;
+    spinlock_unlock(&hc->lock);
+
+    /* Bring the timer interrupt forward if this timer is now the earliest */
+    if (first)
+        vPortUpdateTimerInterrupt();
+    irq_restore(flags);
+    return ret;
+}
+
+int hrtimer_start(hrtimer_t *timer, uint64_t delay_us, uint64_t period_us)
+{
+    return hrtimer_start_at(timer, hrtimer_now() + hrtimer_ns_to_ticks(delay_us * 1000), hrtimer_ns_to_ticks(period_us * 1000));
+}
+
+void hrtimer_handle_irq(uint64_t now, BaseType_t *higher_priority_task_woken)
+{
+    hrtimer_core_t *hc = &s_hrtimer_cores[uxPortGetProcessorId()];
+
+    while (1)
+    {
+        spinlock_lock(&hc->lock);
+        if (!hc->count || hc->heap[0]->expires > now)
+        {
+            spinlock_unlock(&hc->lock);
+            break;
+        }
+
+        hrtimer_t *timer = hc->heap[0];
+        heap_remove(hc, 0);
+        timer->state = HRTIMER_RUNNING;
+        spinlock_unlock(&hc->lock);
+
+        timer->callback(timer, timer->userdata, higher_priority_task_woken);
+
+        spinlock_lock(&hc->lock);
+        /* Left alone if the callback restarted or cancelled the timer */
+        if (timer->state == HRTIMER_RUNNING)
+        {
+            if (timer->period && hc->count < HRTIMER_MAX_PER_CORE)
+            {
+                /* Keep the phase, skipping periods that were missed */
+                timer->expires += timer->period;
+                if (timer->expires <= now)
+                    timer->expires += ((now - timer->expires) / timer->period + 1) * timer->period;
+                timer->state = HRTIMER_PENDING;
+                heap_insert(hc, timer);
+            }
+            else
+            {
+                timer->state = HRTIMER_IDLE;
+            }
+        }
+        spinlock_unlock(&hc->lock);
+    }
+}
+
+uint64_t hrtimer_next_expiry(void)
+{
+    hrtimer_core_t *hc = &s_hrtimer_cores[uxPortGetProcessorId()];
+    uint64_t expires = UINT64_MAX;
+
+    spinlock_lock(&hc->lock);
+    if (hc->count)
+        expires = hc->heap[0]->expires;
+    spinlock_unlock(&hc->lock);
+    return expires;
+}
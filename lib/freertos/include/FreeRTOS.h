@@ -753,6 +753,18 @@ extern "C" {
 	#define configUSE_TICKLESS_IDLE 0
 #endif
 
+#ifndef configUSE_TASK_LOAD_BALANCING
+	#define configUSE_TASK_LOAD_BALANCING 0
+#endif
+
+#ifndef configLOAD_BALANCE_PERIOD
+	#define configLOAD_BALANCE_PERIOD 10
+#endif
+
+#ifndef configLOAD_SAMPLE_PERIOD
+	#define configLOAD_SAMPLE_PERIOD 100
+#endif
+
 #ifndef configPRE_SUPPRESS_TICKS_AND_SLEEP_PROCESSING
 	#define configPRE_SUPPRESS_TICKS_AND_SLEEP_PROCESSING( x )
 #endif
@@ -0,0 +1,104 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+//
+// Inter-core message channel
+
+#ifndef CORE_CHANNEL_H
+#define CORE_CHANNEL_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct _core_channel core_channel_t;
+
+typedef enum
+{
+    /* Exactly one task sends */
+    CORE_CHANNEL_SPSC,
+    /* Any number of tasks or ISRs send, on any core */
+    CORE_CHANNEL_MPSC
+} core_channel_mode_t;
+
+typedef struct _core_channel_stats
+{
+    /* Messages accepted by core_channel_send */
+    size_t sent;
+    /* Messages handed out by core_channel_receive */
+    size_t received;
+    /* Messages rejected because the channel was full */
+    size_t dropped;
+    /* Wake-ups that needed an IPI to the receiving core */
+    size_t doorbells;
+} core_channel_stats_t;
+
+/**
+ * @brief       Create a lock-free message channel with a single receiver
+ *
+ * @param[in]   mode        Single or multiple senders
+ * @param[in]   item_size   Size of one message in bytes
+ * @param[in]   capacity    Number of messages, rounded up to a power of two
+ *
+ * @return      The channel, NULL if out of memory
+ */
+core_channel_t *core_channel_create(core_channel_mode_t mode, size_t item_size, size_t capacity);
+
+/**
+ * @brief       Delete a channel, no task may be using it
+ */
+void core_channel_delete(core_channel_t *channel);
+
+/**
+ * @brief       Send a batch of messages without blocking
+ *
+ * The receiver is woken at most once per call, so batching messages also
+ * batches the IPIs when it runs on the other core. Safe to call from an ISR.
+ *
+ * @param[in]   channel     The channel
+ * @param[in]   items       count messages of item_size bytes each
+ * @param[in]   count       Number of messages
+ *
+ * @return      Number of messages sent, less than count if the channel is full
+ */
+size_t core_channel_send(core_channel_t *channel, const void *items, size_t count);
+
+/**
+ * @brief       Receive up to max_count messages
+ *
+ * Blocks until at least one message is available or the timeout expires. The
+ * notification value of the receiving task is used to wake it up.
+ *
+ * @param[in]   channel     The channel
+ * @param[out]  items       Buffer for max_count messages
+ * @param[in]   max_count   Capacity of the buffer in messages
+ * @param[in]   timeout     Ticks to wait, 0 to poll
+ *
+ * @return      Number of messages received, 0 on timeout
+ */
+size_t core_channel_receive(core_channel_t *channel, void *items, size_t max_count, TickType_t timeout);
+
+/**
+ * @brief       Get the counters of a channel
+ */
+void core_channel_get_stats(core_channel_t *channel, core_channel_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CORE_CHANNEL_H */
@@ -29,13 +29,69 @@ typedef enum
 {
     CORE_SYNC_NONE,
     CORE_SYNC_ADD_TCB,
-    CORE_SYNC_SWITCH_CONTEXT
+    CORE_SYNC_SWITCH_CONTEXT,
+    CORE_SYNC_MIGRATE_TCB
 } core_sync_event_t;
 
+typedef struct _core_sync_doorbell core_sync_doorbell_t;
+
+/* Runs in the software interrupt of the core the doorbell was rung on */
+typedef void (*core_sync_doorbell_handler_t)(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken);
+
+struct _core_sync_doorbell
+{
+    core_sync_doorbell_t *next;
+    volatile int queued;
+    core_sync_doorbell_handler_t handler;
+};
+
+#define CORE_SYNC_DOORBELL_INIT(h) \
+    {                              \
+        .next = NULL,              \
+        .queued = 0,               \
+        .handler = (h)             \
+    }
+
+/* Events each core can have in flight, CORE_SYNC_SWITCH_CONTEXT takes no slot */
+#ifndef CORE_SYNC_QUEUE_SIZE
+#define CORE_SYNC_QUEUE_SIZE 8
+#endif
+
+typedef struct _core_sync_stats
+{
+    /* Events posted to the core, including context switch requests */
+    size_t sent;
+    /* Context switch requests merged into one already pending */
+    size_t coalesced;
+    /* Times a sender found the queue full */
+    size_t waits;
+    /* Events queued but not handled yet */
+    size_t pending;
+} core_sync_stats_t;
+
 void core_sync_request(uint64_t core_id, int event);
-void core_sync_complete(uint64_t core_id);
 void core_sync_awaken(uintptr_t address);
 
+/**
+ * @brief       Get the event counters of one core
+ *
+ * @param[in]   core_id     The core id
+ * @param[out]  stats       The statistics
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail
+ */
+int core_sync_get_stats(uint64_t core_id, core_sync_stats_t *stats);
+
+/**
+ * @brief       Queue a doorbell to another core and interrupt it
+ *
+ * Lock-free and never waits. A doorbell that is already queued is not queued
+ * again, so any number of rings before the target core gets to it cost one IPI.
+ */
+void core_sync_ring_doorbell(uint64_t core_id, core_sync_doorbell_t *bell);
+
 #ifdef __cplusplus
 }
 #endif
@@ -70,6 +70,68 @@ int io_read(handle_t file, uint8_t *buffer, size_t len);
  */
 int io_write(handle_t file, const uint8_t *buffer, size_t len);
 
+/**
+ * @brief       Read from a device into several buffers
+ *
+ * Sockets and SPI devices read in one transfer, others read the buffers in
+ * turn and stop at the first one not filled.
+ *
+ * @param[in]   file        The device handle
+ * @param[in]   iov         The destination buffers
+ * @param[in]   iovcnt      Count of buffers
+ *
+ * @return      Actual bytes read
+ */
+int io_readv(handle_t file, const io_vec_t *iov, int iovcnt);
+
+/**
+ * @brief       Write several buffers to a device
+ *
+ * Sockets and SPI devices write in one transfer, others write the buffers
+ * in turn and stop at the first one not fully written.
+ *
+ * @param[in]   file        The device handle
+ * @param[in]   iov         The source buffers
+ * @param[in]   iovcnt      Count of buffers
+ *
+ * @return      Actual bytes written, -1 if failed
+ */
+int io_writev(handle_t file, const io_vec_t *iov, int iovcnt);
+
+/**
+ * @brief       Queue a read or write and return without waiting for it
+ *
+ * DMA transfers of SPI devices, I2C device writes and UART writes are
+ * started right away and complete from the DMA interrupt, this call may wait
+ * for a transfer still running on the same bus. Other requests run as the
+ * matching synchronous call on one of a few shared I/O worker tasks, so a
+ * single task can have several transfers in flight. Requests may complete in
+ * any order, also on the same handle. When done, result and error are set
+ * and pending is cleared, then on_completion is called and the request is
+ * posted to completion_queue. The request and its buffers must stay valid
+ * until then. on_completion may run on the work queue worker, see
+ * io_completion_t. A full completion_queue is not waited for, the post is
+ * dropped and counted by io_get_completion_overflows. The I/O workers are
+ * created by the first request that runs on them.
+ *
+ * @param[in]   request     The request
+ *
+ * @return      result
+ *     - 0      Queued
+ *     - -1     Fail, errno is EBUSY if the request is still pending, EAGAIN
+ *              if too many requests are queued, ENOMEM if no I/O worker
+ *              could be created
+ */
+int io_submit(io_request_t *request);
+
+/**
+ * @brief       Count the completed requests io_submit could not post to their
+ *              full completion_queue
+ *
+ * @return      The count since boot
+ */
+uint32_t io_get_completion_overflows(void);
+
 /**
  * @brief       Send control info to a device
  *
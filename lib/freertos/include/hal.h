@@ -54,6 +54,17 @@ void pic_set_irq_handler(uint32_t irq, pic_irq_handler_t handler, void *userdata
  */
 void pic_set_irq_priority(uint32_t irq, uint32_t priority);
 
+/**
+ * @brief       Set the cores an IRQ is delivered to
+ *
+ * Sources are routed to core 0 until set otherwise. A task unblocked by
+ * the handler is made ready on the core that took the IRQ.
+ *
+ * @param[in]   irq             IRQ number
+ * @param[in]   core_mask       Bit n routes the IRQ to core n, at least one existing core
+ */
+void pic_set_irq_affinity(uint32_t irq, uint32_t core_mask);
+
 /**
  * @brief       Wait for a free DMA and open it
  *
@@ -88,6 +99,21 @@ void dma_set_request_source(handle_t file, uint32_t request);
  */
 void dma_transmit_async(handle_t file, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, SemaphoreHandle_t completion_event);
 
+/**
+ * @brief       DMA asynchronously, calling a handler when done
+ * @param[in]   file                    The DMA handle
+ * @param[in]   src                     The address of source
+ * @param[out]  dest                    The address of destination
+ * @param[in]   src_inc                 Enable increment of source address
+ * @param[in]   dest_inc                Enable increment of destination address
+ * @param[in]   element_size            Element size in bytes
+ * @param[in]   count                   Element count to transmit
+ * @param[in]   burst_size              Element count to transmit per request
+ * @param[in]   completion_handler      Called when this transmition is completed, usually in ISR
+ * @param[in]   userdata                Passed to completion_handler
+ */
+void dma_transmit_notify(handle_t file, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_completion_handler_t completion_handler, void *userdata);
+
 /**
  * @brief       DMA synchrnonously
  * @param[in]   file                The DMA handle
@@ -0,0 +1,154 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+//
+// High resolution timers
+
+#ifndef HRTIMER_H
+#define HRTIMER_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Timers that can be pending on one core at the same time */
+#ifndef HRTIMER_MAX_PER_CORE
+#define HRTIMER_MAX_PER_CORE 32
+#endif
+
+typedef struct _hrtimer hrtimer_t;
+
+/* Runs in the timer interrupt of the core the timer was started on. Use the
+ * FromISR APIs and set *higher_priority_task_woken if a task was woken. */
+typedef void (*hrtimer_callback_t)(hrtimer_t *timer, void *userdata, BaseType_t *higher_priority_task_woken);
+
+typedef enum
+{
+    HRTIMER_IDLE,
+    HRTIMER_PENDING,
+    HRTIMER_RUNNING
+} hrtimer_state_t;
+
+struct _hrtimer
+{
+    /* Absolute expiry time in mtime ticks */
+    uint64_t expires;
+    /* Reload period in mtime ticks, 0 for one-shot */
+    uint64_t period;
+    hrtimer_callback_t callback;
+    void *userdata;
+    volatile hrtimer_state_t state;
+    uint32_t core;
+    int32_t heap_index;
+};
+
+/**
+ * @brief       Get the current mtime value
+ */
+uint64_t hrtimer_now(void);
+
+/**
+ * @brief       Get the frequency of mtime at the current cpu frequency
+ */
+uint64_t hrtimer_clock_hz(void);
+
+/**
+ * @brief       Convert nanoseconds to mtime ticks, rounding up
+ */
+uint64_t hrtimer_ns_to_ticks(uint64_t ns);
+
+/**
+ * @brief       Convert mtime ticks to nanoseconds
+ */
+uint64_t hrtimer_ticks_to_ns(uint64_t ticks);
+
+/**
+ * @brief       Get a monotonic time in nanoseconds that stays correct across
+ *              cpu frequency changes
+ */
+uint64_t hrtimer_now_ns(void);
+
+/**
+ * @brief       Initialize a timer
+ *
+ * @param[in]   timer       The timer
+ * @param[in]   callback    Called when the timer expires
+ * @param[in]   userdata    Passed to the callback
+ */
+void hrtimer_init(hrtimer_t *timer, hrtimer_callback_t callback, void *userdata);
+
+/**
+ * @brief       Start or restart a timer on the calling core
+ *
+ * @param[in]   timer       The timer
+ * @param[in]   delay_us    Microseconds until the first expiry
+ * @param[in]   period_us   Microseconds between later expiries, 0 for one-shot
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail, too many timers pending on this core
+ */
+int hrtimer_start(hrtimer_t *timer, uint64_t delay_us, uint64_t period_us);
+
+/**
+ * @brief       Start or restart a timer on the calling core at an absolute time
+ *
+ * @param[in]   timer       The timer
+ * @param[in]   expires     mtime value of the first expiry
+ * @param[in]   period      mtime ticks between later expiries, 0 for one-shot
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail, too many timers pending on this core
+ */
+int hrtimer_start_at(hrtimer_t *timer, uint64_t expires, uint64_t period);
+
+/**
+ * @brief       Stop a timer, from any core
+ *
+ * A callback that is already running on the other core is not waited for.
+ *
+ * @return      1 if the timer was pending, otherwise 0
+ */
+int hrtimer_cancel(hrtimer_t *timer);
+
+/**
+ * @brief       Run the expired timers of the calling core, called by the port
+ *              from the timer interrupt
+ */
+void hrtimer_handle_irq(uint64_t now, BaseType_t *higher_priority_task_woken);
+
+/**
+ * @brief       Get the earliest expiry on the calling core, UINT64_MAX if none
+ */
+uint64_t hrtimer_next_expiry(void);
+
+/**
+ * @brief       Rebase the clock and rescale pending timers after the mtime
+ *              frequency changed, called by the port with interrupts disabled
+ *
+ * @param[in]   now         mtime value at the change
+ * @param[in]   old_hz      mtime frequency before the change
+ * @param[in]   new_hz      mtime frequency after the change
+ */
+void hrtimer_clock_changed(uint64_t now, uint64_t old_hz, uint64_t new_hz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HRTIMER_H */
@@ -197,6 +197,8 @@ public:
     virtual int read(gsl::span<uint8_t> buffer) = 0;
     virtual int write(gsl::span<const uint8_t> buffer) = 0;
     virtual void set_read_timeout(size_t millisecond) = 0;
+    /* Start an io_submit request on the DMA, false leaves it to the I/O workers */
+    virtual bool submit_async(io_request_t &request) = 0;
 };
 
 class gpio_driver : public driver
@@ -217,6 +219,8 @@ public:
     virtual int read(gsl::span<uint8_t> buffer) = 0;
     virtual int write(gsl::span<const uint8_t> buffer) = 0;
     virtual int transfer_sequential(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) = 0;
+    /* Start an io_submit request on the DMA, false leaves it to the I/O workers */
+    virtual bool submit_async(io_request_t &request) = 0;
 };
 
 class i2c_driver : public driver
@@ -246,9 +250,14 @@ public:
     virtual void set_endian(uint32_t endian) = 0;
     virtual int read(gsl::span<uint8_t> buffer) = 0;
     virtual int write(gsl::span<const uint8_t> buffer) = 0;
+    /* Transfer all buffers with one chip select assertion */
+    virtual int readv(gsl::span<const io_vec_t> buffers) = 0;
+    virtual int writev(gsl::span<const io_vec_t> buffers) = 0;
     virtual int transfer_full_duplex(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) = 0;
     virtual int transfer_sequential(gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) = 0;
     virtual void fill(uint32_t instruction, uint32_t address, uint32_t value, size_t count) = 0;
+    /* Start an io_submit request on the DMA, false leaves it to the I/O workers */
+    virtual bool submit_async(io_request_t &request) = 0;
 };
 
 class spi_driver : public driver
@@ -377,6 +386,7 @@ class pic_driver : public driver
 public:
     virtual void set_irq_enable(uint32_t irq, bool enable) = 0;
     virtual void set_irq_priority(uint32_t irq, uint32_t priority) = 0;
+    virtual void set_irq_affinity(uint32_t irq, uint32_t core_mask) = 0;
 };
 
 class dma_driver : public driver
@@ -385,6 +395,7 @@ public:
     virtual void set_select_request(uint32_t request) = 0;
     virtual void config(uint32_t priority) = 0;
     virtual void transmit_async(const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, SemaphoreHandle_t completion_event) = 0;
+    virtual void transmit_async(const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_completion_handler_t completion_handler, void *userdata) = 0;
     virtual void loop_async(const volatile void **srcs, size_t src_num, volatile void **dests, size_t dest_num, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_stage_completion_handler_t stage_completion_handler, void *stage_completion_handler_data, SemaphoreHandle_t completion_event, int *stop_signal) = 0;
     virtual void stop() = 0;
 };
@@ -408,6 +419,8 @@ class filesystem_file : public virtual object_access
 public:
     virtual size_t read(gsl::span<uint8_t> buffer) = 0;
     virtual size_t write(gsl::span<const uint8_t> buffer) = 0;
+    virtual size_t readv(gsl::span<const io_vec_t> buffers) = 0;
+    virtual size_t writev(gsl::span<const io_vec_t> buffers) = 0;
     virtual fpos_t get_position() = 0;
     virtual void set_position(fpos_t position) = 0;
     virtual uint64_t get_size() = 0;
@@ -452,6 +465,8 @@ public:
     virtual size_t receive_from(gsl::span<uint8_t> buffer, socket_message_flag_t flags, socket_address_t *from) = 0;
     virtual size_t read(gsl::span<uint8_t> buffer) = 0;
     virtual size_t write(gsl::span<const uint8_t> buffer) = 0;
+    virtual size_t readv(gsl::span<const io_vec_t> buffers) = 0;
+    virtual size_t writev(gsl::span<const io_vec_t> buffers) = 0;
     virtual int fcntl(int cmd, int val) = 0;
     virtual void select(fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout) = 0;
 };
@@ -18,6 +18,9 @@
 #include "driver.hpp"
 #include <atomic>
 
+/* Finish a request a driver started in submit_async, from task context */
+extern "C" void io_request_complete(io_request_t *request, int result, int error);
+
 namespace sys
 {
 class static_object : public virtual object
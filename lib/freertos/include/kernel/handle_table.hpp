@@ -0,0 +1,186 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _FREERTOS_HANDLE_TABLE_H
+#define _FREERTOS_HANDLE_TABLE_H
+
+#include "osdefs.h"
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace sys
+{
+/* Maps handles to objects of type T. Free slots are kept in a tagged lock-free
+ * list as in object_pool, so allocation is O(1), and the table grows a page of
+ * slots at a time up to N. Closing a handle bumps the generation of its slot,
+ * so a stale handle does not find the object that reuses the slot.
+ *
+ * Handles are Offset + (generation << INDEX_BITS | index), the generation is
+ * cut so they stay below 2^31 and also work as POSIX fds. */
+template <class T, size_t N, handle_t Offset>
+class handle_table
+{
+public:
+    static constexpr uint32_t INDEX_BITS = 12;
+    static constexpr uint32_t GENERATION_MASK = (1U << 18) - 1;
+    static constexpr uint32_t PAGE_SIZE = 64;
+
+    static_assert(N > 0 && N <= (1 << INDEX_BITS) && N % PAGE_SIZE == 0, "Invalid handle table size.");
+
+    constexpr handle_table() noexcept
+        : pages_(), free_head_(0), unused_(0)
+    {
+    }
+
+    handle_table(handle_table &) = delete;
+    handle_table &operator=(handle_table &) = delete;
+
+    /* Returns 0 when the table is full */
+    handle_t allocate(T *object) noexcept
+    {
+        uint32_t index;
+        if (!pop_free(index) && !take_unused(index))
+            return 0;
+
+        auto &entry = get_entry(index);
+        uint32_t generation = entry.generation.load(std::memory_order_relaxed) & GENERATION_MASK;
+        entry.object.store(object, std::memory_order_release);
+        return Offset + ((handle_t(generation) << INDEX_BITS) | index);
+    }
+
+    T *get(handle_t handle) noexcept
+    {
+        auto entry = find(handle);
+        return entry ? entry->object.load(std::memory_order_acquire) : nullptr;
+    }
+
+    /* Returns the object of the handle, nullptr if it was not open */
+    T *release(handle_t handle) noexcept
+    {
+        auto entry = find(handle);
+        if (!entry || !entry->object.load(std::memory_order_acquire))
+            return nullptr;
+
+        /* Only one of several concurrent releases gets past the bump */
+        uint32_t generation = entry->generation.load(std::memory_order_relaxed);
+        if ((generation & GENERATION_MASK) != handle_generation(handle)
+            || !entry->generation.compare_exchange_strong(generation, generation + 1, std::memory_order_acq_rel))
+            return nullptr;
+
+        T *object = entry->object.exchange(nullptr, std::memory_order_acq_rel);
+        push_free(handle_index(handle));
+        return object;
+    }
+
+private:
+    struct entry_t
+    {
+        std::atomic<T *> object;
+        std::atomic<uint32_t> generation;
+        uint32_t next;
+    };
+
+    static constexpr uint32_t handle_index(handle_t handle) noexcept { return uint32_t(handle - Offset) & ((1U << INDEX_BITS) - 1); }
+    static constexpr uint32_t handle_generation(handle_t handle) noexcept { return uint32_t((handle - Offset) >> INDEX_BITS); }
+    static constexpr uint32_t head_index(uint64_t head) noexcept { return uint32_t(head); }
+    static constexpr uint32_t head_tag(uint64_t head) noexcept { return uint32_t(head >> 32); }
+    static constexpr uint64_t make_head(uint32_t index, uint32_t tag) noexcept { return (uint64_t(tag) << 32) | index; }
+
+    /* Only for indices that were handed out, their page exists */
+    entry_t &get_entry(uint32_t index) noexcept
+    {
+        return pages_[index / PAGE_SIZE].load(std::memory_order_acquire)[index % PAGE_SIZE];
+    }
+
+    entry_t *find(handle_t handle) noexcept
+    {
+        if (handle < Offset || handle_generation(handle) > GENERATION_MASK)
+            return nullptr;
+
+        uint32_t index = handle_index(handle);
+        if (index >= N)
+            return nullptr;
+
+        auto page = pages_[index / PAGE_SIZE].load(std::memory_order_acquire);
+        if (!page)
+            return nullptr;
+
+        auto entry = &page[index % PAGE_SIZE];
+        if ((entry->generation.load(std::memory_order_acquire) & GENERATION_MASK) != handle_generation(handle))
+            return nullptr;
+        return entry;
+    }
+
+    bool pop_free(uint32_t &index) noexcept
+    {
+        uint64_t head = free_head_.load(std::memory_order_acquire);
+        while (head_index(head))
+        {
+            uint64_t next = make_head(get_entry(head_index(head) - 1).next, head_tag(head) + 1);
+            if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire))
+            {
+                index = head_index(head) - 1;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void push_free(uint32_t index) noexcept
+    {
+        auto &entry = get_entry(index);
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        do
+        {
+            entry.next = head_index(head);
+        } while (!free_head_.compare_exchange_weak(head, make_head(index + 1, head_tag(head) + 1), std::memory_order_release));
+    }
+
+    /* Take a slot that has never been used, adding its page if needed */
+    bool take_unused(uint32_t &index) noexcept
+    {
+        index = unused_.fetch_add(1, std::memory_order_relaxed);
+        if (index >= N)
+        {
+            unused_.store(N, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto &page_ptr = pages_[index / PAGE_SIZE];
+        if (!page_ptr.load(std::memory_order_acquire))
+        {
+            /* Out of memory loses the slot, the rest of its page can still add the page */
+            auto page = new (std::nothrow) entry_t[PAGE_SIZE]();
+            if (!page)
+                return false;
+
+            entry_t *expected = nullptr;
+            if (!page_ptr.compare_exchange_strong(expected, page, std::memory_order_acq_rel))
+                delete[] page;
+        }
+
+        return true;
+    }
+
+private:
+    std::atomic<entry_t *> pages_[N / PAGE_SIZE];
+    /* Low 32 bits: index + 1 of the first free slot, high 32 bits: ABA tag */
+    std::atomic<uint64_t> free_head_;
+    std::atomic<uint32_t> unused_;
+};
+}
+
+#endif /* _FREERTOS_HANDLE_TABLE_H */
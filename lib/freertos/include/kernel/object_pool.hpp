@@ -0,0 +1,148 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _FREERTOS_OBJECT_POOL_H
+#define _FREERTOS_OBJECT_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+namespace sys
+{
+/* Fixed-size slots for objects of type T, reserved in .bss at link time.
+ * Slots are handed out from a lock-free free list, so allocate and
+ * deallocate are O(1) and never touch the heap. */
+template <class T, size_t N>
+class object_pool
+{
+public:
+    static_assert(N > 0 && N < UINT32_MAX, "Invalid pool size.");
+
+    constexpr object_pool() noexcept
+        : slots_(), free_head_(0), unused_(0)
+    {
+    }
+
+    object_pool(object_pool &) = delete;
+    object_pool &operator=(object_pool &) = delete;
+
+    void *allocate() noexcept
+    {
+        uint64_t head = free_head_.load(std::memory_order_acquire);
+        while (head_index(head))
+        {
+            auto &slot = slots_[head_index(head) - 1];
+            uint64_t next = make_head(slot.next, head_tag(head) + 1);
+            if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire))
+                return slot.storage;
+        }
+
+        /* Free list is empty, take a slot that has never been used */
+        size_t index = unused_.fetch_add(1, std::memory_order_relaxed);
+        if (index < N)
+            return slots_[index].storage;
+
+        unused_.store(N, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    void deallocate(void *ptr) noexcept
+    {
+        auto &slot = *reinterpret_cast<slot_t *>(ptr);
+        uint32_t index = uint32_t(&slot - slots_) + 1;
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        do
+        {
+            slot.next = head_index(head);
+        } while (!free_head_.compare_exchange_weak(head, make_head(index, head_tag(head) + 1), std::memory_order_release));
+    }
+
+    bool contains(const void *ptr) const noexcept
+    {
+        auto slot = reinterpret_cast<const slot_t *>(ptr);
+        return slot >= slots_ && slot < slots_ + N;
+    }
+
+private:
+    union slot_t {
+        alignas(T) uint8_t storage[sizeof(T)];
+        uint32_t next;
+    };
+
+    static constexpr uint32_t head_index(uint64_t head) noexcept { return uint32_t(head); }
+    static constexpr uint32_t head_tag(uint64_t head) noexcept { return uint32_t(head >> 32); }
+    static constexpr uint64_t make_head(uint32_t index, uint32_t tag) noexcept { return (uint64_t(tag) << 32) | index; }
+
+private:
+    slot_t slots_[N];
+    /* Low 32 bits: index + 1 of the first free slot, high 32 bits: ABA tag */
+    std::atomic<uint64_t> free_head_;
+    std::atomic<size_t> unused_;
+};
+
+/* Mixin that places every instance of T in an object_pool<T, N>.
+ * When the pool is exhausted (or for larger derived types) it falls
+ * back to the heap, so callers keep the usual new/delete semantics. */
+template <class T, size_t N>
+class pooled_object
+{
+public:
+    static void *operator new(size_t size)
+    {
+        if (size <= sizeof(T))
+        {
+            if (auto ptr = pool().allocate())
+                return ptr;
+        }
+
+        return ::operator new(size);
+    }
+
+    static void *operator new(size_t size, const std::nothrow_t &) noexcept
+    {
+        if (size <= sizeof(T))
+        {
+            if (auto ptr = pool().allocate())
+                return ptr;
+        }
+
+        return ::operator new(size, std::nothrow);
+    }
+
+    static void operator delete(void *ptr) noexcept
+    {
+        if (pool().contains(ptr))
+            pool().deallocate(ptr);
+        else
+            ::operator delete(ptr);
+    }
+
+    static void operator delete(void *ptr, const std::nothrow_t &) noexcept
+    {
+        operator delete(ptr);
+    }
+
+private:
+    static object_pool<T, N> &pool() noexcept
+    {
+        static object_pool<T, N> pool;
+        return pool;
+    }
+};
+}
+
+#endif /* _FREERTOS_OBJECT_POOL_H */
@@ -0,0 +1,61 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _FREERTOS_VECTORED_IO_H
+#define _FREERTOS_VECTORED_IO_H
+
+#include "osdefs.h"
+#include <gsl/span>
+
+namespace sys
+{
+/* Vectored transfers for drivers without one, a read or write per buffer.
+ * They stop at the first short transfer, and an error after some data was
+ * transferred returns the data so far, as readv and writev do. */
+template <class T>
+int io_readv_each(T *driver, gsl::span<const io_vec_t> buffers)
+{
+    int total = 0;
+    for (auto &vec : buffers)
+    {
+        int ret = driver->read({ reinterpret_cast<uint8_t *>(vec.base), std::ptrdiff_t(vec.len) });
+        if (ret < 0)
+            return total ? total : ret;
+        total += ret;
+        if ((size_t)ret != vec.len)
+            break;
+    }
+
+    return total;
+}
+
+template <class T>
+int io_writev_each(T *driver, gsl::span<const io_vec_t> buffers)
+{
+    int total = 0;
+    for (auto &vec : buffers)
+    {
+        int ret = driver->write({ reinterpret_cast<const uint8_t *>(vec.base), std::ptrdiff_t(vec.len) });
+        if (ret < 0)
+            return total ? total : ret;
+        total += ret;
+        if ((size_t)ret != vec.len)
+            break;
+    }
+
+    return total;
+}
+}
+
+#endif /* _FREERTOS_VECTORED_IO_H */
@@ -238,6 +238,9 @@ typedef void(*pic_irq_handler_t)(void *userdata);
 
 typedef void(*dma_stage_completion_handler_t)(void *userdata);
 
+/* Called from the DMA interrupt, or from the work queue when a bounce buffer is copied back */
+typedef void (*dma_completion_handler_t)(void *userdata);
+
 typedef enum _file_access
 {
     FILE_ACCESS_READ = 1,
@@ -265,6 +268,51 @@ typedef struct _find_file_data
     char filename[MAX_PATH];
 } find_find_data_t;
 
+/* One buffer of a vectored read or write, laid out like struct iovec */
+typedef struct _io_vec
+{
+    void *base;
+    size_t len;
+} io_vec_t;
+
+typedef enum _io_request_op
+{
+    /* buffer is a uint8_t array of len bytes */
+    IO_REQUEST_READ,
+    IO_REQUEST_WRITE,
+    /* buffer is an io_vec_t array of len entries */
+    IO_REQUEST_READV,
+    IO_REQUEST_WRITEV
+} io_request_op_t;
+
+typedef struct _io_request io_request_t;
+
+/* Runs on an I/O worker task, or on the work queue worker for requests a driver
+ * completed from its DMA interrupt, once the request is done. The work queue
+ * worker runs above every application task and carries the deferred interrupt
+ * work of all drivers, so keep the callback short and never block in it: give
+ * a semaphore or post to a queue without waiting, and leave the rest to a
+ * task. */
+typedef void (*io_completion_t)(io_request_t *request, void *userdata);
+
+/* An asynchronous read or write, see io_submit. Zero it before first use. */
+struct _io_request
+{
+    handle_t file;
+    io_request_op_t op;
+    void *buffer;
+    size_t len;
+    /* Either or both may be NULL */
+    io_completion_t on_completion;
+    void *userdata;
+    QueueHandle_t completion_queue;
+    /* What the synchronous call returned, and errno if it failed */
+    int result;
+    int error;
+    /* 1 from io_submit until done */
+    volatile int pending;
+};
+
 typedef enum _address_family
 {
     AF_UNSPECIFIED,
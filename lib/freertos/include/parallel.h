@@ -0,0 +1,105 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+//
+// Work-stealing parallel loops across the cores
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+#include <type_traits>
+
+extern "C"
+{
+#endif
+
+/* Priority of the workers started on first use, see parallel_init */
+#ifndef PARALLEL_WORKER_PRIORITY
+#define PARALLEL_WORKER_PRIORITY configMAIN_TASK_PRIORITY
+#endif
+
+/* Stack of each worker in words, the loop bodies run on it */
+#ifndef PARALLEL_WORKER_STACK_DEPTH
+#define PARALLEL_WORKER_STACK_DEPTH 4096
+#endif
+
+/* Ranges each core can have queued */
+#ifndef PARALLEL_DEQUE_SIZE
+#define PARALLEL_DEQUE_SIZE 64
+#endif
+
+/* Runs the iterations [begin, end) of a parallel loop */
+typedef void (*parallel_for_fn_t)(size_t begin, size_t end, void *userdata);
+
+/**
+ * @brief       Start one worker task per core
+ *
+ * parallel_for calls it with PARALLEL_WORKER_PRIORITY on first use, call it
+ * earlier to choose the priority. Calling it again does nothing.
+ *
+ * @param[in]   priority    Priority of the workers
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail
+ */
+int parallel_init(UBaseType_t priority);
+
+/**
+ * @brief       Run fn over [begin, end) on all cores and wait for it
+ *
+ * The range is split in halves down to grain iterations. The calling task
+ * runs its core's share, the workers of the other cores steal the rest and
+ * are woken by an IPI. fn may itself call parallel_for, a waiting task
+ * keeps running queued ranges while there are any. Once the rest of its loop
+ * runs elsewhere it sleeps on its task notification until the task ending
+ * the loop notifies it, notifications given to it meanwhile are consumed.
+ *
+ * Falls back to calling fn once over the whole range when the range is not
+ * larger than grain or the workers could not be started. Must be called
+ * from a task.
+ *
+ * @param[in]   begin       First iteration
+ * @param[in]   end         One past the last iteration
+ * @param[in]   grain       Fewest iterations worth handing to another core, 0 means 1
+ * @param[in]   fn          Loop body, called with disjoint sub-ranges
+ * @param[in]   userdata    Passed to fn
+ */
+void parallel_for(size_t begin, size_t end, size_t grain, parallel_for_fn_t fn, void *userdata);
+
+#ifdef __cplusplus
+}
+
+namespace sys
+{
+/* Calls func(i) for each i in [begin, end), see ::parallel_for */
+template <class TFunc>
+void parallel_for(size_t begin, size_t end, size_t grain, TFunc &&func)
+{
+    using func_t = std::remove_reference_t<TFunc>;
+
+    ::parallel_for(begin, end, grain, [](size_t first, size_t last, void *userdata) {
+        auto &body = *reinterpret_cast<func_t *>(userdata);
+        for (size_t i = first; i < last; i++)
+            body(i);
+    },
+        const_cast<void *>(reinterpret_cast<const void *>(&func)));
+}
+}
+#endif
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,86 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+//
+// Statistical PC-sampling profiler
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "FreeRTOS.h"
+#include <osdefs.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Deepest frame-pointer backtrace kept per sample */
+#define PROFILER_MAX_DEPTH 8
+
+/**
+ * @brief       Start sampling every core from a hardware timer
+ *
+ * The timer interrupt samples the core it is routed to and rings a doorbell
+ * on the other core, which samples itself. A sample is the interrupted pc,
+ * the running task and, when depth is not 0, up to depth return addresses
+ * found by walking frame pointers. Backtraces are only meaningful for code
+ * built with -fno-omit-frame-pointer.
+ *
+ * Once max_samples have been taken further samples are only counted as
+ * dropped. A previous buffer is released first.
+ *
+ * @param[in]   timer_name      Timer device to sample from, e.g. "/dev/timer10"
+ * @param[in]   rate_hz         Samples per second on each core
+ * @param[in]   max_samples     Samples to preallocate
+ * @param[in]   depth           Return addresses per sample, at most PROFILER_MAX_DEPTH
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail
+ */
+int profiler_start(const char *timer_name, uint32_t rate_hz, size_t max_samples, uint32_t depth);
+
+/**
+ * @brief       Stop sampling, the samples are kept until the next start or
+ *              profiler_release
+ */
+void profiler_stop(void);
+
+/**
+ * @brief       Release the sample buffer
+ */
+void profiler_release(void);
+
+/**
+ * @brief       Get the number of samples taken and lost to a full buffer
+ */
+void profiler_get_count(size_t *samples, size_t *dropped);
+
+/**
+ * @brief       Write the samples in the format read by tools/profile2folded.py
+ *
+ * @param[in]   file        A UART or a file opened for writing
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail
+ */
+int profiler_write(handle_t file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILER_H */
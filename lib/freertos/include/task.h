@@ -152,6 +152,15 @@ typedef struct xTASK_STATUS
 	uint16_t usStackHighWaterMark;	/* The minimum amount of stack space that has remained for the task since the task was created.  The closer this value is to zero the closer the task has come to overflowing its stack. */
 } TaskStatus_t;
 
+/* Used with the xTaskGetCoreLoad() function to return the load of one core. */
+typedef struct xCORE_LOAD_STATUS
+{
+	uint32_t ulLoad;				/* Time spent outside the idle task during the last configLOAD_SAMPLE_PERIOD ticks, in permille. */
+	uint32_t ulLoadAverage;			/* Exponential moving average of ulLoad, each new sample weighs a quarter. */
+	uint64_t ullBusyTime;			/* Run time counter units spent outside the idle task, up to the last sample. */
+	uint64_t ullTotalTime;			/* Run time counter units elapsed since the scheduler started, up to the last sample. */
+} CoreLoadStatus_t;
+
 /* Possible return values for eTaskConfirmSleepModeStatus(). */
 typedef enum
 {
@@ -167,6 +176,13 @@ typedef enum
  */
 #define tskIDLE_PRIORITY			( ( UBaseType_t ) 0U )
 
+/**
+ * Affinity mask that allows a task to run on any core.
+ *
+ * \ingroup TaskUtils
+ */
+#define tskNO_AFFINITY				( ( UBaseType_t ) -1 )
+
 /**
  * task. h
  *
@@ -1027,6 +1043,56 @@ void vTaskGetInfo( TaskHandle_t xTask, TaskStatus_t *pxTaskStatus, BaseType_t xG
  */
 void vTaskPrioritySet( TaskHandle_t xTask, UBaseType_t uxNewPriority ) PRIVILEGED_FUNCTION;
 
+/**
+ * task. h
+ * <pre>void vTaskCoreAffinitySet( TaskHandle_t xTask, UBaseType_t uxCoreAffinityMask );</pre>
+ *
+ * Set the cores a task may run on.  Bit n of uxCoreAffinityMask set means the
+ * task may run on core n.  Tasks are created with tskNO_AFFINITY.
+ *
+ * If the task currently belongs to a core that is not in the mask it is
+ * handed over to an allowed core on the next context switch of its core.  If
+ * the calling task changes its own affinity that way it yields immediately.
+ *
+ * @param xTask Handle to the task.  Passing a NULL handle results in the
+ * affinity of the calling task being set.
+ *
+ * @param uxCoreAffinityMask The cores the task may run on.
+ *
+ * \defgroup vTaskCoreAffinitySet vTaskCoreAffinitySet
+ * \ingroup TaskCtrl
+ */
+void vTaskCoreAffinitySet( TaskHandle_t xTask, UBaseType_t uxCoreAffinityMask ) PRIVILEGED_FUNCTION;
+
+/**
+ * task. h
+ * <pre>UBaseType_t uxTaskCoreAffinityGet( TaskHandle_t xTask );</pre>
+ *
+ * @param xTask Handle to the task.  Passing a NULL handle results in the
+ * affinity of the calling task being returned.
+ *
+ * @return The cores the task may run on, see vTaskCoreAffinitySet().
+ *
+ * \defgroup uxTaskCoreAffinityGet uxTaskCoreAffinityGet
+ * \ingroup TaskCtrl
+ */
+UBaseType_t uxTaskCoreAffinityGet( TaskHandle_t xTask ) PRIVILEGED_FUNCTION;
+
+/**
+ * task. h
+ * <pre>UBaseType_t uxTaskProcessorIdGet( TaskHandle_t xTask );</pre>
+ *
+ * @param xTask Handle to the task.  Passing a NULL handle results in the
+ * core of the calling task being returned.
+ *
+ * @return The core whose lists hold the task.  A blocked task stays on this
+ * core until it is readied, a ready task may migrate at any context switch.
+ *
+ * \defgroup uxTaskProcessorIdGet uxTaskProcessorIdGet
+ * \ingroup TaskCtrl
+ */
+UBaseType_t uxTaskProcessorIdGet( TaskHandle_t xTask ) PRIVILEGED_FUNCTION;
+
 /**
  * task. h
  * <pre>void vTaskSuspend( TaskHandle_t xTaskToSuspend );</pre>
@@ -1707,6 +1773,60 @@ void vTaskList( char * pcWriteBuffer ) PRIVILEGED_FUNCTION; /*lint !e971 Unquali
  */
 void vTaskGetRunTimeStats( char *pcWriteBuffer ) PRIVILEGED_FUNCTION; /*lint !e971 Unqualified char types are allowed for strings and single characters only. */
 
+/**
+ * task. h
+ * <PRE>BaseType_t xTaskGetCoreLoad( UBaseType_t uxCore, CoreLoadStatus_t *pxCoreLoad );</PRE>
+ *
+ * configGENERATE_RUN_TIME_STATS must be defined as 1 for this function to be
+ * available.  The tick interrupt of each core samples the time the core spent
+ * outside its idle task every configLOAD_SAMPLE_PERIOD ticks.  Interrupt time
+ * is charged to the task that was interrupted.
+ *
+ * @param uxCore The core to query.
+ *
+ * @param pxCoreLoad Receives the load of the core, see CoreLoadStatus_t.
+ *
+ * @return pdPASS, or pdFAIL if uxCore is not a valid core.
+ *
+ * \defgroup xTaskGetCoreLoad xTaskGetCoreLoad
+ * \ingroup TaskUtils
+ */
+BaseType_t xTaskGetCoreLoad( UBaseType_t uxCore, CoreLoadStatus_t *pxCoreLoad ) PRIVILEGED_FUNCTION;
+
+/**
+ * task. h
+ * <PRE>uint32_t ulTaskGetRunTimeCounter( TaskHandle_t xTask );</PRE>
+ *
+ * configGENERATE_RUN_TIME_STATS must be defined as 1 for this function to be
+ * available.  Works for tasks of either core.
+ *
+ * @param xTask Handle to the task, or NULL for the calling task.
+ *
+ * @return The time the task has spent in the Running state, in units of
+ * portRUN_TIME_COUNTER_HZ.
+ *
+ * \defgroup ulTaskGetRunTimeCounter ulTaskGetRunTimeCounter
+ * \ingroup TaskUtils
+ */
+uint32_t ulTaskGetRunTimeCounter( TaskHandle_t xTask ) PRIVILEGED_FUNCTION;
+
+/**
+ * task. h
+ * <PRE>uint32_t ulTaskGetRunTimePercent( TaskHandle_t xTask );</PRE>
+ *
+ * configGENERATE_RUN_TIME_STATS must be defined as 1 for this function to be
+ * available.
+ *
+ * @param xTask Handle to the task, or NULL for the calling task.
+ *
+ * @return The share of the time the task's core has been running the
+ * scheduler that the task spent in the Running state, in percent.
+ *
+ * \defgroup ulTaskGetRunTimePercent ulTaskGetRunTimePercent
+ * \ingroup TaskUtils
+ */
+uint32_t ulTaskGetRunTimePercent( TaskHandle_t xTask ) PRIVILEGED_FUNCTION;
+
 /**
  * task. h
  * <PRE>BaseType_t xTaskNotify( TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction );</PRE>
@@ -2346,6 +2466,14 @@ eSleepModeStatus eTaskConfirmSleepModeStatus( void ) PRIVILEGED_FUNCTION;
  */
 void *pvTaskIncrementMutexHeldCount( void ) PRIVILEGED_FUNCTION;
 
+/*
+ * For internal use only.  Count a mutex as held by pxMutexHolder, for locks
+ * that only reach the kernel once they are contended, so the holder can inherit
+ * priority through xTaskPriorityInherit() and drop it through
+ * xTaskPriorityDisinherit() like with a kernel mutex.
+ */
+void vTaskIncrementMutexHeldCountOf( TaskHandle_t const pxMutexHolder ) PRIVILEGED_FUNCTION;
+
 /*
  * For internal use only.  Same as vTaskSetTimeOutState(), but without a critial
  * section.
@@ -2354,6 +2482,12 @@ void vTaskInternalSetTimeOutState( TimeOut_t * const pxTimeOut ) PRIVILEGED_FUNC
 
 void vAddNewTaskToCurrentReadyList(TaskHandle_t pxNewTCB) PRIVILEGED_FUNCTION;
 
+/*
+ * For internal use only.  Add a task handed over by another core to the ready
+ * list of the calling core.
+ */
+void vAddMigratedTaskToCurrentReadyList( TaskHandle_t xTask ) PRIVILEGED_FUNCTION;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,155 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+//
+// Binary event trace recorder
+//
+// Included from FreeRTOSConfig.h, so it must not depend on FreeRTOS types.
+// Only the name table is built when configUSE_TRACE_RECORDER is 0, the event
+// functions are left undefined and TRACE_RECORD does nothing.
+
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include "FreeRTOSConfig.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Events kept per core, must be a power of two. Older events are overwritten. */
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 2048
+#endif
+
+/* Task and queue names remembered for the decoder */
+#ifndef TRACE_MAX_NAMES
+#define TRACE_MAX_NAMES 64
+#endif
+
+#define TRACE_NAME_LEN 16
+
+/* Objects are identified by the low 32 bits of their address, all of memory
+ * is below 4 GiB on the K210 */
+#define TRACE_OBJECT_ID(object) ((uint32_t)(uintptr_t)(object))
+
+typedef enum
+{
+    TRACE_EVENT_NONE,
+    /* arg16: priority, arg32: task */
+    TRACE_EVENT_TASK_SWITCH_IN,
+    TRACE_EVENT_TASK_SWITCH_OUT,
+    TRACE_EVENT_TASK_READY,
+    /* arg8: mcause interrupt code */
+    TRACE_EVENT_ISR_ENTER,
+    TRACE_EVENT_ISR_EXIT,
+    /* arg32: PLIC source */
+    TRACE_EVENT_PIC_IRQ_ENTER,
+    TRACE_EVENT_PIC_IRQ_EXIT,
+    /* arg32: queue or semaphore */
+    TRACE_EVENT_QUEUE_BLOCK_SEND,
+    TRACE_EVENT_QUEUE_BLOCK_RECEIVE,
+    TRACE_EVENT_QUEUE_BLOCK_PEEK,
+    /* arg8: channel, arg16: 1 for loop transfers, arg32: element count */
+    TRACE_EVENT_DMA_START,
+    TRACE_EVENT_DMA_COMPLETE,
+    /* arg16: layer type, arg32: layer index */
+    TRACE_EVENT_KPU_LAYER,
+    TRACE_EVENT_KPU_DONE,
+    /* Free for application events */
+    TRACE_EVENT_USER = 0x80
+} trace_event_type_t;
+
+typedef struct _trace_event
+{
+    /* mtime at the event */
+    uint64_t time;
+    uint8_t type;
+    uint8_t arg8;
+    uint16_t arg16;
+    uint32_t arg32;
+} trace_event_t;
+
+#if (configUSE_TRACE_RECORDER == 1)
+extern volatile int g_trace_enabled;
+
+/* Costs a load and a branch while stopped */
+#define TRACE_RECORD(type, arg8, arg16, arg32)                                                    \
+    do                                                                                            \
+    {                                                                                             \
+        if (g_trace_enabled)                                                                      \
+            trace_record((uint8_t)(type), (uint8_t)(arg8), (uint16_t)(arg16), (uint32_t)(arg32)); \
+    } while (0)
+#else
+#define TRACE_RECORD(type, arg8, arg16, arg32) \
+    do                                         \
+    {                                          \
+    } while (0)
+#endif
+
+/**
+ * @brief       Append an event to the ring of the calling core, use TRACE_RECORD
+ */
+void trace_record(uint8_t type, uint8_t arg8, uint16_t arg16, uint32_t arg32);
+
+/**
+ * @brief       Remember the name of a task or queue for the decoder
+ */
+void trace_set_name(const void *object, const char *name);
+
+/**
+ * @brief       Look up a name remembered with trace_set_name
+ *
+ * @param[in]   id      TRACE_OBJECT_ID of the object
+ * @param[out]  name    Receives the name, TRACE_NAME_LEN bytes, not always terminated
+ *
+ * @return      1 if the name is known, otherwise 0
+ */
+int trace_get_name(uint32_t id, char *name);
+
+/**
+ * @brief       Clear the rings and start recording on all cores
+ */
+void trace_start(void);
+
+/**
+ * @brief       Stop recording on all cores
+ */
+void trace_stop(void);
+
+/**
+ * @brief       Get the size of a dump of the current trace
+ */
+size_t trace_dump_size(void);
+
+/**
+ * @brief       Write the trace in the binary dump format read by tools/trace2json.py
+ *
+ * Stop the trace first, events recorded while dumping may be torn.
+ *
+ * @param[out]  buffer      Dump destination
+ * @param[in]   size        Size of buffer
+ *
+ * @return      Bytes written, 0 if buffer is too small
+ */
+size_t trace_dump(void *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_RECORDER_H */
@@ -0,0 +1,105 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+//
+// Deferred interrupt work run by a worker task on each core
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Priority of the workers, above any application task by default */
+#ifndef WORK_QUEUE_PRIORITY
+#define WORK_QUEUE_PRIORITY (configMAX_PRIORITIES - 1)
+#endif
+
+/* Stack of each worker in words, the work functions run on it */
+#ifndef WORK_QUEUE_STACK_DEPTH
+#define WORK_QUEUE_STACK_DEPTH 2048
+#endif
+
+typedef struct _work work_t;
+
+/* Runs on the worker task of the core the work was queued on */
+typedef void (*work_fn_t)(work_t *work, void *userdata);
+
+struct _work
+{
+    work_t *next;
+    work_fn_t fn;
+    void *userdata;
+    volatile int pending;
+};
+
+#define WORK_INIT(f, u) \
+    {                   \
+        .next = NULL, .fn = (f), .userdata = (u), .pending = 0 }
+
+/**
+ * @brief       Start the worker task of each core
+ *
+ * Called once at startup before the drivers are installed.
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail
+ */
+int work_queue_init(void);
+
+/**
+ * @brief       Initialize a work item
+ *
+ * @param[in]   work        The work item, must stay valid while it is queued
+ * @param[in]   fn          Called by the worker
+ * @param[in]   userdata    Passed to fn
+ */
+void work_init(work_t *work, work_fn_t fn, void *userdata);
+
+/**
+ * @brief       Queue a work item on the worker of the calling core
+ *
+ * Safe to call from an ISR. Work queued while the worker sleeps wakes it
+ * once, everything queued until it runs is handled in the same batch, in
+ * queueing order. Queueing an item that is still pending does nothing, an
+ * item queued again while its function runs runs once more afterwards.
+ *
+ * @param[in]   work        The work item
+ *
+ * @return      1 if queued, 0 if it was already pending
+ */
+int work_queue(work_t *work);
+
+/**
+ * @brief       Queue a work item on the worker of a core
+ *
+ * Same as work_queue, a worker on the other core is woken by an IPI.
+ *
+ * @param[in]   core_id     The core to run the work on
+ * @param[in]   work        The work item
+ *
+ * @return      1 if queued, 0 if it was already pending
+ */
+int work_queue_on(UBaseType_t core_id, work_t *work);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKQUEUE_H */
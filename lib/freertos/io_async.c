@@ -0,0 +1,186 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "kernel/device_priv.h"
+#include "queue.h"
+#include "task.h"
+#include <atomic.h>
+#include <devices.h>
+#include <errno.h>
+
+/*
+ * Drivers that can start a request on their DMA take it first, and complete
+ * it from the DMA interrupt through the work queue, no task waits for it.
+ * Everything else goes through one queue to a few worker tasks, each running
+ * requests as the synchronous io_* call, so a worker holds the wait instead
+ * of the submitting task, and the workers' stacks are shared by every task
+ * doing asynchronous I/O. The workers are only created by the first request
+ * that needs them, an application without asynchronous I/O pays for the
+ * queue alone.
+ *
+ * Completion never waits: a request whose completion_queue is full is
+ * dropped from the queue and counted in s_completion_overflows, blocking
+ * there would stall the work queue worker and every driver deferring its
+ * interrupts to it.
+ */
+
+#ifndef CONFIG_IO_WORKER_COUNT
+#define CONFIG_IO_WORKER_COUNT 2
+#endif
+
+#ifndef CONFIG_IO_WORKER_PRIORITY
+#define CONFIG_IO_WORKER_PRIORITY configMAIN_TASK_PRIORITY
+#endif
+
+/* Stack of each worker in words, the drivers and file systems run on it */
+#ifndef CONFIG_IO_WORKER_STACK_DEPTH
+#define CONFIG_IO_WORKER_STACK_DEPTH 2048
+#endif
+
+/* Requests waiting for a worker before io_submit fails */
+#ifndef CONFIG_IO_REQUEST_QUEUE_LENGTH
+#define CONFIG_IO_REQUEST_QUEUE_LENGTH 16
+#endif
+
+static QueueHandle_t s_io_requests;
+static int s_io_workers_started;
+static volatile uint32_t s_completion_overflows;
+
+static void io_run_request(io_request_t *request)
+{
+    errno = 0;
+    switch (request->op)
+    {
+    case IO_REQUEST_READ:
+        request->result = io_read(request->file, (uint8_t *)request->buffer, request->len);
+        break;
+    case IO_REQUEST_WRITE:
+        request->result = io_write(request->file, (const uint8_t *)request->buffer, request->len);
+        break;
+    case IO_REQUEST_READV:
+        request->result = io_readv(request->file, (const io_vec_t *)request->buffer, (int)request->len);
+        break;
+    case IO_REQUEST_WRITEV:
+        request->result = io_writev(request->file, (const io_vec_t *)request->buffer, (int)request->len);
+        break;
+    default:
+        request->result = -1;
+        errno = EINVAL;
+        break;
+    }
+
+    request->error = request->result < 0 ? errno : 0;
+}
+
+void io_request_complete(io_request_t *request, int result, int error)
+{
+    request->result = result;
+    request->error = error;
+
+    /* The owner may reuse the request once pending is cleared */
+    io_completion_t on_completion = request->on_completion;
+    void *userdata = request->userdata;
+    QueueHandle_t completion_queue = request->completion_queue;
+    mb();
+    atomic_set(&request->pending, 0);
+
+    if (on_completion)
+        on_completion(request, userdata);
+    if (completion_queue && xQueueSend(completion_queue, &request, 0) != pdTRUE)
+        atomic_add(&s_completion_overflows, 1);
+}
+
+uint32_t io_get_completion_overflows(void)
+{
+    return s_completion_overflows;
+}
+
+static void io_worker_main(void *arg)
+{
+    io_request_t *request;
+
+    while (1)
+    {
+        if (xQueueReceive(s_io_requests, &request, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        io_run_request(request);
+        io_request_complete(request, request->result, request->error);
+    }
+}
+
+int io_async_init(void)
+{
+    s_io_requests = xQueueCreate(CONFIG_IO_REQUEST_QUEUE_LENGTH, sizeof(io_request_t *));
+    return s_io_requests ? 0 : -1;
+}
+
+/* Create the workers once, on the first request for them. Returns 0 if there are any */
+static int io_start_workers(void)
+{
+    /* A task that lost the race queues its request, the winner's workers pick it up */
+    if (atomic_read(&s_io_workers_started) || atomic_cas(&s_io_workers_started, 0, 1) != 0)
+        return 0;
+
+    for (UBaseType_t i = 0; i < CONFIG_IO_WORKER_COUNT; i++)
+    {
+        if (xTaskCreateAtProcessor(i % portNUM_PROCESSORS, io_worker_main, "io", CONFIG_IO_WORKER_STACK_DEPTH, NULL, CONFIG_IO_WORKER_PRIORITY, NULL) != pdPASS)
+        {
+            /* Workers already started still serve the queue, with none the next request tries again */
+            if (i)
+                return 0;
+            atomic_set(&s_io_workers_started, 0);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int io_submit(io_request_t *request)
+{
+    if (!request)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (atomic_swap(&request->pending, 1))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    request->result = 0;
+    request->error = 0;
+    if (io_submit_native(request))
+        return 0;
+
+    if (io_start_workers() != 0)
+    {
+        atomic_set(&request->pending, 0);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (xQueueSend(s_io_requests, &request, 0) != pdTRUE)
+    {
+        atomic_set(&request->pending, 0);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
@@ -15,6 +15,7 @@
 #ifndef _FREERTOS_DEVICE_PRIV_H
 #define _FREERTOS_DEVICE_PRIV_H
 
+#include "osdefs.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -33,6 +34,34 @@ void install_hal();
  */
 void install_drivers();
 
+/**
+ * @brief       Create the request queue of io_submit, its workers are created
+ *              by the first request that needs them
+ *
+ * @return      result
+ *     - 0      Success
+ *     - other  Fail
+ */
+int io_async_init(void);
+
+/**
+ * @brief       Let the driver of a request start it on its DMA
+ *
+ * @param[in]   request     The request, already marked pending
+ *
+ * @return      1 if the driver took it, 0 to run it on the I/O workers
+ */
+int io_submit_native(io_request_t *request);
+
+/**
+ * @brief       Finish a request a driver started in submit_async, from task context
+ *
+ * @param[in]   request     The request
+ * @param[in]   result      What the synchronous call would have returned
+ * @param[in]   error       errno if result is -1, 0 otherwise
+ */
+void io_request_complete(io_request_t *request, int result, int error);
+
 #ifdef __cplusplus
 }
 #endif
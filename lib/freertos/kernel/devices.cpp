@@ -18,7 +18,11 @@
 #include "filesystem.h"
 #include "hal.h"
 #include "kernel/driver.hpp"
+#include "kernel/handle_table.hpp"
+#include "kernel/object_pool.hpp"
+#include "kernel/vectored_io.hpp"
 #include <atomic.h>
+#include <atomic>
 #include <plic.h>
 #include <semphr.h>
 #include <stdio.h>
@@ -30,10 +34,18 @@
 
 using namespace sys;
 
-#define MAX_HANDLES 256
 #define HANDLE_OFFSET 256
 #define MAX_CUSTOM_DRIVERS 32
 
+/* Devices, files and sockets share one handle table, a multiple of 64 up to 4096 */
+#ifndef CONFIG_MAX_HANDLES
+#define CONFIG_MAX_HANDLES 1024
+#endif
+
+#ifndef CONFIG_FILE_POOL_SIZE
+#define CONFIG_FILE_POOL_SIZE 256
+#endif
+
 #define DEFINE_INSTALL_DRIVER(type)          \
     static void install_##type##_drivers()   \
     {                                        \
@@ -53,12 +65,27 @@ using namespace sys;
         return -1;          \
     }
 
-typedef struct
+/* Interfaces io_read and io_write dispatch to, named after their types */
+enum class io_kind
+{
+    none,
+    uart_driver,
+    i2c_device_driver,
+    spi_device_driver,
+    filesystem_file,
+    network_socket
+};
+
+struct _file : public pooled_object<_file, CONFIG_FILE_POOL_SIZE>
 {
     object_accessor<object_access> object;
-} _file;
+    /* Resolved once in io_alloc_file, object keeps them alive */
+    io_kind kind;
+    void *io_object;
+    custom_driver *custom;
+};
 
-static _file *handles_[MAX_HANDLES];
+static handle_table<_file, CONFIG_MAX_HANDLES, HANDLE_OFFSET> handles_;
 static driver_registry_t g_custom_drivers[MAX_CUSTOM_DRIVERS];
 static const char dummy_driver_name[] = "";
 static _lock_t dma_lock;
@@ -68,8 +95,6 @@ uintptr_t aes_file_;
 uintptr_t sha256_file_;
 uintptr_t kpu_file_;
 
-extern UBaseType_t uxCPUClockRate;
-
 DEFINE_INSTALL_DRIVER(hal);
 DEFINE_INSTALL_DRIVER(dma);
 DEFINE_INSTALL_DRIVER(system);
@@ -131,6 +156,29 @@ void install_drivers()
     kpu_file_ = io_open("/dev/kpu0");
 }
 
+#define RESOLVE_IO_KIND(t)                 \
+    if (auto f = file->object.as<t>())     \
+    {                                      \
+        file->kind = io_kind::t;           \
+        file->io_object = f;               \
+    }
+
+/* Do the casts once, so each read or write is a single virtual call */
+static void io_resolve_file(_file *file)
+{
+    file->kind = io_kind::none;
+    file->io_object = nullptr;
+    file->custom = file->object.as<custom_driver>();
+
+    /* clang-format off */
+    RESOLVE_IO_KIND(uart_driver)
+    else RESOLVE_IO_KIND(i2c_device_driver)
+    else RESOLVE_IO_KIND(spi_device_driver)
+    else RESOLVE_IO_KIND(filesystem_file)
+    else RESOLVE_IO_KIND(network_socket)
+    /* clang-format on */
+}
+
 static _file *io_alloc_file(object_accessor<object_access> object)
 {
     if (object)
@@ -139,6 +187,7 @@ static _file *io_alloc_file(object_accessor<object_access> object)
         if (!file)
             return nullptr;
         file->object = std::move(object);
+        io_resolve_file(file);
         return file;
     }
 
@@ -181,43 +230,60 @@ static _file *io_open_dynamic(const char *name, _file **file)
 
 /* Generic IO Implementation Helper Macros */
 
-#define DEFINE_READ_PROXY(t)                                  \
-    if (auto f = rfile->object.as<t>())                       \
-    {                                                         \
-        return (int)f->read({ buffer, std::ptrdiff_t(len) }); \
-    }
+#define DEFINE_READ_PROXY(t)                                                                   \
+    case io_kind::t:                                                                           \
+        return (int)static_cast<t *>(rfile->io_object)->read({ buffer, std::ptrdiff_t(len) });
 
-#define DEFINE_WRITE_PROXY(t)                                  \
-    if (auto f = rfile->object.as<t>())                        \
-    {                                                          \
-        return (int)f->write({ buffer, std::ptrdiff_t(len) }); \
-    }
+#define DEFINE_WRITE_PROXY(t)                                                                   \
+    case io_kind::t:                                                                            \
+        return (int)static_cast<t *>(rfile->io_object)->write({ buffer, std::ptrdiff_t(len) });
 
-#define DEFINE_CONTROL_PROXY(t)                                                                                                       \
-    if (auto t = rfile->object.as<t##_driver>())                                                                                      \
-    {                                                                                                                                 \
-        return (int)t->control(control_code, { write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) }); \
-    }
+#define DEFINE_READV_PROXY(t) \
+    case io_kind::t:          \
+        return (int)static_cast<t *>(rfile->io_object)->readv(buffers);
+
+#define DEFINE_WRITEV_PROXY(t) \
+    case io_kind::t:           \
+        return (int)static_cast<t *>(rfile->io_object)->writev(buffers);
+
+#define DEFINE_READV_EACH(t) \
+    case io_kind::t:         \
+        return io_readv_each(static_cast<t *>(rfile->io_object), buffers);
+
+#define DEFINE_WRITEV_EACH(t) \
+    case io_kind::t:          \
+        return io_writev_each(static_cast<t *>(rfile->io_object), buffers);
+
+#define DEFINE_SUBMIT_ASYNC_PROXY(t) \
+    case io_kind::t:                 \
+        return static_cast<t *>(rfile->io_object)->submit_async(*request);
 
 static void dma_add_free();
 
+/* Throws for a closed or invalid handle, see CATCH_ALL */
+static _file *io_get_file(handle_t file)
+{
+    _file *rfile = handles_.get(file);
+    if (!rfile)
+        throw errno_exception("Invalid handle.", EBADF);
+    return rfile;
+}
+
 int io_read(handle_t file, uint8_t *buffer, size_t len)
 {
     try
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-        /* clang-format off */
-        DEFINE_READ_PROXY(uart_driver)
-        else DEFINE_READ_PROXY(i2c_device_driver)
-        else DEFINE_READ_PROXY(spi_device_driver)
-        else DEFINE_READ_PROXY(filesystem_file)
-        else DEFINE_READ_PROXY(network_socket)
-        else
+        _file *rfile = io_get_file(file);
+        switch (rfile->kind)
         {
+            DEFINE_READ_PROXY(uart_driver)
+            DEFINE_READ_PROXY(i2c_device_driver)
+            DEFINE_READ_PROXY(spi_device_driver)
+            DEFINE_READ_PROXY(filesystem_file)
+            DEFINE_READ_PROXY(network_socket)
+        default:
             return -1;
         }
-        /* clang-format on */
     }
     CATCH_ALL;
 }
@@ -237,18 +303,10 @@ static handle_t io_alloc_handle(_file *file)
 {
     if (file)
     {
-        size_t i, j;
-        for (i = 0; i < 2; i++)
-        {
-            for (j = 0; j < MAX_HANDLES; j++)
-            {
-                if (atomic_cas(handles_ + j, 0, file) == 0)
-                    return j + HANDLE_OFFSET;
-            }
-        }
-
-        io_free(file);
-        return 0;
+        handle_t handle = handles_.allocate(file);
+        if (!handle)
+            io_free(file);
+        return handle;
     }
 
     return 0;
@@ -277,10 +335,10 @@ int io_close(handle_t file)
 {
     if (file)
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
+        _file *rfile = handles_.release(file);
+        if (!rfile)
+            return -1;
         io_free(rfile);
-        atomic_set(handles_ + file - HANDLE_OFFSET, 0);
     }
 
     return 0;
@@ -290,50 +348,111 @@ int io_write(handle_t file, const uint8_t *buffer, size_t len)
 {
     try
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-        /* clang-format off */
-        DEFINE_WRITE_PROXY(uart_driver)
-        else DEFINE_WRITE_PROXY(i2c_device_driver)
-        else DEFINE_WRITE_PROXY(spi_device_driver)
-        else DEFINE_WRITE_PROXY(filesystem_file)
-        else DEFINE_WRITE_PROXY(network_socket)
-        else
+        _file *rfile = io_get_file(file);
+        switch (rfile->kind)
         {
+            DEFINE_WRITE_PROXY(uart_driver)
+            DEFINE_WRITE_PROXY(i2c_device_driver)
+            DEFINE_WRITE_PROXY(spi_device_driver)
+            DEFINE_WRITE_PROXY(filesystem_file)
+            DEFINE_WRITE_PROXY(network_socket)
+        default:
             return -1;
         }
-        /* clang-format on */
     }
     CATCH_ALL;
 }
 
-int io_control(handle_t file, uint32_t control_code, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len)
+static gsl::span<const io_vec_t> io_get_buffers(const io_vec_t *iov, int iovcnt)
+{
+    if (iovcnt < 0 || (iovcnt && !iov))
+        throw errno_exception("Invalid buffers.", EINVAL);
+    return { iov, std::ptrdiff_t(iovcnt) };
+}
+
+int io_readv(handle_t file, const io_vec_t *iov, int iovcnt)
+{
+    try
+    {
+        _file *rfile = io_get_file(file);
+        auto buffers = io_get_buffers(iov, iovcnt);
+        switch (rfile->kind)
+        {
+            DEFINE_READV_EACH(uart_driver)
+            DEFINE_READV_EACH(i2c_device_driver)
+            DEFINE_READV_PROXY(spi_device_driver)
+            DEFINE_READV_PROXY(filesystem_file)
+            DEFINE_READV_PROXY(network_socket)
+        default:
+            return -1;
+        }
+    }
+    CATCH_ALL;
+}
+
+int io_writev(handle_t file, const io_vec_t *iov, int iovcnt)
 {
     try
     {
-        configASSERT(file >= HANDLE_OFFSET);
-        _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-        DEFINE_CONTROL_PROXY(custom)
-        else
+        _file *rfile = io_get_file(file);
+        auto buffers = io_get_buffers(iov, iovcnt);
+        switch (rfile->kind)
         {
+            DEFINE_WRITEV_EACH(uart_driver)
+            DEFINE_WRITEV_EACH(i2c_device_driver)
+            DEFINE_WRITEV_PROXY(spi_device_driver)
+            DEFINE_WRITEV_PROXY(filesystem_file)
+            DEFINE_WRITEV_PROXY(network_socket)
+        default:
             return -1;
         }
     }
     CATCH_ALL;
+}
+
+int io_submit_native(io_request_t *request)
+{
+    try
+    {
+        _file *rfile = io_get_file(request->file);
+        switch (rfile->kind)
+        {
+            DEFINE_SUBMIT_ASYNC_PROXY(uart_driver)
+            DEFINE_SUBMIT_ASYNC_PROXY(i2c_device_driver)
+            DEFINE_SUBMIT_ASYNC_PROXY(spi_device_driver)
+        default:
+            return 0;
+        }
+    }
+    catch (errno_exception &)
+    {
+        /* The worker runs it and reports the error */
+        return 0;
+    }
+}
+
+int io_control(handle_t file, uint32_t control_code, const uint8_t *write_buffer, size_t write_len, uint8_t *read_buffer, size_t read_len)
+{
+    try
+    {
+        _file *rfile = io_get_file(file);
+        if (!rfile->custom)
+            return -1;
+        return (int)rfile->custom->control(control_code, { write_buffer, std::ptrdiff_t(write_len) }, { read_buffer, std::ptrdiff_t(read_len) });
+    }
+    CATCH_ALL;
     
 }
 
 /* Device IO Implementation Helper Macros */
 
 #define COMMON_ENTRY(t)                                     \
-    configASSERT(file >= HANDLE_OFFSET);                    \
-    _file *rfile = (_file *)handles_[file - HANDLE_OFFSET]; \
+    _file *rfile = handles_.get(file);                      \
     configASSERT(rfile && rfile->object.is<t##_driver>());  \
     auto t = rfile->object.as<t##_driver>();
 
 #define COMMON_ENTRY_FILE(file, t)                          \
-    configASSERT(file >= HANDLE_OFFSET);                    \
-    _file *rfile = (_file *)handles_[file - HANDLE_OFFSET]; \
+    _file *rfile = handles_.get(file);                      \
     configASSERT(rfile && rfile->object.is<t##_driver>());  \
     auto t = rfile->object.as<t##_driver>();
 
@@ -853,7 +972,7 @@ static void init_dma_system()
 
 void install_hal()
 {
-    uxCPUClockRate = sysctl_clock_get_freq(SYSCTL_CLOCK_CPU);
+    vPortSetCPUClock(sysctl_clock_get_freq(SYSCTL_CLOCK_CPU));
     install_hal_drivers();
     pic_file_ = io_open("/dev/pic0");
     configASSERT(pic_file_);
@@ -876,6 +995,12 @@ void pic_set_irq_priority(uint32_t irq, uint32_t priority)
     pic->set_irq_priority(irq, priority);
 }
 
+void pic_set_irq_affinity(uint32_t irq, uint32_t core_mask)
+{
+    COMMON_ENTRY_FILE(pic_file_, pic);
+    pic->set_irq_affinity(irq, core_mask);
+}
+
 void pic_set_irq_handler(uint32_t irq, pic_irq_handler_t handler, void *userdata)
 {
     atomic_set(pic_context_.callback_userdata + irq, userdata);
@@ -943,6 +1068,12 @@ void dma_transmit_async(handle_t file, const volatile void *src, volatile void *
     dma->transmit_async(src, dest, src_inc, dest_inc, element_size, count, burst_size, completion_event);
 }
 
+void dma_transmit_notify(handle_t file, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size, dma_completion_handler_t completion_handler, void *userdata)
+{
+    COMMON_ENTRY(dma);
+    dma->transmit_async(src, dest, src_inc, dest_inc, element_size, count, burst_size, completion_handler, userdata);
+}
+
 void dma_transmit(handle_t file, const volatile void *src, volatile void *dest, bool src_inc, bool dest_inc, size_t element_size, size_t count, size_t burst_size)
 {
     SemaphoreHandle_t event = xSemaphoreCreateBinary();
@@ -1003,11 +1134,9 @@ handle_t sys::system_alloc_handle(object_accessor<object_access> object)
 
 object_accessor<object_access> &sys::system_handle_to_object(handle_t file)
 {
-    if (file < HANDLE_OFFSET)
+    _file *rfile = handles_.get(file);
+    if (!rfile)
         throw std::invalid_argument("Invalid handle.");
-
-    _file *rfile = (_file *)handles_[file - HANDLE_OFFSET];
-    configASSERT(rfile);
     return rfile->object;
 }
 
@@ -1015,7 +1144,7 @@ uint32_t system_set_cpu_frequency(uint32_t frequency)
 {
     uint32_t divider = (sysctl->clk_sel0.aclk_divider_sel + 1) * 2;
     uint32_t result = sysctl_pll_set_freq(SYSCTL_PLL0, divider * frequency) / divider;
-    uxCPUClockRate = result;
+    vPortSetCPUClock(result);
     uarths_init();
     return result;
 }
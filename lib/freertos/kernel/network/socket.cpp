@@ -15,6 +15,7 @@
 #include "FreeRTOS.h"
 #include "devices.h"
 #include "kernel/driver_impl.hpp"
+#include "kernel/object_pool.hpp"
 #include "network.h"
 #include <lwip/sockets.h>
 #include <lwip/errno.h>
@@ -22,6 +23,11 @@
 
 using namespace sys;
 
+/* lwIP can't have more sockets open than netconns */
+#ifndef CONFIG_SOCKET_POOL_SIZE
+#define CONFIG_SOCKET_POOL_SIZE MEMP_NUM_NETCONN
+#endif
+
 static void check_lwip_error(int result)
 {
     if (result < 0)
@@ -53,7 +59,18 @@ static void to_sys_sockaddr(socket_address_t &addr, const sockaddr_in &socket_ad
     *reinterpret_cast<uint16_t *>(addr.data + 4) = ntohs(socket_addr.sin_port);
 }
 
-class k_network_socket : public network_socket, public heap_object, public exclusive_object_access
+static_assert(sizeof(io_vec_t) == sizeof(iovec) && offsetof(io_vec_t, base) == offsetof(iovec, iov_base)
+        && offsetof(io_vec_t, len) == offsetof(iovec, iov_len),
+    "io_vec_t must match struct iovec.");
+
+static const iovec *to_lwip_iovec(gsl::span<const io_vec_t> buffers)
+{
+    if (buffers.size() > IOV_MAX)
+        throw errno_exception("Too many buffers.", EINVAL);
+    return reinterpret_cast<const iovec *>(buffers.data());
+}
+
+class k_network_socket : public network_socket, public heap_object, public exclusive_object_access, public pooled_object<k_network_socket, CONFIG_SOCKET_POOL_SIZE>
 {
 public:
     k_network_socket(address_family_t address_family, socket_type_t type, protocol_type_t protocol)
@@ -267,6 +284,20 @@ public:
         return ret;
     }
 
+    virtual size_t readv(gsl::span<const io_vec_t> buffers) override
+    {
+        auto ret = lwip_readv(sock_, to_lwip_iovec(buffers), buffers.size());
+        check_lwip_error(ret);
+        return ret;
+    }
+
+    virtual size_t writev(gsl::span<const io_vec_t> buffers) override
+    {
+        auto ret = lwip_writev(sock_, to_lwip_iovec(buffers), buffers.size());
+        check_lwip_error(ret);
+        return ret;
+    }
+
     virtual int fcntl(int cmd, int val) override
     {
         auto ret = lwip_fcntl(sock_, cmd, val);
@@ -16,6 +16,7 @@
 #include "FreeRTOS.h"
 #include "devices.h"
 #include "kernel/driver_impl.hpp"
+#include "kernel/object_pool.hpp"
 #include <array>
 #include <cstring>
 #include <diskio.h>
@@ -25,6 +26,10 @@ using namespace sys;
 
 #define MAX_FILE_SYSTEMS 16
 
+#ifndef CONFIG_FS_FILE_POOL_SIZE
+#define CONFIG_FS_FILE_POOL_SIZE 8
+#endif
+
 static void check_fatfs_error(FRESULT result)
 {
     static const char *err_str[] = {
@@ -106,7 +111,7 @@ private:
 
 std::array<object_ptr<k_filesystem>, MAX_FILE_SYSTEMS> k_filesystem::filesystems_;
 
-class k_filesystem_file : public filesystem_file, public heap_object, public exclusive_object_access
+class k_filesystem_file : public filesystem_file, public heap_object, public exclusive_object_access, public pooled_object<k_filesystem_file, CONFIG_FS_FILE_POOL_SIZE>
 {
 public:
     k_filesystem_file(const char *fileName, file_access_t file_access, file_mode_t file_mode)
@@ -159,6 +164,30 @@ public:
         return written;
     }
 
+    virtual size_t readv(gsl::span<const io_vec_t> buffers) override
+    {
+        size_t total = 0;
+        for (auto &vec : buffers)
+        {
+            UINT read = vec.len;
+            check_fatfs_error(f_read(&file_, vec.base, read, &read));
+            total += read;
+            /* End of file */
+            if (read != vec.len)
+                break;
+        }
+
+        return total;
+    }
+
+    virtual size_t writev(gsl::span<const io_vec_t> buffers) override
+    {
+        size_t total = 0;
+        for (auto &vec : buffers)
+            total += write({ reinterpret_cast<const uint8_t *>(vec.base), std::ptrdiff_t(vec.len) });
+        return total;
+    }
+
     virtual fpos_t get_position() override
     {
         return f_tell(&file_);
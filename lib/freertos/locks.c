@@ -2,164 +2,359 @@
 #include "portmacro.h"
 #include "semphr.h"
 #include "task.h"
+#include <atomic.h>
+#include <core_sync.h>
+#include <encoding.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/lock.h>
 
+/*
+ * A lock is a single word, 0 while unlocked:
+ *   bits 0-31   owner, the low 32 bits of its TCB address (LOCK_ISR_OWNER in ISR)
+ *   bits 32-62  extra recursion depth of recursive locks
+ *   bit  63     LOCK_WAITERS, some task may sleep on the lock
+ *
+ * Uncontended acquire and release are one CAS and one swap, no kernel call.
+ * Contended tasks spin briefly, then queue on a hashed wait bucket and sleep
+ * on a binary semaphore of their own, so task notifications stay free for the
+ * application. The releaser only takes the bucket lock when it swapped out
+ * LOCK_WAITERS, and wakes the first waiter of the lock, through a core_sync
+ * doorbell when the waiter lives on the other core.
+ *
+ * A woken waiter always takes the lock with LOCK_WAITERS set, or queues again
+ * and sets it, so waiters still queued behind it are never forgotten.
+ *
+ * While LOCK_WAITERS is set the lock counts as a mutex held by its task owner,
+ * so waiters boost the owner through xTaskPriorityInherit and the owner drops
+ * back through xTaskPriorityDisinherit on release, as with a kernel mutex.
+ */
+
 typedef long _lock_t;
-static void lock_init_generic(_lock_t *lock, uint8_t mutex_type)
+
+#define LOCK_OWNER_MASK 0xFFFFFFFFL
+#define LOCK_DEPTH_ONE (1L << 32)
+#define LOCK_DEPTH_MASK (0x7FFFFFFFL << 32)
+#define LOCK_WAITERS ((_lock_t)(1UL << 63))
+
+/* TCBs are aligned, so no task can own the lock as 1 */
+#define LOCK_ISR_OWNER 1L
+
+/* Tries before a contended task goes to sleep, the owner may be running on the other core */
+#define LOCK_SPIN_COUNT 64
+
+#define LOCK_WAIT_BUCKETS 16
+
+typedef struct _lock_waiter lock_waiter_t;
+
+struct _lock_waiter
 {
-    portENTER_CRITICAL();
-    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
-    {
-        /* nothing to do until the scheduler is running */
-        portEXIT_CRITICAL();
-        return;
-    }
+    lock_waiter_t *next;
+    _lock_t *lock;
+    TaskHandle_t task;
+    SemaphoreHandle_t wake;
+    core_sync_doorbell_t bell;
+};
 
-    if (!*lock)
-    {
-        xSemaphoreHandle new_sem = xQueueCreateMutex(mutex_type);
-        if (!new_sem)
-            abort();
-        *lock = (_lock_t)new_sem;
-    }
+typedef struct _lock_bucket
+{
+    spinlock_t lock;
+    lock_waiter_t *head;
+} lock_bucket_t;
 
-    portEXIT_CRITICAL();
+static lock_bucket_t s_lock_buckets[LOCK_WAIT_BUCKETS] = {
+    [0 ... LOCK_WAIT_BUCKETS - 1] = { .lock = SPINLOCK_INIT, .head = NULL }
+};
+
+static void lock_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken);
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
 }
 
-void _lock_init(_lock_t *lock)
+static inline void irq_restore(uintptr_t flags)
 {
-    *lock = 0;
-    lock_init_generic(lock, queueQUEUE_TYPE_MUTEX);
+    set_csr(mstatus, flags & MSTATUS_MIE);
 }
 
-void _lock_init_recursive(_lock_t *lock)
+static inline lock_bucket_t *lock_bucket(_lock_t *lock)
 {
-    *lock = 0;
-    lock_init_generic(lock, queueQUEUE_TYPE_RECURSIVE_MUTEX);
+    return &s_lock_buckets[((uintptr_t)lock / sizeof(_lock_t)) % LOCK_WAIT_BUCKETS];
 }
 
-void _lock_close(_lock_t *lock)
+static inline _lock_t lock_self(void)
+{
+    return (_lock_t)(uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+}
+
+/* Wake a dequeued waiter on the core that holds it, interrupts must be masked.
+ * The waiter may return as soon as it is given, so it is not touched after. */
+static void lock_notify(lock_waiter_t *waiter, BaseType_t *higher_priority_task_woken)
 {
-    portENTER_CRITICAL();
-    if (*lock)
+    UBaseType_t core_id = uxTaskProcessorIdGet(waiter->task);
+
+    if (core_id == uxPortGetProcessorId())
+    {
+        xSemaphoreGiveFromISR(waiter->wake, higher_priority_task_woken);
+    }
+    else
     {
-        xSemaphoreHandle h = (xSemaphoreHandle)(*lock);
-        configASSERT(xSemaphoreGetMutexHolder(h) == NULL);
-        vSemaphoreDelete(h);
-        *lock = 0;
+        core_sync_ring_doorbell(core_id, &waiter->bell);
     }
+}
 
-    portEXIT_CRITICAL();
+static void lock_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken)
+{
+    lock_waiter_t *waiter = (lock_waiter_t *)((uint8_t *)bell - offsetof(lock_waiter_t, bell));
+
+    /* The waiter may have moved since the doorbell was rung, notify forwards it */
+    lock_notify(waiter, higher_priority_task_woken);
 }
 
-void _lock_close_recursive(_lock_t *lock) __attribute__((alias("_lock_close")));
+static void lock_wake(_lock_t *lock, int disinherit)
+{
+    lock_bucket_t *bucket = lock_bucket(lock);
+    lock_waiter_t *waiter = NULL;
+    lock_waiter_t **link;
+    BaseType_t higher_priority_task_woken = pdFALSE;
+
+    uintptr_t flags = irq_save();
+    spinlock_lock(&bucket->lock);
+    for (link = &bucket->head; *link; link = &(*link)->next)
+    {
+        if ((*link)->lock == lock)
+        {
+            waiter = *link;
+            *link = waiter->next;
+            break;
+        }
+    }
+
+    spinlock_unlock(&bucket->lock);
+    if (waiter)
+        lock_notify(waiter, &higher_priority_task_woken);
+    irq_restore(flags);
 
-static int lock_acquire_generic(_lock_t *lock, uint32_t delay, uint8_t mutex_type)
+    if (disinherit)
+    {
+        taskENTER_CRITICAL();
+        if (xTaskPriorityDisinherit(xTaskGetCurrentTaskHandle()))
+            higher_priority_task_woken = pdTRUE;
+        taskEXIT_CRITICAL();
+    }
+
+    if (higher_priority_task_woken)
+    {
+        if (uxPortIsInISR())
+            portYIELD_FROM_ISR();
+        else
+            portYIELD();
+    }
+}
+
+static void lock_wait(_lock_t *lock, _lock_t self)
 {
-    xSemaphoreHandle h = (xSemaphoreHandle)(*lock);
-    if (!h)
+    lock_bucket_t *bucket = lock_bucket(lock);
+    StaticSemaphore_t wake;
+    lock_waiter_t waiter = {
+        .next = NULL,
+        .lock = lock,
+        .task = xTaskGetCurrentTaskHandle(),
+        .wake = xSemaphoreCreateBinaryStatic(&wake),
+        .bell = CORE_SYNC_DOORBELL_INIT(lock_doorbell)
+    };
+
+    for (;;)
     {
-        if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
-            return 0; /* locking is a no-op before scheduler is up, so this "succeeds" */
+        int acquired = 0, queued = 0;
+
+        /* Critical before the bucket lock, inheritance moves the owner between ready lists */
+        taskENTER_CRITICAL();
+        spinlock_lock(&bucket->lock);
+        _lock_t word = atomic_read(lock);
+        if (!word)
+        {
+            acquired = atomic_cas(lock, 0, self | LOCK_WAITERS) == 0;
+            if (acquired)
+                pvTaskIncrementMutexHeldCount();
+        }
+        else
+        {
+            /* RAM sits below 4 GiB, so the low 32 bits give the owner TCB back */
+            _lock_t owner = word & LOCK_OWNER_MASK;
+
+            if (!(word & LOCK_WAITERS))
+            {
+                queued = atomic_cas(lock, word, word | LOCK_WAITERS) == word;
+                /* The owner swaps LOCK_WAITERS out on release and needs the bucket lock after */
+                if (queued && owner != LOCK_ISR_OWNER)
+                    vTaskIncrementMutexHeldCountOf((TaskHandle_t)(uintptr_t)owner);
+            }
+            else
+            {
+                queued = 1;
+            }
+
+            if (queued)
+            {
+                lock_waiter_t **link = &bucket->head;
+                while (*link)
+                    link = &(*link)->next;
+                waiter.next = NULL;
+                *link = &waiter;
+                if (owner != LOCK_ISR_OWNER)
+                    xTaskPriorityInherit((TaskHandle_t)(uintptr_t)owner);
+            }
+        }
+
+        spinlock_unlock(&bucket->lock);
+        taskEXIT_CRITICAL();
 
-        lock_init_generic(lock, mutex_type);
-        h = (xSemaphoreHandle)(*lock);
-        configASSERT(h != NULL);
+        if (acquired)
+            break;
+        if (queued)
+            xSemaphoreTake(waiter.wake, portMAX_DELAY);
     }
 
-    BaseType_t success;
+    vSemaphoreDelete(waiter.wake);
+}
+
+void _lock_init(_lock_t *lock)
+{
+    *lock = 0;
+}
+
+void _lock_init_recursive(_lock_t *lock) __attribute__((alias("_lock_init")));
+
+void _lock_close(_lock_t *lock)
+{
+    configASSERT((atomic_read(lock) & LOCK_OWNER_MASK) == 0);
+    *lock = 0;
+}
+
+void _lock_close_recursive(_lock_t *lock) __attribute__((alias("_lock_close")));
+
+static int lock_acquire_generic(_lock_t *lock, int wait, int recursive)
+{
     if (uxPortIsInISR())
     {
         /* In ISR Context */
-        if (mutex_type == queueQUEUE_TYPE_RECURSIVE_MUTEX)
+        if (recursive)
         {
             vPortDebugBreak();
             abort(); /* recursive mutexes make no sense in ISR context */
         }
 
-        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-        success = xSemaphoreTakeFromISR(h, &xHigherPriorityTaskWoken);
-        if (!success && delay > 0)
+        if (atomic_cas(lock, 0, LOCK_ISR_OWNER) == 0)
+            return 0;
+
+        if (wait)
         {
             vPortDebugBreak();
             abort(); /* Tried to block on mutex from ISR, couldn't... rewrite your program to avoid libc interactions in ISRs! */
         }
 
-        if (xHigherPriorityTaskWoken)
-            portYIELD_FROM_ISR();
+        return -1;
     }
-    else
+
+    _lock_t self = lock_self();
+    _lock_t word = atomic_cas(lock, 0, self);
+    if (!word)
+        return 0;
+
+    if (recursive && (word & LOCK_OWNER_MASK) == self)
     {
-        if (mutex_type == queueQUEUE_TYPE_RECURSIVE_MUTEX)
-            success = xSemaphoreTakeRecursive(h, delay);
-        else
-            success = xSemaphoreTake(h, delay);
+        /* Only the owner changes the depth, but waiters may set LOCK_WAITERS meanwhile */
+        for (;;)
+        {
+            configASSERT((word & LOCK_DEPTH_MASK) != LOCK_DEPTH_MASK);
+            _lock_t old = atomic_cas(lock, word, word + LOCK_DEPTH_ONE);
+            if (old == word)
+                return 0;
+            word = old;
+        }
     }
 
-    return (success == pdTRUE) ? 0 : -1;
+    if (!wait)
+        return -1;
+
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
+        return 0; /* locking is a no-op before scheduler is up, so this "succeeds" */
+
+    for (int i = 0; i < LOCK_SPIN_COUNT; i++)
+    {
+        if (!atomic_read(lock) && atomic_cas(lock, 0, self) == 0)
+            return 0;
+    }
+
+    lock_wait(lock, self);
+    return 0;
 }
 
 void _lock_acquire(_lock_t *lock)
 {
-    lock_acquire_generic(lock, 200, queueQUEUE_TYPE_MUTEX);
+    lock_acquire_generic(lock, 1, 0);
 }
 
 void _lock_acquire_recursive(_lock_t *lock)
 {
-    lock_acquire_generic(lock, 200, queueQUEUE_TYPE_RECURSIVE_MUTEX);
+    lock_acquire_generic(lock, 1, 1);
 }
 
 int _lock_try_acquire(_lock_t *lock)
 {
-    return lock_acquire_generic(lock, 0, queueQUEUE_TYPE_MUTEX);
+    return lock_acquire_generic(lock, 0, 0);
 }
 
 int _lock_try_acquire_recursive(_lock_t *lock)
 {
-    return lock_acquire_generic(lock, 0, queueQUEUE_TYPE_RECURSIVE_MUTEX);
+    return lock_acquire_generic(lock, 0, 1);
 }
 
-static void lock_release_generic(_lock_t *lock, uint8_t mutex_type)
+static void lock_release_generic(_lock_t *lock, int recursive)
 {
-    xSemaphoreHandle h = (xSemaphoreHandle)(*lock);
-    if (h == NULL)
-    {
-        return;
-    }
+    _lock_t self;
 
     if (uxPortIsInISR())
     {
-        if (mutex_type == queueQUEUE_TYPE_RECURSIVE_MUTEX)
+        if (recursive)
         {
             vPortDebugBreak();
             abort(); /* recursive mutexes make no sense in ISR context */
         }
 
-        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-        xSemaphoreGiveFromISR(h, &xHigherPriorityTaskWoken);
-        if (xHigherPriorityTaskWoken)
-            portYIELD_FROM_ISR();
+        self = LOCK_ISR_OWNER;
     }
     else
     {
-        if (mutex_type == queueQUEUE_TYPE_RECURSIVE_MUTEX)
-        {
-            xSemaphoreGiveRecursive(h);
-        }
-        else
-        {
-            xSemaphoreGive(h);
-        }
+        self = lock_self();
+    }
+
+    _lock_t word = atomic_read(lock);
+    if ((word & LOCK_OWNER_MASK) != self)
+        return; /* not ours, e.g. taken while locking was a no-op */
+
+    while (word & LOCK_DEPTH_MASK)
+    {
+        _lock_t old = atomic_cas(lock, word, word - LOCK_DEPTH_ONE);
+        if (old == word)
+            return;
+        word = old;
     }
+
+    /* The swap only orders what follows it, publish the critical section first */
+    mb();
+    if (atomic_swap(lock, 0) & LOCK_WAITERS)
+        lock_wake(lock, self != LOCK_ISR_OWNER);
 }
 
 void _lock_release(_lock_t *lock)
 {
-    lock_release_generic(lock, queueQUEUE_TYPE_MUTEX);
+    lock_release_generic(lock, 0);
 }
 
 void _lock_release_recursive(_lock_t *lock)
 {
-    lock_release_generic(lock, queueQUEUE_TYPE_RECURSIVE_MUTEX);
+    lock_release_generic(lock, 1);
 }
@@ -16,6 +16,7 @@
 #include "core_sync.h"
 #include "kernel/device_priv.h"
 #include "task.h"
+#include "workqueue.h"
 #include <clint.h>
 #include <encoding.h>
 #include <fpioa.h>
@@ -30,6 +31,7 @@ typedef struct
 
 extern void __libc_init_array(void);
 extern void __libc_fini_array(void);
+extern void malloc_cache_idle(void);
 
 static StaticTask_t s_idle_task[portNUM_PROCESSORS];
 static StackType_t s_idle_task_stack[portNUM_PROCESSORS][configMINIMAL_STACK_SIZE];
@@ -51,6 +53,11 @@ static void main_thunk(void *p)
     __libc_init_array();
 
     install_hal();
+    /* Drivers queue work from their ISRs */
+    if (work_queue_init() != 0)
+        configASSERT(!"Failed to start the work queues");
+    if (io_async_init() != 0)
+        configASSERT(!"Failed to create the I/O request queue");
     install_drivers();
     configure_fpioa();
 
@@ -89,6 +96,7 @@ int os_entry(int (*user_main)(int, char **))
 
 void vApplicationIdleHook(void)
 {
+    malloc_cache_idle();
 }
 
 void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer, StackType_t **ppxIdleTaskStackBuffer, uint32_t *pulIdleTaskStackSize)
@@ -0,0 +1,347 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include <atomic.h>
+#include <core_sync.h>
+#include <encoding.h>
+#include <parallel.h>
+#include <stddef.h>
+
+/*
+ * Each core has a deque of ranges. A task running a range keeps the lower
+ * half and pushes the upper half to the bottom of its core's deque until
+ * the range is down to the grain, so the top of a deque holds the largest
+ * pieces and is where the other cores steal from. The deques are short and
+ * only ever touched by two cores, a spinlock is cheaper than a lock-free
+ * deque's fences here.
+ *
+ * A loop is done when its remaining iteration count drops to 0. The job lives
+ * on the stack of the task that called parallel_for. When another task takes
+ * the count to 0 it notifies that waiter, through a core_sync doorbell when
+ * the waiter lives on the other core, and setting notified right before the
+ * notification is its last access to the job. The waiter only returns once
+ * it ended the loop itself or saw notified.
+ */
+
+/* Empty polls before a waiting parallel_for sleeps until notified, the ranges
+ * it waits for are running on the other core and end within a grain */
+#define PARALLEL_SPIN_COUNT 1000
+
+typedef struct _parallel_job
+{
+    parallel_for_fn_t fn;
+    void *userdata;
+    size_t grain;
+    volatile size_t remaining;
+    TaskHandle_t waiter;
+    volatile int notified;
+    core_sync_doorbell_t doorbell;
+} parallel_job_t;
+
+typedef struct _parallel_range
+{
+    parallel_job_t *job;
+    size_t begin;
+    size_t end;
+} parallel_range_t;
+
+typedef struct _parallel_deque
+{
+    spinlock_t lock;
+    /* Steal from top, push and pop at bottom */
+    volatile size_t top;
+    volatile size_t bottom;
+    parallel_range_t ranges[PARALLEL_DEQUE_SIZE];
+} parallel_deque_t;
+
+typedef struct _parallel_worker
+{
+    TaskHandle_t task;
+    volatile int idle;
+    core_sync_doorbell_t doorbell;
+} parallel_worker_t;
+
+static void parallel_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken);
+static void parallel_job_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken);
+
+/* 0 not started, 1 starting, 2 running, 3 failed */
+static volatile int s_parallel_state;
+static parallel_deque_t s_parallel_deques[portNUM_PROCESSORS];
+static parallel_worker_t s_parallel_workers[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = { .task = NULL, .idle = 0, .doorbell = CORE_SYNC_DOORBELL_INIT(parallel_doorbell) }
+};
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+    set_csr(mstatus, flags & MSTATUS_MIE);
+}
+
+static int parallel_push(const parallel_range_t *range)
+{
+    uintptr_t flags = irq_save();
+    parallel_deque_t *deque = &s_parallel_deques[uxPortGetProcessorId()];
+    int pushed = 0;
+
+    spinlock_lock(&deque->lock);
+    if (deque->bottom - deque->top < PARALLEL_DEQUE_SIZE)
+    {
+        deque->ranges[deque->bottom % PARALLEL_DEQUE_SIZE] = *range;
+        deque->bottom++;
+        pushed = 1;
+    }
+
+    spinlock_unlock(&deque->lock);
+    irq_restore(flags);
+    return pushed;
+}
+
+/* Pop the newest range of this core, else steal the oldest of another */
+static int parallel_take(parallel_range_t *range)
+{
+    uintptr_t flags = irq_save();
+    UBaseType_t core_id = uxPortGetProcessorId();
+    int taken = 0;
+
+    for (UBaseType_t i = 0; i < portNUM_PROCESSORS && !taken; i++)
+    {
+        UBaseType_t victim = (core_id + i) % portNUM_PROCESSORS;
+        parallel_deque_t *deque = &s_parallel_deques[victim];
+
+        if (atomic_read(&deque->bottom) == atomic_read(&deque->top))
+            continue;
+
+        spinlock_lock(&deque->lock);
+        if (deque->bottom != deque->top)
+        {
+            if (victim == core_id)
+                *range = deque->ranges[--deque->bottom % PARALLEL_DEQUE_SIZE];
+            else
+                *range = deque->ranges[deque->top++ % PARALLEL_DEQUE_SIZE];
+            taken = 1;
+        }
+
+        spinlock_unlock(&deque->lock);
+    }
+
+    irq_restore(flags);
+    return taken;
+}
+
+static int parallel_has_work(void)
+{
+    for (UBaseType_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        if (atomic_read(&s_parallel_deques[i].bottom) != atomic_read(&s_parallel_deques[i].top))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Wake the idle workers of the other cores to steal */
+static void parallel_wake_workers(void)
+{
+    UBaseType_t core_id = uxPortGetProcessorId();
+
+    mb();
+    for (UBaseType_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        parallel_worker_t *worker = &s_parallel_workers[i];
+        if (i != core_id && atomic_read(&worker->idle) && atomic_swap(&worker->idle, 0))
+            core_sync_ring_doorbell(i, &worker->doorbell);
+    }
+}
+
+static void parallel_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken)
+{
+    parallel_worker_t *worker = (parallel_worker_t *)((uint8_t *)bell - offsetof(parallel_worker_t, doorbell));
+
+    vTaskNotifyGiveFromISR(worker->task, higher_priority_task_woken);
+}
+
+/* Wake the waiter of an ended job on the core that holds it, interrupts must be masked */
+static void parallel_notify(parallel_job_t *job, BaseType_t *higher_priority_task_woken)
+{
+    TaskHandle_t waiter = job->waiter;
+    UBaseType_t core_id = uxTaskProcessorIdGet(waiter);
+
+    if (core_id == uxPortGetProcessorId())
+    {
+        /* The waiter may return as soon as it sees notified, the job is not touched after */
+        atomic_set(&job->notified, 1);
+        vTaskNotifyGiveFromISR(waiter, higher_priority_task_woken);
+    }
+    else
+    {
+        core_sync_ring_doorbell(core_id, &job->doorbell);
+    }
+}
+
+static void parallel_job_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken)
+{
+    parallel_job_t *job = (parallel_job_t *)((uint8_t *)bell - offsetof(parallel_job_t, doorbell));
+
+    /* The waiter may have moved since the doorbell was rung, notify forwards it */
+    parallel_notify(job, higher_priority_task_woken);
+}
+
+/* Returns 1 if the calling task ended a loop of its own */
+static int parallel_run(parallel_range_t range)
+{
+    parallel_job_t *job = range.job;
+    int woken = 0;
+
+    while (range.end - range.begin > job->grain)
+    {
+        parallel_range_t upper = { job, range.begin + (range.end - range.begin) / 2, range.end };
+        if (!parallel_push(&upper))
+            break;
+
+        if (!woken)
+        {
+            parallel_wake_workers();
+            woken = 1;
+        }
+
+        range.end = upper.begin;
+    }
+
+    job->fn(range.begin, range.end, job->userdata);
+    size_t count = range.end - range.begin;
+    if (atomic_add(&job->remaining, -count) != count)
+        return 0;
+    if (job->waiter == xTaskGetCurrentTaskHandle())
+        return 1;
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    uintptr_t flags = irq_save();
+    parallel_notify(job, &higher_priority_task_woken);
+    irq_restore(flags);
+    if (higher_priority_task_woken)
+        portYIELD();
+    return 0;
+}
+
+static void parallel_worker_main(void *arg)
+{
+    parallel_worker_t *worker = (parallel_worker_t *)arg;
+    parallel_range_t range;
+
+    while (1)
+    {
+        if (parallel_take(&range))
+        {
+            parallel_run(range);
+            continue;
+        }
+
+        atomic_set(&worker->idle, 1);
+        mb();
+
+        /* A range may have been pushed before the pusher could see us idle */
+        if (!parallel_has_work())
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        /* A wake-up claimed meanwhile only causes one extra loop */
+        atomic_set(&worker->idle, 0);
+    }
+}
+
+int parallel_init(UBaseType_t priority)
+{
+    int state = atomic_cas(&s_parallel_state, 0, 1);
+    if (state != 0)
+    {
+        while (state == 1)
+            state = atomic_read(&s_parallel_state);
+        return state == 2 ? 0 : -1;
+    }
+
+    for (UBaseType_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        parallel_worker_t *worker = &s_parallel_workers[i];
+        if (xTaskCreateAtProcessor(i, parallel_worker_main, "parallel", PARALLEL_WORKER_STACK_DEPTH, worker, priority, &worker->task) != pdPASS)
+        {
+            /* Workers already started stay idle forever */
+            atomic_set(&s_parallel_state, 3);
+            return -1;
+        }
+
+        vTaskCoreAffinitySet(worker->task, (UBaseType_t)1 << i);
+    }
+
+    mb();
+    atomic_set(&s_parallel_state, 2);
+    return 0;
+}
+
+void parallel_for(size_t begin, size_t end, size_t grain, parallel_for_fn_t fn, void *userdata)
+{
+    if (end <= begin)
+        return;
+    if (!grain)
+        grain = 1;
+
+    if (end - begin <= grain || (atomic_read(&s_parallel_state) != 2 && parallel_init(PARALLEL_WORKER_PRIORITY) != 0))
+    {
+        fn(begin, end, userdata);
+        return;
+    }
+
+    parallel_job_t job = {
+        .fn = fn,
+        .userdata = userdata,
+        .grain = grain,
+        .remaining = end - begin,
+        .waiter = xTaskGetCurrentTaskHandle(),
+        .notified = 0,
+        .doorbell = CORE_SYNC_DOORBELL_INIT(parallel_job_doorbell)
+    };
+    parallel_range_t range = { &job, begin, end };
+    size_t spins = 0;
+    int done = parallel_run(range);
+
+    /* Help with whatever is queued, our own ranges or anyone else's, while
+     * the other cores run the ranges they took from us */
+    while (!done && atomic_read(&job.remaining) && spins < PARALLEL_SPIN_COUNT)
+    {
+        if (parallel_take(&range))
+        {
+            done = parallel_run(range) && range.job == &job;
+            spins = 0;
+        }
+        else
+        {
+            spins++;
+        }
+    }
+
+    /* The task ending the loop notifies us, and once it set notified it no
+     * longer touches the job. Each take consumes one notification */
+    if (!done)
+    {
+        do
+            ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+        while (!atomic_read(&job.notified));
+    }
+
+    mb();
+}
@@ -46,6 +46,7 @@
 /* Scheduler includes. */
 #include "FreeRTOS.h"
 #include "core_sync.h"
+#include "hrtimer.h"
 #include "portmacro.h"
 #include "task.h"
 #include <atomic.h>
@@ -69,6 +70,14 @@ PRIVILEGED_DATA static corelock_t xCoreLock = CORELOCK_INIT;
 
 UBaseType_t uxCPUClockRate = 390000000;
 
+/* mtime of the next tick of each core, mtimecmp may fire earlier for hrtimers.
+ * Each core updates its own, vPortSetCPUClock rescales all of them, so both
+ * sides go through xTickTimeLock along with the mtimecmp write. */
+static uint64_t ullNextTickTime[portNUM_PROCESSORS];
+static spinlock_t xTickTimeLock = SPINLOCK_INIT;
+
+static TicklessStats_t xTicklessStats[portNUM_PROCESSORS];
+
 /* Contains context when starting scheduler, save all 31 registers */
 #ifdef __gracefulExit
 #error Not ported
@@ -90,6 +99,15 @@ void vPortSetupTimer(void);
  */
 static void prvTaskExitError(void);
 
+/* Same as vPortUpdateTimerInterrupt with xTickTimeLock held */
+static void prvUpdateTimerInterruptLocked(UBaseType_t uxPsrId)
+{
+    uint64_t ullNext = ullNextTickTime[uxPsrId];
+    uint64_t ullTimer = hrtimer_next_expiry();
+
+    clint->mtimecmp[uxPsrId] = ullTimer < ullNext ? ullTimer : ullNext;
+}
+
 UBaseType_t uxPortGetProcessorId()
 {
     return (UBaseType_t)read_csr(mhartid);
@@ -103,11 +121,24 @@ UBaseType_t uxPortIsInISR()
 /*-----------------------------------------------------------*/
 
 /* Sets the next timer interrupt
- * Reads previous timer compare register, and adds tickrate */
+ * Arms the next tick one tick period from now */
 void prvSetNextTimerInterrupt(void)
 {
     UBaseType_t uxPsrId = uxPortGetProcessorId();
-    clint->mtimecmp[uxPsrId] = clint->mtime + (configTICK_CLOCK_HZ / configTICK_RATE_HZ);
+    spinlock_lock(&xTickTimeLock);
+    ullNextTickTime[uxPsrId] = clint->mtime + (configTICK_CLOCK_HZ / configTICK_RATE_HZ);
+    prvUpdateTimerInterruptLocked(uxPsrId);
+    spinlock_unlock(&xTickTimeLock);
+}
+/*-----------------------------------------------------------*/
+
+/* Programs mtimecmp with the earlier of the next tick and the next hrtimer,
+ * must be called with interrupts disabled */
+void vPortUpdateTimerInterrupt(void)
+{
+    spinlock_lock(&xTickTimeLock);
+    prvUpdateTimerInterruptLocked(uxPortGetProcessorId());
+    spinlock_unlock(&xTickTimeLock);
 }
 /*-----------------------------------------------------------*/
 
@@ -122,15 +153,128 @@ void vPortSetupTimer(void)
 
 void handle_irq_m_timer(uintptr_t *regs, uintptr_t cause)
 {
-    prvSetNextTimerInterrupt();
+    UBaseType_t uxPsrId = uxPortGetProcessorId();
+    uint64_t ullNow = clint->mtime;
+    BaseType_t xSwitchRequired = pdFALSE;
+
+    BaseType_t xTick = pdFALSE;
+
+    hrtimer_handle_irq(ullNow, &xSwitchRequired);
+
+    spinlock_lock(&xTickTimeLock);
+    if (ullNow >= ullNextTickTime[uxPsrId])
+    {
+        /* Keep the tick phase unless whole periods were missed */
+        uint64_t ullPeriod = configTICK_CLOCK_HZ / configTICK_RATE_HZ;
+        ullNextTickTime[uxPsrId] += ullPeriod;
+        if (ullNextTickTime[uxPsrId] <= ullNow)
+            ullNextTickTime[uxPsrId] = ullNow + ullPeriod;
+        xTick = pdTRUE;
+    }
+
+    prvUpdateTimerInterruptLocked(uxPsrId);
+    spinlock_unlock(&xTickTimeLock);
 
-    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
-        return;
     /* Increment the RTOS tick. */
-    if (xTaskIncrementTick() != pdFALSE)
+    if (xTick && xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED && xTaskIncrementTick() != pdFALSE)
+        xSwitchRequired = pdTRUE;
+
+    if (xSwitchRequired != pdFALSE)
         vTaskSwitchContext();
 }
 
+#if (configUSE_TICKLESS_IDLE != 0)
+
+/* Called by the idle task with the scheduler suspended. The next tick is
+ * pushed out to the tick at which the next task unblocks, so the core stays
+ * in WFI until then unless another interrupt or an hrtimer wakes it. */
+void vPortSuppressTicksAndSleep(TickType_t xExpectedIdleTime)
+{
+    UBaseType_t uxPsrId = uxPortGetProcessorId();
+    TicklessStats_t *pxStats = &xTicklessStats[uxPsrId];
+    uint64_t ullPeriod = configTICK_CLOCK_HZ / configTICK_RATE_HZ;
+    uint64_t ullFirstTick, ullWakeTime, ullNow, ullElapsed;
+
+    /* WFI still wakes up on a pending interrupt while MIE is clear, the
+     * handler runs once interrupts are enabled again below */
+    uintptr_t flags = clear_csr(mstatus, MSTATUS_MIE);
+
+    if (eTaskConfirmSleepModeStatus() == eAbortSleep)
+    {
+        pxStats->ulAborts++;
+        if (flags & MSTATUS_MIE)
+            set_csr(mstatus, MSTATUS_MIE);
+        return;
+    }
+
+    /* The tick at xExpectedIdleTime is left to the timer interrupt */
+    spinlock_lock(&xTickTimeLock);
+    ullFirstTick = ullNextTickTime[uxPsrId];
+    ullWakeTime = ullFirstTick + (uint64_t)(xExpectedIdleTime - 1) * ullPeriod;
+    ullNextTickTime[uxPsrId] = ullWakeTime;
+    prvUpdateTimerInterruptLocked(uxPsrId);
+    spinlock_unlock(&xTickTimeLock);
+
+    ullNow = clint->mtime;
+    __asm volatile("wfi");
+    ullElapsed = clint->mtime - ullNow;
+    ullNow += ullElapsed;
+
+    spinlock_lock(&xTickTimeLock);
+    if (ullNextTickTime[uxPsrId] != ullWakeTime)
+    {
+        /* The cpu clock changed while asleep, which also woke us. Account
+         * the ticks that passed at the old rate and tick again one new
+         * period from now. */
+        if (ullNow >= ullFirstTick)
+        {
+            uint64_t ullTicks = (ullNow - ullFirstTick) / ullPeriod + 1;
+            if (ullTicks > (uint64_t)(xExpectedIdleTime - 1))
+                ullTicks = xExpectedIdleTime - 1;
+            vTaskStepTick((TickType_t)ullTicks);
+        }
+
+        ullNextTickTime[uxPsrId] = ullNow + configTICK_CLOCK_HZ / configTICK_RATE_HZ;
+        prvUpdateTimerInterruptLocked(uxPsrId);
+    }
+    else if (ullNow >= ullWakeTime)
+    {
+        pxStats->ullLastWakeLatency = ullNow - ullWakeTime;
+        if (pxStats->ullLastWakeLatency > pxStats->ullMaxWakeLatency)
+            pxStats->ullMaxWakeLatency = pxStats->ullLastWakeLatency;
+        vTaskStepTick(xExpectedIdleTime - 1);
+    }
+    else if (ullNow >= ullFirstTick)
+    {
+        /* Woken early, account the whole ticks that passed and resume the
+         * tick at the next boundary */
+        uint64_t ullTicks = (ullNow - ullFirstTick) / ullPeriod + 1;
+        vTaskStepTick((TickType_t)ullTicks);
+        ullNextTickTime[uxPsrId] = ullFirstTick + ullTicks * ullPeriod;
+        prvUpdateTimerInterruptLocked(uxPsrId);
+    }
+    else
+    {
+        ullNextTickTime[uxPsrId] = ullFirstTick;
+        prvUpdateTimerInterruptLocked(uxPsrId);
+    }
+    spinlock_unlock(&xTickTimeLock);
+
+    pxStats->ulSleeps++;
+    pxStats->ullSleptTime += ullElapsed;
+
+    if (flags & MSTATUS_MIE)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+#endif /* configUSE_TICKLESS_IDLE */
+
+void vPortGetTicklessStats(UBaseType_t uxPsrId, TicklessStats_t *pxStats)
+{
+    configASSERT(uxPsrId < portNUM_PROCESSORS);
+    *pxStats = xTicklessStats[uxPsrId];
+}
+
 void prvTaskExitError(void)
 {
     /* A function that implements a task must not exit or attempt to return to
@@ -179,6 +323,7 @@ StackType_t *pxPortInitialiseStack(StackType_t *pxTopOfStack, TaskFunction_t pxC
     pxTopOfStack[REG_SP] = (portSTACK_TYPE)pxTopOfStack;
     pxTopOfStack[REG_A0] = (portSTACK_TYPE)pvParameters; /* Register a0 */
     pxTopOfStack[REG_EPC] = (portSTACK_TYPE)pxCode; /* Register mepc */
+    pxTopOfStack[REG_FSTATUS] = MSTATUS_FS_INITIAL; /* No FP state to restore yet */
 
     return pxTopOfStack;
 }
@@ -205,7 +350,10 @@ void vPortYield()
 
 void vPortYieldFromISR(void)
 {
+    /* PLIC handlers may run with interrupts enabled when nesting */
+    UBaseType_t uxSavedStatus = clear_csr(mstatus, MSTATUS_MIE);
     vTaskSwitchContext();
+    set_csr(mstatus, uxSavedStatus & MSTATUS_MIE);
 }
 
 void vPortFatal(const char *file, int line, const char *message)
@@ -225,6 +373,48 @@ UBaseType_t uxPortGetCPUClock()
     return uxCPUClockRate;
 }
 
+/* Changes the cpu clock the port counts with. mtime runs from the cpu clock,
+ * so the next tick of every core and the pending hrtimers are rescaled to
+ * keep their remaining time. */
+void vPortSetCPUClock(UBaseType_t uxClockRate)
+{
+    uintptr_t flags = clear_csr(mstatus, MSTATUS_MIE);
+    spinlock_lock(&xTickTimeLock);
+    uint64_t ullNow = clint->mtime;
+    uint64_t ullOldHz = configTICK_CLOCK_HZ;
+    UBaseType_t i;
+
+    uxCPUClockRate = uxClockRate;
+
+    uint64_t ullNewHz = configTICK_CLOCK_HZ;
+    if (ullNewHz != ullOldHz)
+    {
+        for (i = 0; i < portNUM_PROCESSORS; i++)
+        {
+            if (ullNextTickTime[i] > ullNow)
+                ullNextTickTime[i] = ullNow + (ullNextTickTime[i] - ullNow) * ullNewHz / ullOldHz;
+        }
+
+        hrtimer_clock_changed(ullNow, ullOldHz, ullNewHz);
+
+        /* Let every core reprogram its own mtimecmp from the timer interrupt */
+        for (i = 0; i < portNUM_PROCESSORS; i++)
+        {
+            if (ullNextTickTime[i])
+                clint->mtimecmp[i] = ullNow;
+        }
+    }
+
+    spinlock_unlock(&xTickTimeLock);
+    if (flags & MSTATUS_MIE)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+uint32_t ulPortGetRunTimeCounterValue(void)
+{
+    return (uint32_t)(clint->mtime >> portRUN_TIME_COUNTER_SHIFT);
+}
+
 void vPortDebugBreak(void)
 {
     asm volatile("sbreak");
@@ -119,7 +119,26 @@ extern void vPortYieldFromISR(void);
 
 /*-----------------------------------------------------------*/
 
-#define portGET_HIGHEST_PRIORITY( uxTopPriority, uxReadyPriorities ) uxTopPriority = ( 31 - __builtin_clz( ( uxReadyPriorities ) ) )
+/* RV64GC has no count leading zeros instruction and __builtin_clz would end up
+in a libgcc call, so find the highest set bit with a fixed five step search. */
+static inline UBaseType_t uxPortGetHighestPriority( UBaseType_t uxReadyPriorities )
+{
+#if defined( __riscv_zbb )
+    return ( UBaseType_t ) ( 63 - __builtin_clzl( uxReadyPriorities ) );
+#else
+    UBaseType_t uxTopPriority = 0;
+
+    if( uxReadyPriorities & 0xFFFF0000UL ) { uxReadyPriorities >>= 16; uxTopPriority += 16; }
+    if( uxReadyPriorities & 0xFF00UL ) { uxReadyPriorities >>= 8; uxTopPriority += 8; }
+    if( uxReadyPriorities & 0xF0UL ) { uxReadyPriorities >>= 4; uxTopPriority += 4; }
+    if( uxReadyPriorities & 0xCUL ) { uxReadyPriorities >>= 2; uxTopPriority += 2; }
+    if( uxReadyPriorities & 0x2UL ) { uxTopPriority += 1; }
+
+    return uxTopPriority;
+#endif
+}
+
+#define portGET_HIGHEST_PRIORITY( uxTopPriority, uxReadyPriorities ) uxTopPriority = uxPortGetHighestPriority( uxReadyPriorities )
 
 #endif /* configUSE_PORT_OPTIMISED_TASK_SELECTION */
 
@@ -130,17 +149,45 @@ extern void vTaskEnterCritical( void );
 extern void vTaskExitCritical( void );
 extern UBaseType_t uxPortGetProcessorId(void);
 void prvSetNextTimerInterrupt();
+void vPortUpdateTimerInterrupt(void);
 void vPortAddNewTaskToReadyListAsync(UBaseType_t uxPsrId, void* pxNewTaskHandle);
+BaseType_t xPortMigrateTaskToReadyListAsync(UBaseType_t uxPsrId, void* pxTaskHandle);
 
 void vPortEnterCritical(void);
 void vPortExitCritical(void);
 
 UBaseType_t uxPortGetCPUClock(void);
+void vPortSetCPUClock(UBaseType_t uxClockRate);
 UBaseType_t uxPortIsInISR(void);
 void vPortDebugBreak(void);
 
 #define portGET_PROCESSOR_ID() uxPortGetProcessorId()
 
+/* Run time stats count CLINT mtime scaled down, so the 32-bit counters
+last about an hour before they wrap. */
+#define portRUN_TIME_COUNTER_SHIFT				3
+#define portRUN_TIME_COUNTER_HZ					( configTICK_CLOCK_HZ >> portRUN_TIME_COUNTER_SHIFT )
+uint32_t ulPortGetRunTimeCounterValue(void);
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()		ulPortGetRunTimeCounterValue()
+
+/* Tickless idle, the core sleeps in WFI with the tick suppressed until the
+next task unblocks. Times are in mtime ticks. */
+typedef struct xTICKLESS_STATS
+{
+	uint32_t ulSleeps;				/* Times the core entered WFI with the tick suppressed. */
+	uint32_t ulAborts;				/* Sleeps abandoned because a task became ready. */
+	uint64_t ullSleptTime;			/* Total time spent in WFI. */
+	uint64_t ullLastWakeLatency;	/* Time from the programmed wake up to leaving WFI, last sleep. */
+	uint64_t ullMaxWakeLatency;		/* Same, worst case. */
+} TicklessStats_t;
+
+#if( configUSE_TICKLESS_IDLE != 0 )
+	void vPortSuppressTicksAndSleep( TickType_t xExpectedIdleTime );
+	#define portSUPPRESS_TICKS_AND_SLEEP( xExpectedIdleTime ) vPortSuppressTicksAndSleep( xExpectedIdleTime )
+#endif
+void vPortGetTicklessStats( UBaseType_t uxPsrId, TicklessStats_t *pxStats );
+
 #define portDISABLE_INTERRUPTS()                __asm volatile  ( "csrc mstatus,8" )
 #define portENABLE_INTERRUPTS()                 __asm volatile  ( "csrs mstatus,8" )
 #define portENTER_CRITICAL()					vPortEnterCritical()
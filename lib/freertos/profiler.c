@@ -0,0 +1,270 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include <atomic.h>
+#include <core_sync.h>
+#include <devices.h>
+#include <encoding.h>
+#include <profiler.h>
+#include <string.h>
+#include <trace_recorder.h>
+
+/*
+ * Dump layout, little endian:
+ *   profiler_header_t
+ *   profiler_name_t             x name_count
+ *   profiler_sample_t           x count, each followed by depth return addresses
+ *                               and padded to header.depth of them
+ */
+
+#define PROFILER_MAGIC "K210PRF"
+#define PROFILER_VERSION 1
+
+/* Stacks live in the cached SRAM mapping, see the linker script */
+#define PROFILER_RAM_START 0x80000000UL
+extern char _ram_end[];
+
+/* Interrupted register frame of each core, kept by the bsp interrupt entry */
+extern uintptr_t *g_irq_regs[];
+
+typedef struct _profiler_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t depth;
+    uint32_t rate_hz;
+    uint32_t name_count;
+    uint64_t count;
+    uint64_t dropped;
+} profiler_header_t;
+
+typedef struct _profiler_name
+{
+    uint32_t id;
+    char name[TRACE_NAME_LEN];
+} profiler_name_t;
+
+typedef struct _profiler_sample
+{
+    uint64_t pc;
+    uint32_t task;
+    uint16_t core;
+    uint16_t depth;
+    uint64_t frames[];
+} profiler_sample_t;
+
+static void profiler_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken);
+
+static struct
+{
+    volatile int enabled;
+    handle_t timer;
+    uint32_t rate_hz;
+    uint32_t depth;
+    size_t stride;
+    size_t max_samples;
+    volatile size_t next;
+    uint8_t *samples;
+} s_profiler;
+
+static core_sync_doorbell_t s_profiler_doorbells[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = CORE_SYNC_DOORBELL_INIT(profiler_doorbell)
+};
+
+static int profiler_frame_valid(uintptr_t fp)
+{
+    return fp >= PROFILER_RAM_START + 2 * sizeof(uintptr_t) && fp <= (uintptr_t)_ram_end && !(fp & (sizeof(uintptr_t) - 1));
+}
+
+/* Sample the context the calling core was interrupted in */
+static void profiler_sample(void)
+{
+    UBaseType_t core_id = uxPortGetProcessorId();
+    uintptr_t *regs = g_irq_regs[core_id];
+
+    if (!regs || !atomic_read(&s_profiler.enabled))
+        return;
+
+    /* Indices past the end only count dropped samples */
+    size_t index = atomic_add(&s_profiler.next, 1);
+    if (index >= s_profiler.max_samples)
+        return;
+
+    profiler_sample_t *sample = (profiler_sample_t *)(s_profiler.samples + index * s_profiler.stride);
+    sample->pc = regs[REG_EPC];
+    sample->task = TRACE_OBJECT_ID(xTaskGetCurrentTaskHandle());
+    sample->core = core_id;
+
+    /* With frame pointers s0 is the frame address, the return address and
+     * the caller's frame address are saved just below it */
+    uintptr_t fp = regs[REG_S0];
+    uint32_t depth = 0;
+    while (depth < s_profiler.depth && profiler_frame_valid(fp))
+    {
+        uintptr_t *frame = (uintptr_t *)fp;
+        uintptr_t next = frame[-2];
+
+        sample->frames[depth++] = frame[-1];
+        if (next <= fp)
+            break;
+        fp = next;
+    }
+
+    sample->depth = depth;
+}
+
+static void profiler_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken)
+{
+    profiler_sample();
+}
+
+static void profiler_tick(void *userdata)
+{
+    UBaseType_t core_id = uxPortGetProcessorId();
+
+    profiler_sample();
+    for (UBaseType_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        if (i != core_id)
+            core_sync_ring_doorbell(i, &s_profiler_doorbells[i]);
+    }
+}
+
+int profiler_start(const char *timer_name, uint32_t rate_hz, size_t max_samples, uint32_t depth)
+{
+    if (!rate_hz || !max_samples || depth > PROFILER_MAX_DEPTH)
+        return -1;
+
+    profiler_release();
+
+    s_profiler.stride = sizeof(profiler_sample_t) + depth * sizeof(uint64_t);
+    s_profiler.samples = (uint8_t *)pvPortMalloc(s_profiler.stride * max_samples);
+    if (!s_profiler.samples)
+        return -1;
+
+    s_profiler.timer = io_open(timer_name);
+    if (!s_profiler.timer)
+    {
+        profiler_release();
+        return -1;
+    }
+
+    s_profiler.rate_hz = rate_hz;
+    s_profiler.depth = depth;
+    s_profiler.max_samples = max_samples;
+    s_profiler.next = 0;
+    mb();
+    atomic_set(&s_profiler.enabled, 1);
+
+    timer_set_interval(s_profiler.timer, 1000000000UL / rate_hz);
+    timer_set_on_tick(s_profiler.timer, profiler_tick, NULL);
+    timer_set_enable(s_profiler.timer, true);
+    return 0;
+}
+
+void profiler_stop(void)
+{
+    atomic_set(&s_profiler.enabled, 0);
+    mb();
+
+    if (s_profiler.timer)
+    {
+        timer_set_enable(s_profiler.timer, false);
+        io_close(s_profiler.timer);
+        s_profiler.timer = 0;
+    }
+}
+
+void profiler_release(void)
+{
+    profiler_stop();
+
+    if (s_profiler.samples)
+    {
+        vPortFree(s_profiler.samples);
+        s_profiler.samples = NULL;
+    }
+
+    s_profiler.next = 0;
+    s_profiler.max_samples = 0;
+}
+
+void profiler_get_count(size_t *samples, size_t *dropped)
+{
+    size_t next = atomic_read(&s_profiler.next);
+
+    *samples = next < s_profiler.max_samples ? next : s_profiler.max_samples;
+    *dropped = next - *samples;
+}
+
+static int profiler_write_all(handle_t file, const void *buffer, size_t len)
+{
+    const uint8_t *data = (const uint8_t *)buffer;
+
+    while (len)
+    {
+        int ret = io_write(file, data, len);
+        if (ret <= 0)
+            return -1;
+        data += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+int profiler_write(handle_t file)
+{
+    profiler_name_t names[TRACE_MAX_NAMES];
+    profiler_header_t header;
+    size_t count, dropped, i, n;
+
+    if (atomic_read(&s_profiler.enabled))
+        return -1;
+
+    profiler_get_count(&count, &dropped);
+
+    /* Name the tasks that were sampled, as far as the trace recorder knows them */
+    header.name_count = 0;
+    for (i = 0; i < count; i++)
+    {
+        uint32_t task = ((profiler_sample_t *)(s_profiler.samples + i * s_profiler.stride))->task;
+        for (n = 0; n < header.name_count; n++)
+        {
+            if (names[n].id == task)
+                break;
+        }
+
+        if (n == header.name_count && n < TRACE_MAX_NAMES && trace_get_name(task, names[n].name))
+        {
+            names[n].id = task;
+            header.name_count++;
+        }
+    }
+
+    memcpy(header.magic, PROFILER_MAGIC, sizeof(header.magic));
+    header.version = PROFILER_VERSION;
+    header.depth = s_profiler.depth;
+    header.rate_hz = s_profiler.rate_hz;
+    header.count = count;
+    header.dropped = dropped;
+
+    if (profiler_write_all(file, &header, sizeof(header)) != 0)
+        return -1;
+    if (profiler_write_all(file, names, header.name_count * sizeof(profiler_name_t)) != 0)
+        return -1;
+    return profiler_write_all(file, s_profiler.samples, count * s_profiler.stride);
+}
@@ -183,7 +183,7 @@ configIDLE_TASK_NAME in FreeRTOSConfig.h. */
 	/* Define away taskRESET_READY_PRIORITY() and portRESET_READY_PRIORITY() as
 	they are only required when a port optimised method of task selection is
 	being used. */
-	#define taskRESET_READY_PRIORITY( uxPriority )
+	#define taskRESET_READY_PRIORITY( uxPriority, uxCore )
 	#define portRESET_READY_PRIORITY( uxPriority, uxTopReadyPriority )
 
 #else /* configUSE_PORT_OPTIMISED_TASK_SELECTION */
@@ -193,7 +193,7 @@ configIDLE_TASK_NAME in FreeRTOSConfig.h. */
 	architecture being used. */
 
 	/* A port optimised version is provided.  Call the port defined macros. */
-	#define taskRECORD_READY_PRIORITY( uxPriority )	portRECORD_READY_PRIORITY( uxPriority, uxTopReadyPriority )
+	#define taskRECORD_READY_PRIORITY( uxPriority )	portRECORD_READY_PRIORITY( uxPriority, uxTopReadyPriority[uxPsrId] )
 
 	/*-----------------------------------------------------------*/
 
@@ -211,12 +211,13 @@ configIDLE_TASK_NAME in FreeRTOSConfig.h. */
 
 	/* A port optimised version is provided, call it only if the TCB being reset
 	is being referenced from a ready list.  If it is referenced from a delayed
-	or suspended list then it won't be in a ready list. */
-	#define taskRESET_READY_PRIORITY( uxPriority )														\
+	or suspended list then it won't be in a ready list.  uxCore is the core
+	whose lists the TCB was removed from, which need not be the calling one. */
+	#define taskRESET_READY_PRIORITY( uxPriority, uxCore )													\
 	{																									\
-		if( listCURRENT_LIST_LENGTH( &( pxReadyTasksLists[uxPsrId][ ( uxPriority ) ] ) ) == ( UBaseType_t ) 0 )	\
+		if( listCURRENT_LIST_LENGTH( &( pxReadyTasksLists[( uxCore )][ ( uxPriority ) ] ) ) == ( UBaseType_t ) 0 )	\
 		{																								\
-			portRESET_READY_PRIORITY( ( uxPriority ), ( uxTopReadyPriority[uxPsrId] ) );							\
+			portRESET_READY_PRIORITY( ( uxPriority ), ( uxTopReadyPriority[( uxCore )] ) );						\
 		}																								\
 	}
 
@@ -250,6 +251,11 @@ count overflows. */
 	traceMOVED_TASK_TO_READY_STATE( pxTCB );																	\
 	taskRECORD_READY_PRIORITY( ( pxTCB )->uxPriority );															\
 	vListInsertEnd( &( pxReadyTasksLists[uxPsrId][ ( pxTCB )->uxPriority ] ), &( ( pxTCB )->xStateListItem ) );	\
+	( pxTCB )->uxProcessorId = uxPsrId;																			\
+	if( ( ( pxTCB )->uxCoreAffinityMask & ( ( UBaseType_t ) 1U << uxPsrId ) ) == 0 )							\
+	{																											\
+		xMigrationPending[uxPsrId] = pdTRUE;																	\
+	}																											\
 	tracePOST_MOVED_TASK_TO_READY_STATE( pxTCB )
 /*-----------------------------------------------------------*/
 
@@ -293,6 +299,8 @@ typedef struct tskTaskControlBlock
 	UBaseType_t			uxPriority;			/*< The priority of the task.  0 is the lowest priority. */
 	StackType_t			*pxStack;			/*< Points to the start of the stack. */
 	char				pcTaskName[ configMAX_TASK_NAME_LEN ];/*< Descriptive name given to the task when created.  Facilitates debugging only. */ /*lint !e971 Unqualified char types are allowed for strings and single characters only. */
+	UBaseType_t			uxProcessorId;		/*< The core whose lists the task was last readied on. */
+	UBaseType_t			uxCoreAffinityMask;	/*< Bit n set means the task may run on core n. */
 
 	#if ( ( portSTACK_GROWTH > 0 ) || ( configRECORD_STACK_HIGH_ADDRESS == 1 ) )
 		StackType_t		*pxEndOfStack;		/*< Points to the highest valid address for the stack. */
@@ -404,10 +412,27 @@ when the scheduler is unsuspended.  The pending ready list itself can only be
 accessed from a critical section. */
 PRIVILEGED_DATA static volatile UBaseType_t uxSchedulerSuspended[portNUM_PROCESSORS]	= { ( UBaseType_t ) pdFALSE };
 
+/* Set when a ready list of the core holds a task whose affinity does not allow
+it to run there.  The next context switch on that core hands such tasks over to
+a core they may run on. */
+PRIVILEGED_DATA static volatile BaseType_t xMigrationPending[portNUM_PROCESSORS]		= { pdFALSE };
+
+#if ( configUSE_TASK_LOAD_BALANCING == 1 )
+
+	PRIVILEGED_DATA static volatile BaseType_t xBalancePending[portNUM_PROCESSORS]		= { pdFALSE };	/*< The core has more ready tasks than another one, migrate one on the next context switch. */
+
+#endif
+
 #if ( configGENERATE_RUN_TIME_STATS == 1 )
 
 	PRIVILEGED_DATA static uint32_t ulTaskSwitchedInTime[portNUM_PROCESSORS] = { 0UL };	/*< Holds the value of a timer/counter the last time a task was switched in. */
 	PRIVILEGED_DATA static uint32_t ulTotalRunTime[portNUM_PROCESSORS] = { 0UL };		/*< Holds the total amount of execution time as defined by the run time counter clock. */
+	PRIVILEGED_DATA static uint32_t ulRunTimeStart[portNUM_PROCESSORS] = { 0UL };		/*< Run time counter value when the scheduler started on the core. */
+	PRIVILEGED_DATA static uint64_t ullIdleRunTime[portNUM_PROCESSORS] = { 0ULL };	/*< Time spent in the idle task of the core, does not wrap. */
+	PRIVILEGED_DATA static TickType_t xLoadSampleTick[portNUM_PROCESSORS] = { 0U };		/*< Tick count of the last load sample. */
+	PRIVILEGED_DATA static uint32_t ulLoadSampleTime[portNUM_PROCESSORS] = { 0UL };	/*< Run time counter value of the last load sample. */
+	PRIVILEGED_DATA static uint64_t ullLoadSampleIdle[portNUM_PROCESSORS] = { 0ULL };	/*< ullIdleRunTime at the last load sample. */
+	PRIVILEGED_DATA static CoreLoadStatus_t xCoreLoad[portNUM_PROCESSORS];
 
 #endif
 
@@ -577,6 +602,39 @@ static void prvInitialiseNewTask( 	TaskFunction_t pxTaskCode,
  */
 static void prvAddNewTaskToReadyList( UBaseType_t xProcessorId, TCB_t *pxNewTCB ) PRIVILEGED_FUNCTION;
 
+/*
+ * Called from vTaskSwitchContext() to hand ready tasks that may not run on the
+ * calling core (or that the load balancer picked) over to another core.  The
+ * outgoing task's context has already been saved, so it may be moved too.
+ */
+static void prvMigrateReadyTasks( void ) PRIVILEGED_FUNCTION;
+
+#if ( configUSE_TASK_LOAD_BALANCING == 1 )
+
+	/*
+	 * Called from the tick interrupt to compare the number of ready tasks of
+	 * each core and request a migration if they differ by more than one.
+	 */
+	static void prvCheckLoadBalance( void ) PRIVILEGED_FUNCTION;
+
+#endif
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+
+	/*
+	 * Returns the run time counter value, using whichever of the two port
+	 * macros is defined.
+	 */
+	static uint32_t prvGetRunTimeCounterValue( void ) PRIVILEGED_FUNCTION;
+
+	/*
+	 * Called from the tick interrupt to update the load of the calling core
+	 * every configLOAD_SAMPLE_PERIOD ticks.
+	 */
+	static void prvSampleCoreLoad( TickType_t xConstTickCount ) PRIVILEGED_FUNCTION;
+
+#endif
+
 /*
  * freertos_tasks_c_additions_init() should only be called if the user definable
  * macro FREERTOS_TASKS_C_ADDITIONS_INIT() is defined, as that is the only macro
@@ -951,6 +1009,8 @@ UBaseType_t x;
 	}
 
 	pxNewTCB->uxPriority = uxPriority;
+	pxNewTCB->uxProcessorId = uxPortGetProcessorId();
+	pxNewTCB->uxCoreAffinityMask = tskNO_AFFINITY;
 	#if ( configUSE_MUTEXES == 1 )
 	{
 		pxNewTCB->uxBasePriority = uxPriority;
@@ -1154,6 +1214,377 @@ static void prvAddNewTaskToReadyList( UBaseType_t uxPsrId, TCB_t *pxNewTCB )
 }
 /*-----------------------------------------------------------*/
 
+void vAddMigratedTaskToCurrentReadyList( TaskHandle_t xTask )
+{
+UBaseType_t uxPsrId = uxPortGetProcessorId();
+TCB_t *pxTCB = ( TCB_t * ) xTask;
+
+	/* Called from the inter-core interrupt.  The sending core has already
+	removed the task from its ready list. */
+	uxCurrentNumberOfTasks[uxPsrId]++;
+
+	if( uxSchedulerSuspended[uxPsrId] == ( UBaseType_t ) pdFALSE )
+	{
+		prvAddTaskToReadyList( pxTCB );
+
+		if( pxTCB->uxPriority > pxCurrentTCB[uxPsrId]->uxPriority )
+		{
+			taskYIELD_IF_USING_PREEMPTION();
+		}
+		else
+		{
+			mtCOVERAGE_TEST_MARKER();
+		}
+	}
+	else
+	{
+		/* The ready lists cannot be accessed, xTaskResumeAll() will move the
+		task. */
+		pxTCB->uxProcessorId = uxPsrId;
+		vListInsertEnd( &( xPendingReadyList[uxPsrId] ), &( pxTCB->xEventListItem ) );
+	}
+}
+/*-----------------------------------------------------------*/
+
+static UBaseType_t prvGetReadyTaskCount( UBaseType_t uxCore )
+{
+UBaseType_t uxPriority, uxCount = 0;
+
+	#if ( configUSE_PORT_OPTIMISED_TASK_SELECTION == 1 )
+	{
+	UBaseType_t uxReadyPriorities = uxTopReadyPriority[uxCore];
+
+		/* Only visit the lists the bit map marks as non-empty. */
+		while( uxReadyPriorities != ( UBaseType_t ) 0 )
+		{
+			portGET_HIGHEST_PRIORITY( uxPriority, uxReadyPriorities );
+			uxReadyPriorities &= ~( ( UBaseType_t ) 1U << uxPriority );
+			uxCount += listCURRENT_LIST_LENGTH( &( pxReadyTasksLists[uxCore][uxPriority] ) );
+		}
+	}
+	#else
+	{
+		for( uxPriority = 0; uxPriority < ( UBaseType_t ) configMAX_PRIORITIES; uxPriority++ )
+		{
+			uxCount += listCURRENT_LIST_LENGTH( &( pxReadyTasksLists[uxCore][uxPriority] ) );
+		}
+	}
+	#endif
+
+	return uxCount;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvMigrateTask( TCB_t *pxTCB, UBaseType_t uxTargetId )
+{
+UBaseType_t uxPsrId = uxPortGetProcessorId();
+
+	if( xSchedulerRunning[uxTargetId] == pdFALSE )
+	{
+		return pdFALSE;
+	}
+
+	if( uxListRemove( &( pxTCB->xStateListItem ) ) == ( UBaseType_t ) 0 )
+	{
+		taskRESET_READY_PRIORITY( pxTCB->uxPriority, pxTCB->uxProcessorId );
+	}
+	else
+	{
+		mtCOVERAGE_TEST_MARKER();
+	}
+
+	--uxCurrentNumberOfTasks[uxPsrId];
+
+	if( xPortMigrateTaskToReadyListAsync( uxTargetId, pxTCB ) == pdFALSE )
+	{
+		/* The target core has not consumed its previous request yet, keep the
+		task here for now. */
+		++uxCurrentNumberOfTasks[uxPsrId];
+		prvAddTaskToReadyList( pxTCB );
+		return pdFALSE;
+	}
+
+	return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+static void prvMigrateReadyTasks( void )
+{
+UBaseType_t uxPsrId = uxPortGetProcessorId();
+UBaseType_t uxPriority, uxCore;
+ListItem_t *pxItem;
+TCB_t *pxTCB;
+
+	if( xMigrationPending[uxPsrId] != pdFALSE )
+	{
+		xMigrationPending[uxPsrId] = pdFALSE;
+
+		for( uxPriority = 0; uxPriority < ( UBaseType_t ) configMAX_PRIORITIES; uxPriority++ )
+		{
+			pxItem = listGET_HEAD_ENTRY( &( pxReadyTasksLists[uxPsrId][uxPriority] ) );
+			while( pxItem != ( ListItem_t * ) listGET_END_MARKER( &( pxReadyTasksLists[uxPsrId][uxPriority] ) ) )
+			{
+				pxTCB = ( TCB_t * ) listGET_LIST_ITEM_OWNER( pxItem );
+				pxItem = listGET_NEXT( pxItem );
+
+				if( ( pxTCB->uxCoreAffinityMask & ( ( UBaseType_t ) 1U << uxPsrId ) ) == 0 )
+				{
+					for( uxCore = 0; uxCore < portNUM_PROCESSORS; uxCore++ )
+					{
+						if( ( pxTCB->uxCoreAffinityMask & ( ( UBaseType_t ) 1U << uxCore ) ) != 0 )
+						{
+							break;
+						}
+					}
+
+					/* Only one hand over can be in flight per core.  A failed
+					attempt put the task back and set xMigrationPending again,
+					so the rest is retried on the next context switch. */
+					if( ( uxCore == portNUM_PROCESSORS ) || ( prvMigrateTask( pxTCB, uxCore ) == pdFALSE ) )
+					{
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	#if ( configUSE_TASK_LOAD_BALANCING == 1 )
+	{
+	UBaseType_t uxTargetId = uxPsrId;
+
+		if( xBalancePending[uxPsrId] != pdFALSE )
+		{
+			xBalancePending[uxPsrId] = pdFALSE;
+
+			for( uxCore = 0; uxCore < portNUM_PROCESSORS; uxCore++ )
+			{
+				if( ( xSchedulerRunning[uxCore] != pdFALSE ) && ( prvGetReadyTaskCount( uxCore ) < prvGetReadyTaskCount( uxTargetId ) ) )
+				{
+					uxTargetId = uxCore;
+				}
+			}
+
+			if( uxTargetId == uxPsrId )
+			{
+				return;
+			}
+
+			/* Prefer the highest priority task that is waiting for this core.
+			The outgoing task is left alone as its cache lines are still
+			warm here. */
+			for( uxPriority = ( UBaseType_t ) configMAX_PRIORITIES; uxPriority-- > ( UBaseType_t ) 0; )
+			{
+				pxItem = listGET_HEAD_ENTRY( &( pxReadyTasksLists[uxPsrId][uxPriority] ) );
+				while( pxItem != ( ListItem_t * ) listGET_END_MARKER( &( pxReadyTasksLists[uxPsrId][uxPriority] ) ) )
+				{
+					pxTCB = ( TCB_t * ) listGET_LIST_ITEM_OWNER( pxItem );
+					pxItem = listGET_NEXT( pxItem );
+
+					if( ( pxTCB != pxCurrentTCB[uxPsrId] ) && ( ( pxTCB->uxCoreAffinityMask & ( ( UBaseType_t ) 1U << uxTargetId ) ) != 0 ) )
+					{
+						( void ) prvMigrateTask( pxTCB, uxTargetId );
+						return;
+					}
+				}
+			}
+		}
+	}
+	#endif /* configUSE_TASK_LOAD_BALANCING */
+}
+/*-----------------------------------------------------------*/
+
+#if ( configUSE_TASK_LOAD_BALANCING == 1 )
+
+	static void prvCheckLoadBalance( void )
+	{
+	UBaseType_t uxPsrId = uxPortGetProcessorId();
+	UBaseType_t uxCore, uxReadyTasks = prvGetReadyTaskCount( uxPsrId );
+
+		/* Both counts include the idle task and the running task of the core,
+		only act when moving one task actually evens them out. */
+		for( uxCore = 0; uxCore < portNUM_PROCESSORS; uxCore++ )
+		{
+			if( ( uxCore != uxPsrId ) && ( xSchedulerRunning[uxCore] != pdFALSE ) && ( prvGetReadyTaskCount( uxCore ) + ( UBaseType_t ) 1 < uxReadyTasks ) )
+			{
+				xBalancePending[uxPsrId] = pdTRUE;
+				break;
+			}
+		}
+	}
+
+#endif /* configUSE_TASK_LOAD_BALANCING */
+/*-----------------------------------------------------------*/
+
+void vTaskCoreAffinitySet( TaskHandle_t xTask, UBaseType_t uxCoreAffinityMask )
+{
+TCB_t *pxTCB;
+BaseType_t xYieldRequired = pdFALSE;
+UBaseType_t uxPsrId = uxPortGetProcessorId();
+
+	configASSERT( ( uxCoreAffinityMask & ( ( ( UBaseType_t ) 1U << portNUM_PROCESSORS ) - ( UBaseType_t ) 1U ) ) != 0 );
+
+	taskENTER_CRITICAL();
+	{
+		pxTCB = prvGetTCBFromHandle( xTask );
+		pxTCB->uxCoreAffinityMask = uxCoreAffinityMask;
+
+		if( ( uxCoreAffinityMask & ( ( UBaseType_t ) 1U << pxTCB->uxProcessorId ) ) == 0 )
+		{
+			/* The core the task belongs to moves it on its next context switch,
+			or as soon as it becomes ready if it is blocked. */
+			xMigrationPending[pxTCB->uxProcessorId] = pdTRUE;
+
+			if( pxTCB == pxCurrentTCB[uxPsrId] )
+			{
+				xYieldRequired = pdTRUE;
+			}
+			else
+			{
+				mtCOVERAGE_TEST_MARKER();
+			}
+		}
+		else
+		{
+			mtCOVERAGE_TEST_MARKER();
+		}
+	}
+	taskEXIT_CRITICAL();
+
+	if( xYieldRequired != pdFALSE )
+	{
+		portYIELD_WITHIN_API();
+	}
+	else
+	{
+		mtCOVERAGE_TEST_MARKER();
+	}
+}
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxTaskCoreAffinityGet( TaskHandle_t xTask )
+{
+UBaseType_t uxPsrId = uxPortGetProcessorId();
+
+	return prvGetTCBFromHandle( xTask )->uxCoreAffinityMask;
+}
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxTaskProcessorIdGet( TaskHandle_t xTask )
+{
+UBaseType_t uxPsrId = uxPortGetProcessorId();
+
+	return prvGetTCBFromHandle( xTask )->uxProcessorId;
+}
+/*-----------------------------------------------------------*/
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+
+	static uint32_t prvGetRunTimeCounterValue( void )
+	{
+	uint32_t ulValue;
+
+		#ifdef portALT_GET_RUN_TIME_COUNTER_VALUE
+			portALT_GET_RUN_TIME_COUNTER_VALUE( ulValue );
+		#else
+			ulValue = portGET_RUN_TIME_COUNTER_VALUE();
+		#endif
+
+		return ulValue;
+	}
+	/*-----------------------------------------------------------*/
+
+	static void prvSampleCoreLoad( TickType_t xConstTickCount )
+	{
+	UBaseType_t uxPsrId = uxPortGetProcessorId();
+	CoreLoadStatus_t *pxLoad = &( xCoreLoad[uxPsrId] );
+	uint32_t ulNow, ulElapsed, ulIdle;
+	uint64_t ullIdleTotal;
+
+		ulNow = prvGetRunTimeCounterValue();
+		ulElapsed = ulNow - ulLoadSampleTime[uxPsrId];
+
+		/* Include the part of the current idle period that has not been
+		accounted by a context switch yet. */
+		ullIdleTotal = ullIdleRunTime[uxPsrId];
+		if( pxCurrentTCB[uxPsrId] == ( TCB_t * ) xIdleTaskHandle[uxPsrId] )
+		{
+			ullIdleTotal += ( uint32_t ) ( ulNow - ulTaskSwitchedInTime[uxPsrId] );
+		}
+		else
+		{
+			mtCOVERAGE_TEST_MARKER();
+		}
+
+		ulIdle = ( uint32_t ) ( ullIdleTotal - ullLoadSampleIdle[uxPsrId] );
+		if( ulIdle > ulElapsed )
+		{
+			ulIdle = ulElapsed;
+		}
+
+		if( ulElapsed != 0UL )
+		{
+			pxLoad->ulLoad = ( uint32_t ) ( ( ( uint64_t ) ( ulElapsed - ulIdle ) * 1000ULL ) / ulElapsed );
+		}
+		else
+		{
+			pxLoad->ulLoad = 0UL;
+		}
+
+		/* Exponential moving average, each sample weighs a quarter. */
+		pxLoad->ulLoadAverage = ( ( pxLoad->ulLoadAverage * 3UL ) + pxLoad->ulLoad ) / 4UL;
+		pxLoad->ullBusyTime += ulElapsed - ulIdle;
+		pxLoad->ullTotalTime += ulElapsed;
+
+		xLoadSampleTick[uxPsrId] = xConstTickCount;
+		ulLoadSampleTime[uxPsrId] = ulNow;
+		ullLoadSampleIdle[uxPsrId] = ullIdleTotal;
+	}
+	/*-----------------------------------------------------------*/
+
+	BaseType_t xTaskGetCoreLoad( UBaseType_t uxCore, CoreLoadStatus_t *pxCoreLoad )
+	{
+		if( uxCore >= ( UBaseType_t ) portNUM_PROCESSORS )
+		{
+			return pdFAIL;
+		}
+
+		/* Written by the tick interrupt of that core only, a reader on the
+		other core may see fields from two consecutive samples. */
+		*pxCoreLoad = xCoreLoad[uxCore];
+		return pdPASS;
+	}
+	/*-----------------------------------------------------------*/
+
+	uint32_t ulTaskGetRunTimeCounter( TaskHandle_t xTask )
+	{
+	UBaseType_t uxPsrId = uxPortGetProcessorId();
+
+		return prvGetTCBFromHandle( xTask )->ulRunTimeCounter;
+	}
+	/*-----------------------------------------------------------*/
+
+	uint32_t ulTaskGetRunTimePercent( TaskHandle_t xTask )
+	{
+	UBaseType_t uxPsrId = uxPortGetProcessorId();
+	TCB_t *pxTCB = prvGetTCBFromHandle( xTask );
+	uint32_t ulTotalTime;
+
+		/* Relative to the time the core the task belongs to has been running
+		the scheduler. */
+		ulTotalTime = ( prvGetRunTimeCounterValue() - ulRunTimeStart[pxTCB->uxProcessorId] ) / 100UL;
+
+		if( ulTotalTime > 0UL )
+		{
+			return pxTCB->ulRunTimeCounter / ulTotalTime;
+		}
+
+		return 0UL;
+	}
+	/*-----------------------------------------------------------*/
+
+#endif /* configGENERATE_RUN_TIME_STATS */
+
 #if ( INCLUDE_vTaskDelete == 1 )
 
 	void vTaskDelete( TaskHandle_t xTaskToDelete )
@@ -1170,7 +1601,7 @@ static void prvAddNewTaskToReadyList( UBaseType_t uxPsrId, TCB_t *pxNewTCB )
 			/* Remove task from the ready list. */
 			if( uxListRemove( &( pxTCB->xStateListItem ) ) == ( UBaseType_t ) 0 )
 			{
-				taskRESET_READY_PRIORITY( pxTCB->uxPriority );
+				taskRESET_READY_PRIORITY( pxTCB->uxPriority, pxTCB->uxProcessorId );
 			}
 			else
 			{
@@ -1646,7 +2077,7 @@ static void prvAddNewTaskToReadyList( UBaseType_t uxPsrId, TCB_t *pxNewTCB )
 						/* It is known that the task is in its ready list so
 						there is no need to check again and the port level
 						reset macro can be called directly. */
-						portRESET_READY_PRIORITY( uxPriorityUsedOnEntry, uxTopReadyPriority[uxPsrId] );
+						portRESET_READY_PRIORITY( uxPriorityUsedOnEntry, uxTopReadyPriority[pxTCB->uxProcessorId] );
 					}
 					else
 					{
@@ -1698,7 +2129,7 @@ static void prvAddNewTaskToReadyList( UBaseType_t uxPsrId, TCB_t *pxNewTCB )
 			suspended list. */
 			if( uxListRemove( &( pxTCB->xStateListItem ) ) == ( UBaseType_t ) 0 )
 			{
-				taskRESET_READY_PRIORITY( pxTCB->uxPriority );
+				taskRESET_READY_PRIORITY( pxTCB->uxPriority, pxTCB->uxProcessorId );
 			}
 			else
 			{
@@ -2000,6 +2431,12 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 	}
 	#endif /* configSUPPORT_STATIC_ALLOCATION */
 
+	/* The idle task of each core must stay on that core. */
+	if( xReturn == pdPASS )
+	{
+		( ( TCB_t * ) xIdleTaskHandle[uxPsrId] )->uxCoreAffinityMask = ( UBaseType_t ) 1U << uxPsrId;
+	}
+
 	#if ( configUSE_TIMERS == 1 )
 	{
 		if( xReturn == pdPASS )
@@ -2051,6 +2488,14 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 		FreeRTOSConfig.h file. */
 		portCONFIGURE_TIMER_FOR_RUN_TIME_STATS();
 
+		#if ( configGENERATE_RUN_TIME_STATS == 1 )
+		{
+			ulRunTimeStart[uxPsrId] = prvGetRunTimeCounterValue();
+			ulTaskSwitchedInTime[uxPsrId] = ulRunTimeStart[uxPsrId];
+			ulLoadSampleTime[uxPsrId] = ulRunTimeStart[uxPsrId];
+		}
+		#endif /* configGENERATE_RUN_TIME_STATS */
+
 		/* Setting up the timer tick is hardware specific and thus in the
 		portable interface. */
 		if( xPortStartScheduler() != pdFALSE )
@@ -2128,7 +2573,7 @@ void vTaskSuspendAll( void )
 			significant bit are set then there are tasks that have a priority
 			above the idle priority that are in the Ready state.  This takes
 			care of the case where the co-operative scheduler is in use. */
-			if( uxTopReadyPriority > uxLeastSignificantBit )
+			if( uxTopReadyPriority[uxPsrId] > uxLeastSignificantBit )
 			{
 				uxHigherPriorityReadyTasks = pdTRUE;
 			}
@@ -2193,7 +2638,13 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 				{
 					pxTCB = ( TCB_t * ) listGET_OWNER_OF_HEAD_ENTRY( ( &xPendingReadyList[uxPsrId] ) );
 					( void ) uxListRemove( &( pxTCB->xEventListItem ) );
-					( void ) uxListRemove( &( pxTCB->xStateListItem ) );
+
+					/* Tasks migrated from another core are not in any state
+					list. */
+					if( listLIST_ITEM_CONTAINER( &( pxTCB->xStateListItem ) ) != NULL )
+					{
+						( void ) uxListRemove( &( pxTCB->xStateListItem ) );
+					}
 					prvAddTaskToReadyList( pxTCB );
 
 					/* If the moved task has a priority higher than the current
@@ -2516,11 +2967,9 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 				{
 					if( pulTotalRunTime != NULL )
 					{
-						#ifdef portALT_GET_RUN_TIME_COUNTER_VALUE
-							portALT_GET_RUN_TIME_COUNTER_VALUE( ( *pulTotalRunTime ) );
-						#else
-							*pulTotalRunTime = portGET_RUN_TIME_COUNTER_VALUE();
-						#endif
+						/* Only the tasks of this core are listed, so report
+						the time this core has been running the scheduler. */
+						*pulTotalRunTime = prvGetRunTimeCounterValue() - ulRunTimeStart[uxPsrId];
 					}
 				}
 				#else
@@ -2784,6 +3233,26 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 		}
 		#endif /* ( ( configUSE_PREEMPTION == 1 ) && ( configUSE_TIME_SLICING == 1 ) ) */
 
+		#if ( configUSE_TASK_LOAD_BALANCING == 1 )
+		{
+			if( ( xConstTickCount % configLOAD_BALANCE_PERIOD ) == ( TickType_t ) 0 )
+			{
+				prvCheckLoadBalance();
+			}
+		}
+		#endif /* configUSE_TASK_LOAD_BALANCING */
+
+		#if ( configGENERATE_RUN_TIME_STATS == 1 )
+		{
+			/* Compare against the last sample rather than testing for a
+			multiple, tickless idle steps the tick count past them. */
+			if( ( TickType_t ) ( xConstTickCount - xLoadSampleTick[uxPsrId] ) >= configLOAD_SAMPLE_PERIOD )
+			{
+				prvSampleCoreLoad( xConstTickCount );
+			}
+		}
+		#endif /* configGENERATE_RUN_TIME_STATS */
+
 		#if ( configUSE_TICK_HOOK == 1 )
 		{
 			/* Guard against the tick hook being called when the pended tick
@@ -2825,6 +3294,22 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 	}
 	#endif /* configUSE_PREEMPTION */
 
+	/* Tasks are only handed over to another core from vTaskSwitchContext(). */
+	if( xMigrationPending[uxPsrId] != pdFALSE )
+	{
+		xSwitchRequired = pdTRUE;
+	}
+	#if ( configUSE_TASK_LOAD_BALANCING == 1 )
+	else if( xBalancePending[uxPsrId] != pdFALSE )
+	{
+		xSwitchRequired = pdTRUE;
+	}
+	#endif
+	else
+	{
+		mtCOVERAGE_TEST_MARKER();
+	}
+
 	return xSwitchRequired;
 }
 /*-----------------------------------------------------------*/
@@ -2942,22 +3427,21 @@ void vTaskSwitchContext( void )
 
 		#if ( configGENERATE_RUN_TIME_STATS == 1 )
 		{
-				#ifdef portALT_GET_RUN_TIME_COUNTER_VALUE
-					portALT_GET_RUN_TIME_COUNTER_VALUE( ulTotalRunTime[uxPsrId] );
-				#else
-					ulTotalRunTime[uxPsrId]  = portGET_RUN_TIME_COUNTER_VALUE();
-				#endif
+				uint32_t ulRunTime;
+
+				ulTotalRunTime[uxPsrId] = prvGetRunTimeCounterValue();
 
 				/* Add the amount of time the task has been running to the
 				accumulated time so far.  The time the task started running was
-				stored in ulTaskSwitchedInTime.  Note that there is no overflow
-				protection here so count values are only valid until the timer
-				overflows.  The guard against negative values is to protect
-				against suspect run time stat counter implementations - which
-				are provided by the application, not the kernel. */
-				if( ulTotalRunTime[uxPsrId] > ulTaskSwitchedInTime[uxPsrId] )
+				stored in ulTaskSwitchedInTime.  The unsigned difference stays
+				correct across a wrap of the counter, the per task totals are
+				only valid until they wrap themselves. */
+				ulRunTime = ulTotalRunTime[uxPsrId] - ulTaskSwitchedInTime[uxPsrId];
+				pxCurrentTCB[uxPsrId]->ulRunTimeCounter += ulRunTime;
+
+				if( pxCurrentTCB[uxPsrId] == ( TCB_t * ) xIdleTaskHandle[uxPsrId] )
 				{
-					pxCurrentTCB[uxPsrId]->ulRunTimeCounter += ( ulTotalRunTime[uxPsrId] - ulTaskSwitchedInTime[uxPsrId] );
+					ullIdleRunTime[uxPsrId] += ulRunTime;
 				}
 				else
 				{
@@ -2970,6 +3454,10 @@ void vTaskSwitchContext( void )
 		/* Check for stack overflow, if configured. */
 		taskCHECK_FOR_STACK_OVERFLOW();
 
+		/* Hand over tasks that should run on another core before one of them
+		gets selected here. */
+		prvMigrateReadyTasks();
+
 		/* Select a new task to run using either the generic C or port
 		optimised asm code. */
 		taskSELECT_HIGHEST_PRIORITY_TASK();
@@ -3929,7 +4417,7 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 				{
 					if( uxListRemove( &( pxMutexHolderTCB->xStateListItem ) ) == ( UBaseType_t ) 0 )
 					{
-						taskRESET_READY_PRIORITY( pxMutexHolderTCB->uxPriority );
+						taskRESET_READY_PRIORITY( pxMutexHolderTCB->uxPriority, pxMutexHolderTCB->uxProcessorId );
 					}
 					else
 					{
@@ -4013,7 +4501,7 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 					the holding task from the ready list. */
 					if( uxListRemove( &( pxTCB->xStateListItem ) ) == ( UBaseType_t ) 0 )
 					{
-						taskRESET_READY_PRIORITY( pxTCB->uxPriority );
+						taskRESET_READY_PRIORITY( pxTCB->uxPriority, pxTCB->uxProcessorId );
 					}
 					else
 					{
@@ -4132,7 +4620,7 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 					{
 						if( uxListRemove( &( pxTCB->xStateListItem ) ) == ( UBaseType_t ) 0 )
 						{
-							taskRESET_READY_PRIORITY( pxTCB->uxPriority );
+							taskRESET_READY_PRIORITY( pxTCB->uxPriority, pxTCB->uxProcessorId );
 						}
 						else
 						{
@@ -4523,6 +5011,23 @@ UBaseType_t uxPsrId = uxPortGetProcessorId();
 #endif /* configUSE_MUTEXES */
 /*-----------------------------------------------------------*/
 
+#if ( configUSE_MUTEXES == 1 )
+
+	void vTaskIncrementMutexHeldCountOf( TaskHandle_t const pxMutexHolder )
+	{
+	TCB_t * const pxTCB = ( TCB_t * ) pxMutexHolder;
+
+		/* Called from a critical section by a task that found the lock already
+		taken, the holder itself releases it through xTaskPriorityDisinherit(). */
+		if( pxTCB != NULL )
+		{
+			( pxTCB->uxMutexesHeld )++;
+		}
+	}
+
+#endif /* configUSE_MUTEXES */
+/*-----------------------------------------------------------*/
+
 #if( configUSE_TASK_NOTIFICATIONS == 1 )
 
 	uint32_t ulTaskNotifyTake( BaseType_t xClearCountOnExit, TickType_t xTicksToWait )
@@ -0,0 +1,260 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include <atomic.h>
+#include <clint.h>
+#include <encoding.h>
+#include <string.h>
+#include <trace_recorder.h>
+
+/*
+ * Every core only ever writes its own ring, with local interrupts masked, so
+ * recording needs no lock and never contends with the other core. A ring keeps
+ * the last TRACE_BUFFER_EVENTS events. Without configUSE_TRACE_RECORDER only
+ * the name table is built, the profiler uses it too.
+ *
+ * Dump layout, little endian:
+ *   trace_dump_header_t
+ *   trace_dump_name_t           x name_count
+ *   per core: trace_dump_core_t, then trace_event_t x count, oldest first
+ */
+
+#define TRACE_DUMP_MAGIC "K210TRC"
+#define TRACE_DUMP_VERSION 1
+
+typedef struct _trace_dump_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t core_count;
+    uint64_t clock_hz;
+    uint32_t name_count;
+    uint32_t event_size;
+} trace_dump_header_t;
+
+typedef struct _trace_dump_name
+{
+    uint32_t id;
+    char name[TRACE_NAME_LEN];
+} trace_dump_name_t;
+
+typedef struct _trace_dump_core
+{
+    uint32_t core;
+    uint32_t count;
+    /* Events lost to the ring wrapping around */
+    uint64_t overwritten;
+} trace_dump_core_t;
+
+#if (configUSE_TRACE_RECORDER == 1)
+typedef struct _trace_core
+{
+    size_t head;
+    trace_event_t events[TRACE_BUFFER_EVENTS];
+} __attribute__((aligned(64))) trace_core_t;
+
+volatile int g_trace_enabled;
+
+static trace_core_t s_trace_cores[portNUM_PROCESSORS];
+#endif
+
+static spinlock_t s_trace_names_lock = SPINLOCK_INIT;
+static trace_dump_name_t s_trace_names[TRACE_MAX_NAMES];
+static size_t s_trace_names_next;
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+    if (flags & MSTATUS_MIE)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+#if (configUSE_TRACE_RECORDER == 1)
+void trace_record(uint8_t type, uint8_t arg8, uint16_t arg16, uint32_t arg32)
+{
+    uintptr_t flags = irq_save();
+    trace_core_t *tc = &s_trace_cores[uxPortGetProcessorId()];
+    trace_event_t *event = &tc->events[tc->head & (TRACE_BUFFER_EVENTS - 1)];
+
+    event->time = clint->mtime;
+    event->type = type;
+    event->arg8 = arg8;
+    event->arg16 = arg16;
+    event->arg32 = arg32;
+    tc->head++;
+    irq_restore(flags);
+}
+#endif
+
+void trace_set_name(const void *object, const char *name)
+{
+    uint32_t id = TRACE_OBJECT_ID(object);
+    size_t i;
+
+    uintptr_t flags = irq_save();
+    spinlock_lock(&s_trace_names_lock);
+
+    /* Objects may be recreated at the same address, reuse their entry */
+    for (i = 0; i < TRACE_MAX_NAMES; i++)
+    {
+        if (s_trace_names[i].id == id)
+            break;
+    }
+
+    if (i == TRACE_MAX_NAMES)
+        i = s_trace_names_next++ % TRACE_MAX_NAMES;
+
+    s_trace_names[i].id = id;
+    strncpy(s_trace_names[i].name, name, TRACE_NAME_LEN);
+    spinlock_unlock(&s_trace_names_lock);
+    irq_restore(flags);
+}
+
+int trace_get_name(uint32_t id, char *name)
+{
+    int found = 0;
+
+    uintptr_t flags = irq_save();
+    spinlock_lock(&s_trace_names_lock);
+    for (size_t i = 0; i < TRACE_MAX_NAMES; i++)
+    {
+        if (id && s_trace_names[i].id == id)
+        {
+            memcpy(name, s_trace_names[i].name, TRACE_NAME_LEN);
+            found = 1;
+            break;
+        }
+    }
+    spinlock_unlock(&s_trace_names_lock);
+    irq_restore(flags);
+    return found;
+}
+
+#if (configUSE_TRACE_RECORDER == 1)
+void trace_start(void)
+{
+    atomic_set(&g_trace_enabled, 0);
+    mb();
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        atomic_set(&s_trace_cores[i].head, 0);
+    mb();
+    atomic_set(&g_trace_enabled, 1);
+}
+
+void trace_stop(void)
+{
+    atomic_set(&g_trace_enabled, 0);
+    mb();
+}
+
+static size_t trace_core_count(const trace_core_t *tc)
+{
+    size_t head = atomic_read(&tc->head);
+    return head < TRACE_BUFFER_EVENTS ? head : TRACE_BUFFER_EVENTS;
+}
+
+static size_t trace_name_count(void)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < TRACE_MAX_NAMES; i++)
+    {
+        if (s_trace_names[i].id)
+            count++;
+    }
+
+    return count;
+}
+
+size_t trace_dump_size(void)
+{
+    size_t size = sizeof(trace_dump_header_t) + trace_name_count() * sizeof(trace_dump_name_t);
+
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        size += sizeof(trace_dump_core_t) + trace_core_count(&s_trace_cores[i]) * sizeof(trace_event_t);
+    return size;
+}
+
+size_t trace_dump(void *buffer, size_t size)
+{
+    uint8_t *out = (uint8_t *)buffer;
+    uint8_t *end = out + size;
+    size_t i;
+
+    /* Names and events may still be added while dumping, so every part is
+     * bounds checked again */
+    if (size < sizeof(trace_dump_header_t))
+        return 0;
+
+    trace_dump_header_t *header = (trace_dump_header_t *)out;
+    memcpy(header->magic, TRACE_DUMP_MAGIC, sizeof(header->magic));
+    header->version = TRACE_DUMP_VERSION;
+    header->core_count = portNUM_PROCESSORS;
+    header->clock_hz = configTICK_CLOCK_HZ;
+    header->name_count = 0;
+    header->event_size = sizeof(trace_event_t);
+    out += sizeof(trace_dump_header_t);
+
+    uintptr_t flags = irq_save();
+    spinlock_lock(&s_trace_names_lock);
+    for (i = 0; i < TRACE_MAX_NAMES && out; i++)
+    {
+        if (s_trace_names[i].id)
+        {
+            if (out + sizeof(trace_dump_name_t) > end)
+            {
+                out = NULL;
+                break;
+            }
+
+            memcpy(out, &s_trace_names[i], sizeof(trace_dump_name_t));
+            out += sizeof(trace_dump_name_t);
+            header->name_count++;
+        }
+    }
+    spinlock_unlock(&s_trace_names_lock);
+    irq_restore(flags);
+
+    for (i = 0; i < portNUM_PROCESSORS && out; i++)
+    {
+        trace_core_t *tc = &s_trace_cores[i];
+        size_t head = atomic_read(&tc->head);
+        size_t count = head < TRACE_BUFFER_EVENTS ? head : TRACE_BUFFER_EVENTS;
+
+        if (out + sizeof(trace_dump_core_t) + count * sizeof(trace_event_t) > end)
+        {
+            out = NULL;
+            break;
+        }
+
+        trace_dump_core_t *core = (trace_dump_core_t *)out;
+        core->core = i;
+        core->count = count;
+        core->overwritten = head - count;
+        out += sizeof(trace_dump_core_t);
+
+        for (size_t n = head - count; n != head; n++)
+        {
+            memcpy(out, &tc->events[n & (TRACE_BUFFER_EVENTS - 1)], sizeof(trace_event_t));
+            out += sizeof(trace_event_t);
+        }
+    }
+
+    return out ? (size_t)(out - (uint8_t *)buffer) : 0;
+}
+#endif
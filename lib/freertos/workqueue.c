@@ -0,0 +1,160 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include <atomic.h>
+#include <core_sync.h>
+#include <encoding.h>
+#include <stddef.h>
+#include <workqueue.h>
+
+/*
+ * Each core has a FIFO of pending work items and a worker task pinned to it.
+ * Producers append under a spinlock with interrupts masked, the worker takes
+ * the whole list at once and runs it without the lock. Only the producer that
+ * finds the list empty wakes the worker, so a burst of interrupts costs one
+ * wake-up, through a core_sync doorbell when queued from the other core.
+ */
+
+typedef struct _work_worker
+{
+    spinlock_t lock;
+    work_t *head;
+    work_t *tail;
+    TaskHandle_t task;
+    core_sync_doorbell_t doorbell;
+} work_worker_t;
+
+static void work_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken);
+
+static work_worker_t s_work_workers[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = { .lock = SPINLOCK_INIT, .head = NULL, .tail = NULL, .task = NULL, .doorbell = CORE_SYNC_DOORBELL_INIT(work_doorbell) }
+};
+
+static inline uintptr_t irq_save(void)
+{
+    return clear_csr(mstatus, MSTATUS_MIE);
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+    set_csr(mstatus, flags & MSTATUS_MIE);
+}
+
+static void work_doorbell(core_sync_doorbell_t *bell, BaseType_t *higher_priority_task_woken)
+{
+    work_worker_t *worker = (work_worker_t *)((uint8_t *)bell - offsetof(work_worker_t, doorbell));
+
+    vTaskNotifyGiveFromISR(worker->task, higher_priority_task_woken);
+}
+
+static void work_worker_main(void *arg)
+{
+    work_worker_t *worker = (work_worker_t *)arg;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uintptr_t flags = irq_save();
+        spinlock_lock(&worker->lock);
+        work_t *work = worker->head;
+        worker->head = worker->tail = NULL;
+        spinlock_unlock(&worker->lock);
+        irq_restore(flags);
+
+        while (work)
+        {
+            work_t *next = work->next;
+
+            /* The item may be queued again as soon as pending is cleared */
+            mb();
+            atomic_set(&work->pending, 0);
+            work->fn(work, work->userdata);
+            work = next;
+        }
+    }
+}
+
+int work_queue_init(void)
+{
+    for (UBaseType_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        work_worker_t *worker = &s_work_workers[i];
+        if (xTaskCreateAtProcessor(i, work_worker_main, "work", WORK_QUEUE_STACK_DEPTH, worker, WORK_QUEUE_PRIORITY, &worker->task) != pdPASS)
+            return -1;
+
+        vTaskCoreAffinitySet(worker->task, (UBaseType_t)1 << i);
+    }
+
+    return 0;
+}
+
+void work_init(work_t *work, work_fn_t fn, void *userdata)
+{
+    work->next = NULL;
+    work->fn = fn;
+    work->userdata = userdata;
+    work->pending = 0;
+}
+
+int work_queue_on(UBaseType_t core_id, work_t *work)
+{
+    work_worker_t *worker = &s_work_workers[core_id];
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    int was_empty;
+
+    configASSERT(worker->task);
+    if (atomic_swap(&work->pending, 1))
+        return 0;
+
+    uintptr_t flags = irq_save();
+    spinlock_lock(&worker->lock);
+    work->next = NULL;
+    was_empty = worker->head == NULL;
+    if (was_empty)
+        worker->head = work;
+    else
+        worker->tail->next = work;
+    worker->tail = work;
+    spinlock_unlock(&worker->lock);
+
+    if (was_empty)
+    {
+        if (core_id == uxPortGetProcessorId())
+            vTaskNotifyGiveFromISR(worker->task, &higher_priority_task_woken);
+        else
+            core_sync_ring_doorbell(core_id, &worker->doorbell);
+    }
+
+    irq_restore(flags);
+
+    if (higher_priority_task_woken)
+    {
+        if (uxPortIsInISR())
+            portYIELD_FROM_ISR();
+        else
+            portYIELD();
+    }
+
+    return 1;
+}
+
+int work_queue(work_t *work)
+{
+    /* Interrupts stay enabled, a task may move to the other core meanwhile,
+     * which only makes the work run there */
+    return work_queue_on(uxPortGetProcessorId(), work);
+}
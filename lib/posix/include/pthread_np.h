@@ -0,0 +1,101 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _POSIX_PTHREAD_NP_H
+#define _POSIX_PTHREAD_NP_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Non-portable thread extensions, modelled after the GNU ones. */
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 32
+
+typedef struct
+{
+    uint32_t __bits;
+} cpu_set_t;
+
+#define CPU_ZERO(set) ((set)->__bits = 0)
+#define CPU_SET(cpu, set) ((cpu) < CPU_SETSIZE ? ((set)->__bits |= (UINT32_C(1) << (cpu))) : 0)
+#define CPU_CLR(cpu, set) ((cpu) < CPU_SETSIZE ? ((set)->__bits &= ~(UINT32_C(1) << (cpu))) : 0)
+#define CPU_ISSET(cpu, set) ((cpu) < CPU_SETSIZE ? (((set)->__bits >> (cpu)) & 1) : 0)
+#define CPU_COUNT(set) __builtin_popcount((set)->__bits)
+#define CPU_EQUAL(set1, set2) ((set1)->__bits == (set2)->__bits)
+#endif
+
+/**
+ * @brief       Set the cores a thread created with this attribute may run on
+ *
+ * @param[in]   attr        The thread attribute
+ * @param[in]   cpusetsize  Size of the cpu set
+ * @param[in]   cpuset      The allowed cores, must contain at least one existing core
+ *
+ * @return      result
+ *     - 0      Success
+ *     - EINVAL Invalid cpu set
+ */
+int pthread_attr_setaffinity_np(pthread_attr_t *attr, size_t cpusetsize, const cpu_set_t *cpuset);
+
+/**
+ * @brief       Get the cores a thread created with this attribute may run on
+ *
+ * @param[in]   attr        The thread attribute
+ * @param[in]   cpusetsize  Size of the cpu set
+ * @param[out]  cpuset      The allowed cores
+ *
+ * @return      result
+ *     - 0      Success
+ *     - EINVAL Invalid cpu set
+ */
+int pthread_attr_getaffinity_np(const pthread_attr_t *attr, size_t cpusetsize, cpu_set_t *cpuset);
+
+/**
+ * @brief       Set the cores a running thread may run on
+ *
+ * @param[in]   thread      The thread
+ * @param[in]   cpusetsize  Size of the cpu set
+ * @param[in]   cpuset      The allowed cores, must contain at least one existing core
+ *
+ * @return      result
+ *     - 0      Success
+ *     - EINVAL Invalid cpu set
+ */
+int pthread_setaffinity_np(pthread_t thread, size_t cpusetsize, const cpu_set_t *cpuset);
+
+/**
+ * @brief       Get the cores a running thread may run on
+ *
+ * @param[in]   thread      The thread
+ * @param[in]   cpusetsize  Size of the cpu set
+ * @param[out]  cpuset      The allowed cores
+ *
+ * @return      result
+ *     - 0      Success
+ *     - EINVAL Invalid cpu set
+ */
+int pthread_getaffinity_np(pthread_t thread, size_t cpusetsize, cpu_set_t *cpuset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POSIX_PTHREAD_NP_H */
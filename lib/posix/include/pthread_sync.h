@@ -0,0 +1,93 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _POSIX_PTHREAD_SYNC_H
+#define _POSIX_PTHREAD_SYNC_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Reader-writer locks, spin locks and barriers. newlib only declares them
+ * when the target advertises the options, so the same layout is provided
+ * here otherwise. */
+
+#ifndef _POSIX_READER_WRITER_LOCKS
+typedef uint32_t pthread_rwlock_t;
+
+typedef struct
+{
+    int is_initialized;
+    int process_shared;
+} pthread_rwlockattr_t;
+
+#define PTHREAD_RWLOCK_INITIALIZER ((pthread_rwlock_t)0xFFFFFFFF)
+
+int pthread_rwlockattr_init(pthread_rwlockattr_t *__attr);
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t *__attr);
+int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *__attr, int *__pshared);
+int pthread_rwlockattr_setpshared(pthread_rwlockattr_t *__attr, int __pshared);
+
+int pthread_rwlock_init(pthread_rwlock_t *__rwlock, const pthread_rwlockattr_t *__attr);
+int pthread_rwlock_destroy(pthread_rwlock_t *__rwlock);
+int pthread_rwlock_rdlock(pthread_rwlock_t *__rwlock);
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *__rwlock);
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *__rwlock, const struct timespec *__abstime);
+int pthread_rwlock_wrlock(pthread_rwlock_t *__rwlock);
+int pthread_rwlock_trywrlock(pthread_rwlock_t *__rwlock);
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *__rwlock, const struct timespec *__abstime);
+int pthread_rwlock_unlock(pthread_rwlock_t *__rwlock);
+#endif
+
+#ifndef _POSIX_SPIN_LOCKS
+typedef uint32_t pthread_spinlock_t;
+
+int pthread_spin_init(pthread_spinlock_t *__spinlock, int __pshared);
+int pthread_spin_destroy(pthread_spinlock_t *__spinlock);
+int pthread_spin_lock(pthread_spinlock_t *__spinlock);
+int pthread_spin_trylock(pthread_spinlock_t *__spinlock);
+int pthread_spin_unlock(pthread_spinlock_t *__spinlock);
+#endif
+
+#ifndef _POSIX_BARRIERS
+typedef uint32_t pthread_barrier_t;
+
+typedef struct
+{
+    int is_initialized;
+    int process_shared;
+} pthread_barrierattr_t;
+
+#define PTHREAD_BARRIER_SERIAL_THREAD (-1)
+
+int pthread_barrierattr_init(pthread_barrierattr_t *__attr);
+int pthread_barrierattr_destroy(pthread_barrierattr_t *__attr);
+int pthread_barrierattr_getpshared(const pthread_barrierattr_t *__attr, int *__pshared);
+int pthread_barrierattr_setpshared(pthread_barrierattr_t *__attr, int __pshared);
+
+int pthread_barrier_init(pthread_barrier_t *__barrier, const pthread_barrierattr_t *__attr, unsigned __count);
+int pthread_barrier_destroy(pthread_barrier_t *__barrier);
+int pthread_barrier_wait(pthread_barrier_t *__barrier);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POSIX_PTHREAD_SYNC_H */
@@ -19,6 +19,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "sys/ip_addr.h"
+#include "sys/uio.h"
 
 #ifdef __cplusplus
 extern "C"
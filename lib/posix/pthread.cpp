@@ -12,6 +12,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include "utils.h"
 #include <FreeRTOS.h>
 #include <atomic.h>
 #include <atomic>
@@ -21,14 +22,18 @@
 #include <kernel/driver_impl.hpp>
 #include <platform.h>
 #include <pthread.h>
+#include <pthread_np.h>
+#include <pthread_sync.h>
 #include <semphr.h>
 #include <task.h>
-#include <unordered_map>
 
 // Workaround for keeping pthread functions
 void *g_pthread_keep[] = {
     (void *)pthread_cond_init,
     (void *)pthread_mutex_init,
+    (void *)pthread_rwlock_init,
+    (void *)pthread_spin_init,
+    (void *)pthread_barrier_init,
     (void *)pthread_self
 };
 
@@ -38,15 +43,23 @@ static const pthread_attr_t s_default_thread_attributes = {
     .detachstate = PTHREAD_CREATE_JOINABLE
 };
 
-struct k_pthread_key
+#define CORE_MASK ((UBaseType_t(1) << portNUM_PROCESSORS) - 1)
+
+/* newlib's pthread_attr_t has no affinity field. Threads never take their
+ * stack from the attribute, so its unused stackaddr carries the mask set
+ * through pthread_attr_setaffinity_np, null for no affinity. Copies of the
+ * attribute keep it. */
+static UBaseType_t attr_get_affinity(const pthread_attr_t *attr)
 {
-    void (*destructor)(void *);
-};
+    if (!attr || !attr->stackaddr)
+        return tskNO_AFFINITY;
+    return (UBaseType_t)(uintptr_t)attr->stackaddr;
+}
 
-struct k_pthread_tls
+static void attr_set_affinity(pthread_attr_t *attr, UBaseType_t mask)
 {
-    std::unordered_map<pthread_key_t, uintptr_t> storage;
-};
+    attr->stackaddr = mask == tskNO_AFFINITY ? nullptr : (void *)(uintptr_t)mask;
+}
 
 struct k_pthread
 {
@@ -57,9 +70,10 @@ struct k_pthread
     void *arg;
     TaskHandle_t handle;
     void *ret;
+    UBaseType_t affinity;
 
-    k_pthread(pthread_attr_t attr, void *(*startroutine)(void *), void *arg) noexcept
-        : attr(attr), startroutine(startroutine), arg(arg)
+    k_pthread(pthread_attr_t attr, UBaseType_t affinity, void *(*startroutine)(void *), void *arg) noexcept
+        : attr(attr), startroutine(startroutine), arg(arg), affinity(affinity)
     {
         if (attr.detachstate == PTHREAD_CREATE_JOINABLE)
         {
@@ -70,11 +84,18 @@ struct k_pthread
 
     BaseType_t create() noexcept
     {
-        auto ret = xTaskCreate(thread_thunk, "posix", (uint16_t)(attr.stacksize / sizeof(StackType_t)), this, attr.schedparam.sched_priority, &handle);
+        /* Start on the current core if allowed, otherwise on the first allowed one. */
+        UBaseType_t core = uxPortGetProcessorId();
+        if (!(affinity & (UBaseType_t(1) << core)))
+            core = __builtin_ctzl(affinity & CORE_MASK);
+
+        auto ret = xTaskCreateAtProcessor(core, thread_thunk, "posix", (uint16_t)(attr.stacksize / sizeof(StackType_t)), this, attr.schedparam.sched_priority, &handle);
         if (ret == pdPASS)
         {
             /* Store the pointer to the thread object in the task tag. */
             vTaskSetApplicationTaskTag(handle, (TaskHookFunction_t)this);
+            if (affinity != tskNO_AFFINITY)
+                vTaskCoreAffinitySet(handle, affinity);
         }
 
         return ret;
@@ -91,8 +112,14 @@ private:
     static void thread_thunk(void *arg)
     {
         k_pthread *k_thread = reinterpret_cast<k_pthread *>(arg);
+        /* A thread started on the other core may run before create() tags it. */
+        vTaskSetApplicationTaskTag(NULL, (TaskHookFunction_t)k_thread);
         k_thread->ret = k_thread->startroutine(k_thread->arg);
 
+        /* Key destructors run here, on the exiting thread, before the table
+         * is freed by on_exit or pthread_join. */
+        pthread_tls_run_destructors();
+
         k_thread->on_exit();
     }
 
@@ -110,7 +137,7 @@ private:
         {
             /* For a detached thread, perform cleanup of thread object. */
             delete this;
-            delete reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+            pthread_tls_free(NULL);
             vTaskDelete(NULL);
         }
     }
@@ -122,7 +149,7 @@ int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*startr
     k_pthread *k_thrd = NULL;
 
     /* Allocate memory for new thread object. */
-    k_thrd = new (std::nothrow) k_pthread(attr ? *attr : s_default_thread_attributes, startroutine, arg);
+    k_thrd = new (std::nothrow) k_pthread(attr ? *attr : s_default_thread_attributes, attr_get_affinity(attr), startroutine, arg);
 
     if (!k_thrd)
     {
@@ -213,7 +240,7 @@ int pthread_join(pthread_t pthread, void **retval)
         }
 
         /* Free the thread object. */
-        delete reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(k_thrd->handle, PTHREAD_TLS_INDEX));
+        pthread_tls_free(k_thrd->handle);
         /* Delete the FreeRTOS task that ran the thread. */
         vTaskDelete(k_thrd->handle);
         delete k_thrd;
@@ -241,61 +268,108 @@ int pthread_cancel(pthread_t pthread)
     return 0;
 }
 
-int pthread_key_create(pthread_key_t *__key, void (*__destructor)(void *))
+int pthread_attr_init(pthread_attr_t *attr)
 {
-    auto k_key = new (std::nothrow) k_pthread_key;
-    if (k_key)
-    {
-        k_key->destructor = __destructor;
+    *attr = s_default_thread_attributes;
+    attr->is_initialized = 1;
+    return 0;
+}
 
-        *__key = reinterpret_cast<uintptr_t>(k_key);
-        return 0;
-    }
+int pthread_attr_destroy(pthread_attr_t *attr)
+{
+    attr->is_initialized = 0;
+    return 0;
+}
 
-    return ENOMEM;
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize)
+{
+    if (stacksize < configMINIMAL_STACK_SIZE * sizeof(StackType_t))
+        return EINVAL;
+
+    attr->stacksize = stacksize;
+    return 0;
 }
 
-int pthread_key_delete(pthread_key_t key)
+int pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *stacksize)
 {
-    auto k_key = reinterpret_cast<k_pthread_key *>(key);
-    delete k_key;
+    *stacksize = attr->stacksize;
     return 0;
 }
 
-void *pthread_getspecific(pthread_key_t key)
+int pthread_attr_setdetachstate(pthread_attr_t *attr, int detachstate)
 {
-    auto tls = reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+    if (detachstate != PTHREAD_CREATE_JOINABLE && detachstate != PTHREAD_CREATE_DETACHED)
+        return EINVAL;
 
-    if (tls)
-    {
-        auto it = tls->storage.find(key);
-        if (it != tls->storage.end())
-            return reinterpret_cast<void *>(it->second);
-    }
+    attr->detachstate = detachstate;
+    return 0;
+}
 
-    return nullptr;
+int pthread_attr_getdetachstate(const pthread_attr_t *attr, int *detachstate)
+{
+    *detachstate = attr->detachstate;
+    return 0;
 }
 
-int pthread_setspecific(pthread_key_t key, const void *value)
+int pthread_attr_setschedparam(pthread_attr_t *attr, const struct sched_param *param)
 {
-    auto tls = reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
-    if (!tls)
-    {
-        tls = new (std::nothrow) k_pthread_tls;
-        if (!tls)
-            return ENOMEM;
-        vTaskSetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX, tls);
-    }
+    if (param->sched_priority < 0 || param->sched_priority >= configMAX_PRIORITIES)
+        return EINVAL;
 
-    try
-    {
-        tls->storage[key] = uintptr_t(value);
-        return 0;
-    }
-    catch (...)
-    {
-        return ENOMEM;
-    }
+    attr->schedparam = *param;
+    return 0;
+}
+
+int pthread_attr_getschedparam(const pthread_attr_t *attr, struct sched_param *param)
+{
+    *param = attr->schedparam;
+    return 0;
+}
+
+int pthread_attr_setaffinity_np(pthread_attr_t *attr, size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    if (cpusetsize < sizeof(cpu_set_t) || !(cpuset->__bits & CORE_MASK))
+        return EINVAL;
+
+    UBaseType_t mask = cpuset->__bits & CORE_MASK;
+    attr_set_affinity(attr, mask == CORE_MASK ? tskNO_AFFINITY : mask);
+    return 0;
+}
+
+int pthread_attr_getaffinity_np(const pthread_attr_t *attr, size_t cpusetsize, cpu_set_t *cpuset)
+{
+    if (cpusetsize < sizeof(cpu_set_t))
+        return EINVAL;
+
+    CPU_ZERO(cpuset);
+    cpuset->__bits = attr_get_affinity(attr) & CORE_MASK;
+    return 0;
+}
+
+int pthread_setaffinity_np(pthread_t thread, size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    k_pthread *k_thrd = reinterpret_cast<k_pthread *>(thread);
+    if (!k_thrd)
+        return ESRCH;
+    if (cpusetsize < sizeof(cpu_set_t) || !(cpuset->__bits & CORE_MASK))
+        return EINVAL;
+
+    UBaseType_t mask = cpuset->__bits & CORE_MASK;
+    vTaskCoreAffinitySet(k_thrd->handle, mask == CORE_MASK ? tskNO_AFFINITY : mask);
+    return 0;
+}
+
+int pthread_getaffinity_np(pthread_t thread, size_t cpusetsize, cpu_set_t *cpuset)
+{
+    k_pthread *k_thrd = reinterpret_cast<k_pthread *>(thread);
+    if (!k_thrd)
+        return ESRCH;
+    if (cpusetsize < sizeof(cpu_set_t))
+        return EINVAL;
+
+    CPU_ZERO(cpuset);
+    cpuset->__bits = uxTaskCoreAffinityGet(k_thrd->handle) & CORE_MASK;
+    return 0;
 }
 
 int pthread_once(pthread_once_t *once_control, void (*init_routine)(void))
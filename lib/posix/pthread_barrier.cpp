@@ -0,0 +1,145 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <FreeRTOS.h>
+#include <atomic.h>
+#include <climits>
+#include <errno.h>
+#include <kernel/driver_impl.hpp>
+#include <platform.h>
+#include <pthread_sync.h>
+#include <semphr.h>
+#include <task.h>
+
+using namespace sys;
+
+static const pthread_barrierattr_t s_default_barrier_attributes = {
+    .is_initialized = true,
+    .process_shared = 0
+};
+
+/* Waiters of consecutive generations block on alternating semaphores. A
+ * generation cannot complete before every waiter of the previous one has
+ * left, so a fast thread never takes a wake-up meant for a slow one.
+ * Released waiters count down leaving once they are past their semaphore,
+ * the barrier cannot be destroyed under them until it is 0. */
+struct k_pthread_barrier
+{
+    StaticSemaphore_t mutex;
+    StaticSemaphore_t wait_semphr[2];
+    uint32_t count;
+    uint32_t arrived;
+    uint32_t generation;
+    volatile uint32_t leaving;
+
+    k_pthread_barrier(uint32_t count) noexcept
+        : count(count), arrived(0), generation(0), leaving(0)
+    {
+        xSemaphoreCreateMutexStatic(&mutex);
+        xSemaphoreCreateCountingStatic(UINT_MAX, 0U, &wait_semphr[0]);
+        xSemaphoreCreateCountingStatic(UINT_MAX, 0U, &wait_semphr[1]);
+    }
+
+    ~k_pthread_barrier()
+    {
+        vSemaphoreDelete(&mutex);
+        vSemaphoreDelete(&wait_semphr[0]);
+        vSemaphoreDelete(&wait_semphr[1]);
+    }
+
+    semaphore_lock lock() noexcept
+    {
+        return { &mutex };
+    }
+};
+
+int pthread_barrierattr_init(pthread_barrierattr_t *__attr)
+{
+    *__attr = s_default_barrier_attributes;
+    return 0;
+}
+
+int pthread_barrierattr_destroy(pthread_barrierattr_t *__attr)
+{
+    __attr->is_initialized = false;
+    return 0;
+}
+
+int pthread_barrierattr_getpshared(const pthread_barrierattr_t *__attr, int *__pshared)
+{
+    *__pshared = 1;
+    return 0;
+}
+
+int pthread_barrierattr_setpshared(pthread_barrierattr_t *__attr, int __pshared)
+{
+    return 0;
+}
+
+int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned count)
+{
+    /* Silence warnings about unused parameters. */
+    (void)attr;
+
+    if (!count)
+        return EINVAL;
+
+    auto k_barrier = new (std::nothrow) k_pthread_barrier(count);
+    if (!k_barrier)
+        return ENOMEM;
+
+    *barrier = reinterpret_cast<uintptr_t>(k_barrier);
+    return 0;
+}
+
+int pthread_barrier_destroy(pthread_barrier_t *barrier)
+{
+    auto k_barrier = reinterpret_cast<k_pthread_barrier *>(*barrier);
+
+    {
+        auto locker = k_barrier->lock();
+        if (k_barrier->arrived || atomic_read(&k_barrier->leaving))
+            return EBUSY;
+    }
+
+    delete k_barrier;
+    return 0;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier)
+{
+    auto k_barrier = reinterpret_cast<k_pthread_barrier *>(*barrier);
+    SemaphoreHandle_t wait_semphr;
+
+    {
+        auto locker = k_barrier->lock();
+        wait_semphr = &k_barrier->wait_semphr[k_barrier->generation & 1];
+
+        /* The last thread to arrive releases the others */
+        if (++k_barrier->arrived == k_barrier->count)
+        {
+            k_barrier->arrived = 0;
+            k_barrier->generation++;
+            atomic_add(&k_barrier->leaving, k_barrier->count - 1);
+            for (uint32_t i = 1; i < k_barrier->count; i++)
+                xSemaphoreGive(wait_semphr);
+            return PTHREAD_BARRIER_SERIAL_THREAD;
+        }
+    }
+
+    xSemaphoreTake(wait_semphr, portMAX_DELAY);
+    /* The last access, the barrier may be destroyed after */
+    atomic_add(&k_barrier->leaving, -1);
+    return 0;
+}
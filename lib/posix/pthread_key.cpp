@@ -0,0 +1,212 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "utils.h"
+#include <FreeRTOS.h>
+#include <atomic.h>
+#include <errno.h>
+#include <new>
+#include <pthread.h>
+#include <task.h>
+
+/* A key is the index of its slot in s_pthread_keys plus the generation of
+ * the slot, so a value set through a deleted key never shows up through a
+ * new key that reuses the slot. Each thread keeps its values in a table hung
+ * off PTHREAD_TLS_INDEX: the first TLS_FAST_KEYS entries are inline, later
+ * ones live in pages allocated by the first set that needs them, and so does
+ * the page directory. */
+#define TLS_FAST_KEYS 8
+#define TLS_PAGE_KEYS 8
+#define TLS_MAX_KEYS 256
+#define TLS_MAX_PAGES ((TLS_MAX_KEYS - TLS_FAST_KEYS) / TLS_PAGE_KEYS)
+#define TLS_KEY_INDEX_BITS 16
+#define TLS_KEY_INDEX_MASK ((pthread_key_t(1) << TLS_KEY_INDEX_BITS) - 1)
+#define TLS_DESTRUCTOR_ITERATIONS 4
+
+struct k_pthread_key
+{
+    /* 0 free, 2 being created, 1 in use */
+    volatile uint32_t used;
+    uint32_t generation;
+    void (*destructor)(void *);
+};
+
+static k_pthread_key s_pthread_keys[TLS_MAX_KEYS];
+
+struct k_pthread_tls_entry
+{
+    pthread_key_t key;
+    uintptr_t value;
+};
+
+struct k_pthread_tls
+{
+    k_pthread_tls_entry fast[TLS_FAST_KEYS];
+    k_pthread_tls_entry **pages;
+
+    ~k_pthread_tls()
+    {
+        if (pages)
+        {
+            for (uint32_t i = 0; i < TLS_MAX_PAGES; i++)
+                delete[] pages[i];
+            delete[] pages;
+        }
+    }
+
+    k_pthread_tls_entry *find(uint32_t index) noexcept
+    {
+        if (index < TLS_FAST_KEYS)
+            return &fast[index];
+        if (!pages)
+            return nullptr;
+
+        index -= TLS_FAST_KEYS;
+        auto page = pages[index / TLS_PAGE_KEYS];
+        return page ? &page[index % TLS_PAGE_KEYS] : nullptr;
+    }
+
+    k_pthread_tls_entry *find_or_add(uint32_t index) noexcept
+    {
+        auto entry = find(index);
+        if (!entry)
+        {
+            if (!pages)
+            {
+                pages = new (std::nothrow) k_pthread_tls_entry *[TLS_MAX_PAGES]();
+                if (!pages)
+                    return nullptr;
+            }
+
+            index -= TLS_FAST_KEYS;
+            auto &page = pages[index / TLS_PAGE_KEYS];
+            page = new (std::nothrow) k_pthread_tls_entry[TLS_PAGE_KEYS]();
+            if (page)
+                entry = &page[index % TLS_PAGE_KEYS];
+        }
+
+        return entry;
+    }
+
+    /* Call the destructor of every live key with a value, clearing the value
+     * first. A destructor may set values again, so repeat a few times. */
+    void run_destructors()
+    {
+        for (int iteration = 0; iteration < TLS_DESTRUCTOR_ITERATIONS; iteration++)
+        {
+            bool called = false;
+            for (uint32_t index = 0; index < TLS_MAX_KEYS; index++)
+            {
+                auto entry = find(index);
+                if (!entry || !entry->value)
+                    continue;
+
+                auto &k_key = s_pthread_keys[index];
+                auto value = reinterpret_cast<void *>(entry->value);
+                entry->value = 0;
+                if (atomic_read(&k_key.used) == 1 && entry->key >> TLS_KEY_INDEX_BITS == k_key.generation && k_key.destructor)
+                {
+                    k_key.destructor(value);
+                    called = true;
+                }
+            }
+
+            if (!called)
+                break;
+        }
+    }
+};
+
+void pthread_tls_run_destructors(void)
+{
+    auto tls = reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+    if (tls)
+        tls->run_destructors();
+}
+
+void pthread_tls_free(TaskHandle_t task)
+{
+    delete reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(task, PTHREAD_TLS_INDEX));
+}
+
+int pthread_key_create(pthread_key_t *__key, void (*__destructor)(void *))
+{
+    for (uint32_t i = 0; i < TLS_MAX_KEYS; i++)
+    {
+        auto &k_key = s_pthread_keys[i];
+        if (atomic_cas(&k_key.used, 0, 2) == 0)
+        {
+            k_key.destructor = __destructor;
+            k_key.generation = (k_key.generation + 1) & (UINT32_MAX >> TLS_KEY_INDEX_BITS);
+            /* Key 0 is never handed out, zeroed entries match no key */
+            if (!k_key.generation)
+                k_key.generation = 1;
+            mb();
+            atomic_set(&k_key.used, 1);
+
+            *__key = pthread_key_t(k_key.generation << TLS_KEY_INDEX_BITS) | i;
+            return 0;
+        }
+    }
+
+    return EAGAIN;
+}
+
+int pthread_key_delete(pthread_key_t key)
+{
+    uint32_t index = key & TLS_KEY_INDEX_MASK;
+    if (index >= TLS_MAX_KEYS || s_pthread_keys[index].generation != key >> TLS_KEY_INDEX_BITS)
+        return EINVAL;
+
+    return atomic_cas(&s_pthread_keys[index].used, 1, 0) == 1 ? 0 : EINVAL;
+}
+
+void *pthread_getspecific(pthread_key_t key)
+{
+    auto tls = reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+    uint32_t index = key & TLS_KEY_INDEX_MASK;
+
+    if (tls && index < TLS_MAX_KEYS)
+    {
+        auto entry = tls->find(index);
+        if (entry && entry->key == key)
+            return reinterpret_cast<void *>(entry->value);
+    }
+
+    return nullptr;
+}
+
+int pthread_setspecific(pthread_key_t key, const void *value)
+{
+    uint32_t index = key & TLS_KEY_INDEX_MASK;
+    if (index >= TLS_MAX_KEYS)
+        return EINVAL;
+
+    auto tls = reinterpret_cast<k_pthread_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+    if (!tls)
+    {
+        tls = new (std::nothrow) k_pthread_tls();
+        if (!tls)
+            return ENOMEM;
+        vTaskSetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX, tls);
+    }
+
+    auto entry = tls->find_or_add(index);
+    if (!entry)
+        return ENOMEM;
+
+    entry->key = key;
+    entry->value = uintptr_t(value);
+    return 0;
+}
@@ -0,0 +1,284 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "utils.h"
+#include <FreeRTOS.h>
+#include <atomic>
+#include <climits>
+#include <errno.h>
+#include <kernel/driver_impl.hpp>
+#include <platform.h>
+#include <pthread_sync.h>
+#include <semphr.h>
+#include <task.h>
+
+using namespace sys;
+
+static const pthread_rwlockattr_t s_default_rwlock_attributes = {
+    .is_initialized = true,
+    .process_shared = 0
+};
+
+/* Readers take and drop the lock with a CAS on state and never touch the
+ * mutex unless they have to wait. Waiting writers block new readers, so a
+ * stream of readers cannot starve a writer. Waiters re-check after every
+ * wake-up, a spurious one only costs a retry. */
+struct k_pthread_rwlock
+{
+    StaticSemaphore_t mutex;
+    StaticSemaphore_t read_semphr;
+    StaticSemaphore_t write_semphr;
+    /* Number of readers holding the lock, -1 while a writer holds it */
+    std::atomic<int32_t> state;
+    std::atomic<uint32_t> read_waiters;
+    std::atomic<uint32_t> write_waiters;
+    TaskHandle_t writer;
+
+    k_pthread_rwlock() noexcept
+        : state(0), read_waiters(0), write_waiters(0), writer(nullptr)
+    {
+        xSemaphoreCreateMutexStatic(&mutex);
+        xSemaphoreCreateCountingStatic(UINT_MAX, 0U, &read_semphr);
+        xSemaphoreCreateCountingStatic(UINT_MAX, 0U, &write_semphr);
+    }
+
+    ~k_pthread_rwlock()
+    {
+        vSemaphoreDelete(&mutex);
+        vSemaphoreDelete(&read_semphr);
+        vSemaphoreDelete(&write_semphr);
+    }
+
+    semaphore_lock guard() noexcept
+    {
+        return { &mutex };
+    }
+
+    bool try_read() noexcept
+    {
+        int32_t readers = state.load();
+        while (readers >= 0 && !write_waiters.load())
+        {
+            if (state.compare_exchange_weak(readers, readers + 1))
+                return true;
+        }
+
+        return false;
+    }
+
+    bool try_write() noexcept
+    {
+        int32_t expected = 0;
+        if (state.compare_exchange_strong(expected, -1))
+        {
+            writer = xTaskGetCurrentTaskHandle();
+            return true;
+        }
+
+        return false;
+    }
+
+    int acquire(bool write, TickType_t delay) noexcept
+    {
+        if (write ? try_write() : try_read())
+            return 0;
+        if (!delay)
+            return ETIMEDOUT;
+
+        auto &waiters = write ? write_waiters : read_waiters;
+        auto semphr = write ? &write_semphr : &read_semphr;
+        TimeOut_t timeout;
+        vTaskSetTimeOutState(&timeout);
+
+        while (true)
+        {
+            {
+                auto locker = guard();
+                /* Count ourselves before the last check, the unlocker checks in the other order */
+                waiters++;
+                if (write ? try_write() : try_read())
+                {
+                    waiters--;
+                    return 0;
+                }
+            }
+
+            BaseType_t taken = xSemaphoreTake(semphr, delay);
+
+            auto locker = guard();
+            waiters--;
+            if (taken != pdPASS)
+            {
+                /* Readers may only have been waiting for this writer to give up */
+                if (write && !write_waiters.load() && state.load() >= 0)
+                    wake_readers();
+                return ETIMEDOUT;
+            }
+
+            xTaskCheckForTimeOut(&timeout, &delay);
+        }
+    }
+
+    int release() noexcept
+    {
+        int32_t readers = state.load();
+        if (readers < 0)
+        {
+            if (writer != xTaskGetCurrentTaskHandle())
+                return EPERM;
+
+            writer = nullptr;
+            state.store(0);
+            if (write_waiters.load() || read_waiters.load())
+            {
+                auto locker = guard();
+                if (write_waiters.load())
+                    xSemaphoreGive(&write_semphr);
+                else
+                    wake_readers();
+            }
+        }
+        else if (readers > 0)
+        {
+            if (state.fetch_sub(1) == 1 && write_waiters.load())
+            {
+                auto locker = guard();
+                if (write_waiters.load())
+                    xSemaphoreGive(&write_semphr);
+            }
+        }
+        else
+        {
+            return EPERM;
+        }
+
+        return 0;
+    }
+
+private:
+    /* Call with the mutex held */
+    void wake_readers() noexcept
+    {
+        for (uint32_t i = 0; i < read_waiters.load(); i++)
+            xSemaphoreGive(&read_semphr);
+    }
+};
+
+static void pthread_rwlock_init_if_static(pthread_rwlock_t *rwlock)
+{
+    if (*rwlock == PTHREAD_RWLOCK_INITIALIZER)
+    {
+        configASSERT(pthread_rwlock_init(rwlock, nullptr) == 0);
+    }
+}
+
+static TickType_t abstime_to_delay(const struct timespec *abstime)
+{
+    return abstime ? timespec_to_ticks(*abstime) : portMAX_DELAY;
+}
+
+int pthread_rwlockattr_init(pthread_rwlockattr_t *__attr)
+{
+    *__attr = s_default_rwlock_attributes;
+    return 0;
+}
+
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t *__attr)
+{
+    __attr->is_initialized = false;
+    return 0;
+}
+
+int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *__attr, int *__pshared)
+{
+    *__pshared = 1;
+    return 0;
+}
+
+int pthread_rwlockattr_setpshared(pthread_rwlockattr_t *__attr, int __pshared)
+{
+    return 0;
+}
+
+int pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr)
+{
+    /* Silence warnings about unused parameters. */
+    (void)attr;
+
+    auto k_rwlock = new (std::nothrow) k_pthread_rwlock();
+    if (!k_rwlock)
+        return ENOMEM;
+
+    *rwlock = reinterpret_cast<uintptr_t>(k_rwlock);
+    return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+    if (*rwlock == PTHREAD_RWLOCK_INITIALIZER)
+        return 0;
+
+    auto k_rwlock = reinterpret_cast<k_pthread_rwlock *>(*rwlock);
+    if (k_rwlock->state.load() != 0)
+        return EBUSY;
+
+    delete k_rwlock;
+    return 0;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+    return pthread_rwlock_timedrdlock(rwlock, NULL);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+{
+    pthread_rwlock_init_if_static(rwlock);
+    int iStatus = reinterpret_cast<k_pthread_rwlock *>(*rwlock)->acquire(false, 0);
+
+    /* POSIX specifies EBUSY instead of ETIMEDOUT for a lock that is held. */
+    return iStatus == ETIMEDOUT ? EBUSY : iStatus;
+}
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock, const struct timespec *abstime)
+{
+    pthread_rwlock_init_if_static(rwlock);
+    return reinterpret_cast<k_pthread_rwlock *>(*rwlock)->acquire(false, abstime_to_delay(abstime));
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+    return pthread_rwlock_timedwrlock(rwlock, NULL);
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
+{
+    pthread_rwlock_init_if_static(rwlock);
+    int iStatus = reinterpret_cast<k_pthread_rwlock *>(*rwlock)->acquire(true, 0);
+
+    /* POSIX specifies EBUSY instead of ETIMEDOUT for a lock that is held. */
+    return iStatus == ETIMEDOUT ? EBUSY : iStatus;
+}
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock, const struct timespec *abstime)
+{
+    pthread_rwlock_init_if_static(rwlock);
+    return reinterpret_cast<k_pthread_rwlock *>(*rwlock)->acquire(true, abstime_to_delay(abstime));
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+    pthread_rwlock_init_if_static(rwlock);
+    return reinterpret_cast<k_pthread_rwlock *>(*rwlock)->release();
+}
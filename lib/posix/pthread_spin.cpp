@@ -0,0 +1,107 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <FreeRTOS.h>
+#include <atomic.h>
+#include <encoding.h>
+#include <errno.h>
+#include <pthread_sync.h>
+
+/* Like a corelock the word records the holding core, 1 + core id, 0 while
+ * free. The holder runs with interrupts masked on its own core only, so it is
+ * never preempted by a task that would spin on the same lock, and only the
+ * other core ever spins. Whether interrupts were enabled before is kept in
+ * the word too, so nested spin locks unmask again at the outermost unlock.
+ * Keep the critical sections short and never block in them. */
+
+#define SPIN_CORE_MASK 0xFFU
+#define SPIN_IRQ_ENABLED 0x100U
+
+static inline pthread_spinlock_t spin_self(void)
+{
+    return (pthread_spinlock_t)uxPortGetProcessorId() + 1;
+}
+
+static inline pthread_spinlock_t spin_irq_save(void)
+{
+    return (clear_csr(mstatus, MSTATUS_MIE) & MSTATUS_MIE) ? SPIN_IRQ_ENABLED : 0;
+}
+
+static inline void spin_irq_restore(pthread_spinlock_t word)
+{
+    if (word & SPIN_IRQ_ENABLED)
+        set_csr(mstatus, MSTATUS_MIE);
+}
+
+int pthread_spin_init(pthread_spinlock_t *spinlock, int pshared)
+{
+    (void)pshared;
+
+    *spinlock = 0;
+    return 0;
+}
+
+int pthread_spin_destroy(pthread_spinlock_t *spinlock)
+{
+    if (atomic_read(spinlock))
+        return EBUSY;
+
+    return 0;
+}
+
+int pthread_spin_lock(pthread_spinlock_t *spinlock)
+{
+    pthread_spinlock_t irq = spin_irq_save();
+    pthread_spinlock_t self = spin_self();
+
+    if ((atomic_read(spinlock) & SPIN_CORE_MASK) == self)
+    {
+        spin_irq_restore(irq);
+        return EDEADLK;
+    }
+
+    do
+    {
+        while (atomic_read(spinlock))
+            ;
+    } while (atomic_cas(spinlock, 0, self | irq) != 0);
+
+    return 0;
+}
+
+int pthread_spin_trylock(pthread_spinlock_t *spinlock)
+{
+    pthread_spinlock_t irq = spin_irq_save();
+
+    if (atomic_cas(spinlock, 0, spin_self() | irq) != 0)
+    {
+        spin_irq_restore(irq);
+        return EBUSY;
+    }
+
+    return 0;
+}
+
+int pthread_spin_unlock(pthread_spinlock_t *spinlock)
+{
+    pthread_spinlock_t word = atomic_read(spinlock);
+
+    if ((word & SPIN_CORE_MASK) != spin_self())
+        return EPERM;
+
+    mb();
+    atomic_set(spinlock, 0);
+    spin_irq_restore(word);
+    return 0;
+}
@@ -0,0 +1,31 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sys/uio.h"
+#include <devices.h>
+
+static_assert(sizeof(iovec) == sizeof(io_vec_t) && offsetof(iovec, iov_base) == offsetof(io_vec_t, base)
+        && offsetof(iovec, iov_len) == offsetof(io_vec_t, len),
+    "struct iovec must match io_vec_t.");
+
+/* io_readv and io_writev set errno */
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    return io_readv(fd, reinterpret_cast<const io_vec_t *>(iov), iovcnt);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    return io_writev(fd, reinterpret_cast<const io_vec_t *>(iov), iovcnt);
+}
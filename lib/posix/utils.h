@@ -15,8 +15,10 @@
 #ifndef _POSIX_UTILS_H
 #define _POSIX_UTILS_H
 
+#include <FreeRTOS.h>
 #include <cstdint>
 #include <sys/time.h>
+#include <task.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +26,12 @@ extern "C" {
 
 uint32_t timespec_to_ticks(const struct timespec &ts);
 
+/* Run the key destructors of the calling thread, see pthread_key.cpp */
+void pthread_tls_run_destructors(void);
+
+/* Free the key values of a task, NULL for the calling one */
+void pthread_tls_free(TaskHandle_t task);
+
 #ifdef __cplusplus
 }
 #endif
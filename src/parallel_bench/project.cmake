@@ -0,0 +1,3 @@
+# The benchmark is shared with the host tests, see tests/parallel_bench.c.
+# Build it for the board with -DPROJ=parallel_bench.
+target_sources(${PROJECT_NAME} PRIVATE ${SDK_ROOT}/tests/parallel_bench.c)
@@ -0,0 +1,196 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "queue.h"
+#include "semphr.h"
+#include <core_channel.h>
+
+/*
+ * Cross-core message latency (ping-pong between core 0 and core 1) and
+ * one-way throughput for batches of 1 and 16, through core_channel and
+ * through a FreeRTOS queue. On the host a doorbell is an extra hop through
+ * the interrupt thread of the other core, so latency reads high there.
+ *
+ *   core_channel_bench [messages]
+ */
+
+#define BATCH 16
+
+typedef struct
+{
+    const char *name;
+    int use_queue;
+    size_t batch;
+    uint32_t messages;
+    core_channel_t *channels[2];
+    QueueHandle_t queues[2];
+    SemaphoreHandle_t done;
+} bench_t;
+
+static size_t bench_send(bench_t *bench, int dir, const uint32_t *items, size_t count)
+{
+    if (!bench->use_queue)
+        return core_channel_send(bench->channels[dir], items, count);
+
+    size_t sent = 0;
+    while (sent < count && xQueueSend(bench->queues[dir], &items[sent], 0) == pdTRUE)
+        sent++;
+    return sent;
+}
+
+static size_t bench_receive(bench_t *bench, int dir, uint32_t *items, size_t max_count)
+{
+    if (!bench->use_queue)
+        return core_channel_receive(bench->channels[dir], items, max_count, portMAX_DELAY);
+
+    size_t count = 0;
+    if (xQueueReceive(bench->queues[dir], &items[count], portMAX_DELAY) == pdTRUE)
+        count++;
+    while (count < max_count && xQueueReceive(bench->queues[dir], &items[count], 0) == pdTRUE)
+        count++;
+    return count;
+}
+
+static void echo_task(void *arg)
+{
+    bench_t *bench = (bench_t *)arg;
+    uint32_t item;
+    for (uint32_t i = 0; i < bench->messages; i++)
+    {
+        HOST_ASSERT(bench_receive(bench, 0, &item, 1) == 1);
+        while (!bench_send(bench, 1, &item, 1))
+            taskYIELD();
+    }
+
+    xSemaphoreGive(bench->done);
+    vTaskDelete(NULL);
+}
+
+static void sink_task(void *arg)
+{
+    bench_t *bench = (bench_t *)arg;
+    uint32_t items[BATCH * 4];
+    uint32_t expected = 0;
+    while (expected < bench->messages)
+    {
+        size_t count = bench_receive(bench, 0, items, BATCH * 4);
+        for (size_t i = 0; i < count; i++)
+            HOST_ASSERT(items[i] == expected++);
+    }
+
+    xSemaphoreGive(bench->done);
+    vTaskDelete(NULL);
+}
+
+static void setup(bench_t *bench)
+{
+    for (int dir = 0; dir < 2; dir++)
+    {
+        if (bench->use_queue)
+            bench->queues[dir] = xQueueCreate(BATCH * 8, sizeof(uint32_t));
+        else
+            bench->channels[dir] = core_channel_create(CORE_CHANNEL_SPSC, sizeof(uint32_t), BATCH * 8);
+    }
+
+    bench->done = xSemaphoreCreateBinary();
+}
+
+static void teardown(bench_t *bench)
+{
+    for (int dir = 0; dir < 2; dir++)
+    {
+        if (bench->use_queue)
+        {
+            vQueueDelete(bench->queues[dir]);
+        }
+        else
+        {
+            core_channel_stats_t stats;
+            core_channel_get_stats(bench->channels[dir], &stats);
+            if (dir == 0)
+                printf("  (%zu doorbells)", stats.doorbells);
+            core_channel_delete(bench->channels[dir]);
+        }
+    }
+
+    printf("\n");
+    vSemaphoreDelete(bench->done);
+}
+
+static void latency(bench_t *bench)
+{
+    setup(bench);
+    HOST_ASSERT(xTaskCreateAtProcessor(1, echo_task, "echo", configMINIMAL_STACK_SIZE, bench, 2, NULL) == pdPASS);
+
+    uint64_t start = host_time_ns();
+    for (uint32_t i = 0; i < bench->messages; i++)
+    {
+        uint32_t item = i;
+        while (!bench_send(bench, 0, &item, 1))
+            taskYIELD();
+        HOST_ASSERT(bench_receive(bench, 1, &item, 1) == 1 && item == i);
+    }
+
+    uint64_t elapsed = host_time_ns() - start;
+    HOST_ASSERT(xSemaphoreTake(bench->done, portMAX_DELAY) == pdTRUE);
+    printf("%-14s latency          %8.0f ns one way", bench->name, (double)elapsed / bench->messages / 2);
+    teardown(bench);
+}
+
+static void throughput(bench_t *bench)
+{
+    setup(bench);
+    HOST_ASSERT(xTaskCreateAtProcessor(1, sink_task, "sink", configMINIMAL_STACK_SIZE, bench, 2, NULL) == pdPASS);
+
+    uint32_t items[BATCH];
+    uint64_t start = host_time_ns();
+    for (uint32_t seq = 0; seq < bench->messages;)
+    {
+        size_t count = bench->batch;
+        if (seq + count > bench->messages)
+            count = bench->messages - seq;
+        for (size_t i = 0; i < count; i++)
+            items[i] = seq + i;
+
+        size_t sent = bench_send(bench, 0, items, count);
+        if (!sent)
+            taskYIELD();
+        seq += sent;
+    }
+
+    HOST_ASSERT(xSemaphoreTake(bench->done, portMAX_DELAY) == pdTRUE);
+    uint64_t elapsed = host_time_ns() - start;
+    printf("%-14s throughput x%-3zu %8.2f Mmsg/s", bench->name, bench->batch, bench->messages * 1e3 / elapsed);
+    teardown(bench);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t messages = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 200000;
+
+    for (int use_queue = 0; use_queue < 2; use_queue++)
+    {
+        const char *name = use_queue ? "queue" : "core_channel";
+        bench_t bench = { name, use_queue, 1, messages / 10 + 1 };
+        latency(&bench);
+
+        bench.messages = messages;
+        throughput(&bench);
+        bench.batch = BATCH;
+        throughput(&bench);
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+#include <core_channel.h>
+
+#define MESSAGES 200000
+#define SENDERS (portNUM_PROCESSORS + 1)
+
+typedef struct
+{
+    uint32_t sender;
+    uint32_t seq;
+} message_t;
+
+static core_channel_t *s_channel;
+static SemaphoreHandle_t s_done;
+
+static void test_basic(void)
+{
+    core_channel_t *channel = core_channel_create(CORE_CHANNEL_SPSC, sizeof(uint32_t), 5);
+    HOST_ASSERT(channel);
+
+    uint32_t items[16];
+    HOST_ASSERT(core_channel_receive(channel, items, 16, 0) == 0);
+
+    /* Capacity is rounded up to 8 */
+    for (uint32_t i = 0; i < 16; i++)
+        items[i] = i;
+    HOST_ASSERT(core_channel_send(channel, items, 16) == 8);
+    HOST_ASSERT(core_channel_send(channel, items, 1) == 0);
+
+    uint32_t received[16];
+    HOST_ASSERT(core_channel_receive(channel, received, 3, 0) == 3);
+    HOST_ASSERT(received[0] == 0 && received[1] == 1 && received[2] == 2);
+    HOST_ASSERT(core_channel_send(channel, items + 8, 4) == 3);
+    HOST_ASSERT(core_channel_receive(channel, received, 16, 0) == 8);
+    for (uint32_t i = 0; i < 8; i++)
+        HOST_ASSERT(received[i] == i + 3);
+
+    /* Times out empty */
+    uint64_t start = host_time_ns();
+    HOST_ASSERT(core_channel_receive(channel, received, 16, 2) == 0);
+    HOST_ASSERT(host_time_ns() - start >= 10000000);
+
+    core_channel_stats_t stats;
+    core_channel_get_stats(channel, &stats);
+    HOST_ASSERT(stats.sent == 11 && stats.received == 11 && stats.dropped == 10);
+    core_channel_delete(channel);
+}
+
+static void spsc_sender(void *arg)
+{
+    uint32_t batch[16];
+    uint32_t seq = 0;
+    while (seq < MESSAGES)
+    {
+        size_t count = 1 + seq % 16;
+        for (size_t i = 0; i < count; i++)
+            batch[i] = seq + i;
+        if (seq + count > MESSAGES)
+            count = MESSAGES - seq;
+        size_t sent = core_channel_send(s_channel, batch, count);
+        if (!sent)
+            taskYIELD();
+        seq += sent;
+    }
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void spsc_receiver(void *arg)
+{
+    uint32_t batch[32];
+    uint32_t expected = 0;
+    while (expected < MESSAGES)
+    {
+        size_t count = core_channel_receive(s_channel, batch, 32, portMAX_DELAY);
+        HOST_ASSERT(count);
+        for (size_t i = 0; i < count; i++)
+            HOST_ASSERT(batch[i] == expected++);
+    }
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void test_spsc(void)
+{
+    s_channel = core_channel_create(CORE_CHANNEL_SPSC, sizeof(uint32_t), 64);
+    s_done = xSemaphoreCreateCounting(2, 0);
+    HOST_ASSERT(xTaskCreateAtProcessor(1, spsc_receiver, "rx", configMINIMAL_STACK_SIZE, NULL, 2, NULL) == pdPASS);
+    HOST_ASSERT(xTaskCreateAtProcessor(0, spsc_sender, "tx", configMINIMAL_STACK_SIZE, NULL, 1, NULL) == pdPASS);
+    for (int i = 0; i < 2; i++)
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+
+    core_channel_stats_t stats;
+    core_channel_get_stats(s_channel, &stats);
+    HOST_ASSERT(stats.sent == MESSAGES && stats.received == MESSAGES);
+    printf("spsc: %zu dropped sends, %zu doorbells\n", stats.dropped, stats.doorbells);
+    vSemaphoreDelete(s_done);
+    core_channel_delete(s_channel);
+}
+
+static void mpsc_send(uint32_t sender, uint32_t seq)
+{
+    message_t message = { sender, seq };
+    while (!core_channel_send(s_channel, &message, 1))
+        taskYIELD();
+}
+
+static void mpsc_sender(void *arg)
+{
+    uint32_t sender = (uint32_t)(uintptr_t)arg;
+    for (uint32_t seq = 0; seq < MESSAGES / SENDERS; seq++)
+        mpsc_send(sender, seq);
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void isr_send(void *arg)
+{
+    message_t message = { SENDERS - 1, *(uint32_t *)arg };
+    *(uint32_t *)arg += core_channel_send(s_channel, &message, 1);
+}
+
+/* The last sender posts from interrupts of core 0 */
+static void isr_sender(void *arg)
+{
+    uint32_t seq = 0;
+    while (seq < MESSAGES / SENDERS)
+        host_run_isr(0, isr_send, &seq);
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void mpsc_receiver(void *arg)
+{
+    uint32_t expected[SENDERS] = { 0 };
+    uint32_t total = 0;
+    message_t batch[32];
+    while (total < (MESSAGES / SENDERS) * SENDERS)
+    {
+        size_t count = core_channel_receive(s_channel, batch, 32, portMAX_DELAY);
+        for (size_t i = 0; i < count; i++)
+        {
+            HOST_ASSERT(batch[i].sender < SENDERS);
+            HOST_ASSERT(batch[i].seq == expected[batch[i].sender]++);
+        }
+
+        total += count;
+    }
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void test_mpsc(void)
+{
+    s_channel = core_channel_create(CORE_CHANNEL_MPSC, sizeof(message_t), 32);
+    s_done = xSemaphoreCreateCounting(SENDERS + 1, 0);
+    HOST_ASSERT(xTaskCreateAtProcessor(1, mpsc_receiver, "rx", configMINIMAL_STACK_SIZE, NULL, 2, NULL) == pdPASS);
+    for (uintptr_t sender = 0; sender < SENDERS - 1; sender++)
+        HOST_ASSERT(xTaskCreateAtProcessor(sender % portNUM_PROCESSORS, mpsc_sender, "tx", configMINIMAL_STACK_SIZE, (void *)sender, 1, NULL) == pdPASS);
+    HOST_ASSERT(xTaskCreateAtProcessor(1, isr_sender, "isr", configMINIMAL_STACK_SIZE, NULL, 1, NULL) == pdPASS);
+    for (int i = 0; i < SENDERS + 1; i++)
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+
+    core_channel_stats_t stats;
+    core_channel_get_stats(s_channel, &stats);
+    HOST_ASSERT(stats.sent == stats.received);
+    HOST_ASSERT(stats.received == (MESSAGES / SENDERS) * SENDERS);
+    vSemaphoreDelete(s_done);
+    core_channel_delete(s_channel);
+}
+
+int main(void)
+{
+    test_basic();
+    test_spsc();
+    test_mpsc();
+    printf("core_channel_test passed\n");
+    return 0;
+}
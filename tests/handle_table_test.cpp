@@ -0,0 +1,193 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+#include <atomic>
+#include <kernel/handle_table.hpp>
+#include <vector>
+
+using namespace sys;
+
+#define OFFSET 256
+#define CAPACITY 128
+#define TASKS 4
+#define ROUNDS 200000
+/* More than fit in the table, so allocations also race with a full table */
+#define SHARED_SLOTS 160
+
+struct object_t
+{
+    handle_t handle;
+    std::atomic<int> releases;
+};
+
+typedef handle_table<object_t, CAPACITY, OFFSET> table_t;
+
+static void test_basic()
+{
+    static table_t table;
+    object_t a = {}, b = {};
+
+    handle_t ha = table.allocate(&a);
+    HOST_ASSERT(ha >= OFFSET);
+    HOST_ASSERT(table.get(ha) == &a);
+    HOST_ASSERT(table.get(0) == nullptr && table.get(OFFSET - 1) == nullptr);
+    HOST_ASSERT(table.get(ha + 1) == nullptr);
+
+    HOST_ASSERT(table.release(ha) == &a);
+    HOST_ASSERT(table.get(ha) == nullptr);
+    HOST_ASSERT(table.release(ha) == nullptr);
+
+    /* The slot is reused under a new generation, the old handle stays dead */
+    handle_t hb = table.allocate(&b);
+    HOST_ASSERT(hb != ha);
+    HOST_ASSERT((hb - OFFSET) % (1 << table_t::INDEX_BITS) == (ha - OFFSET) % (1 << table_t::INDEX_BITS));
+    HOST_ASSERT(table.get(ha) == nullptr && table.release(ha) == nullptr);
+    HOST_ASSERT(table.get(hb) == &b);
+
+    /* Generations wrap before handles leave the POSIX fd range */
+    for (uint32_t i = 0; i <= table_t::GENERATION_MASK; i++)
+    {
+        HOST_ASSERT(table.release(hb) == &b);
+        hb = table.allocate(&b);
+        HOST_ASSERT(hb && hb < 0x80000000U);
+    }
+
+    HOST_ASSERT(table.release(hb) == &b);
+}
+
+static void test_capacity()
+{
+    static table_t table;
+    static object_t objects[CAPACITY];
+    handle_t handles[CAPACITY];
+
+    for (int round = 0; round < 2; round++)
+    {
+        for (size_t i = 0; i < CAPACITY; i++)
+        {
+            handles[i] = table.allocate(&objects[i]);
+            HOST_ASSERT(handles[i]);
+        }
+
+        HOST_ASSERT(table.allocate(&objects[0]) == 0);
+        for (size_t i = 0; i < CAPACITY; i++)
+        {
+            HOST_ASSERT(table.get(handles[i]) == &objects[i]);
+            HOST_ASSERT(table.release(handles[i]) == &objects[i]);
+        }
+    }
+}
+
+static table_t s_table;
+static std::atomic<handle_t> s_shared[SHARED_SLOTS];
+static std::atomic<uint32_t> s_full;
+static SemaphoreHandle_t s_done;
+
+/* Objects are never freed, a racing get may still look at one after its release */
+static void release_checked(handle_t handle)
+{
+    if (auto object = s_table.release(handle))
+    {
+        HOST_ASSERT(object->handle == handle);
+        HOST_ASSERT(object->releases.fetch_add(1) == 0);
+    }
+}
+
+/* Tasks allocate, look up, and close handles that other tasks may close at the
+ * same time, so every handle sees double closes and stale lookups */
+static void stress_task(void *arg)
+{
+    auto objects = static_cast<object_t *>(arg);
+    uint32_t seed = uint32_t(uintptr_t(arg)) | 1;
+
+    for (uint32_t round = 0; round < ROUNDS; round++)
+    {
+        seed = seed * 1103515245 + 12345;
+        auto object = &objects[round];
+        handle_t handle = s_table.allocate(object);
+        if (!handle)
+        {
+            s_full++;
+            release_checked(s_shared[(seed >> 8) % SHARED_SLOTS].exchange(0));
+            continue;
+        }
+
+        object->handle = handle;
+        HOST_ASSERT(s_table.get(handle) == object);
+
+        handle_t old = s_shared[(seed >> 8) % SHARED_SLOTS].exchange(handle);
+        if (old)
+        {
+            auto found = s_table.get(old);
+            HOST_ASSERT(!found || found->handle == old);
+            release_checked(old);
+        }
+
+        /* Close a handle another task may be closing or have closed already */
+        handle_t other = s_shared[(seed >> 16) % SHARED_SLOTS].load();
+        if (other && (seed & 0x100))
+            release_checked(other);
+
+        if (!(seed & 0x3F000))
+            taskYIELD();
+    }
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void test_stress()
+{
+    std::vector<object_t> objects(TASKS * ROUNDS);
+    s_done = xSemaphoreCreateCounting(TASKS, 0);
+    for (size_t i = 0; i < TASKS; i++)
+        HOST_ASSERT(xTaskCreateAtProcessor(i % portNUM_PROCESSORS, stress_task, "stress", configMINIMAL_STACK_SIZE, &objects[i * ROUNDS], 1, NULL) == pdPASS);
+    for (size_t i = 0; i < TASKS; i++)
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    vSemaphoreDelete(s_done);
+
+    for (auto &shared : s_shared)
+        release_checked(shared.exchange(0));
+
+    /* Every allocated handle was closed exactly once, so the table is empty again */
+    size_t allocated = 0;
+    for (auto &object : objects)
+    {
+        if (object.handle)
+        {
+            allocated++;
+            HOST_ASSERT(object.releases.load() == 1);
+            HOST_ASSERT(s_table.get(object.handle) == nullptr);
+        }
+    }
+
+    std::vector<handle_t> handles;
+    object_t dummy = {};
+    while (handle_t handle = s_table.allocate(&dummy))
+        handles.push_back(handle);
+    HOST_ASSERT(handles.size() == CAPACITY);
+
+    printf("handle_table: %zu handles, %u allocations found the table full\n", allocated, s_full.load());
+}
+
+int main()
+{
+    test_basic();
+    test_capacity();
+    test_stress();
+    printf("handle_table_test passed\n");
+    return 0;
+}
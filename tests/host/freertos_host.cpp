@@ -0,0 +1,1123 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+#include <atomic>
+#include <atomic.h>
+#include <chrono>
+#include <clint.h>
+#include <condition_variable>
+#include <core_sync.h>
+#include <cstring>
+#include <deque>
+#include <encoding.h>
+#include <hrtimer.h>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+struct host_tcb
+{
+    UBaseType_t core;
+    UBaseType_t affinity;
+    UBaseType_t priority;
+    UBaseType_t base_priority;
+    UBaseType_t mutexes_held;
+    void *tls[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+    TaskHookFunction_t tag;
+    TaskFunction_t code;
+    void *arg;
+    char name[configMAX_TASK_NAME_LEN];
+
+    std::mutex lock;
+    std::condition_variable cv;
+    uint32_t notify_value;
+    bool notified;
+    bool suspended;
+    bool deleted;
+};
+
+struct host_queue
+{
+    std::mutex lock;
+    std::condition_variable cv;
+    uint8_t type;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    std::deque<std::vector<uint8_t>> items;
+    host_tcb *holder;
+    UBaseType_t recursion;
+    bool dynamic;
+    /* Tasks inside a send or receive, the queue must not be deleted under them */
+    UBaseType_t users;
+};
+
+/* Counts a task in a queue call, for the check in vQueueDelete */
+struct host_queue_user
+{
+    host_queue *queue;
+
+    host_queue_user(host_queue *queue)
+        : queue(queue)
+    {
+        queue->users++;
+    }
+
+    ~host_queue_user()
+    {
+        queue->users--;
+    }
+};
+
+struct host_isr
+{
+    void (*handler)(void *);
+    void *arg;
+    bool done;
+};
+
+struct host_core
+{
+    /* Held while a task of the core masks interrupts or an ISR runs */
+    std::mutex masked;
+
+    /* Interrupt thread */
+    std::mutex irq_lock;
+    std::condition_variable irq_cv;
+    std::deque<host_isr *> isrs;
+    core_sync_doorbell_t *volatile doorbells = nullptr;
+    std::once_flag started;
+};
+
+/* mtimecmp of a core, a timer thread raises the timer interrupt when mtime reaches it */
+struct host_timer
+{
+    std::mutex lock;
+    std::condition_variable cv;
+    uint64_t compare = UINT64_MAX;
+    std::once_flag started;
+};
+
+/* Never destroyed, the detached interrupt threads still wait on them at exit */
+host_core *const s_cores = new host_core[portNUM_PROCESSORS];
+host_timer *const s_timers = new host_timer[portNUM_PROCESSORS];
+
+/* mtime is base_ticks at base_ns and counts at configTICK_CLOCK_HZ from there */
+std::mutex s_clock_lock;
+std::atomic<UBaseType_t> s_cpu_clock(390000000);
+uint64_t s_mtime_base_ticks;
+uint64_t s_mtime_base_ns;
+thread_local host_clint_t t_clint;
+std::atomic<unsigned long> s_mie[portNUM_PROCESSORS];
+std::recursive_mutex s_kernel;
+const auto s_boot = std::chrono::steady_clock::now();
+
+thread_local host_tcb *t_self;
+thread_local unsigned long t_mstatus = MSTATUS_MIE;
+thread_local UBaseType_t t_critical_nesting;
+thread_local bool t_in_isr;
+thread_local UBaseType_t t_isr_core;
+
+/* locks.c keeps the low 32 bits of a TCB address, so TCBs live below 4 GiB as on the target */
+host_tcb *tcb_alloc()
+{
+    void *memory = mmap(nullptr, sizeof(host_tcb), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    configASSERT(memory != MAP_FAILED);
+    return new (memory) host_tcb();
+}
+
+host_tcb *self()
+{
+    if (!t_self)
+    {
+        /* A thread the port did not start, such as main, runs as a task of core 0 */
+        auto tcb = tcb_alloc();
+        tcb->core = 0;
+        tcb->affinity = tskNO_AFFINITY;
+        tcb->priority = tcb->base_priority = configMAIN_TASK_PRIORITY;
+        strncpy(tcb->name, "main", sizeof(tcb->name) - 1);
+        t_self = tcb;
+    }
+
+    return t_self;
+}
+
+host_tcb *tcb_of(TaskHandle_t task)
+{
+    return task ? reinterpret_cast<host_tcb *>(task) : self();
+}
+
+host_queue *queue_of(QueueHandle_t queue)
+{
+    return *reinterpret_cast<host_queue **>(queue);
+}
+
+UBaseType_t current_core()
+{
+    return t_in_isr ? t_isr_core : self()->core;
+}
+
+std::chrono::steady_clock::duration ticks_to_duration(TickType_t ticks)
+{
+    return std::chrono::milliseconds(uint64_t(ticks) * 1000 / configTICK_RATE_HZ);
+}
+
+/* Wait on cv until ready() holds or the ticks passed, lock is held. As on the
+ * target, a task woken by an interrupt handler of its own core only runs once
+ * the handler returned, so the handler may still touch the task's stack. */
+template <class Lock, class Pred>
+bool wait_ticks(std::condition_variable &cv, Lock &lock, TickType_t ticks, Pred ready)
+{
+    auto deadline = std::chrono::steady_clock::now() + ticks_to_duration(ticks);
+    while (!ready())
+    {
+        if (ticks == portMAX_DELAY)
+            cv.wait(lock);
+        else if (cv.wait_until(lock, deadline) == std::cv_status::timeout)
+            return ready();
+
+        if (!t_in_isr && (t_mstatus & MSTATUS_MIE))
+        {
+            lock.unlock();
+            s_cores[current_core()].masked.lock();
+            s_cores[current_core()].masked.unlock();
+            lock.lock();
+        }
+    }
+
+    return true;
+}
+
+void exit_task()
+{
+    pthread_exit(nullptr);
+}
+
+void irq_thread(UBaseType_t core)
+{
+    auto &c = s_cores[core];
+    t_in_isr = true;
+    t_isr_core = core;
+    t_mstatus = 0;
+
+    std::unique_lock<std::mutex> lock(c.irq_lock);
+    while (true)
+    {
+        c.irq_cv.wait(lock, [&] { return !c.isrs.empty() || atomic_read(&c.doorbells); });
+        auto isrs = std::move(c.isrs);
+        c.isrs.clear();
+        lock.unlock();
+
+        {
+            std::lock_guard<std::mutex> masked(c.masked);
+            for (auto isr : isrs)
+                isr->handler(isr->arg);
+
+            BaseType_t higher_priority_task_woken = pdFALSE;
+            core_sync_doorbell_t *bell = atomic_swap(&c.doorbells, nullptr);
+            while (bell)
+            {
+                core_sync_doorbell_t *next = bell->next;
+                atomic_set(&bell->queued, 0);
+                mb();
+                bell->handler(bell, &higher_priority_task_woken);
+                bell = next;
+            }
+        }
+
+        lock.lock();
+        for (auto isr : isrs)
+            isr->done = true;
+        c.irq_cv.notify_all();
+    }
+}
+
+void start_irq_thread(UBaseType_t core)
+{
+    std::call_once(s_cores[core].started, [core] { std::thread(irq_thread, core).detach(); });
+}
+
+uint64_t mtime_locked(uint64_t now_ns)
+{
+    return s_mtime_base_ticks + (unsigned __int128)(now_ns - s_mtime_base_ns) * configTICK_CLOCK_HZ / 1000000000ULL;
+}
+
+uint64_t mtime()
+{
+    std::lock_guard<std::mutex> lock(s_clock_lock);
+    return mtime_locked(host_time_ns());
+}
+
+void timer_isr(void *)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    hrtimer_handle_irq(hrtimer_now(), &higher_priority_task_woken);
+    vPortUpdateTimerInterrupt();
+}
+
+void timer_thread(UBaseType_t core)
+{
+    auto &t = s_timers[core];
+    /* Default timer slack adds 50 us to every wakeup */
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
+    std::unique_lock<std::mutex> lock(t.lock);
+    while (true)
+    {
+        if (t.compare == UINT64_MAX)
+        {
+            t.cv.wait(lock);
+            continue;
+        }
+
+        uint64_t now = mtime();
+        if (now < t.compare)
+        {
+            /* Woken early by a new compare value or a clock change */
+            t.cv.wait_for(lock, std::chrono::nanoseconds((unsigned __int128)(t.compare - now) * 1000000000ULL / configTICK_CLOCK_HZ));
+            continue;
+        }
+
+        t.compare = UINT64_MAX;
+        lock.unlock();
+        host_run_isr(core, timer_isr, nullptr);
+        lock.lock();
+    }
+}
+
+void set_timer_compare(UBaseType_t core, uint64_t compare)
+{
+    auto &t = s_timers[core];
+    std::call_once(t.started, [core] { std::thread(timer_thread, core).detach(); });
+    std::lock_guard<std::mutex> lock(t.lock);
+    t.compare = compare;
+    t.cv.notify_all();
+}
+
+void task_thunk(host_tcb *tcb)
+{
+    t_self = tcb;
+    tcb->code(tcb->arg);
+}
+
+QueueHandle_t queue_create(StaticQueue_t *buffer, UBaseType_t length, UBaseType_t item_size, UBaseType_t count, uint8_t type)
+{
+    auto queue = new host_queue();
+    queue->type = type;
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->count = count;
+    queue->dynamic = !buffer;
+    if (!buffer)
+        buffer = new StaticQueue_t();
+    *reinterpret_cast<host_queue **>(buffer) = queue;
+    return reinterpret_cast<QueueHandle_t>(buffer);
+}
+
+bool is_mutex(host_queue *queue)
+{
+    return queue->type == queueQUEUE_TYPE_MUTEX || queue->type == queueQUEUE_TYPE_RECURSIVE_MUTEX;
+}
+
+/* Queue lock held, count > 0 */
+void queue_pop(host_queue *queue, void *buffer, bool peek)
+{
+    if (queue->item_size)
+    {
+        memcpy(buffer, queue->items.front().data(), queue->item_size);
+        if (!peek)
+            queue->items.pop_front();
+    }
+
+    if (!peek)
+    {
+        queue->count--;
+        if (is_mutex(queue))
+        {
+            queue->holder = self();
+            queue->holder->mutexes_held++;
+        }
+
+        queue->cv.notify_all();
+    }
+}
+
+/* Queue lock held, returns false if full */
+bool queue_push(host_queue *queue, const void *item, BaseType_t position)
+{
+    if (is_mutex(queue))
+    {
+        if (queue->holder)
+        {
+            queue->holder->mutexes_held--;
+            queue->holder = nullptr;
+        }
+    }
+    else if (queue->count >= queue->length && position != queueOVERWRITE)
+    {
+        return false;
+    }
+
+    if (queue->item_size)
+    {
+        std::vector<uint8_t> data((const uint8_t *)item, (const uint8_t *)item + queue->item_size);
+        if (position == queueOVERWRITE && queue->count)
+        {
+            queue->items.back() = std::move(data);
+            queue->cv.notify_all();
+            return true;
+        }
+        else if (position == queueSEND_TO_FRONT)
+        {
+            queue->items.push_front(std::move(data));
+        }
+        else
+        {
+            queue->items.push_back(std::move(data));
+        }
+    }
+
+    if (queue->count < queue->length || queue->item_size)
+        queue->count++;
+    queue->cv.notify_all();
+    return true;
+}
+}
+
+extern "C"
+{
+unsigned long host_read_mstatus(void)
+{
+    return t_mstatus;
+}
+
+unsigned long host_clear_mstatus(unsigned long bits)
+{
+    unsigned long old = t_mstatus;
+    if ((bits & MSTATUS_MIE) && (old & MSTATUS_MIE))
+        s_cores[current_core()].masked.lock();
+    t_mstatus &= ~bits;
+    return old;
+}
+
+unsigned long host_set_mstatus(unsigned long bits)
+{
+    unsigned long old = t_mstatus;
+    t_mstatus |= bits;
+    if ((bits & MSTATUS_MIE) && !(old & MSTATUS_MIE))
+        s_cores[current_core()].masked.unlock();
+    return old;
+}
+
+unsigned long host_read_mhartid(void)
+{
+    return current_core();
+}
+
+unsigned long host_read_mie(void)
+{
+    return s_mie[current_core()].load();
+}
+
+unsigned long host_set_mie(unsigned long bits)
+{
+    return s_mie[current_core()].fetch_or(bits);
+}
+
+unsigned long host_clear_mie(unsigned long bits)
+{
+    return s_mie[current_core()].fetch_and(~bits);
+}
+
+void host_write_mie(unsigned long value)
+{
+    s_mie[current_core()] = value;
+}
+
+uint64_t host_time_ns(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_boot).count();
+}
+
+void host_run_isr(UBaseType_t core, void (*handler)(void *arg), void *arg)
+{
+    configASSERT(core < portNUM_PROCESSORS);
+    start_irq_thread(core);
+    host_isr isr = { handler, arg, false };
+    auto &c = s_cores[core];
+    std::unique_lock<std::mutex> lock(c.irq_lock);
+    c.isrs.push_back(&isr);
+    c.irq_cv.notify_all();
+    c.irq_cv.wait(lock, [&] { return isr.done; });
+}
+
+void host_run_task(UBaseType_t core, TaskFunction_t task, void *arg, UBaseType_t priority)
+{
+    struct run
+    {
+        TaskFunction_t task;
+        void *arg;
+        StaticSemaphore_t done_buffer;
+        SemaphoreHandle_t done;
+
+        static void thunk(void *arg)
+        {
+            auto r = reinterpret_cast<run *>(arg);
+            r->task(r->arg);
+            xSemaphoreGive(r->done);
+            vTaskDelete(NULL);
+        }
+    } r = { task, arg, {}, nullptr };
+
+    r.done = xSemaphoreCreateBinaryStatic(&r.done_buffer);
+    configASSERT(xTaskCreateAtProcessor(core, run::thunk, "host", configMINIMAL_STACK_SIZE, &r, priority, NULL) == pdPASS);
+    configASSERT(xSemaphoreTake(r.done, portMAX_DELAY) == pdTRUE);
+    vSemaphoreDelete(r.done);
+}
+
+void vPortFatal(const char *file, int line, const char *message)
+{
+    fprintf(stderr, "%s:%d: assertion failed: %s\n", file, line, message);
+    abort();
+}
+
+void vPortDebugBreak(void)
+{
+    abort();
+}
+
+UBaseType_t uxPortGetProcessorId(void)
+{
+    return current_core();
+}
+
+UBaseType_t uxPortIsInISR(void)
+{
+    return t_in_isr;
+}
+
+UBaseType_t uxPortGetCPUClock(void)
+{
+    return s_cpu_clock.load();
+}
+
+volatile host_clint_t *host_clint(void)
+{
+    t_clint.mtime = mtime();
+    return &t_clint;
+}
+
+/* The host has no tick interrupt, mtimecmp only follows the hrtimers */
+void vPortUpdateTimerInterrupt(void)
+{
+    set_timer_compare(current_core(), hrtimer_next_expiry());
+}
+
+void vPortSetCPUClock(UBaseType_t uxClockRate)
+{
+    unsigned long flags = host_clear_mstatus(MSTATUS_MIE);
+    uint64_t now, old_hz, new_hz;
+    {
+        std::lock_guard<std::mutex> lock(s_clock_lock);
+        uint64_t now_ns = host_time_ns();
+        now = mtime_locked(now_ns);
+        old_hz = configTICK_CLOCK_HZ;
+        s_mtime_base_ticks = now;
+        s_mtime_base_ns = now_ns;
+        s_cpu_clock = uxClockRate;
+        new_hz = configTICK_CLOCK_HZ;
+    }
+
+    if (new_hz != old_hz)
+    {
+        hrtimer_clock_changed(now, old_hz, new_hz);
+
+        /* As on the target, every core reprograms its compare from the timer interrupt */
+        for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+            set_timer_compare(core, now);
+    }
+
+    if (flags & MSTATUS_MIE)
+        host_set_mstatus(MSTATUS_MIE);
+}
+
+void vPortYield(void)
+{
+    std::this_thread::yield();
+}
+
+void vPortYieldFromISR(void)
+{
+}
+
+void vPortEnterCritical(void)
+{
+    if (t_critical_nesting++ == 0)
+        host_clear_mstatus(MSTATUS_MIE);
+    s_kernel.lock();
+}
+
+void vPortExitCritical(void)
+{
+    s_kernel.unlock();
+    /* As on the target, leaving the last critical section enables interrupts */
+    if (--t_critical_nesting == 0 && !t_in_isr)
+        host_set_mstatus(MSTATUS_MIE);
+}
+
+int vPortSetInterruptMask(void)
+{
+    s_kernel.lock();
+    return 0;
+}
+
+void vPortClearInterruptMask(int uxSavedStatusValue)
+{
+    s_kernel.unlock();
+}
+
+void vTaskEnterCritical(void)
+{
+    vPortEnterCritical();
+}
+
+void vTaskExitCritical(void)
+{
+    vPortExitCritical();
+}
+
+void *pvPortMalloc(size_t xSize)
+{
+    return malloc(xSize);
+}
+
+void vPortFree(void *pv)
+{
+    free(pv);
+}
+
+BaseType_t xTaskCreateAtProcessor(UBaseType_t uxProcessor, TaskFunction_t pxTaskCode, const char *const pcName, const configSTACK_DEPTH_TYPE usStackDepth, void *const pvParameters, UBaseType_t uxPriority, TaskHandle_t *const pxCreatedTask)
+{
+    configASSERT(uxProcessor < portNUM_PROCESSORS);
+    auto tcb = tcb_alloc();
+    tcb->core = uxProcessor;
+    tcb->affinity = tskNO_AFFINITY;
+    tcb->priority = tcb->base_priority = uxPriority;
+    tcb->code = pxTaskCode;
+    tcb->arg = pvParameters;
+    strncpy(tcb->name, pcName ? pcName : "", sizeof(tcb->name) - 1);
+    if (pxCreatedTask)
+        *pxCreatedTask = reinterpret_cast<TaskHandle_t>(tcb);
+
+    std::thread(task_thunk, tcb).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *const pcName, const configSTACK_DEPTH_TYPE usStackDepth, void *const pvParameters, UBaseType_t uxPriority, TaskHandle_t *const pxCreatedTask)
+{
+    return xTaskCreateAtProcessor(current_core(), pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    auto tcb = tcb_of(xTaskToDelete);
+    if (tcb == t_self)
+        exit_task();
+
+    /* Another task can only be deleted while it is suspended */
+    std::lock_guard<std::mutex> lock(tcb->lock);
+    tcb->deleted = true;
+    tcb->cv.notify_all();
+}
+
+void vTaskSuspend(TaskHandle_t xTaskToSuspend)
+{
+    auto tcb = tcb_of(xTaskToSuspend);
+    configASSERT(tcb == self());
+
+    std::unique_lock<std::mutex> lock(tcb->lock);
+    tcb->suspended = true;
+    tcb->cv.wait(lock, [&] { return !tcb->suspended || tcb->deleted; });
+    if (tcb->deleted)
+    {
+        lock.unlock();
+        exit_task();
+    }
+}
+
+void vTaskResume(TaskHandle_t xTaskToResume)
+{
+    auto tcb = tcb_of(xTaskToResume);
+    std::lock_guard<std::mutex> lock(tcb->lock);
+    tcb->suspended = false;
+    tcb->cv.notify_all();
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    if (xTicksToDelay)
+        std::this_thread::sleep_for(ticks_to_duration(xTicksToDelay));
+    else
+        std::this_thread::yield();
+}
+
+void vTaskSuspendAll(void)
+{
+    s_kernel.lock();
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+    s_kernel.unlock();
+    return pdFALSE;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return TickType_t(host_time_ns() / (1000000000ULL / configTICK_RATE_HZ));
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+    return taskSCHEDULER_RUNNING;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return reinterpret_cast<TaskHandle_t>(self());
+}
+
+char *pcTaskGetName(TaskHandle_t xTaskToQuery)
+{
+    return tcb_of(xTaskToQuery)->name;
+}
+
+UBaseType_t uxTaskProcessorIdGet(TaskHandle_t xTask)
+{
+    return tcb_of(xTask)->core;
+}
+
+void vTaskCoreAffinitySet(TaskHandle_t xTask, UBaseType_t uxCoreAffinityMask)
+{
+    auto tcb = tcb_of(xTask);
+    configASSERT(uxCoreAffinityMask & ((1UL << portNUM_PROCESSORS) - 1));
+
+    /* A task only moves while it has interrupts enabled */
+    configASSERT(tcb != t_self || (t_mstatus & MSTATUS_MIE));
+    tcb->affinity = uxCoreAffinityMask;
+    if (!(uxCoreAffinityMask & (1UL << tcb->core)))
+        tcb->core = __builtin_ctzl(uxCoreAffinityMask);
+}
+
+UBaseType_t uxTaskCoreAffinityGet(TaskHandle_t xTask)
+{
+    return tcb_of(xTask)->affinity;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t xTask)
+{
+    return tcb_of(xTask)->priority;
+}
+
+void vTaskPrioritySet(TaskHandle_t xTask, UBaseType_t uxNewPriority)
+{
+    std::lock_guard<std::recursive_mutex> lock(s_kernel);
+    auto tcb = tcb_of(xTask);
+    if (tcb->priority == tcb->base_priority || uxNewPriority > tcb->priority)
+        tcb->priority = uxNewPriority;
+    tcb->base_priority = uxNewPriority;
+}
+
+void *pvTaskIncrementMutexHeldCount(void)
+{
+    auto tcb = self();
+    tcb->mutexes_held++;
+    return tcb;
+}
+
+void vTaskIncrementMutexHeldCountOf(TaskHandle_t const pxMutexHolder)
+{
+    if (pxMutexHolder)
+        tcb_of(pxMutexHolder)->mutexes_held++;
+}
+
+BaseType_t xTaskPriorityInherit(TaskHandle_t const pxMutexHolder)
+{
+    if (!pxMutexHolder)
+        return pdFALSE;
+
+    auto holder = tcb_of(pxMutexHolder);
+    auto current = self();
+    if (holder->priority < current->priority)
+    {
+        holder->priority = current->priority;
+        return pdTRUE;
+    }
+
+    return holder->base_priority < current->priority ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xTaskPriorityDisinherit(TaskHandle_t const pxMutexHolder)
+{
+    if (!pxMutexHolder)
+        return pdFALSE;
+
+    auto holder = tcb_of(pxMutexHolder);
+    configASSERT(holder == self());
+    configASSERT(holder->mutexes_held);
+    holder->mutexes_held--;
+    if (holder->priority != holder->base_priority && !holder->mutexes_held)
+    {
+        holder->priority = holder->base_priority;
+        return pdTRUE;
+    }
+
+    return pdFALSE;
+}
+
+void vTaskSetTimeOutState(TimeOut_t *const pxTimeOut)
+{
+    pxTimeOut->xOverflowCount = 0;
+    pxTimeOut->xTimeOnEntering = xTaskGetTickCount();
+}
+
+BaseType_t xTaskCheckForTimeOut(TimeOut_t *const pxTimeOut, TickType_t *const pxTicksToWait)
+{
+    if (*pxTicksToWait == portMAX_DELAY)
+        return pdFALSE;
+
+    TickType_t now = xTaskGetTickCount();
+    TickType_t elapsed = now - pxTimeOut->xTimeOnEntering;
+    if (elapsed < *pxTicksToWait)
+    {
+        *pxTicksToWait -= elapsed;
+        vTaskSetTimeOutState(pxTimeOut);
+        return pdFALSE;
+    }
+
+    *pxTicksToWait = 0;
+    return pdTRUE;
+}
+
+void vTaskSetApplicationTaskTag(TaskHandle_t xTask, TaskHookFunction_t pxHookFunction)
+{
+    tcb_of(xTask)->tag = pxHookFunction;
+}
+
+TaskHookFunction_t xTaskGetApplicationTaskTag(TaskHandle_t xTask)
+{
+    return tcb_of(xTask)->tag;
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t xTaskToSet, BaseType_t xIndex, void *pvValue)
+{
+    configASSERT(xIndex < configNUM_THREAD_LOCAL_STORAGE_POINTERS);
+    tcb_of(xTaskToSet)->tls[xIndex] = pvValue;
+}
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t xTaskToQuery, BaseType_t xIndex)
+{
+    configASSERT(xIndex < configNUM_THREAD_LOCAL_STORAGE_POINTERS);
+    return tcb_of(xTaskToQuery)->tls[xIndex];
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    auto tcb = self();
+    std::unique_lock<std::mutex> lock(tcb->lock);
+    wait_ticks(tcb->cv, lock, xTicksToWait, [&] { return tcb->notify_value != 0; });
+    uint32_t value = tcb->notify_value;
+    if (value)
+        tcb->notify_value = xClearCountOnExit ? 0 : value - 1;
+    return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue, TickType_t xTicksToWait)
+{
+    auto tcb = self();
+    std::unique_lock<std::mutex> lock(tcb->lock);
+    if (!tcb->notified)
+        tcb->notify_value &= ~ulBitsToClearOnEntry;
+    bool notified = wait_ticks(tcb->cv, lock, xTicksToWait, [&] { return tcb->notified; });
+    if (pulNotificationValue)
+        *pulNotificationValue = tcb->notify_value;
+    if (notified)
+        tcb->notify_value &= ~ulBitsToClearOnExit;
+    tcb->notified = false;
+    return notified ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xTaskGenericNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, uint32_t *pulPreviousNotificationValue)
+{
+    auto tcb = tcb_of(xTaskToNotify);
+    std::lock_guard<std::mutex> lock(tcb->lock);
+    if (pulPreviousNotificationValue)
+        *pulPreviousNotificationValue = tcb->notify_value;
+
+    BaseType_t result = pdPASS;
+    switch (eAction)
+    {
+    case eSetBits:
+        tcb->notify_value |= ulValue;
+        break;
+    case eIncrement:
+        tcb->notify_value++;
+        break;
+    case eSetValueWithOverwrite:
+        tcb->notify_value = ulValue;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (tcb->notified)
+            result = pdFAIL;
+        else
+            tcb->notify_value = ulValue;
+        break;
+    default:
+        break;
+    }
+
+    tcb->notified = true;
+    tcb->cv.notify_all();
+    return result;
+}
+
+BaseType_t xTaskGenericNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, uint32_t *pulPreviousNotificationValue, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    return xTaskGenericNotify(xTaskToNotify, ulValue, eAction, pulPreviousNotificationValue);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    xTaskGenericNotify(xTaskToNotify, 0, eIncrement, NULL);
+}
+
+void core_sync_ring_doorbell(uint64_t core_id, core_sync_doorbell_t *bell)
+{
+    if (atomic_cas(&bell->queued, 0, 1) != 0)
+        return;
+
+    auto &c = s_cores[core_id];
+    start_irq_thread(core_id);
+    core_sync_doorbell_t *head;
+    do
+    {
+        head = atomic_read(&c.doorbells);
+        bell->next = head;
+    } while (atomic_cas(&c.doorbells, head, bell) != head);
+
+    std::lock_guard<std::mutex> lock(c.irq_lock);
+    c.irq_cv.notify_all();
+}
+
+QueueHandle_t xQueueGenericCreate(const UBaseType_t uxQueueLength, const UBaseType_t uxItemSize, const uint8_t ucQueueType)
+{
+    return queue_create(nullptr, uxQueueLength, uxItemSize, 0, ucQueueType);
+}
+
+QueueHandle_t xQueueGenericCreateStatic(const UBaseType_t uxQueueLength, const UBaseType_t uxItemSize, uint8_t *pucQueueStorage, StaticQueue_t *pxStaticQueue, const uint8_t ucQueueType)
+{
+    return queue_create(pxStaticQueue, uxQueueLength, uxItemSize, 0, ucQueueType);
+}
+
+QueueHandle_t xQueueCreateMutex(const uint8_t ucQueueType)
+{
+    return queue_create(nullptr, 1, 0, 1, ucQueueType);
+}
+
+QueueHandle_t xQueueCreateMutexStatic(const uint8_t ucQueueType, StaticQueue_t *pxStaticQueue)
+{
+    return queue_create(pxStaticQueue, 1, 0, 1, ucQueueType);
+}
+
+QueueHandle_t xQueueCreateCountingSemaphore(const UBaseType_t uxMaxCount, const UBaseType_t uxInitialCount)
+{
+    return queue_create(nullptr, uxMaxCount, 0, uxInitialCount, queueQUEUE_TYPE_COUNTING_SEMAPHORE);
+}
+
+QueueHandle_t xQueueCreateCountingSemaphoreStatic(const UBaseType_t uxMaxCount, const UBaseType_t uxInitialCount, StaticQueue_t *pxStaticQueue)
+{
+    return queue_create(pxStaticQueue, uxMaxCount, 0, uxInitialCount, queueQUEUE_TYPE_COUNTING_SEMAPHORE);
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    auto queue = queue_of(xQueue);
+    {
+        std::lock_guard<std::mutex> lock(queue->lock);
+        configASSERT(queue->users == 0);
+    }
+
+    bool dynamic = queue->dynamic;
+    delete queue;
+    if (dynamic)
+        delete reinterpret_cast<StaticQueue_t *>(xQueue);
+}
+
+BaseType_t xQueueGenericReset(QueueHandle_t xQueue, BaseType_t xNewQueue)
+{
+    auto queue = queue_of(xQueue);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->items.clear();
+    queue->count = 0;
+    queue->cv.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t xQueue, const void *const pvItemToQueue, TickType_t xTicksToWait, const BaseType_t xCopyPosition)
+{
+    auto queue = queue_of(xQueue);
+    std::unique_lock<std::mutex> lock(queue->lock);
+    host_queue_user user(queue);
+    if (!is_mutex(queue) && xCopyPosition != queueOVERWRITE)
+    {
+        if (!wait_ticks(queue->cv, lock, xTicksToWait, [&] { return queue->count < queue->length; }))
+            return errQUEUE_FULL;
+    }
+    else if (is_mutex(queue) && queue->holder != self())
+    {
+        return pdFAIL;
+    }
+
+    return queue_push(queue, pvItemToQueue, xCopyPosition) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueGenericSendFromISR(QueueHandle_t xQueue, const void *const pvItemToQueue, BaseType_t *const pxHigherPriorityTaskWoken, const BaseType_t xCopyPosition)
+{
+    auto queue = queue_of(xQueue);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue_push(queue, pvItemToQueue, xCopyPosition) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueGiveFromISR(QueueHandle_t xQueue, BaseType_t *const pxHigherPriorityTaskWoken)
+{
+    return xQueueGenericSendFromISR(xQueue, NULL, pxHigherPriorityTaskWoken, queueSEND_TO_BACK);
+}
+
+BaseType_t xQueueSemaphoreTake(QueueHandle_t xQueue, TickType_t xTicksToWait)
+{
+    auto queue = queue_of(xQueue);
+    std::unique_lock<std::mutex> lock(queue->lock);
+    host_queue_user user(queue);
+    if (!wait_ticks(queue->cv, lock, xTicksToWait, [&] { return queue->count != 0; }))
+        return errQUEUE_EMPTY;
+
+    queue_pop(queue, nullptr, false);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *const pvBuffer, TickType_t xTicksToWait)
+{
+    auto queue = queue_of(xQueue);
+    std::unique_lock<std::mutex> lock(queue->lock);
+    host_queue_user user(queue);
+    if (!wait_ticks(queue->cv, lock, xTicksToWait, [&] { return queue->count != 0; }))
+        return errQUEUE_EMPTY;
+
+    queue_pop(queue, pvBuffer, false);
+    return pdPASS;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void *const pvBuffer, TickType_t xTicksToWait)
+{
+    auto queue = queue_of(xQueue);
+    std::unique_lock<std::mutex> lock(queue->lock);
+    host_queue_user user(queue);
+    if (!wait_ticks(queue->cv, lock, xTicksToWait, [&] { return queue->count != 0; }))
+        return errQUEUE_EMPTY;
+
+    queue_pop(queue, pvBuffer, true);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue, void *const pvBuffer, BaseType_t *const pxHigherPriorityTaskWoken)
+{
+    auto queue = queue_of(xQueue);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    if (!queue->count)
+        return pdFAIL;
+
+    queue_pop(queue, pvBuffer, false);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+    auto queue = queue_of(xQueue);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t xQueue)
+{
+    auto queue = queue_of(xQueue);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->length - queue->count;
+}
+
+void *xQueueGetMutexHolder(QueueHandle_t xSemaphore)
+{
+    auto queue = queue_of(xSemaphore);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->holder;
+}
+
+BaseType_t xQueueTakeMutexRecursive(QueueHandle_t xMutex, TickType_t xTicksToWait)
+{
+    auto queue = queue_of(xMutex);
+    {
+        std::lock_guard<std::mutex> lock(queue->lock);
+        if (queue->holder == self())
+        {
+            queue->recursion++;
+            return pdPASS;
+        }
+    }
+
+    if (xQueueSemaphoreTake(xMutex, xTicksToWait) != pdPASS)
+        return pdFAIL;
+
+    queue->recursion++;
+    return pdPASS;
+}
+
+BaseType_t xQueueGiveMutexRecursive(QueueHandle_t xMutex)
+{
+    auto queue = queue_of(xMutex);
+    {
+        std::lock_guard<std::mutex> lock(queue->lock);
+        if (queue->holder != self())
+            return pdFAIL;
+        if (--queue->recursion)
+            return pdPASS;
+    }
+
+    return xQueueGenericSend(xMutex, NULL, 0, queueSEND_TO_BACK);
+}
+}
@@ -0,0 +1,73 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _HOST_PORT_H
+#define _HOST_PORT_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Host port of the kernel API used by the host tests.
+ *
+ * Every task is a host thread bound to one of the portNUM_PROCESSORS cores.
+ * Masking interrupts takes the core, so code that keeps per-core state under
+ * the interrupt mask sees the same exclusion as on the target. Doorbells and
+ * host_run_isr run on a per-core interrupt thread once the core unmasks,
+ * and so do hrtimers, on the mtime of host/include/clint.h. Priorities are
+ * bookkeeping only, the host scheduler ignores them.
+ */
+
+/**
+ * @brief       Run a function as an interrupt handler of a core and wait for it
+ *
+ * @param[in]   core        The core id
+ * @param[in]   handler     The handler, uxPortIsInISR() is 1 while it runs
+ * @param[in]   arg         The handler argument
+ */
+void host_run_isr(UBaseType_t core, void (*handler)(void *arg), void *arg);
+
+/**
+ * @brief       Nanoseconds of a monotonic host clock
+ */
+uint64_t host_time_ns(void);
+
+/**
+ * @brief       Create a task on a core and wait until it returned or deleted itself
+ */
+void host_run_task(UBaseType_t core, TaskFunction_t task, void *arg, UBaseType_t priority);
+
+#define HOST_ASSERT(x)                                                    \
+    do                                                                    \
+    {                                                                     \
+        if (!(x))                                                         \
+        {                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+            abort();                                                      \
+        }                                                                 \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_PORT_H */
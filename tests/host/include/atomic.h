@@ -0,0 +1,137 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _BSP_ATOMIC_H
+#define _BSP_ATOMIC_H
+
+/* Host build of lib/arch/include/atomic.h, same interface without the RISC-V
+ * fence and mhartid. */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    unsigned long host_read_mhartid(void);
+
+    typedef struct
+    {
+        int lock;
+    } spinlock_t;
+
+#define SPINLOCK_INIT \
+    {                 \
+        0             \
+    }
+
+#define mb()                      \
+    {                             \
+        __sync_synchronize();     \
+    }
+
+#define atomic_set(ptr, val) (*(volatile typeof(*(ptr)) *)(ptr) = val)
+#define atomic_read(ptr) (*(volatile typeof(*(ptr)) *)(ptr))
+
+#define atomic_add(ptr, inc) __sync_fetch_and_add(ptr, inc)
+#define atomic_or(ptr, inc) __sync_fetch_and_or(ptr, inc)
+#define atomic_swap(ptr, swp) __sync_lock_test_and_set(ptr, swp)
+#define atomic_cas(ptr, cmp, swp) __sync_val_compare_and_swap(ptr, cmp, swp)
+
+    static inline int spinlock_trylock(spinlock_t *lock)
+    {
+        int res = atomic_swap(&lock->lock, -1);
+        mb();
+        return res;
+    }
+
+    static inline void spinlock_lock(spinlock_t *lock)
+    {
+        do
+        {
+            while (atomic_read(&lock->lock))
+                ;
+        } while (spinlock_trylock(lock));
+    }
+
+    static inline void spinlock_unlock(spinlock_t *lock)
+    {
+        mb();
+        atomic_set(&lock->lock, 0);
+    }
+
+    typedef struct
+    {
+        spinlock_t lock;
+        int count;
+        int core;
+    } corelock_t;
+
+#define CORELOCK_INIT          \
+    {                          \
+        .lock = SPINLOCK_INIT, \
+        .count = 0,            \
+        .core = -1             \
+    }
+
+    static inline int corelock_trylock(corelock_t *lock)
+    {
+        int res = 0;
+        int core = (int)host_read_mhartid();
+
+        spinlock_lock(&lock->lock);
+        if (lock->count == 0)
+        {
+            lock->count++;
+            lock->core = core;
+        }
+        else if (lock->core == core)
+        {
+            lock->count++;
+        }
+        else
+        {
+            res = -1;
+        }
+        spinlock_unlock(&lock->lock);
+
+        return res;
+    }
+
+    static inline void corelock_lock(corelock_t *lock)
+    {
+        while (corelock_trylock(lock))
+        {
+            while (atomic_read(&lock->count))
+                ;
+        }
+    }
+
+    static inline void corelock_unlock(corelock_t *lock)
+    {
+        int core = (int)host_read_mhartid();
+
+        spinlock_lock(&lock->lock);
+        if (lock->core == core && --lock->count <= 0)
+        {
+            lock->core = -1;
+            lock->count = 0;
+        }
+        spinlock_unlock(&lock->lock);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BSP_ATOMIC_H */
@@ -0,0 +1,41 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _HOST_CLINT_H
+#define _HOST_CLINT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Only mtime is modelled. It counts at configTICK_CLOCK_HZ of the emulated
+ * cpu clock, so it slows down and speeds up with vPortSetCPUClock as on the
+ * target. Each access through clint samples the host clock. */
+typedef struct _host_clint
+{
+    uint64_t mtime;
+} host_clint_t;
+
+volatile host_clint_t *host_clint(void);
+
+#define clint (host_clint())
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_CLINT_H */
@@ -0,0 +1,54 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _HOST_ENCODING_H
+#define _HOST_ENCODING_H
+
+/* The register layout comes from the real header, only the CSR accessors
+ * are replaced. Clearing MSTATUS_MIE takes the calling task's core, as the
+ * interrupt mask does on the target: no other task nor doorbell runs on that
+ * core until it is set again. mie is kept per core and only read back, the
+ * host port does not look at it. */
+#include_next <encoding.h>
+
+#undef read_csr
+#undef write_csr
+#undef swap_csr
+#undef set_csr
+#undef clear_csr
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+unsigned long host_read_mstatus(void);
+unsigned long host_set_mstatus(unsigned long bits);
+unsigned long host_clear_mstatus(unsigned long bits);
+unsigned long host_read_mhartid(void);
+unsigned long host_read_mie(void);
+unsigned long host_set_mie(unsigned long bits);
+unsigned long host_clear_mie(unsigned long bits);
+void host_write_mie(unsigned long value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define read_csr(reg) host_read_##reg()
+#define write_csr(reg, val) host_write_##reg(val)
+#define set_csr(reg, bit) host_set_##reg(bit)
+#define clear_csr(reg, bit) host_clear_##reg(bit)
+
+#endif /* _HOST_ENCODING_H */
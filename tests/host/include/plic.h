@@ -0,0 +1,107 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _HOST_PLIC_H
+#define _HOST_PLIC_H
+
+#include <platform.h>
+#include <stdint.h>
+
+/*
+ * Host model of the PLIC, see host/plic_host.cpp. Same field names as the
+ * real register block but only PLIC_NUM_CORES targets, and PLIC_BASE_ADDR
+ * points at the model. Reading claim_complete claims the highest priority
+ * pending source enabled for the core above its threshold, writing it
+ * completes the source. The pending bits are kept by the model and raised
+ * with host_plic_raise.
+ */
+
+#define PLIC_NUM_SOURCES (IRQN_MAX - 1)
+#define PLIC_NUM_PRIORITIES (7)
+#define PLIC_NUM_CORES (2)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifdef __cplusplus
+/* claim_complete, reads claim and writes complete for the core it belongs to */
+struct host_plic_claim
+{
+    operator uint32_t() const volatile;
+    void operator=(uint32_t source) volatile;
+
+    uint32_t unused;
+};
+#else
+typedef uint32_t host_plic_claim;
+#endif
+
+typedef struct _plic_source_priorities
+{
+    uint32_t priority[1024];
+} plic_source_priorities_t;
+
+typedef struct _plic_target_enables
+{
+    struct
+    {
+        uint32_t enable[32 * 2];
+    } target[PLIC_NUM_CORES];
+} plic_target_enables_t;
+
+typedef struct _plic_target
+{
+    struct
+    {
+        uint32_t priority_threshold;
+        host_plic_claim claim_complete;
+    } target[PLIC_NUM_CORES];
+} plic_target_t;
+
+typedef struct _plic
+{
+    plic_source_priorities_t source_priorities;
+    plic_target_enables_t target_enables;
+    plic_target_t targets;
+} plic_t;
+
+extern plic_t host_plic;
+
+#undef PLIC_BASE_ADDR
+#define PLIC_BASE_ADDR ((uintptr_t)&host_plic)
+
+/**
+ * @brief       Make a source pending, as its gateway does on an edge
+ */
+void host_plic_raise(uint32_t source);
+
+/**
+ * @brief       Whether a source above the threshold of a core waits for a claim
+ *
+ * This is the external interrupt pending bit of the core, mip.MEIP.
+ */
+int host_plic_meip(uint32_t core);
+
+/**
+ * @brief       Whether any source is pending or claimed and not completed yet
+ */
+int host_plic_busy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_PLIC_H */
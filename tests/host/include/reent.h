@@ -0,0 +1,27 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _HOST_REENT_H
+#define _HOST_REENT_H
+
+/* FreeRTOS.h includes newlib's reent.h for configUSE_NEWLIB_REENTRANT, the
+ * host C library keeps its state per thread already. */
+struct _reent
+{
+    int _errno;
+};
+
+#define _REENT ((struct _reent *)0)
+
+#endif /* _HOST_REENT_H */
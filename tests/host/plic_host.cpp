@@ -0,0 +1,132 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <FreeRTOS.h>
+#include <mutex>
+#include <plic.h>
+
+/*
+ * PLIC model behind host/include/plic.h. A source is pending from
+ * host_plic_raise until a core claims it and in service until the core
+ * completes it, it can be raised again meanwhile but is only claimed again
+ * once completed, as the gateway holds it back.
+ */
+
+plic_t host_plic;
+
+namespace
+{
+#define SOURCE_WORDS ((PLIC_NUM_SOURCES + 32u) / 32u)
+
+std::mutex s_lock;
+uint32_t s_pending[SOURCE_WORDS];
+uint32_t s_in_service[SOURCE_WORDS];
+
+volatile plic_t &regs = host_plic;
+
+bool test_bit(const uint32_t *bits, uint32_t source)
+{
+    return bits[source / 32] & ((uint32_t)1 << (source % 32));
+}
+
+void set_bit(uint32_t *bits, uint32_t source, bool value)
+{
+    if (value)
+        bits[source / 32] |= (uint32_t)1 << (source % 32);
+    else
+        bits[source / 32] &= ~((uint32_t)1 << (source % 32));
+}
+
+/* Highest priority source the core may claim, the lowest id on ties, call locked */
+uint32_t best_source(uint32_t core)
+{
+    uint32_t best = 0;
+    uint32_t best_priority = regs.targets.target[core].priority_threshold;
+
+    for (uint32_t source = 1; source <= PLIC_NUM_SOURCES; source++)
+    {
+        if (!test_bit(s_pending, source) || test_bit(s_in_service, source)
+            || !(regs.target_enables.target[core].enable[source / 32] & ((uint32_t)1 << (source % 32))))
+            continue;
+
+        uint32_t priority = regs.source_priorities.priority[source];
+        if (priority > best_priority)
+        {
+            best = source;
+            best_priority = priority;
+        }
+    }
+
+    return best;
+}
+
+uint32_t core_of(const volatile host_plic_claim *claim)
+{
+    uintptr_t offset = uintptr_t(claim) - uintptr_t(&regs.targets.target[0].claim_complete);
+    uint32_t core = offset / sizeof(regs.targets.target[0]);
+    configASSERT(core < PLIC_NUM_CORES);
+    return core;
+}
+}
+
+host_plic_claim::operator uint32_t() const volatile
+{
+    uint32_t core = core_of(this);
+    std::lock_guard<std::mutex> lock(s_lock);
+    uint32_t source = best_source(core);
+    if (source)
+    {
+        set_bit(s_pending, source, false);
+        set_bit(s_in_service, source, true);
+    }
+
+    return source;
+}
+
+void host_plic_claim::operator=(uint32_t source) volatile
+{
+    core_of(this);
+    configASSERT(source && source <= PLIC_NUM_SOURCES);
+    std::lock_guard<std::mutex> lock(s_lock);
+    set_bit(s_in_service, source, false);
+}
+
+extern "C"
+{
+void host_plic_raise(uint32_t source)
+{
+    configASSERT(source && source <= PLIC_NUM_SOURCES);
+    std::lock_guard<std::mutex> lock(s_lock);
+    set_bit(s_pending, source, true);
+}
+
+int host_plic_meip(uint32_t core)
+{
+    configASSERT(core < PLIC_NUM_CORES);
+    std::lock_guard<std::mutex> lock(s_lock);
+    return best_source(core) != 0;
+}
+
+int host_plic_busy(void)
+{
+    std::lock_guard<std::mutex> lock(s_lock);
+    for (uint32_t i = 0; i < SOURCE_WORDS; i++)
+    {
+        if (s_pending[i] || s_in_service[i])
+            return 1;
+    }
+
+    return 0;
+}
+}
@@ -0,0 +1,27 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include <cstdint>
+#include <malloc.h>
+#include <unistd.h>
+
+/* lib/posix keeps its objects in 32 bit handles, RAM sits below 4 GiB on the
+ * target. Posix tests link without PIE, so the brk heap is low too, and all
+ * threads allocate from it instead of from mmapped per-thread arenas. */
+__attribute__((constructor)) static void posix_host_init()
+{
+    mallopt(M_ARENA_MAX, 1);
+    configASSERT(reinterpret_cast<uintptr_t>(sbrk(0)) < UINT32_MAX);
+}
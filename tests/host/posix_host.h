@@ -0,0 +1,98 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _POSIX_HOST_H
+#define _POSIX_HOST_H
+
+/*
+ * Included ahead of every lib/posix source and posix test. The host C library
+ * declares its own rwlocks, spin locks and barriers, so they are renamed out
+ * of the way here and pthread_sync.h provides the newlib layout as it does on
+ * the target.
+ */
+
+#define pthread_rwlock_t host_pthread_rwlock_t
+#define pthread_rwlockattr_t host_pthread_rwlockattr_t
+#define pthread_spinlock_t host_pthread_spinlock_t
+#define pthread_barrier_t host_pthread_barrier_t
+#define pthread_barrierattr_t host_pthread_barrierattr_t
+
+#define pthread_rwlockattr_init host_pthread_rwlockattr_init
+#define pthread_rwlockattr_destroy host_pthread_rwlockattr_destroy
+#define pthread_rwlockattr_getpshared host_pthread_rwlockattr_getpshared
+#define pthread_rwlockattr_setpshared host_pthread_rwlockattr_setpshared
+#define pthread_rwlock_init host_pthread_rwlock_init
+#define pthread_rwlock_destroy host_pthread_rwlock_destroy
+#define pthread_rwlock_rdlock host_pthread_rwlock_rdlock
+#define pthread_rwlock_tryrdlock host_pthread_rwlock_tryrdlock
+#define pthread_rwlock_timedrdlock host_pthread_rwlock_timedrdlock
+#define pthread_rwlock_wrlock host_pthread_rwlock_wrlock
+#define pthread_rwlock_trywrlock host_pthread_rwlock_trywrlock
+#define pthread_rwlock_timedwrlock host_pthread_rwlock_timedwrlock
+#define pthread_rwlock_unlock host_pthread_rwlock_unlock
+#define pthread_spin_init host_pthread_spin_init
+#define pthread_spin_destroy host_pthread_spin_destroy
+#define pthread_spin_lock host_pthread_spin_lock
+#define pthread_spin_trylock host_pthread_spin_trylock
+#define pthread_spin_unlock host_pthread_spin_unlock
+#define pthread_barrierattr_init host_pthread_barrierattr_init
+#define pthread_barrierattr_destroy host_pthread_barrierattr_destroy
+#define pthread_barrierattr_getpshared host_pthread_barrierattr_getpshared
+#define pthread_barrierattr_setpshared host_pthread_barrierattr_setpshared
+#define pthread_barrier_init host_pthread_barrier_init
+#define pthread_barrier_destroy host_pthread_barrier_destroy
+#define pthread_barrier_wait host_pthread_barrier_wait
+
+#include <pthread.h>
+#include <unistd.h>
+
+#undef pthread_rwlock_t
+#undef pthread_rwlockattr_t
+#undef pthread_spinlock_t
+#undef pthread_barrier_t
+#undef pthread_barrierattr_t
+
+#undef pthread_rwlockattr_init
+#undef pthread_rwlockattr_destroy
+#undef pthread_rwlockattr_getpshared
+#undef pthread_rwlockattr_setpshared
+#undef pthread_rwlock_init
+#undef pthread_rwlock_destroy
+#undef pthread_rwlock_rdlock
+#undef pthread_rwlock_tryrdlock
+#undef pthread_rwlock_timedrdlock
+#undef pthread_rwlock_wrlock
+#undef pthread_rwlock_trywrlock
+#undef pthread_rwlock_timedwrlock
+#undef pthread_rwlock_unlock
+#undef pthread_spin_init
+#undef pthread_spin_destroy
+#undef pthread_spin_lock
+#undef pthread_spin_trylock
+#undef pthread_spin_unlock
+#undef pthread_barrierattr_init
+#undef pthread_barrierattr_destroy
+#undef pthread_barrierattr_getpshared
+#undef pthread_barrierattr_setpshared
+#undef pthread_barrier_init
+#undef pthread_barrier_destroy
+#undef pthread_barrier_wait
+
+#undef _POSIX_READER_WRITER_LOCKS
+#undef _POSIX_SPIN_LOCKS
+#undef _POSIX_BARRIERS
+#undef PTHREAD_RWLOCK_INITIALIZER
+#undef PTHREAD_BARRIER_SERIAL_THREAD
+
+#endif /* _POSIX_HOST_H */
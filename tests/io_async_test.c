@@ -0,0 +1,337 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "kernel/device_priv.h"
+#include "queue.h"
+#include "semphr.h"
+#include <devices.h>
+#include <errno.h>
+#include <string.h>
+
+/*
+ * io_submit of io_async.c against fake devices standing in for the io_*
+ * calls of devices.cpp. Stream devices block in the I/O worker until the
+ * test opens their gate, the native device is taken by io_submit_native and
+ * completed later from a task of its own, as a DMA completion would be.
+ * Checks completion through the callback and the queue, errors, vectored
+ * requests, several requests in flight from one task, a full request queue
+ * and a full completion queue.
+ * CONFIG_IO_WORKER_COUNT and CONFIG_IO_REQUEST_QUEUE_LENGTH come from the
+ * build, so the test and io_async.c agree on them.
+ */
+
+#define STREAM_FILE 1
+#define NATIVE_FILE 2
+#define FAILING_FILE 3
+#define WRITE_FILE 4
+
+#define WAIT_TICKS pdMS_TO_TICKS(5000)
+#define MAX_REQUESTS (CONFIG_IO_WORKER_COUNT + CONFIG_IO_REQUEST_QUEUE_LENGTH + 1)
+
+static SemaphoreHandle_t s_started;
+static SemaphoreHandle_t s_gate;
+static QueueHandle_t s_done;
+static volatile int s_callbacks;
+
+/* A device transfer started, wait until the test lets it finish */
+static void wait_gate(void)
+{
+    xSemaphoreGive(s_started);
+    configASSERT(xSemaphoreTake(s_gate, WAIT_TICKS) == pdTRUE);
+}
+
+static void fill(uint8_t *buffer, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        buffer[i] = (uint8_t)i;
+}
+
+int io_read(handle_t file, uint8_t *buffer, size_t len)
+{
+    if (file == FAILING_FILE)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    configASSERT(file == STREAM_FILE);
+    wait_gate();
+    fill(buffer, len);
+    return (int)len;
+}
+
+int io_write(handle_t file, const uint8_t *buffer, size_t len)
+{
+    configASSERT(file == WRITE_FILE);
+    return (int)len;
+}
+
+int io_readv(handle_t file, const io_vec_t *iov, int iovcnt)
+{
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        fill((uint8_t *)iov[i].base, iov[i].len);
+        total += (int)iov[i].len;
+    }
+
+    return total;
+}
+
+int io_writev(handle_t file, const io_vec_t *iov, int iovcnt)
+{
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += (int)iov[i].len;
+    return total;
+}
+
+static void native_transfer_task(void *arg)
+{
+    io_request_t *request = (io_request_t *)arg;
+    wait_gate();
+    fill((uint8_t *)request->buffer, request->len);
+    io_request_complete(request, (int)request->len, 0);
+    vTaskDelete(NULL);
+}
+
+int io_submit_native(io_request_t *request)
+{
+    if (request->file != NATIVE_FILE)
+        return 0;
+
+    configASSERT(request->pending);
+    configASSERT(xTaskCreate(native_transfer_task, "dma", configMINIMAL_STACK_SIZE, request, 1, NULL) == pdPASS);
+    return 1;
+}
+
+static void on_completion(io_request_t *request, void *userdata)
+{
+    HOST_ASSERT(userdata == &s_callbacks);
+    HOST_ASSERT(!request->pending);
+    s_callbacks++;
+}
+
+static void init_request(io_request_t *request, handle_t file, io_request_op_t op, void *buffer, size_t len)
+{
+    memset(request, 0, sizeof(*request));
+    request->file = file;
+    request->op = op;
+    request->buffer = buffer;
+    request->len = len;
+    request->on_completion = on_completion;
+    request->userdata = (void *)&s_callbacks;
+    request->completion_queue = s_done;
+}
+
+static io_request_t *wait_done(void)
+{
+    io_request_t *request;
+    HOST_ASSERT(xQueueReceive(s_done, &request, WAIT_TICKS) == pdTRUE);
+    return request;
+}
+
+static void check_filled(const uint8_t *buffer, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        HOST_ASSERT(buffer[i] == (uint8_t)i);
+}
+
+static void test_completion(void)
+{
+    uint8_t buffer[16] = { 0 };
+    io_request_t request;
+    init_request(&request, STREAM_FILE, IO_REQUEST_READ, buffer, sizeof(buffer));
+    s_callbacks = 0;
+
+    /* The submitting task goes on while a worker waits for the device */
+    HOST_ASSERT(io_submit(&request) == 0);
+    HOST_ASSERT(xSemaphoreTake(s_started, WAIT_TICKS) == pdTRUE);
+    HOST_ASSERT(request.pending);
+    HOST_ASSERT(io_submit(&request) == -1 && errno == EBUSY);
+
+    xSemaphoreGive(s_gate);
+    HOST_ASSERT(wait_done() == &request);
+    HOST_ASSERT(s_callbacks == 1 && !request.pending);
+    HOST_ASSERT(request.result == sizeof(buffer) && request.error == 0);
+    check_filled(buffer, sizeof(buffer));
+
+    /* A done request can be submitted again, here without a queue */
+    memset(buffer, 0, sizeof(buffer));
+    request.completion_queue = NULL;
+    HOST_ASSERT(io_submit(&request) == 0);
+    HOST_ASSERT(xSemaphoreTake(s_started, WAIT_TICKS) == pdTRUE);
+    xSemaphoreGive(s_gate);
+    while (request.pending)
+        vTaskDelay(1);
+    HOST_ASSERT(s_callbacks == 2 && request.result == sizeof(buffer));
+    check_filled(buffer, sizeof(buffer));
+}
+
+static void test_errors(void)
+{
+    uint8_t buffer[4];
+    io_request_t request;
+
+    HOST_ASSERT(io_submit(NULL) == -1 && errno == EINVAL);
+
+    init_request(&request, FAILING_FILE, IO_REQUEST_READ, buffer, sizeof(buffer));
+    HOST_ASSERT(io_submit(&request) == 0);
+    HOST_ASSERT(wait_done() == &request);
+    HOST_ASSERT(request.result == -1 && request.error == EIO);
+
+    init_request(&request, WRITE_FILE, (io_request_op_t)42, buffer, sizeof(buffer));
+    HOST_ASSERT(io_submit(&request) == 0);
+    HOST_ASSERT(wait_done() == &request);
+    HOST_ASSERT(request.result == -1 && request.error == EINVAL);
+
+    /* A failure does not stick to the next request */
+    init_request(&request, WRITE_FILE, IO_REQUEST_WRITE, buffer, sizeof(buffer));
+    HOST_ASSERT(io_submit(&request) == 0);
+    HOST_ASSERT(wait_done() == &request);
+    HOST_ASSERT(request.result == sizeof(buffer) && request.error == 0);
+}
+
+static void test_vectored(void)
+{
+    uint8_t header[4], payload[12];
+    io_vec_t vecs[] = { { header, sizeof(header) }, { payload, sizeof(payload) } };
+    io_request_t request;
+
+    init_request(&request, WRITE_FILE, IO_REQUEST_WRITEV, vecs, 2);
+    HOST_ASSERT(io_submit(&request) == 0);
+    HOST_ASSERT(wait_done() == &request);
+    HOST_ASSERT(request.result == sizeof(header) + sizeof(payload));
+
+    init_request(&request, STREAM_FILE, IO_REQUEST_READV, vecs, 2);
+    HOST_ASSERT(io_submit(&request) == 0);
+    HOST_ASSERT(wait_done() == &request);
+    HOST_ASSERT(request.result == sizeof(header) + sizeof(payload));
+    check_filled(header, sizeof(header));
+    check_filled(payload, sizeof(payload));
+}
+
+/* One task has a transfer in flight on every worker and a native one at once */
+static void test_overlap(void)
+{
+    uint8_t buffers[CONFIG_IO_WORKER_COUNT + 1][8];
+    io_request_t requests[CONFIG_IO_WORKER_COUNT + 1];
+    const int count = CONFIG_IO_WORKER_COUNT + 1;
+
+    memset(buffers, 0, sizeof(buffers));
+    for (int i = 0; i < count; i++)
+    {
+        init_request(&requests[i], i ? STREAM_FILE : NATIVE_FILE, IO_REQUEST_READ, buffers[i], sizeof(buffers[i]));
+        HOST_ASSERT(io_submit(&requests[i]) == 0);
+    }
+
+    for (int i = 0; i < count; i++)
+        HOST_ASSERT(xSemaphoreTake(s_started, WAIT_TICKS) == pdTRUE);
+    for (int i = 0; i < count; i++)
+        HOST_ASSERT(requests[i].pending);
+
+    for (int i = 0; i < count; i++)
+        xSemaphoreGive(s_gate);
+    for (int i = 0; i < count; i++)
+    {
+        io_request_t *request = wait_done();
+        HOST_ASSERT(request->result == sizeof(buffers[0]) && request->error == 0);
+    }
+
+    for (int i = 0; i < count; i++)
+        check_filled(buffers[i], sizeof(buffers[i]));
+}
+
+/* Completion does not wait for a full completion queue, it counts the drop */
+static void test_completion_overflow(void)
+{
+    uint8_t buffer[4];
+    io_request_t requests[2];
+    QueueHandle_t done = xQueueCreate(1, sizeof(io_request_t *));
+    HOST_ASSERT(done);
+    uint32_t overflows = io_get_completion_overflows();
+    s_callbacks = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        init_request(&requests[i], WRITE_FILE, IO_REQUEST_WRITE, buffer, sizeof(buffer));
+        requests[i].completion_queue = done;
+        HOST_ASSERT(io_submit(&requests[i]) == 0);
+    }
+
+    while (requests[0].pending || requests[1].pending || s_callbacks != 2)
+        vTaskDelay(1);
+    while (io_get_completion_overflows() != overflows + 1)
+        vTaskDelay(1);
+
+    io_request_t *request;
+    HOST_ASSERT(xQueueReceive(done, &request, 0) == pdTRUE);
+    HOST_ASSERT(request == &requests[0] || request == &requests[1]);
+    HOST_ASSERT(xQueueReceive(done, &request, 0) != pdTRUE);
+    vQueueDelete(done);
+}
+
+/* With every worker busy, the queue takes CONFIG_IO_REQUEST_QUEUE_LENGTH more */
+static void test_queue_full(void)
+{
+    static uint8_t buffers[MAX_REQUESTS][4];
+    static io_request_t requests[MAX_REQUESTS];
+    const int accepted = CONFIG_IO_WORKER_COUNT + CONFIG_IO_REQUEST_QUEUE_LENGTH;
+
+    for (int i = 0; i < MAX_REQUESTS; i++)
+        init_request(&requests[i], STREAM_FILE, IO_REQUEST_READ, buffers[i], sizeof(buffers[i]));
+
+    for (int i = 0; i < CONFIG_IO_WORKER_COUNT; i++)
+        HOST_ASSERT(io_submit(&requests[i]) == 0);
+    for (int i = 0; i < CONFIG_IO_WORKER_COUNT; i++)
+        HOST_ASSERT(xSemaphoreTake(s_started, WAIT_TICKS) == pdTRUE);
+    for (int i = CONFIG_IO_WORKER_COUNT; i < accepted; i++)
+        HOST_ASSERT(io_submit(&requests[i]) == 0);
+
+    io_request_t *rejected = &requests[accepted];
+    HOST_ASSERT(io_submit(rejected) == -1 && errno == EAGAIN);
+    HOST_ASSERT(!rejected->pending);
+
+    for (int i = 0; i < accepted; i++)
+        xSemaphoreGive(s_gate);
+    for (int i = 0; i < accepted; i++)
+        HOST_ASSERT(wait_done()->result == sizeof(buffers[0]));
+    for (int i = CONFIG_IO_WORKER_COUNT; i < accepted; i++)
+        HOST_ASSERT(xSemaphoreTake(s_started, WAIT_TICKS) == pdTRUE);
+
+    /* The rejected request can be submitted once there is room */
+    HOST_ASSERT(io_submit(rejected) == 0);
+    HOST_ASSERT(xSemaphoreTake(s_started, WAIT_TICKS) == pdTRUE);
+    xSemaphoreGive(s_gate);
+    HOST_ASSERT(wait_done() == rejected && rejected->result == sizeof(buffers[0]));
+}
+
+int main(void)
+{
+    s_started = xSemaphoreCreateCounting(MAX_REQUESTS, 0);
+    s_gate = xSemaphoreCreateCounting(MAX_REQUESTS, 0);
+    s_done = xQueueCreate(MAX_REQUESTS, sizeof(io_request_t *));
+    HOST_ASSERT(s_started && s_gate && s_done);
+    HOST_ASSERT(io_async_init() == 0);
+
+    test_completion();
+    test_errors();
+    test_vectored();
+    test_overlap();
+    test_queue_full();
+    test_completion_overflow();
+    printf("io_async_test passed\n");
+    return 0;
+}
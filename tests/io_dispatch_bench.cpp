@@ -0,0 +1,204 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include <devices.h>
+#include <kernel/driver_impl.hpp>
+#include <sysctl.h>
+#include <uarths.h>
+
+/*
+ * Cost of a small io_read through the real dispatch of devices.cpp for a
+ * uart opened from the registry, and a file and a socket given a handle with
+ * system_alloc_handle, next to a virtual call straight on the object. The
+ * objects do nothing but count the bytes.
+ *
+ *   io_dispatch_bench [rounds]
+ */
+
+using namespace sys;
+
+#define READ_SIZE 4
+
+static size_t s_bytes;
+
+class bench_uart : public uart_driver, public static_object, public free_object_access
+{
+public:
+    virtual void install() override {}
+    virtual void config(uint32_t baud_rate, uint32_t databits, uart_stopbits_t stopbits, uart_parity_t parity) override {}
+    virtual void set_read_timeout(size_t millisecond) override {}
+    virtual bool submit_async(io_request_t &request) override { return false; }
+
+    virtual int read(gsl::span<uint8_t> buffer) override
+    {
+        s_bytes += buffer.size_bytes();
+        return buffer.size_bytes();
+    }
+
+    virtual int write(gsl::span<const uint8_t> buffer) override { return buffer.size_bytes(); }
+};
+
+class bench_filesystem_file : public filesystem_file, public heap_object, public free_object_access
+{
+public:
+    virtual size_t read(gsl::span<uint8_t> buffer) override
+    {
+        s_bytes += buffer.size_bytes();
+        return buffer.size_bytes();
+    }
+
+    virtual size_t write(gsl::span<const uint8_t> buffer) override { return buffer.size_bytes(); }
+    virtual size_t readv(gsl::span<const io_vec_t> buffers) override { return 0; }
+    virtual size_t writev(gsl::span<const io_vec_t> buffers) override { return 0; }
+    virtual fpos_t get_position() override { return {}; }
+    virtual void set_position(fpos_t position) override {}
+    virtual uint64_t get_size() override { return 0; }
+    virtual void flush() override {}
+};
+
+class bench_socket : public network_socket, public heap_object, public free_object_access
+{
+public:
+    virtual void install() override {}
+    virtual int control(uint32_t control_code, gsl::span<const uint8_t> write_buffer, gsl::span<uint8_t> read_buffer) override { return -1; }
+    virtual object_accessor<network_socket> accept(socket_address_t *remote_address) override { return {}; }
+    virtual void bind(const socket_address_t &address) override {}
+    virtual void connect(const socket_address_t &address) override {}
+    virtual void listen(uint32_t backlog) override {}
+    virtual void shutdown(socket_shutdown_t how) override {}
+    virtual size_t send(gsl::span<const uint8_t> buffer, socket_message_flag_t flags) override { return buffer.size_bytes(); }
+    virtual size_t receive(gsl::span<uint8_t> buffer, socket_message_flag_t flags) override { return read(buffer); }
+    virtual size_t send_to(gsl::span<const uint8_t> buffer, socket_message_flag_t flags, const socket_address_t &to) override { return buffer.size_bytes(); }
+    virtual size_t receive_from(gsl::span<uint8_t> buffer, socket_message_flag_t flags, socket_address_t *from) override { return read(buffer); }
+
+    virtual size_t read(gsl::span<uint8_t> buffer) override
+    {
+        s_bytes += buffer.size_bytes();
+        return buffer.size_bytes();
+    }
+
+    virtual size_t write(gsl::span<const uint8_t> buffer) override { return buffer.size_bytes(); }
+    virtual size_t readv(gsl::span<const io_vec_t> buffers) override { return 0; }
+    virtual size_t writev(gsl::span<const io_vec_t> buffers) override { return 0; }
+    virtual int fcntl(int cmd, int val) override { return 0; }
+    virtual void select(fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout) override {}
+};
+
+/* Neither of the interfaces */
+class bench_object : public heap_object, public free_object_access
+{
+};
+
+static bench_uart s_uart;
+static driver &s_uart_driver = s_uart;
+
+driver_registry_t sys::g_system_drivers[] = {
+    { "/dev/uart1", { std::in_place, &s_uart_driver } },
+    {}
+};
+
+driver_registry_t sys::g_hal_drivers[] = {
+    {}
+};
+
+driver_registry_t sys::g_dma_drivers[] = {
+    {}
+};
+
+/* The clock setup of devices.cpp, unused here */
+static sysctl_t s_sysctl;
+volatile sysctl_t *const sysctl = &s_sysctl;
+
+uint32_t sysctl_clock_get_freq(sysctl_clock_t clock)
+{
+    return 0;
+}
+
+uint32_t sysctl_pll_set_freq(sysctl_pll_t pll, uint32_t pll_freq)
+{
+    return 0;
+}
+
+void uarths_init()
+{
+}
+
+static double time_reads(handle_t file, uint32_t rounds)
+{
+    uint8_t buffer[READ_SIZE];
+    s_bytes = 0;
+    uint64_t start = host_time_ns();
+    for (uint32_t round = 0; round < rounds; round++)
+        HOST_ASSERT(io_read(file, buffer, sizeof(buffer)) == READ_SIZE);
+    double ns = double(host_time_ns() - start) / rounds;
+    HOST_ASSERT(s_bytes == size_t(rounds) * READ_SIZE);
+    return ns;
+}
+
+template <class T>
+__attribute__((noinline)) static int direct_read(T *object, uint8_t *buffer, size_t len)
+{
+    return (int)object->read({ buffer, std::ptrdiff_t(len) });
+}
+
+template <class T>
+static double time_direct_reads(T *object, uint32_t rounds)
+{
+    uint8_t buffer[READ_SIZE];
+    s_bytes = 0;
+    uint64_t start = host_time_ns();
+    for (uint32_t round = 0; round < rounds; round++)
+        HOST_ASSERT(direct_read(object, buffer, sizeof(buffer)) == READ_SIZE);
+    double ns = double(host_time_ns() - start) / rounds;
+    HOST_ASSERT(s_bytes == size_t(rounds) * READ_SIZE);
+    return ns;
+}
+
+template <class T>
+static void bench(const char *name, handle_t file, T *object, uint32_t rounds)
+{
+    HOST_ASSERT(file);
+    double io_ns = time_reads(file, rounds);
+    double direct_ns = time_direct_reads(object, rounds);
+    printf("%-6s io_read %6.1f ns  virtual call %6.1f ns\n", name, io_ns, direct_ns);
+    HOST_ASSERT(io_close(file) == 0);
+}
+
+template <class T>
+static void bench_object_handle(const char *name, uint32_t rounds)
+{
+    object_ptr<T> object(std::in_place);
+    T *raw = object.get();
+    bench(name, system_alloc_handle(make_accessor(object_ptr<object_access>(object))), raw, rounds);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = argc > 1 ? uint32_t(strtoul(argv[1], NULL, 0)) : 10000000;
+    if (!rounds)
+        rounds = 1;
+
+    bench("uart", io_open("/dev/uart1"), &s_uart, rounds);
+    bench_object_handle<bench_filesystem_file>("file", rounds);
+    bench_object_handle<bench_socket>("socket", rounds);
+
+    /* An object without a read interface fails the read */
+    handle_t file = system_alloc_handle(make_accessor(object_ptr<object_access>(object_ptr<bench_object>(std::in_place))));
+    uint8_t buffer[READ_SIZE];
+    HOST_ASSERT(file);
+    HOST_ASSERT(io_read(file, buffer, sizeof(buffer)) == -1);
+    HOST_ASSERT(io_close(file) == 0);
+    return 0;
+}
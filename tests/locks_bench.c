@@ -0,0 +1,110 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+
+/*
+ * Acquire and release of the newlib lock with 1, 2 and 4 tasks spread over
+ * both cores, through locks.c and through a kernel mutex taken with a
+ * 200 tick timeout as the previous locks.c did for every _lock_acquire.
+ *
+ *   locks_bench [rounds per task]
+ */
+
+typedef long _lock_t;
+
+void _lock_init(_lock_t *lock);
+void _lock_acquire(_lock_t *lock);
+void _lock_release(_lock_t *lock);
+
+static _lock_t s_lock;
+static SemaphoreHandle_t s_mutex;
+static volatile uint32_t s_counter;
+
+static void futex_acquire(void)
+{
+    _lock_acquire(&s_lock);
+}
+
+static void futex_release(void)
+{
+    _lock_release(&s_lock);
+}
+
+static void mutex_acquire(void)
+{
+    xSemaphoreTake(s_mutex, 200);
+}
+
+static void mutex_release(void)
+{
+    xSemaphoreGive(s_mutex);
+}
+
+typedef struct
+{
+    void (*acquire)(void);
+    void (*release)(void);
+    uint32_t rounds;
+    SemaphoreHandle_t done;
+} bench_t;
+
+static void lock_task(void *arg)
+{
+    bench_t *bench = (bench_t *)arg;
+    for (uint32_t round = 0; round < bench->rounds; round++)
+    {
+        bench->acquire();
+        s_counter++;
+        bench->release();
+    }
+
+    xSemaphoreGive(bench->done);
+    vTaskDelete(NULL);
+}
+
+static double run(void (*acquire)(void), void (*release)(void), int tasks, uint32_t rounds)
+{
+    bench_t bench = { acquire, release, rounds, xSemaphoreCreateCounting(tasks, 0) };
+    s_counter = 0;
+
+    uint64_t start = host_time_ns();
+    for (int i = 0; i < tasks; i++)
+        HOST_ASSERT(xTaskCreateAtProcessor(i % portNUM_PROCESSORS, lock_task, "lock", configMINIMAL_STACK_SIZE, &bench, 1, NULL) == pdPASS);
+    for (int i = 0; i < tasks; i++)
+        HOST_ASSERT(xSemaphoreTake(bench.done, portMAX_DELAY) == pdTRUE);
+    uint64_t elapsed = host_time_ns() - start;
+
+    HOST_ASSERT(s_counter == (uint32_t)tasks * rounds);
+    vSemaphoreDelete(bench.done);
+    return (double)elapsed / ((double)rounds * tasks);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 1000000;
+    _lock_init(&s_lock);
+    s_mutex = xSemaphoreCreateMutex();
+
+    printf("tasks  mutex ns  locks.c ns\n");
+    for (int tasks = 1; tasks <= 4; tasks *= 2)
+    {
+        double mutex = run(mutex_acquire, mutex_release, tasks, rounds);
+        double futex = run(futex_acquire, futex_release, tasks, rounds);
+        printf("%5d %9.1f %11.1f\n", tasks, mutex, futex);
+    }
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+#include <atomic.h>
+
+typedef long _lock_t;
+
+void _lock_init(_lock_t *lock);
+void _lock_close(_lock_t *lock);
+void _lock_acquire(_lock_t *lock);
+void _lock_acquire_recursive(_lock_t *lock);
+int _lock_try_acquire(_lock_t *lock);
+int _lock_try_acquire_recursive(_lock_t *lock);
+void _lock_release(_lock_t *lock);
+void _lock_release_recursive(_lock_t *lock);
+
+#define STRESS_TASKS 4
+#define STRESS_ROUNDS 100000
+
+static _lock_t s_lock;
+static SemaphoreHandle_t s_done;
+static volatile uint32_t s_counter;
+
+static void try_acquire_task(void *arg)
+{
+    *(int *)arg = _lock_try_acquire(&s_lock);
+    if (*(int *)arg == 0)
+        _lock_release(&s_lock);
+}
+
+static int try_from_other_task(void)
+{
+    int result;
+    host_run_task(1, try_acquire_task, &result, 1);
+    return result;
+}
+
+static void test_basic(void)
+{
+    _lock_init(&s_lock);
+    _lock_acquire(&s_lock);
+    HOST_ASSERT(try_from_other_task() == -1);
+    _lock_release(&s_lock);
+    HOST_ASSERT(try_from_other_task() == 0);
+    HOST_ASSERT(s_lock == 0);
+
+    /* Recursive locks count their depth, the lock is free after the last release */
+    _lock_acquire_recursive(&s_lock);
+    _lock_acquire_recursive(&s_lock);
+    HOST_ASSERT(_lock_try_acquire_recursive(&s_lock) == 0);
+    _lock_release_recursive(&s_lock);
+    _lock_release_recursive(&s_lock);
+    HOST_ASSERT(try_from_other_task() == -1);
+    _lock_release_recursive(&s_lock);
+    HOST_ASSERT(try_from_other_task() == 0);
+
+    /* Releasing a lock held by someone else is ignored */
+    _lock_acquire(&s_lock);
+    host_run_task(1, (TaskFunction_t)_lock_release, &s_lock, 1);
+    HOST_ASSERT(try_from_other_task() == -1);
+    _lock_release(&s_lock);
+    _lock_close(&s_lock);
+}
+
+static void isr_try_acquire(void *arg)
+{
+    *(int *)arg = _lock_try_acquire(&s_lock);
+}
+
+static void isr_release(void *arg)
+{
+    _lock_release(&s_lock);
+}
+
+static void waiter_task(void *arg)
+{
+    _lock_acquire(&s_lock);
+    s_counter++;
+    _lock_release(&s_lock);
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void wait_for_waiters(void)
+{
+    while (!(atomic_read(&s_lock) & (1UL << 63)))
+        vTaskDelay(1);
+}
+
+/* An interrupt may take a free lock without blocking, tasks then queue behind it */
+static void test_isr(void)
+{
+    int result;
+    _lock_init(&s_lock);
+    s_done = xSemaphoreCreateCounting(1, 0);
+    s_counter = 0;
+
+    _lock_acquire(&s_lock);
+    host_run_isr(1, isr_try_acquire, &result);
+    HOST_ASSERT(result == -1);
+    _lock_release(&s_lock);
+
+    host_run_isr(0, isr_try_acquire, &result);
+    HOST_ASSERT(result == 0);
+    HOST_ASSERT(_lock_try_acquire(&s_lock) == -1);
+
+    HOST_ASSERT(xTaskCreateAtProcessor(1, waiter_task, "waiter", configMINIMAL_STACK_SIZE, NULL, 2, NULL) == pdPASS);
+    wait_for_waiters();
+    HOST_ASSERT(s_counter == 0);
+    host_run_isr(0, isr_release, NULL);
+    HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    HOST_ASSERT(s_counter == 1 && s_lock == 0);
+    vSemaphoreDelete(s_done);
+}
+
+typedef struct
+{
+    TaskHandle_t holder;
+    SemaphoreHandle_t locked;
+    SemaphoreHandle_t release;
+} inherit_t;
+
+static void holder_task(void *arg)
+{
+    inherit_t *inherit = (inherit_t *)arg;
+    _lock_acquire(&s_lock);
+    xSemaphoreGive(inherit->locked);
+    xSemaphoreTake(inherit->release, portMAX_DELAY);
+    _lock_release(&s_lock);
+
+    /* Back at the base priority once the lock is gone */
+    HOST_ASSERT(uxTaskPriorityGet(NULL) == 1);
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+/* A waiter boosts the holder as a kernel mutex would, and the notification
+ * value of the waiter is left alone */
+static void test_priority_inheritance(void)
+{
+    inherit_t inherit = { NULL, xSemaphoreCreateBinary(), xSemaphoreCreateBinary() };
+    _lock_init(&s_lock);
+    s_done = xSemaphoreCreateCounting(2, 0);
+    s_counter = 0;
+
+    HOST_ASSERT(xTaskCreateAtProcessor(0, holder_task, "holder", configMINIMAL_STACK_SIZE, &inherit, 1, &inherit.holder) == pdPASS);
+    HOST_ASSERT(xSemaphoreTake(inherit.locked, portMAX_DELAY) == pdTRUE);
+    HOST_ASSERT(uxTaskPriorityGet(inherit.holder) == 1);
+
+    TaskHandle_t waiter;
+    HOST_ASSERT(xTaskCreateAtProcessor(1, waiter_task, "waiter", configMINIMAL_STACK_SIZE, NULL, 5, &waiter) == pdPASS);
+    xTaskNotify(waiter, 0x5A, eSetValueWithOverwrite);
+    wait_for_waiters();
+    HOST_ASSERT(uxTaskPriorityGet(inherit.holder) == 5);
+
+    xSemaphoreGive(inherit.release);
+    for (int i = 0; i < 2; i++)
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    HOST_ASSERT(s_counter == 1 && s_lock == 0);
+
+    vSemaphoreDelete(inherit.locked);
+    vSemaphoreDelete(inherit.release);
+    vSemaphoreDelete(s_done);
+}
+
+static void notify_waiter_task(void *arg)
+{
+    uint32_t value = 0;
+    _lock_acquire(&s_lock);
+    _lock_release(&s_lock);
+    HOST_ASSERT(xTaskNotifyWait(0, 0, &value, 0) == pdTRUE);
+    HOST_ASSERT(value == 0x5A);
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void test_notification(void)
+{
+    _lock_init(&s_lock);
+    s_done = xSemaphoreCreateCounting(1, 0);
+
+    TaskHandle_t waiter;
+    _lock_acquire(&s_lock);
+    HOST_ASSERT(xTaskCreateAtProcessor(1, notify_waiter_task, "waiter", configMINIMAL_STACK_SIZE, NULL, 2, &waiter) == pdPASS);
+    xTaskNotify(waiter, 0x5A, eSetValueWithOverwrite);
+    wait_for_waiters();
+    _lock_release(&s_lock);
+    HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    vSemaphoreDelete(s_done);
+}
+
+static void stress_task(void *arg)
+{
+    for (uint32_t round = 0; round < STRESS_ROUNDS; round++)
+    {
+        if (round & 1)
+        {
+            _lock_acquire_recursive(&s_lock);
+            _lock_acquire_recursive(&s_lock);
+            s_counter++;
+            _lock_release_recursive(&s_lock);
+            _lock_release_recursive(&s_lock);
+        }
+        else
+        {
+            _lock_acquire(&s_lock);
+            s_counter++;
+            _lock_release(&s_lock);
+        }
+    }
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void test_stress(void)
+{
+    _lock_init(&s_lock);
+    s_done = xSemaphoreCreateCounting(STRESS_TASKS, 0);
+    s_counter = 0;
+
+    for (uintptr_t i = 0; i < STRESS_TASKS; i++)
+        HOST_ASSERT(xTaskCreateAtProcessor(i % portNUM_PROCESSORS, stress_task, "stress", configMINIMAL_STACK_SIZE, NULL, 1 + i, NULL) == pdPASS);
+    for (int i = 0; i < STRESS_TASKS; i++)
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+
+    HOST_ASSERT(s_counter == STRESS_TASKS * STRESS_ROUNDS);
+    HOST_ASSERT(s_lock == 0);
+    vSemaphoreDelete(s_done);
+}
+
+int main(void)
+{
+    test_basic();
+    test_isr();
+    test_priority_inheritance();
+    test_notification();
+    test_stress();
+    printf("locks_test passed\n");
+    return 0;
+}
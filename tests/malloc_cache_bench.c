@@ -0,0 +1,167 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+#include <malloc.h>
+#include <malloc_cache.h>
+
+/*
+ * Small allocation churn on both cores at once, through the cache and through
+ * newlib behind one lock as before the cache, which is what every malloc paid
+ * for its _lock_t.
+ *
+ *   malloc_cache_bench [rounds per core]
+ */
+
+void *__wrap__malloc_r(struct _reent *reent, size_t size);
+void __wrap__free_r(struct _reent *reent, void *ptr);
+
+static SemaphoreHandle_t s_newlib_lock;
+
+/* newlib behind the cache */
+void *__real__malloc_r(struct _reent *reent, size_t size)
+{
+    return malloc(size);
+}
+
+void __real__free_r(struct _reent *reent, void *ptr)
+{
+    free(ptr);
+}
+
+void *__real__realloc_r(struct _reent *reent, void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void *__real__calloc_r(struct _reent *reent, size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
+
+void *__real__memalign_r(struct _reent *reent, size_t align, size_t size)
+{
+    return aligned_alloc(align, size);
+}
+
+size_t __real__malloc_usable_size_r(struct _reent *reent, void *ptr)
+{
+    return malloc_usable_size(ptr);
+}
+
+static void *cached_malloc(size_t size)
+{
+    return __wrap__malloc_r(NULL, size);
+}
+
+static void cached_free(void *ptr)
+{
+    __wrap__free_r(NULL, ptr);
+}
+
+static void *locked_malloc(size_t size)
+{
+    xSemaphoreTake(s_newlib_lock, portMAX_DELAY);
+    void *ptr = malloc(size);
+    xSemaphoreGive(s_newlib_lock);
+    return ptr;
+}
+
+static void locked_free(void *ptr)
+{
+    xSemaphoreTake(s_newlib_lock, portMAX_DELAY);
+    free(ptr);
+    xSemaphoreGive(s_newlib_lock);
+}
+
+#define LIVE_BLOCKS 64
+
+typedef struct
+{
+    void *(*alloc)(size_t size);
+    void (*release)(void *ptr);
+    uint32_t rounds;
+    SemaphoreHandle_t done;
+} bench_t;
+
+static void churn_task(void *arg)
+{
+    bench_t *bench = (bench_t *)arg;
+    void *blocks[LIVE_BLOCKS] = { 0 };
+    uint32_t seed = uxPortGetProcessorId() + 1;
+
+    for (uint32_t round = 0; round < bench->rounds; round++)
+    {
+        seed = seed * 1103515245 + 12345;
+        size_t slot = (seed >> 8) % LIVE_BLOCKS;
+        if (blocks[slot])
+            bench->release(blocks[slot]);
+        blocks[slot] = bench->alloc(16 + (seed >> 20) % (MALLOC_CACHE_MAX_SIZE - 16));
+        HOST_ASSERT(blocks[slot]);
+        *(volatile uint8_t *)blocks[slot] = (uint8_t)round;
+    }
+
+    for (size_t slot = 0; slot < LIVE_BLOCKS; slot++)
+    {
+        if (blocks[slot])
+            bench->release(blocks[slot]);
+    }
+
+    xSemaphoreGive(bench->done);
+    vTaskDelete(NULL);
+}
+
+static double run(const char *name, void *(*alloc)(size_t), void (*release)(void *), uint32_t rounds)
+{
+    bench_t bench = { alloc, release, rounds, xSemaphoreCreateCounting(portNUM_PROCESSORS, 0) };
+    uint64_t start = host_time_ns();
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+        HOST_ASSERT(xTaskCreateAtProcessor(core, churn_task, name, configMINIMAL_STACK_SIZE, &bench, 1, NULL) == pdPASS);
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+        HOST_ASSERT(xSemaphoreTake(bench.done, portMAX_DELAY) == pdTRUE);
+    uint64_t elapsed = host_time_ns() - start;
+    vSemaphoreDelete(bench.done);
+
+    /* Each round is one free and one allocation */
+    double ns = (double)elapsed / ((double)rounds * portNUM_PROCESSORS * 2);
+    printf("%-16s %8.1f ns/op\n", name, ns);
+    return ns;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 200000;
+    s_newlib_lock = xSemaphoreCreateMutex();
+
+    double locked = run("newlib+lock", locked_malloc, locked_free, rounds);
+    double cached = run("malloc_cache", cached_malloc, cached_free, rounds);
+
+    size_t depot_waits = 0, hits = 0, misses = 0;
+    for (uint32_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        malloc_cache_stats_t stats;
+        HOST_ASSERT(malloc_cache_get_stats(core, &stats) == 0);
+        depot_waits += stats.depot_waits;
+        for (size_t i = 0; i < MALLOC_CACHE_CLASSES; i++)
+        {
+            hits += stats.classes[i].hits;
+            misses += stats.classes[i].misses;
+        }
+    }
+
+    printf("magazine hit rate %.1f%%, depot lock waits %zu, speedup %.2fx\n",
+        100.0 * hits / (hits + misses), depot_waits, locked / cached);
+    return 0;
+}
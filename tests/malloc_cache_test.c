@@ -0,0 +1,332 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+#include <atomic.h>
+#include <malloc.h>
+#include <malloc_cache.h>
+#include <string.h>
+
+void *__wrap__malloc_r(struct _reent *reent, size_t size);
+void __wrap__free_r(struct _reent *reent, void *ptr);
+void *__wrap__realloc_r(struct _reent *reent, void *ptr, size_t size);
+void *__wrap__calloc_r(struct _reent *reent, size_t nmemb, size_t size);
+void *__wrap__memalign_r(struct _reent *reent, size_t align, size_t size);
+size_t __wrap__malloc_usable_size_r(struct _reent *reent, void *ptr);
+void __malloc_lock(struct _reent *reent);
+void __malloc_unlock(struct _reent *reent);
+
+static volatile size_t s_newlib_mallocs;
+
+/* newlib behind the cache */
+void *__real__malloc_r(struct _reent *reent, size_t size)
+{
+    s_newlib_mallocs++;
+    return malloc(size);
+}
+
+void __real__free_r(struct _reent *reent, void *ptr)
+{
+    free(ptr);
+}
+
+void *__real__realloc_r(struct _reent *reent, void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void *__real__calloc_r(struct _reent *reent, size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
+
+/* newlib's memalign takes its chunk from _malloc_r and carves it up, so that
+ * chunk must come from newlib and not from the cache */
+void *__real__memalign_r(struct _reent *reent, size_t align, size_t size)
+{
+    size_t mallocs = s_newlib_mallocs;
+    void *chunk = __wrap__malloc_r(reent, size + align);
+    HOST_ASSERT(chunk && s_newlib_mallocs == mallocs + 1);
+    free(chunk);
+    return aligned_alloc(align, size);
+}
+
+size_t __real__malloc_usable_size_r(struct _reent *reent, void *ptr)
+{
+    return malloc_usable_size(ptr);
+}
+
+#define STRESS_SLOTS 256
+#define STRESS_ROUNDS 200000
+
+typedef struct
+{
+    uint32_t tag;
+    uint32_t size;
+} block_header_t;
+
+static void *volatile s_slots[STRESS_SLOTS];
+static SemaphoreHandle_t s_done;
+
+static void fill(void *ptr, size_t size, uint32_t tag)
+{
+    block_header_t *header = (block_header_t *)ptr;
+    header->tag = tag;
+    header->size = size;
+    memset(header + 1, tag & 0xFF, size - sizeof(*header));
+}
+
+static void check(const void *ptr)
+{
+    const block_header_t *header = (const block_header_t *)ptr;
+    const uint8_t *data = (const uint8_t *)(header + 1);
+    for (size_t i = 0; i < header->size - sizeof(*header); i++)
+        HOST_ASSERT(data[i] == (header->tag & 0xFF));
+}
+
+static size_t total_cached(void)
+{
+    size_t cached = 0;
+    for (uint32_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        malloc_cache_stats_t stats;
+        HOST_ASSERT(malloc_cache_get_stats(core, &stats) == 0);
+        for (size_t i = 0; i < MALLOC_CACHE_CLASSES; i++)
+            cached += stats.classes[i].cached;
+    }
+
+    return cached;
+}
+
+static void test_sizes(void *arg)
+{
+    void *blocks[MALLOC_CACHE_MAX_SIZE + 1];
+    for (size_t size = 8; size <= MALLOC_CACHE_MAX_SIZE; size++)
+    {
+        blocks[size] = __wrap__malloc_r(NULL, size);
+        HOST_ASSERT(blocks[size]);
+        HOST_ASSERT(((uintptr_t)blocks[size] & 7) == 0);
+        fill(blocks[size], size, (uint32_t)size);
+    }
+
+    for (size_t size = 8; size <= MALLOC_CACHE_MAX_SIZE; size++)
+    {
+        check(blocks[size]);
+        __wrap__free_r(NULL, blocks[size]);
+    }
+
+    malloc_cache_stats_t stats;
+    HOST_ASSERT(malloc_cache_get_stats(0, &stats) == 0);
+    HOST_ASSERT(stats.arena_size >= MALLOC_CACHE_SEGMENT_SIZE);
+    HOST_ASSERT(stats.arena_used > 0 && stats.arena_used <= stats.arena_size);
+    HOST_ASSERT(stats.classes[0].block_size == 16);
+    HOST_ASSERT(stats.classes[MALLOC_CACHE_CLASSES - 1].block_size == MALLOC_CACHE_MAX_SIZE);
+    HOST_ASSERT(malloc_cache_get_stats(portNUM_PROCESSORS, &stats) != 0);
+
+    /* Too large for a class, goes to newlib */
+    size_t fallbacks = stats.fallbacks;
+    void *large = __wrap__malloc_r(NULL, MALLOC_CACHE_MAX_SIZE + 1);
+    HOST_ASSERT(large);
+    __wrap__free_r(NULL, large);
+    HOST_ASSERT(malloc_cache_get_stats(0, &stats) == 0);
+    HOST_ASSERT(stats.fallbacks == fallbacks + 1);
+}
+
+static void test_realloc_calloc(void *arg)
+{
+    uint8_t *ptr = (uint8_t *)__wrap__calloc_r(NULL, 10, 10);
+    HOST_ASSERT(ptr);
+    for (size_t i = 0; i < 100; i++)
+        HOST_ASSERT(ptr[i] == 0);
+    HOST_ASSERT(__wrap__calloc_r(NULL, SIZE_MAX / 2, 4) == NULL);
+
+    for (size_t i = 0; i < 100; i++)
+        ptr[i] = (uint8_t)i;
+
+    /* Within the same class the block stays */
+    HOST_ASSERT(__wrap__realloc_r(NULL, ptr, 120) == ptr);
+
+    /* Grown into a larger class, then out of the cache */
+    ptr = (uint8_t *)__wrap__realloc_r(NULL, ptr, 300);
+    HOST_ASSERT(ptr);
+    for (size_t i = 0; i < 100; i++)
+        HOST_ASSERT(ptr[i] == i);
+
+    ptr = (uint8_t *)__wrap__realloc_r(NULL, ptr, 4096);
+    HOST_ASSERT(ptr);
+    for (size_t i = 0; i < 100; i++)
+        HOST_ASSERT(ptr[i] == i);
+
+    ptr = (uint8_t *)__wrap__realloc_r(NULL, ptr, 64);
+    HOST_ASSERT(ptr);
+    for (size_t i = 0; i < 64; i++)
+        HOST_ASSERT(ptr[i] == i);
+
+    HOST_ASSERT(__wrap__realloc_r(NULL, ptr, 0) == NULL);
+}
+
+static void test_memalign(void *arg)
+{
+    void *ptr = __wrap__memalign_r(NULL, 64, 32);
+    HOST_ASSERT(ptr && ((uintptr_t)ptr & 63) == 0);
+    HOST_ASSERT(__wrap__malloc_usable_size_r(NULL, ptr) >= 32);
+    __wrap__free_r(NULL, ptr);
+
+    /* Cached blocks report their class size */
+    ptr = __wrap__malloc_r(NULL, 20);
+    HOST_ASSERT(ptr && __wrap__malloc_usable_size_r(NULL, ptr) == 32);
+    __wrap__free_r(NULL, ptr);
+}
+
+/* Both cores allocate and free through shared slots, so most blocks are
+ * freed on the other core than the one that allocated them */
+static void stress_task(void *arg)
+{
+    uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+    for (uint32_t round = 0; round < STRESS_ROUNDS; round++)
+    {
+        seed = seed * 1103515245 + 12345;
+        size_t slot = (seed >> 8) % STRESS_SLOTS;
+        size_t size = sizeof(block_header_t) + (seed >> 20) % (MALLOC_CACHE_MAX_SIZE - sizeof(block_header_t) + 1);
+
+        void *block = __wrap__malloc_r(NULL, size);
+        HOST_ASSERT(block);
+        fill(block, size, round ^ seed);
+
+        void *old = atomic_swap(&s_slots[slot], block);
+        if (old)
+        {
+            check(old);
+            __wrap__free_r(NULL, old);
+        }
+    }
+
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static void test_stress(void)
+{
+    s_done = xSemaphoreCreateCounting(portNUM_PROCESSORS, 0);
+    for (uintptr_t core = 0; core < portNUM_PROCESSORS; core++)
+        HOST_ASSERT(xTaskCreateAtProcessor(core, stress_task, "stress", configMINIMAL_STACK_SIZE, (void *)core, 1, NULL) == pdPASS);
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    vSemaphoreDelete(s_done);
+
+    for (size_t slot = 0; slot < STRESS_SLOTS; slot++)
+    {
+        if (s_slots[slot])
+        {
+            check(s_slots[slot]);
+            __wrap__free_r(NULL, s_slots[slot]);
+            s_slots[slot] = NULL;
+        }
+    }
+}
+
+static void flush_task(void *arg)
+{
+    malloc_cache_flush();
+}
+
+static SemaphoreHandle_t s_heap_locked;
+static SemaphoreHandle_t s_heap_release;
+
+/* A task inside newlib malloc */
+static void heap_lock_task(void *arg)
+{
+    __malloc_lock(NULL);
+    xSemaphoreGive(s_heap_locked);
+    xSemaphoreTake(s_heap_release, portMAX_DELAY);
+    __malloc_unlock(NULL);
+    xSemaphoreGive(s_heap_locked);
+    vTaskDelete(NULL);
+}
+
+static size_t arena_size(void)
+{
+    malloc_cache_stats_t stats;
+    HOST_ASSERT(malloc_cache_get_stats(0, &stats) == 0);
+    return stats.arena_size;
+}
+
+/* Two idle passes, MALLOC_CACHE_IDLE_TICKS apart */
+static void idle_task(void *arg)
+{
+    malloc_cache_idle();
+    vTaskDelay(MALLOC_CACHE_IDLE_TICKS + 1);
+    malloc_cache_idle();
+}
+
+/* The idle hook trims an unused cache, but never waits for newlib's lock */
+static void test_idle_trim(void)
+{
+    s_heap_locked = xSemaphoreCreateBinary();
+    s_heap_release = xSemaphoreCreateBinary();
+    HOST_ASSERT(s_heap_locked && s_heap_release);
+
+    __wrap__free_r(NULL, __wrap__malloc_r(NULL, 32));
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+        host_run_task(core, flush_task, NULL, 1);
+    HOST_ASSERT(arena_size() == MALLOC_CACHE_SEGMENT_SIZE);
+
+    HOST_ASSERT(xTaskCreate(heap_lock_task, "heap", configMINIMAL_STACK_SIZE, NULL, 1, NULL) == pdPASS);
+    HOST_ASSERT(xSemaphoreTake(s_heap_locked, portMAX_DELAY) == pdTRUE);
+    host_run_task(0, idle_task, NULL, 0);
+    HOST_ASSERT(arena_size() == MALLOC_CACHE_SEGMENT_SIZE);
+
+    xSemaphoreGive(s_heap_release);
+    HOST_ASSERT(xSemaphoreTake(s_heap_locked, portMAX_DELAY) == pdTRUE);
+    host_run_task(0, idle_task, NULL, 0);
+    HOST_ASSERT(arena_size() == 0);
+}
+
+static void test_trim(void)
+{
+    void *live = __wrap__malloc_r(NULL, 32);
+    HOST_ASSERT(live);
+    HOST_ASSERT(malloc_cache_trim() != 0);
+    __wrap__free_r(NULL, live);
+
+    /* Flushing leaves nothing cached on either core */
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+        host_run_task(core, flush_task, NULL, 1);
+    HOST_ASSERT(total_cached() == 0);
+
+    HOST_ASSERT(malloc_cache_trim() == 0);
+    malloc_cache_stats_t stats;
+    HOST_ASSERT(malloc_cache_get_stats(0, &stats) == 0);
+    HOST_ASSERT(stats.arena_size == 0 && stats.arena_used == 0);
+
+    /* The cache comes back on the next allocation */
+    live = __wrap__malloc_r(NULL, 32);
+    HOST_ASSERT(live);
+    HOST_ASSERT(malloc_cache_get_stats(0, &stats) == 0);
+    HOST_ASSERT(stats.arena_size == MALLOC_CACHE_SEGMENT_SIZE);
+    __wrap__free_r(NULL, live);
+}
+
+int main(void)
+{
+    host_run_task(0, test_sizes, NULL, 1);
+    host_run_task(1, test_realloc_calloc, NULL, 1);
+    host_run_task(0, test_memalign, NULL, 1);
+    test_stress();
+    test_trim();
+    test_idle_trim();
+    printf("malloc_cache_test passed\n");
+    return 0;
+}
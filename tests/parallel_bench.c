@@ -0,0 +1,171 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include <hrtimer.h>
+#include <parallel.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * parallel_for against a plain loop over the same body, for a light and a
+ * heavy body and several grains, plus checks that every iteration runs once,
+ * also with nested loops and with ranges slow enough for the caller to sleep. Only uses the SDK API, so it runs on the host
+ * under ctest and on the board as the parallel_bench project
+ * (src/parallel_bench). The host may have fewer cpus than portNUM_PROCESSORS,
+ * speedups are only meaningful on the board.
+ *
+ *   parallel_bench [passes]
+ */
+
+#define ITEMS 65536
+#define NESTED_ROWS 64
+#define NESTED_COLUMNS 256
+
+static uint32_t s_out[ITEMS];
+static volatile uint8_t s_visits[ITEMS];
+
+typedef struct
+{
+    uint32_t work;
+} body_t;
+
+static void body(size_t begin, size_t end, void *userdata)
+{
+    uint32_t work = ((body_t *)userdata)->work;
+    for (size_t i = begin; i < end; i++)
+    {
+        uint32_t x = (uint32_t)i;
+        for (uint32_t k = 0; k < work; k++)
+            x = x * 1103515245 + 12345;
+        s_out[i] = x;
+    }
+}
+
+static uint32_t checksum(void)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < ITEMS; i++)
+        sum = sum * 31 + s_out[i];
+    return sum;
+}
+
+static void visit(size_t begin, size_t end, void *userdata)
+{
+    for (size_t i = begin; i < end; i++)
+        s_visits[i]++;
+}
+
+/* Ranges slow enough that a waiting caller stops polling and sleeps */
+static void slow_visit(size_t begin, size_t end, void *userdata)
+{
+    vTaskDelay(2);
+    visit(begin, end, userdata);
+}
+
+static void nested_row(size_t begin, size_t end, void *userdata)
+{
+    for (size_t row = begin; row < end; row++)
+        parallel_for(row * NESTED_COLUMNS, (row + 1) * NESTED_COLUMNS, 16, visit, NULL);
+}
+
+static void check_visits(size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        configASSERT(s_visits[i] == 1);
+    memset((void *)s_visits, 0, sizeof(s_visits));
+}
+
+static void test_coverage(void)
+{
+    static const size_t counts[] = { 1, 2, 3, 100, 4097, ITEMS };
+    static const size_t grains[] = { 0, 1, 7, 64, 100000 };
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        for (size_t g = 0; g < sizeof(grains) / sizeof(grains[0]); g++)
+        {
+            parallel_for(0, counts[c], grains[g], visit, NULL);
+            check_visits(counts[c]);
+        }
+    }
+
+    /* An empty range runs nothing, an offset range only its own iterations */
+    parallel_for(10, 10, 1, visit, NULL);
+    parallel_for(10, 5, 1, visit, NULL);
+    parallel_for(1000, 2000, 8, visit, NULL);
+    for (size_t i = 0; i < ITEMS; i++)
+        configASSERT(s_visits[i] == (i >= 1000 && i < 2000));
+    memset((void *)s_visits, 0, sizeof(s_visits));
+
+    parallel_for(0, NESTED_ROWS, 1, nested_row, NULL);
+    check_visits(NESTED_ROWS * NESTED_COLUMNS);
+
+    /* The task ending the loop wakes the caller with exactly one notification */
+    parallel_for(0, 16, 1, slow_visit, NULL);
+    check_visits(16);
+    configASSERT(ulTaskNotifyTake(pdTRUE, 0) == 0);
+}
+
+static uint64_t time_serial(body_t *b, uint32_t passes)
+{
+    uint64_t start = hrtimer_now_ns();
+    for (uint32_t pass = 0; pass < passes; pass++)
+        body(0, ITEMS, b);
+    return (hrtimer_now_ns() - start) / passes;
+}
+
+static uint64_t time_parallel(body_t *b, size_t grain, uint32_t passes)
+{
+    uint64_t start = hrtimer_now_ns();
+    for (uint32_t pass = 0; pass < passes; pass++)
+        parallel_for(0, ITEMS, grain, body, b);
+    return (hrtimer_now_ns() - start) / passes;
+}
+
+static void bench(const char *name, uint32_t work, uint32_t passes)
+{
+    static const size_t grains[] = { 64, 512, 4096 };
+    body_t b = { work };
+
+    /* Fault the output in before timing anything */
+    body(0, ITEMS, &b);
+    uint64_t serial = time_serial(&b, passes);
+    uint32_t expected = checksum();
+    printf("%-6s serial        %10llu ns\n", name, (unsigned long long)serial);
+
+    for (size_t g = 0; g < sizeof(grains) / sizeof(grains[0]); g++)
+    {
+        memset(s_out, 0, sizeof(s_out));
+        uint64_t parallel = time_parallel(&b, grains[g], passes);
+        configASSERT(checksum() == expected);
+        printf("%-6s grain %5u   %10llu ns  speedup %.2f\n", name, (unsigned)grains[g],
+            (unsigned long long)parallel, (double)serial / parallel);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t passes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 20;
+    if (!passes)
+        passes = 1;
+
+    configASSERT(parallel_init(PARALLEL_WORKER_PRIORITY) == 0);
+    test_coverage();
+    bench("light", 4, passes);
+    bench("heavy", 64, passes);
+    return 0;
+}
@@ -0,0 +1,387 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include <algorithm>
+#include <encoding.h>
+#include <kernel/driver.hpp>
+#include <plic.h>
+#include <vector>
+
+/*
+ * handle_irq_m_ext of the PLIC driver against the PLIC model of
+ * host/plic_host.cpp, built once as is and once with CONFIG_PLIC_NESTED_IRQ.
+ * A trap is modelled as masking interrupts and saving and restoring a
+ * register frame around the handler, and the core only takes an interrupt at
+ * the poll points a handler passes. Checks the claim order, the threshold,
+ * the routing to cores and which sources preempt a running handler, then
+ * times bursts against a handler that claims a single source per trap, and
+ * the latency of a high priority source raised during a long low priority
+ * handler. The trap cost of the host is not the one of the board, only the
+ * trap counts and the nested latency carry over.
+ *
+ *   plic_bench [rounds]
+ */
+
+using namespace sys;
+
+#ifndef CONFIG_PLIC_NESTED_IRQ
+#define CONFIG_PLIC_NESTED_IRQ 0
+#endif
+
+#define FRAME_WORDS 64
+#define MAX_EVENTS 64
+#define LONG_WORK 4000
+
+extern volatile plic_t &plic;
+extern driver &g_pic_driver_plic0;
+extern "C" void handle_irq_m_ext(uintptr_t *regs, uintptr_t cause);
+
+typedef void (*trap_handler_t)(uintptr_t *regs, uintptr_t cause);
+
+struct event_t
+{
+    uint32_t irq;
+    uint32_t core;
+    uint32_t threshold;
+    uint32_t depth;
+    bool exit;
+};
+
+static pic_driver &s_pic = static_cast<pic_driver &>(g_pic_driver_plic0);
+static event_t s_events[MAX_EVENTS];
+static size_t s_event_count;
+static bool s_record;
+static uint32_t s_depth;
+static uint32_t s_traps;
+static uint32_t s_handled;
+
+/* The long handler raises raise_irq after raise_at of its work iterations */
+static struct
+{
+    uint32_t irq;
+    uint32_t raise_irq;
+    uint32_t raise_at;
+    uint64_t raised_ns;
+    uint64_t latency_ns;
+} s_long;
+
+static void trap(trap_handler_t handler)
+{
+    volatile uintptr_t frame[FRAME_WORDS];
+    uintptr_t flags = clear_csr(mstatus, MSTATUS_MIE);
+    s_traps++;
+    s_depth++;
+    for (size_t i = 0; i < FRAME_WORDS; i++)
+        frame[i] = i;
+    handler(const_cast<uintptr_t *>(frame), IRQ_M_EXT);
+    uintptr_t sum = 0;
+    for (size_t i = 0; i < FRAME_WORDS; i++)
+        sum += frame[i];
+    HOST_ASSERT(sum == FRAME_WORDS * (FRAME_WORDS - 1) / 2);
+    s_depth--;
+    set_csr(mstatus, flags & MSTATUS_MIE);
+}
+
+/* Take the external interrupt if the core would between two instructions here.
+ * The pending line is sampled either way, so a poll costs the same masked or not. */
+static void poll_point()
+{
+    bool meip = host_plic_meip(read_csr(mhartid));
+    if (meip && (read_csr(mstatus) & MSTATUS_MIE) && (read_csr(mie) & MIP_MEIP))
+        trap(handle_irq_m_ext);
+}
+
+/* Trap until the core has no external interrupt pending */
+static void run_pending(trap_handler_t handler)
+{
+    while ((read_csr(mie) & MIP_MEIP) && host_plic_meip(read_csr(mhartid)))
+        trap(handler);
+}
+
+/* The handler before the claim loop, one source per trap, nesting as the driver does */
+static void single_claim_handle_irq(uintptr_t *regs, uintptr_t cause)
+{
+    uint64_t core_id = read_csr(mhartid);
+    uint32_t int_threshold = plic.targets.target[core_id].priority_threshold;
+    uint32_t int_num = plic.targets.target[core_id].claim_complete;
+#if CONFIG_PLIC_NESTED_IRQ
+    uintptr_t ie_flag = read_csr(mie);
+#endif
+    if (!int_num)
+        return;
+
+    plic.targets.target[core_id].priority_threshold = plic.source_priorities.priority[int_num];
+#if CONFIG_PLIC_NESTED_IRQ
+    clear_csr(mie, MIP_MTIP | MIP_MSIP);
+    set_csr(mstatus, MSTATUS_MIE);
+#endif
+    kernel_iface_pic_on_irq(int_num);
+#if CONFIG_PLIC_NESTED_IRQ
+    clear_csr(mstatus, MSTATUS_MIE);
+    write_csr(mie, ie_flag);
+#endif
+    plic.targets.target[core_id].claim_complete = int_num;
+    plic.targets.target[core_id].priority_threshold = int_threshold;
+}
+
+static void record(uint32_t irq, bool exit)
+{
+    if (!s_record)
+        return;
+    HOST_ASSERT(s_event_count < MAX_EVENTS);
+    uint32_t core = read_csr(mhartid);
+    s_events[s_event_count++] = { irq, core, plic.targets.target[core].priority_threshold, s_depth, exit };
+}
+
+void sys::kernel_iface_pic_on_irq(uint32_t irq)
+{
+    s_handled++;
+#if CONFIG_PLIC_NESTED_IRQ
+    HOST_ASSERT(read_csr(mstatus) & MSTATUS_MIE);
+    HOST_ASSERT(!(read_csr(mie) & (MIP_MTIP | MIP_MSIP)));
+#else
+    HOST_ASSERT(!(read_csr(mstatus) & MSTATUS_MIE));
+#endif
+    record(irq, false);
+
+    if (irq == s_long.irq)
+    {
+        volatile uint32_t x = irq;
+        for (uint32_t i = 0; i < LONG_WORK; i++)
+        {
+            if (i == s_long.raise_at)
+            {
+                s_long.raised_ns = host_time_ns();
+                host_plic_raise(s_long.raise_irq);
+            }
+
+            x = x * 1103515245 + 12345;
+            poll_point();
+        }
+    }
+    else if (irq == s_long.raise_irq && s_long.raised_ns)
+    {
+        s_long.latency_ns = host_time_ns() - s_long.raised_ns;
+        s_long.raised_ns = 0;
+    }
+
+    record(irq, true);
+}
+
+static void setup(uint32_t irq, uint32_t priority, uint32_t core_mask)
+{
+    s_pic.set_irq_priority(irq, priority);
+    s_pic.set_irq_affinity(irq, core_mask);
+    s_pic.set_irq_enable(irq, true);
+}
+
+static void start_recording()
+{
+    s_event_count = 0;
+    s_traps = 0;
+    s_record = true;
+}
+
+static void check_enter(size_t index, uint32_t irq, uint32_t core, uint32_t depth)
+{
+    HOST_ASSERT(index < s_event_count);
+    const event_t &e = s_events[index];
+    HOST_ASSERT(!e.exit && e.irq == irq && e.core == core && e.depth == depth);
+    HOST_ASSERT(e.threshold == plic.source_priorities.priority[irq]);
+}
+
+/* The claim loop takes a burst highest priority first, lowest id on ties, in one trap */
+static void test_claim_order()
+{
+    setup(1, 1, 1);
+    setup(2, 3, 1);
+    setup(3, 2, 1);
+    setup(4, 2, 1);
+    uintptr_t mie = read_csr(mie);
+
+    for (uint32_t irq = 1; irq <= 4; irq++)
+        host_plic_raise(irq);
+    start_recording();
+    run_pending(handle_irq_m_ext);
+
+    HOST_ASSERT(s_traps == 1 && s_event_count == 8);
+    static const uint32_t order[] = { 2, 3, 4, 1 };
+    for (size_t i = 0; i < 4; i++)
+        check_enter(2 * i, order[i], 0, 1);
+    HOST_ASSERT(plic.targets.target[0].priority_threshold == 0);
+    HOST_ASSERT(read_csr(mie) == mie);
+    HOST_ASSERT(!host_plic_busy());
+
+    /* Sources at or below the threshold wait until it drops */
+    plic.targets.target[0].priority_threshold = 2;
+    host_plic_raise(1);
+    host_plic_raise(3);
+    HOST_ASSERT(!host_plic_meip(0));
+    host_plic_raise(2);
+    start_recording();
+    run_pending(handle_irq_m_ext);
+    HOST_ASSERT(s_traps == 1 && s_event_count == 2);
+    check_enter(0, 2, 0, 1);
+    HOST_ASSERT(plic.targets.target[0].priority_threshold == 2);
+
+    plic.targets.target[0].priority_threshold = 0;
+    start_recording();
+    run_pending(handle_irq_m_ext);
+    HOST_ASSERT(s_traps == 1 && s_event_count == 4);
+    check_enter(0, 3, 0, 1);
+    check_enter(2, 1, 0, 1);
+    HOST_ASSERT(!host_plic_busy());
+    s_record = false;
+}
+
+static void core1_trap(void *)
+{
+    set_csr(mie, MIP_MEIP);
+    run_pending(handle_irq_m_ext);
+}
+
+/* A source is only taken by the cores of its affinity, and by one of them */
+static void test_routing()
+{
+    setup(5, 1, 2);
+    host_plic_raise(5);
+    HOST_ASSERT(!host_plic_meip(0) && host_plic_meip(1));
+    start_recording();
+    host_run_task(1, core1_trap, NULL, 1);
+    HOST_ASSERT(s_event_count == 2);
+    check_enter(0, 5, 1, 1);
+
+    s_pic.set_irq_affinity(5, 3);
+    host_plic_raise(5);
+    HOST_ASSERT(host_plic_meip(0) && host_plic_meip(1));
+    start_recording();
+    run_pending(handle_irq_m_ext);
+    HOST_ASSERT(s_event_count == 2);
+    check_enter(0, 5, 0, 1);
+    HOST_ASSERT(!host_plic_meip(1));
+
+    s_pic.set_irq_enable(5, false);
+    host_plic_raise(5);
+    HOST_ASSERT(!host_plic_meip(0) && !host_plic_meip(1));
+    s_pic.set_irq_enable(5, true);
+    start_recording();
+    run_pending(handle_irq_m_ext);
+    HOST_ASSERT(s_event_count == 2);
+    HOST_ASSERT(!host_plic_busy());
+    s_record = false;
+}
+
+/* Only a higher priority source preempts the long handler, and only when nesting */
+static void test_preemption()
+{
+    setup(6, 2, 1);
+    setup(7, 2, 1);
+    setup(8, 5, 1);
+
+    for (uint32_t raise_irq : { 7, 8 })
+    {
+        s_long = { 6, raise_irq, LONG_WORK / 8, 0, 0 };
+        host_plic_raise(6);
+        start_recording();
+        run_pending(handle_irq_m_ext);
+        HOST_ASSERT(s_event_count == 4);
+        check_enter(0, 6, 0, 1);
+
+        bool nested = CONFIG_PLIC_NESTED_IRQ && raise_irq == 8;
+        if (nested)
+        {
+            check_enter(1, raise_irq, 0, 2);
+            HOST_ASSERT(s_events[3].irq == 6 && s_events[3].exit);
+            HOST_ASSERT(s_traps == 2);
+        }
+        else
+        {
+            HOST_ASSERT(s_events[1].irq == 6 && s_events[1].exit);
+            check_enter(2, raise_irq, 0, 1);
+            HOST_ASSERT(s_traps == 1);
+        }
+
+        HOST_ASSERT(plic.targets.target[0].priority_threshold == 0);
+        HOST_ASSERT(!host_plic_busy());
+    }
+
+    s_long = {};
+    s_record = false;
+}
+
+static void bench_bursts(uint32_t rounds)
+{
+    for (uint32_t irq = 1; irq <= 16; irq++)
+        setup(irq, 1 + irq % PLIC_NUM_PRIORITIES, 1);
+
+    for (uint32_t burst : { 1, 4, 16 })
+    {
+        for (trap_handler_t handler : { handle_irq_m_ext, single_claim_handle_irq })
+        {
+            s_traps = 0;
+            s_handled = 0;
+            uint64_t start = host_time_ns();
+            for (uint32_t round = 0; round < rounds; round++)
+            {
+                for (uint32_t irq = 1; irq <= burst; irq++)
+                    host_plic_raise(irq);
+                run_pending(handler);
+            }
+            uint64_t elapsed = host_time_ns() - start;
+
+            HOST_ASSERT(s_handled == burst * rounds);
+            HOST_ASSERT(s_traps == (handler == handle_irq_m_ext ? 1 : burst) * rounds);
+            printf("burst %2u %-12s %8.1f ns/burst  %5.2f traps/burst\n", burst,
+                handler == handle_irq_m_ext ? "claim loop" : "single claim", double(elapsed) / rounds, double(s_traps) / rounds);
+        }
+    }
+}
+
+static void bench_nested_latency(uint32_t rounds)
+{
+    std::vector<uint64_t> latencies;
+    setup(6, 2, 1);
+    setup(8, 5, 1);
+    for (uint32_t round = 0; round < rounds; round++)
+    {
+        s_long = { 6, 8, LONG_WORK / 8, 0, 0 };
+        host_plic_raise(6);
+        run_pending(handle_irq_m_ext);
+        HOST_ASSERT(s_long.latency_ns);
+        latencies.push_back(s_long.latency_ns);
+    }
+
+    s_long = {};
+    std::sort(latencies.begin(), latencies.end());
+    printf("priority 5 during priority 2 (%s): median latency %8.1f ns, max %8.1f ns\n",
+        CONFIG_PLIC_NESTED_IRQ ? "nested" : "not nested", double(latencies[rounds / 2]), double(latencies.back()));
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = argc > 1 ? uint32_t(strtoul(argv[1], NULL, 0)) : 200000;
+    if (!rounds)
+        rounds = 1;
+
+    g_pic_driver_plic0.install();
+    set_csr(mie, MIP_MTIP | MIP_MSIP);
+
+    test_claim_order();
+    test_routing();
+    test_preemption();
+    bench_bursts(rounds);
+    bench_nested_latency(std::max(rounds / 100, 11u));
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "utils.h"
+#include <cerrno>
+#include <new>
+#include <pthread.h>
+#include <unordered_map>
+
+/*
+ * Cost of pthread_getspecific and pthread_setspecific for keys in the inline
+ * part of the per-thread table and for keys in its pages, next to the
+ * unordered_map the table replaced. Each variant runs in a task of its own
+ * that touches KEYS keys round robin. On the host the lookup of the TLS
+ * pointer is a thread_local access and takes a good part of each call.
+ *
+ *   pthread_key_bench [rounds]
+ */
+
+#define KEYS 8
+
+/* The former per-thread storage, hung off the same TLS pointer */
+struct map_tls
+{
+    std::unordered_map<pthread_key_t, uintptr_t> storage;
+};
+
+static void *map_get(pthread_key_t key)
+{
+    auto tls = reinterpret_cast<map_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+    if (tls)
+    {
+        auto it = tls->storage.find(key);
+        if (it != tls->storage.end())
+            return reinterpret_cast<void *>(it->second);
+    }
+
+    return nullptr;
+}
+
+static int map_set(pthread_key_t key, const void *value)
+{
+    auto tls = reinterpret_cast<map_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+    if (!tls)
+    {
+        tls = new (std::nothrow) map_tls;
+        if (!tls)
+            return ENOMEM;
+        vTaskSetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX, tls);
+    }
+
+    tls->storage[key] = uintptr_t(value);
+    return 0;
+}
+
+struct bench_t
+{
+    void *(*get)(pthread_key_t key);
+    int (*set)(pthread_key_t key, const void *value);
+    const pthread_key_t *keys;
+    uint32_t rounds;
+    double get_ns;
+    double set_ns;
+};
+
+static void bench_task(void *arg)
+{
+    auto bench = static_cast<bench_t *>(arg);
+    uintptr_t sum = 0;
+
+    for (size_t i = 0; i < KEYS; i++)
+        HOST_ASSERT(bench->set(bench->keys[i], nullptr) == 0);
+
+    uint64_t start = host_time_ns();
+    for (uint32_t round = 0; round < bench->rounds; round++)
+        bench->set(bench->keys[round % KEYS], reinterpret_cast<void *>(uintptr_t(round) + 1));
+    bench->set_ns = double(host_time_ns() - start) / bench->rounds;
+
+    start = host_time_ns();
+    for (uint32_t round = 0; round < bench->rounds; round++)
+        sum += reinterpret_cast<uintptr_t>(bench->get(bench->keys[round % KEYS]));
+    bench->get_ns = double(host_time_ns() - start) / bench->rounds;
+
+    /* Every key holds the last value set through it */
+    for (uint32_t i = 0; i < KEYS && i < bench->rounds; i++)
+    {
+        uint32_t last = (bench->rounds - 1 - i) / KEYS * KEYS + i;
+        HOST_ASSERT(reinterpret_cast<uintptr_t>(bench->get(bench->keys[i])) == uintptr_t(last) + 1);
+    }
+
+    HOST_ASSERT(sum != 0 || bench->rounds == 0);
+    if (bench->get == map_get)
+        delete reinterpret_cast<map_tls *>(pvTaskGetThreadLocalStoragePointer(NULL, PTHREAD_TLS_INDEX));
+    else
+        pthread_tls_free(NULL);
+}
+
+static void run(const char *name, bench_t bench)
+{
+    host_run_task(0, bench_task, &bench, 1);
+    printf("%-16s get %6.1f ns  set %6.1f ns\n", name, bench.get_ns, bench.set_ns);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = argc > 1 ? uint32_t(strtoul(argv[1], NULL, 0)) : 10000000;
+    pthread_key_t keys[2 * KEYS];
+
+    /* Keys take the lowest free slots, the first KEYS ones are inline */
+    for (auto &key : keys)
+        HOST_ASSERT(pthread_key_create(&key, NULL) == 0);
+
+    run("table inline", { pthread_getspecific, pthread_setspecific, keys, rounds });
+    run("table paged", { pthread_getspecific, pthread_setspecific, keys + KEYS, rounds });
+    run("unordered_map", { map_get, map_set, keys, rounds });
+
+    /* A key that reuses the slot of a deleted one does not see its value */
+    HOST_ASSERT(pthread_setspecific(keys[0], keys) == 0);
+    HOST_ASSERT(pthread_key_delete(keys[0]) == 0);
+    pthread_key_t reused;
+    HOST_ASSERT(pthread_key_create(&reused, NULL) == 0);
+    HOST_ASSERT(reused != keys[0] && pthread_getspecific(reused) == nullptr);
+
+    for (auto &key : keys)
+        pthread_key_delete(key);
+    pthread_key_delete(reused);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+#include <pthread_sync.h>
+
+/*
+ * Contention on a shared table with 4 tasks over both cores: a read-mostly
+ * lookup (1 write in 16) behind a kernel mutex and behind a rwlock, a short
+ * counter update behind a kernel mutex and behind a spin lock, and the cost
+ * of a barrier round for 2 and 4 tasks. On the host masking interrupts takes
+ * a mutex of its own, so the spin lock reads slower there than on the target.
+ *
+ *   pthread_sync_bench [rounds per task]
+ */
+
+#define TASKS 4
+#define TABLE_SIZE 16
+#define WRITE_EVERY 16
+
+static SemaphoreHandle_t s_mutex;
+static pthread_rwlock_t s_rwlock;
+static pthread_spinlock_t s_spin;
+static pthread_barrier_t s_barrier;
+static volatile uint32_t s_table[TABLE_SIZE];
+
+typedef struct
+{
+    void (*body)(uint32_t round);
+    uint32_t rounds;
+    SemaphoreHandle_t done;
+} bench_t;
+
+static uint32_t read_table(void)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < TABLE_SIZE; i++)
+        sum += s_table[i];
+    return sum;
+}
+
+static void write_table(uint32_t round)
+{
+    s_table[round % TABLE_SIZE]++;
+}
+
+static void lookup_mutex(uint32_t round)
+{
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    if (round % WRITE_EVERY == 0)
+        write_table(round);
+    else
+        read_table();
+    xSemaphoreGive(s_mutex);
+}
+
+static void lookup_rwlock(uint32_t round)
+{
+    if (round % WRITE_EVERY == 0)
+    {
+        pthread_rwlock_wrlock(&s_rwlock);
+        write_table(round);
+    }
+    else
+    {
+        pthread_rwlock_rdlock(&s_rwlock);
+        read_table();
+    }
+
+    pthread_rwlock_unlock(&s_rwlock);
+}
+
+static void update_mutex(uint32_t round)
+{
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    write_table(round);
+    xSemaphoreGive(s_mutex);
+}
+
+static void update_spin(uint32_t round)
+{
+    pthread_spin_lock(&s_spin);
+    write_table(round);
+    pthread_spin_unlock(&s_spin);
+}
+
+static void barrier_round(uint32_t round)
+{
+    pthread_barrier_wait(&s_barrier);
+}
+
+static void bench_task(void *arg)
+{
+    bench_t *bench = (bench_t *)arg;
+    for (uint32_t round = 0; round < bench->rounds; round++)
+        bench->body(round);
+
+    xSemaphoreGive(bench->done);
+    vTaskDelete(NULL);
+}
+
+/* Returns the wall time per round, all tasks run their rounds at once */
+static double run(void (*body)(uint32_t), int tasks, uint32_t rounds)
+{
+    bench_t bench = { body, rounds, xSemaphoreCreateCounting(tasks, 0) };
+    uint64_t start = host_time_ns();
+    for (int i = 0; i < tasks; i++)
+        HOST_ASSERT(xTaskCreateAtProcessor(i % portNUM_PROCESSORS, bench_task, "bench", configMINIMAL_STACK_SIZE, &bench, 1, NULL) == pdPASS);
+    for (int i = 0; i < tasks; i++)
+        HOST_ASSERT(xSemaphoreTake(bench.done, portMAX_DELAY) == pdTRUE);
+    uint64_t elapsed = host_time_ns() - start;
+    vSemaphoreDelete(bench.done);
+    return (double)elapsed / rounds;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 200000;
+    s_mutex = xSemaphoreCreateMutex();
+    HOST_ASSERT(pthread_rwlock_init(&s_rwlock, NULL) == 0);
+    HOST_ASSERT(pthread_spin_init(&s_spin, 0) == 0);
+
+    double mutex = run(lookup_mutex, TASKS, rounds) / TASKS;
+    double rwlock = run(lookup_rwlock, TASKS, rounds) / TASKS;
+    printf("read-mostly lookup  mutex %8.1f ns  rwlock %8.1f ns\n", mutex, rwlock);
+
+    mutex = run(update_mutex, TASKS, rounds) / TASKS;
+    double spin = run(update_spin, TASKS, rounds) / TASKS;
+    printf("short update        mutex %8.1f ns  spin   %8.1f ns\n", mutex, spin);
+
+    for (int tasks = 2; tasks <= TASKS; tasks *= 2)
+    {
+        HOST_ASSERT(pthread_barrier_init(&s_barrier, NULL, tasks) == 0);
+        printf("barrier x%d          %8.1f ns per round\n", tasks, run(barrier_round, tasks, rounds / 10));
+        HOST_ASSERT(pthread_barrier_destroy(&s_barrier) == 0);
+    }
+
+    HOST_ASSERT(pthread_rwlock_destroy(&s_rwlock) == 0);
+    HOST_ASSERT(pthread_spin_destroy(&s_spin) == 0);
+    return 0;
+}
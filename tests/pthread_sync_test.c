@@ -0,0 +1,279 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "semphr.h"
+#include <atomic.h>
+#include <encoding.h>
+#include <errno.h>
+#include <pthread_sync.h>
+
+#define TASKS 4
+#define SPIN_ROUNDS 20000
+#define RWLOCK_ROUNDS 20000
+#define BARRIER_ROUNDS 2000
+#define BARRIER_DESTROY_ROUNDS 2000
+
+static SemaphoreHandle_t s_done;
+
+static void run_tasks(TaskFunction_t task, int count)
+{
+    s_done = xSemaphoreCreateCounting(count, 0);
+    for (uintptr_t i = 0; i < (uintptr_t)count; i++)
+        HOST_ASSERT(xTaskCreateAtProcessor(i % portNUM_PROCESSORS, task, "sync", configMINIMAL_STACK_SIZE, (void *)i, 1, NULL) == pdPASS);
+    for (int i = 0; i < count; i++)
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    vSemaphoreDelete(s_done);
+}
+
+static void task_done(void)
+{
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+static pthread_spinlock_t s_spin;
+static volatile uint32_t s_counter;
+
+static void spin_unlock_task(void *arg)
+{
+    *(int *)arg = pthread_spin_unlock(&s_spin);
+}
+
+static void test_spin_basic(void)
+{
+    pthread_spinlock_t inner;
+    HOST_ASSERT(pthread_spin_init(&s_spin, 0) == 0);
+    HOST_ASSERT(pthread_spin_init(&inner, 0) == 0);
+
+    /* Interrupts stay masked on this core until the outermost unlock */
+    HOST_ASSERT(read_csr(mstatus) & MSTATUS_MIE);
+    HOST_ASSERT(pthread_spin_lock(&s_spin) == 0);
+    HOST_ASSERT(!(read_csr(mstatus) & MSTATUS_MIE));
+    HOST_ASSERT(pthread_spin_trylock(&inner) == 0);
+    HOST_ASSERT(pthread_spin_unlock(&inner) == 0);
+    HOST_ASSERT(!(read_csr(mstatus) & MSTATUS_MIE));
+
+    HOST_ASSERT(pthread_spin_lock(&s_spin) == EDEADLK);
+    HOST_ASSERT(pthread_spin_trylock(&s_spin) == EBUSY);
+    HOST_ASSERT(pthread_spin_destroy(&s_spin) == EBUSY);
+    HOST_ASSERT(pthread_spin_unlock(&s_spin) == 0);
+    HOST_ASSERT(read_csr(mstatus) & MSTATUS_MIE);
+
+    /* Only the holding core unlocks */
+    int result;
+    HOST_ASSERT(pthread_spin_lock(&s_spin) == 0);
+    host_run_task(1, spin_unlock_task, &result, 1);
+    HOST_ASSERT(result == EPERM);
+    HOST_ASSERT(pthread_spin_unlock(&s_spin) == 0);
+    HOST_ASSERT(pthread_spin_unlock(&s_spin) == EPERM);
+    HOST_ASSERT(read_csr(mstatus) & MSTATUS_MIE);
+
+    HOST_ASSERT(pthread_spin_destroy(&s_spin) == 0);
+    HOST_ASSERT(pthread_spin_destroy(&inner) == 0);
+}
+
+static void spin_stress_task(void *arg)
+{
+    for (uint32_t round = 0; round < SPIN_ROUNDS; round++)
+    {
+        HOST_ASSERT(pthread_spin_lock(&s_spin) == 0);
+        s_counter++;
+        HOST_ASSERT(pthread_spin_unlock(&s_spin) == 0);
+    }
+
+    task_done();
+}
+
+static void test_spin_stress(void)
+{
+    HOST_ASSERT(pthread_spin_init(&s_spin, 0) == 0);
+    s_counter = 0;
+    run_tasks(spin_stress_task, TASKS);
+    HOST_ASSERT(s_counter == TASKS * SPIN_ROUNDS);
+    HOST_ASSERT(pthread_spin_destroy(&s_spin) == 0);
+}
+
+static pthread_rwlock_t s_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static volatile uint32_t s_values[2];
+
+static void rwlock_try_task(void *arg)
+{
+    int *results = (int *)arg;
+    results[0] = pthread_rwlock_tryrdlock(&s_rwlock);
+    if (!results[0])
+        pthread_rwlock_unlock(&s_rwlock);
+    results[1] = pthread_rwlock_trywrlock(&s_rwlock);
+    if (!results[1])
+        pthread_rwlock_unlock(&s_rwlock);
+}
+
+static void rwlock_writer_task(void *arg)
+{
+    HOST_ASSERT(pthread_rwlock_wrlock(&s_rwlock) == 0);
+    s_counter++;
+    HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == 0);
+    task_done();
+}
+
+static void test_rwlock_basic(void)
+{
+    int results[2];
+
+    /* The static initializer is set up on first use */
+    HOST_ASSERT(pthread_rwlock_rdlock(&s_rwlock) == 0);
+    HOST_ASSERT(s_rwlock != PTHREAD_RWLOCK_INITIALIZER);
+    HOST_ASSERT(pthread_rwlock_tryrdlock(&s_rwlock) == 0);
+    host_run_task(1, rwlock_try_task, results, 1);
+    HOST_ASSERT(results[0] == 0 && results[1] == EBUSY);
+    HOST_ASSERT(pthread_rwlock_destroy(&s_rwlock) == EBUSY);
+    HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == 0);
+    HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == 0);
+    HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == EPERM);
+
+    HOST_ASSERT(pthread_rwlock_wrlock(&s_rwlock) == 0);
+    host_run_task(1, rwlock_try_task, results, 1);
+    HOST_ASSERT(results[0] == EBUSY && results[1] == EBUSY);
+
+    /* Only the writer unlocks, a timed wait gives up */
+    struct timespec timeout = { 0, 20000000 };
+    HOST_ASSERT(pthread_rwlock_timedrdlock(&s_rwlock, &timeout) == ETIMEDOUT);
+    HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == 0);
+
+    /* A waiting writer holds off new readers */
+    s_counter = 0;
+    s_done = xSemaphoreCreateCounting(1, 0);
+    HOST_ASSERT(pthread_rwlock_rdlock(&s_rwlock) == 0);
+    HOST_ASSERT(xTaskCreateAtProcessor(1, rwlock_writer_task, "writer", configMINIMAL_STACK_SIZE, NULL, 1, NULL) == pdPASS);
+    do
+    {
+        vTaskDelay(1);
+        host_run_task(0, rwlock_try_task, results, 1);
+    } while (results[0] == 0);
+    HOST_ASSERT(results[0] == EBUSY && s_counter == 0);
+    HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == 0);
+    HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    HOST_ASSERT(s_counter == 1);
+    vSemaphoreDelete(s_done);
+
+    HOST_ASSERT(pthread_rwlock_destroy(&s_rwlock) == 0);
+}
+
+/* Writers keep both values equal, readers must never see them apart */
+static void rwlock_stress_task(void *arg)
+{
+    uintptr_t id = (uintptr_t)arg;
+    for (uint32_t round = 0; round < RWLOCK_ROUNDS; round++)
+    {
+        if ((round + id) % 8 == 0)
+        {
+            HOST_ASSERT(pthread_rwlock_wrlock(&s_rwlock) == 0);
+            s_values[0]++;
+            taskYIELD();
+            s_values[1]++;
+            HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == 0);
+        }
+        else
+        {
+            HOST_ASSERT(pthread_rwlock_rdlock(&s_rwlock) == 0);
+            HOST_ASSERT(s_values[0] == s_values[1]);
+            HOST_ASSERT(pthread_rwlock_unlock(&s_rwlock) == 0);
+        }
+    }
+
+    task_done();
+}
+
+static void test_rwlock_stress(void)
+{
+    HOST_ASSERT(pthread_rwlock_init(&s_rwlock, NULL) == 0);
+    run_tasks(rwlock_stress_task, TASKS);
+    HOST_ASSERT(s_values[0] == TASKS * RWLOCK_ROUNDS / 8);
+    HOST_ASSERT(s_values[0] == s_values[1]);
+    HOST_ASSERT(pthread_rwlock_destroy(&s_rwlock) == 0);
+}
+
+static pthread_barrier_t s_barrier;
+static volatile uint32_t s_arrived;
+static volatile uint32_t s_serial;
+
+static void barrier_task(void *arg)
+{
+    for (uint32_t round = 0; round < BARRIER_ROUNDS; round++)
+    {
+        atomic_add(&s_arrived, 1);
+        int result = pthread_barrier_wait(&s_barrier);
+        HOST_ASSERT(result == 0 || result == PTHREAD_BARRIER_SERIAL_THREAD);
+        if (result == PTHREAD_BARRIER_SERIAL_THREAD)
+            atomic_add(&s_serial, 1);
+
+        /* Nobody leaves before everyone of this round arrived */
+        HOST_ASSERT(atomic_read(&s_arrived) >= (round + 1) * TASKS);
+    }
+
+    task_done();
+}
+
+static void test_barrier(void)
+{
+    HOST_ASSERT(pthread_barrier_init(&s_barrier, NULL, 0) == EINVAL);
+    HOST_ASSERT(pthread_barrier_init(&s_barrier, NULL, 1) == 0);
+    HOST_ASSERT(pthread_barrier_wait(&s_barrier) == PTHREAD_BARRIER_SERIAL_THREAD);
+    HOST_ASSERT(pthread_barrier_destroy(&s_barrier) == 0);
+
+    HOST_ASSERT(pthread_barrier_init(&s_barrier, NULL, TASKS) == 0);
+    run_tasks(barrier_task, TASKS);
+    HOST_ASSERT(s_arrived == TASKS * BARRIER_ROUNDS);
+    HOST_ASSERT(s_serial == BARRIER_ROUNDS);
+    HOST_ASSERT(pthread_barrier_destroy(&s_barrier) == 0);
+}
+
+static void barrier_wait_task(void *arg)
+{
+    int result = pthread_barrier_wait(&s_barrier);
+    HOST_ASSERT(result == 0 || result == PTHREAD_BARRIER_SERIAL_THREAD);
+    task_done();
+}
+
+/* Destroying right after leaving the barrier waits out the other thread */
+static void test_barrier_destroy(void)
+{
+    s_done = xSemaphoreCreateCounting(BARRIER_DESTROY_ROUNDS, 0);
+    for (int round = 0; round < BARRIER_DESTROY_ROUNDS; round++)
+    {
+        HOST_ASSERT(pthread_barrier_init(&s_barrier, NULL, 2) == 0);
+        HOST_ASSERT(xTaskCreateAtProcessor(round % portNUM_PROCESSORS, barrier_wait_task, "sync", configMINIMAL_STACK_SIZE, NULL, 1, NULL) == pdPASS);
+        int result = pthread_barrier_wait(&s_barrier);
+        HOST_ASSERT(result == 0 || result == PTHREAD_BARRIER_SERIAL_THREAD);
+
+        while ((result = pthread_barrier_destroy(&s_barrier)) == EBUSY)
+            vTaskDelay(0);
+        HOST_ASSERT(result == 0);
+        HOST_ASSERT(xSemaphoreTake(s_done, portMAX_DELAY) == pdTRUE);
+    }
+
+    vSemaphoreDelete(s_done);
+}
+
+int main(void)
+{
+    test_spin_basic();
+    test_spin_stress();
+    test_rwlock_basic();
+    test_rwlock_stress();
+    test_barrier();
+    test_barrier_destroy();
+    printf("pthread_sync_test passed\n");
+    return 0;
+}
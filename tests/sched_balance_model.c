@@ -0,0 +1,292 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ * Design model of the load balancing of tasks.c, not a test of it: a
+ * tick-level simulation of the partitioned scheduler with and without
+ * configUSE_TASK_LOAD_BALANCING that never runs prvCheckLoadBalance or
+ * prvMigrateReadyTasks, the host port stands in for the whole kernel. It is
+ * built next to the tests but ctest does not run it, a change to the
+ * balancing rules of tasks.c has to be made here by hand.
+ *
+ * The tasks were all created on core 0 as pthreads are. The rules: every
+ * configLOAD_BALANCE_PERIOD ticks a core whose ready count (running and idle
+ * task included) exceeds another core's by two or more hands its highest
+ * priority waiting task that may run there to the least loaded core, the
+ * task arrives one tick later and a core has one hand-over in flight at most.
+ * Affinity masks keep pinned tasks where they are. Reports the share of
+ * processor time spent in tasks (throughput) and Jain's fairness index of
+ * the time each task got.
+ *
+ *   sched_balance_model [ticks per scenario]
+ */
+
+#define MAX_TASKS 16
+#define NO_CORE portNUM_PROCESSORS
+
+typedef struct
+{
+    UBaseType_t priority;
+    UBaseType_t affinity;
+    UBaseType_t core;
+    uint32_t burst_max;    /* Ticks of work before blocking, 0 never blocks */
+    uint32_t sleep_max;    /* Ticks blocked after a burst */
+
+    uint32_t burst_left;
+    uint32_t wake_tick;
+    int ready;
+    int in_flight;
+    uint32_t run_ticks;
+    uint32_t wrong_core_ticks;
+    uint32_t last_run;
+} sim_task_t;
+
+typedef struct
+{
+    sim_task_t tasks[MAX_TASKS];
+    size_t task_count;
+    int balancing;
+    uint32_t seed;
+    /* Hand-over in flight to each core, arrives on the next tick */
+    sim_task_t *mailbox[portNUM_PROCESSORS];
+    int balance_pending[portNUM_PROCESSORS];
+    sim_task_t *running[portNUM_PROCESSORS];
+    uint32_t busy_ticks;
+    uint32_t migrations;
+} sim_t;
+
+static uint32_t sim_random(sim_t *sim, uint32_t max)
+{
+    sim->seed = sim->seed * 1103515245 + 12345;
+    return max ? 1 + (sim->seed >> 8) % max : 0;
+}
+
+static void sim_add(sim_t *sim, UBaseType_t priority, UBaseType_t affinity, uint32_t burst_max, uint32_t sleep_max)
+{
+    HOST_ASSERT(sim->task_count < MAX_TASKS);
+    sim_task_t *task = &sim->tasks[sim->task_count++];
+    memset(task, 0, sizeof(*task));
+    task->priority = priority;
+    task->affinity = affinity;
+    task->core = 0;
+    task->burst_max = burst_max;
+    task->sleep_max = sleep_max;
+    task->burst_left = sim_random(sim, burst_max);
+    task->ready = 1;
+}
+
+/* Ready tasks of the core plus its idle task, as prvGetReadyTaskCount sees them */
+static size_t ready_count(sim_t *sim, UBaseType_t core)
+{
+    size_t count = 1;
+    for (size_t i = 0; i < sim->task_count; i++)
+        count += sim->tasks[i].ready && !sim->tasks[i].in_flight && sim->tasks[i].core == core;
+    return count;
+}
+
+/* Highest priority ready task of the core, round robin within a priority */
+static sim_task_t *select_task(sim_t *sim, UBaseType_t core, uint32_t tick)
+{
+    sim_task_t *best = NULL;
+    for (size_t i = 0; i < sim->task_count; i++)
+    {
+        sim_task_t *task = &sim->tasks[i];
+        if (!task->ready || task->in_flight || task->core != core)
+            continue;
+        if (!best || task->priority > best->priority || (task->priority == best->priority && task->last_run < best->last_run))
+            best = task;
+    }
+
+    return best;
+}
+
+static void check_balance(sim_t *sim, UBaseType_t core)
+{
+    size_t own = ready_count(sim, core);
+    for (UBaseType_t other = 0; other < portNUM_PROCESSORS; other++)
+    {
+        if (other != core && ready_count(sim, other) + 1 < own)
+        {
+            sim->balance_pending[core] = 1;
+            return;
+        }
+    }
+}
+
+/* The context switch half of the balancer, run on the core after its tick */
+static void balance(sim_t *sim, UBaseType_t core)
+{
+    if (!sim->balance_pending[core])
+        return;
+    sim->balance_pending[core] = 0;
+
+    UBaseType_t target = core;
+    for (UBaseType_t other = 0; other < portNUM_PROCESSORS; other++)
+    {
+        if (ready_count(sim, other) < ready_count(sim, target))
+            target = other;
+    }
+
+    if (target == core || sim->mailbox[target])
+        return;
+
+    sim_task_t *best = NULL;
+    for (size_t i = 0; i < sim->task_count; i++)
+    {
+        sim_task_t *task = &sim->tasks[i];
+        if (task->ready && !task->in_flight && task->core == core && task != sim->running[core]
+            && (task->affinity & (1UL << target)) && (!best || task->priority > best->priority))
+            best = task;
+    }
+
+    if (best)
+    {
+        best->in_flight = 1;
+        best->core = target;
+        sim->mailbox[target] = best;
+        sim->migrations++;
+    }
+}
+
+static void sim_tick(sim_t *sim, uint32_t tick)
+{
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        if (sim->mailbox[core])
+        {
+            sim->mailbox[core]->in_flight = 0;
+            sim->mailbox[core] = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < sim->task_count; i++)
+    {
+        sim_task_t *task = &sim->tasks[i];
+        if (!task->ready && tick >= task->wake_tick)
+        {
+            task->ready = 1;
+            task->burst_left = sim_random(sim, task->burst_max);
+        }
+    }
+
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        sim_task_t *task = select_task(sim, core, tick);
+        sim->running[core] = task;
+        if (!task)
+            continue;
+
+        task->run_ticks++;
+        task->last_run = tick;
+        sim->busy_ticks++;
+        if (!(task->affinity & (1UL << core)))
+            task->wrong_core_ticks++;
+
+        if (task->burst_max && --task->burst_left == 0)
+        {
+            task->ready = 0;
+            task->wake_tick = tick + sim_random(sim, task->sleep_max);
+        }
+    }
+
+    if (!sim->balancing)
+        return;
+
+    if (tick % configLOAD_BALANCE_PERIOD == 0)
+    {
+        for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+            check_balance(sim, core);
+    }
+
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+        balance(sim, core);
+}
+
+typedef void (*scenario_t)(sim_t *sim);
+
+static void compute_bound(sim_t *sim)
+{
+    for (int i = 0; i < 6; i++)
+        sim_add(sim, 1, tskNO_AFFINITY, 0, 0);
+}
+
+static void bursty(sim_t *sim)
+{
+    for (int i = 0; i < 8; i++)
+        sim_add(sim, 1 + i % 3, tskNO_AFFINITY, 5, 10);
+}
+
+static void pinned(sim_t *sim)
+{
+    for (int i = 0; i < 2; i++)
+        sim_add(sim, 1, 1 << 0, 0, 0);
+    for (int i = 0; i < 4; i++)
+        sim_add(sim, 1, tskNO_AFFINITY, 0, 0);
+}
+
+/* Jain's index of the processor time of the tasks of one priority */
+static double fairness(sim_t *sim, UBaseType_t priority)
+{
+    double sum = 0, squares = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < sim->task_count; i++)
+    {
+        if (sim->tasks[i].priority == priority)
+        {
+            sum += sim->tasks[i].run_ticks;
+            squares += (double)sim->tasks[i].run_ticks * sim->tasks[i].run_ticks;
+            count++;
+        }
+    }
+
+    return squares ? sum * sum / (count * squares) : 1.0;
+}
+
+static void run(const char *name, scenario_t scenario, uint32_t ticks, double min_throughput)
+{
+    for (int balancing = 0; balancing < 2; balancing++)
+    {
+        sim_t sim;
+        memset(&sim, 0, sizeof(sim));
+        sim.balancing = balancing;
+        sim.seed = 1;
+        scenario(&sim);
+
+        for (uint32_t tick = 1; tick <= ticks; tick++)
+            sim_tick(&sim, tick);
+
+        double throughput = (double)sim.busy_ticks / ((double)ticks * portNUM_PROCESSORS);
+        printf("%-14s %-3s  throughput %5.1f%%  fairness %.3f  migrations %u\n",
+            name, balancing ? "on" : "off", throughput * 100, fairness(&sim, 1), sim.migrations);
+
+        for (size_t i = 0; i < sim.task_count; i++)
+            HOST_ASSERT(sim.tasks[i].wrong_core_ticks == 0);
+        if (balancing)
+            HOST_ASSERT(throughput >= min_throughput);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t ticks = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 1000000;
+
+    run("compute-bound", compute_bound, ticks, 0.95);
+    run("bursty", bursty, ticks, 0.5);
+    run("pinned", pinned, ticks, 0.95);
+    return 0;
+}
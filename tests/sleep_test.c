@@ -0,0 +1,157 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include <errno.h>
+#include <hrtimer.h>
+#include <sleep.h>
+
+/*
+ * Accuracy of nanosleep from 1 us to 100 ms at the lowest, the default and the
+ * highest cpu clock, and across a clock change in the middle of a sleep. mtime
+ * counts at a fiftieth of the cpu clock, so a sleep may end up to one mtime
+ * tick before the wall clock deadline but never earlier. The host scheduler
+ * adds its own latency to single sleeps, so lateness is bounded on the median
+ * of each sweep point and loosely on single sleeps.
+ */
+
+#define ROUNDS 21
+#define MAX_MEDIAN_LATE_NS 2000000ULL
+#define MAX_LATE_NS 20000000ULL
+
+static const UBaseType_t s_clocks[] = { 26000000, 390000000, 806000000 };
+static const uint64_t s_durations[] = { 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+static uint64_t mtime_tick_ns(void)
+{
+    return (1000000000ULL + hrtimer_clock_hz() - 1) / hrtimer_clock_hz();
+}
+
+static uint64_t timed_sleep(uint64_t duration)
+{
+    struct timespec req = { (time_t)(duration / 1000000000ULL), (long)(duration % 1000000000ULL) };
+    uint64_t start = host_time_ns();
+    HOST_ASSERT(nanosleep(&req, NULL) == 0);
+    return host_time_ns() - start;
+}
+
+static void check_elapsed(uint64_t duration, uint64_t elapsed, uint64_t tick_ns)
+{
+    HOST_ASSERT(elapsed + tick_ns >= duration);
+    HOST_ASSERT(elapsed < duration + MAX_LATE_NS);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void test_sweep(void)
+{
+    for (size_t c = 0; c < sizeof(s_clocks) / sizeof(s_clocks[0]); c++)
+    {
+        vPortSetCPUClock(s_clocks[c]);
+        uint64_t tick_ns = mtime_tick_ns();
+        printf("cpu %3u MHz, mtime tick %llu ns\n", (unsigned)(s_clocks[c] / 1000000), (unsigned long long)tick_ns);
+
+        for (size_t d = 0; d < sizeof(s_durations) / sizeof(s_durations[0]); d++)
+        {
+            uint64_t duration = s_durations[d];
+            int rounds = duration >= 10000000 ? 5 : ROUNDS;
+            uint64_t elapsed[ROUNDS];
+
+            for (int i = 0; i < rounds; i++)
+            {
+                elapsed[i] = timed_sleep(duration);
+                check_elapsed(duration, elapsed[i], tick_ns);
+            }
+
+            qsort(elapsed, rounds, sizeof(elapsed[0]), compare_u64);
+            uint64_t median = elapsed[rounds / 2];
+            HOST_ASSERT(median < duration + MAX_MEDIAN_LATE_NS);
+            printf("  %9llu ns  median late %8.1f us  max late %8.1f us\n", (unsigned long long)duration,
+                (double)(int64_t)(median - duration) / 1000, (double)(int64_t)(elapsed[rounds - 1] - duration) / 1000);
+        }
+    }
+}
+
+typedef struct
+{
+    UBaseType_t clock;
+    uint64_t delay_ns;
+} clock_change_t;
+
+static void clock_change_task(void *arg)
+{
+    clock_change_t *change = (clock_change_t *)arg;
+    uint64_t start = host_time_ns();
+    while (host_time_ns() - start < change->delay_ns)
+        vTaskDelay(1);
+    vPortSetCPUClock(change->clock);
+    vTaskDelete(NULL);
+}
+
+/* A pending sleep keeps its wall clock deadline when the clock changes under it,
+ * without the rescale a slower clock would wake it far too late */
+static void test_clock_change(void)
+{
+    static const UBaseType_t pairs[][2] = { { 390000000, 26000000 }, { 26000000, 806000000 }, { 806000000, 390000000 } };
+    const uint64_t duration = 50000000;
+
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++)
+    {
+        vPortSetCPUClock(pairs[i][0]);
+        uint64_t tick_ns = mtime_tick_ns();
+        clock_change_t change = { pairs[i][1], duration / 2 };
+
+        uint64_t start_ns = hrtimer_now_ns();
+        HOST_ASSERT(xTaskCreateAtProcessor(1, clock_change_task, "clock", configMINIMAL_STACK_SIZE, &change, 1, NULL) == pdPASS);
+        uint64_t elapsed = timed_sleep(duration);
+        HOST_ASSERT(hrtimer_clock_hz() == pairs[i][1] / 50);
+        if (mtime_tick_ns() > tick_ns)
+            tick_ns = mtime_tick_ns();
+        check_elapsed(duration, elapsed, tick_ns);
+
+        /* The nanosecond clock runs on across the change */
+        uint64_t clock_elapsed = hrtimer_now_ns() - start_ns;
+        HOST_ASSERT(clock_elapsed + 2 * tick_ns >= elapsed && clock_elapsed < elapsed + MAX_LATE_NS);
+
+        printf("cpu %3u -> %3u MHz during %llu ns: late %8.1f us\n", (unsigned)(pairs[i][0] / 1000000),
+            (unsigned)(pairs[i][1] / 1000000), (unsigned long long)duration, (double)(int64_t)(elapsed - duration) / 1000);
+    }
+}
+
+static void test_usleep(void)
+{
+    vPortSetCPUClock(390000000);
+    uint64_t start = host_time_ns();
+    HOST_ASSERT(usleep(1500) == 0);
+    check_elapsed(1500000, host_time_ns() - start, mtime_tick_ns());
+
+    struct timespec req = { 0, 1000000000 };
+    HOST_ASSERT(nanosleep(&req, NULL) == -1 && errno == EINVAL);
+    req.tv_sec = -1;
+    req.tv_nsec = 0;
+    HOST_ASSERT(nanosleep(&req, NULL) == -1 && errno == EINVAL);
+}
+
+int main(void)
+{
+    test_usleep();
+    test_sweep();
+    test_clock_change();
+    printf("sleep_test passed\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include "list.h"
+
+/*
+ * Cost of taskSELECT_HIGHEST_PRIORITY_TASK with the port bitmap and with the
+ * generic scan of the ready lists, for a task at the top priority of the
+ * range that wakes, runs and blocks again over background tasks at priority
+ * 0 and 1, for ranges of 4 up to configMAX_PRIORITIES priorities.
+ *
+ *   task_select_bench [switches per range]
+ */
+
+#define BACKGROUND_TASKS 2
+
+typedef struct
+{
+    List_t lists[configMAX_PRIORITIES];
+    UBaseType_t top_priority;
+    UBaseType_t bitmap;
+} ready_lists_t;
+
+typedef struct
+{
+    ListItem_t item;
+    UBaseType_t priority;
+} task_t;
+
+static void ready_init(ready_lists_t *ready)
+{
+    for (size_t i = 0; i < configMAX_PRIORITIES; i++)
+        vListInitialise(&ready->lists[i]);
+    ready->top_priority = 0;
+    ready->bitmap = 0;
+}
+
+static void ready_add(ready_lists_t *ready, task_t *task)
+{
+    if (task->priority > ready->top_priority)
+        ready->top_priority = task->priority;
+    portRECORD_READY_PRIORITY(task->priority, ready->bitmap);
+    vListInsertEnd(&ready->lists[task->priority], &task->item);
+}
+
+static void ready_remove(ready_lists_t *ready, task_t *task)
+{
+    if (uxListRemove(&task->item) == 0)
+        portRESET_READY_PRIORITY(task->priority, ready->bitmap);
+}
+
+/* taskSELECT_HIGHEST_PRIORITY_TASK of both selection methods */
+static task_t *select_generic(ready_lists_t *ready)
+{
+    UBaseType_t top_priority = ready->top_priority;
+    while (listLIST_IS_EMPTY(&ready->lists[top_priority]))
+    {
+        configASSERT(top_priority);
+        --top_priority;
+    }
+
+    task_t *task;
+    listGET_OWNER_OF_NEXT_ENTRY(task, &ready->lists[top_priority]);
+    ready->top_priority = top_priority;
+    return task;
+}
+
+static task_t *select_bitmap(ready_lists_t *ready)
+{
+    UBaseType_t top_priority;
+    portGET_HIGHEST_PRIORITY(top_priority, ready->bitmap);
+    configASSERT(listCURRENT_LIST_LENGTH(&ready->lists[top_priority]) > 0);
+
+    task_t *task;
+    listGET_OWNER_OF_NEXT_ENTRY(task, &ready->lists[top_priority]);
+    return task;
+}
+
+static void test_highest_priority(void)
+{
+    for (UBaseType_t bit = 0; bit < 32; bit++)
+    {
+        HOST_ASSERT(uxPortGetHighestPriority(1UL << bit) == bit);
+        HOST_ASSERT(uxPortGetHighestPriority((1UL << bit) | 1) == bit);
+        HOST_ASSERT(uxPortGetHighestPriority((2UL << bit) - 1) == bit);
+    }
+}
+
+static double run(task_t *(*select)(ready_lists_t *), UBaseType_t priorities, uint32_t switches)
+{
+    static ready_lists_t ready;
+    task_t background[BACKGROUND_TASKS];
+    task_t waker;
+
+    ready_init(&ready);
+    for (size_t i = 0; i < BACKGROUND_TASKS; i++)
+    {
+        vListInitialiseItem(&background[i].item);
+        listSET_LIST_ITEM_OWNER(&background[i].item, &background[i]);
+        background[i].priority = i;
+        ready_add(&ready, &background[i]);
+    }
+
+    vListInitialiseItem(&waker.item);
+    listSET_LIST_ITEM_OWNER(&waker.item, &waker);
+    waker.priority = priorities - 1;
+
+    uint64_t start = host_time_ns();
+    for (uint32_t i = 0; i < switches; i++)
+    {
+        ready_add(&ready, &waker);
+        HOST_ASSERT(select(&ready) == &waker);
+        ready_remove(&ready, &waker);
+        HOST_ASSERT(select(&ready) == &background[BACKGROUND_TASKS - 1]);
+    }
+
+    return (double)(host_time_ns() - start) / ((double)switches * 2);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t switches = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 2000000;
+    test_highest_priority();
+
+    printf("priorities  generic ns  bitmap ns\n");
+    for (UBaseType_t priorities = 4; priorities <= configMAX_PRIORITIES; priorities *= 2)
+    {
+        double generic = run(select_generic, priorities, switches);
+        double bitmap = run(select_bitmap, priorities, switches);
+        printf("%10u %11.1f %10.1f\n", (unsigned)priorities, generic, bitmap);
+    }
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* Copyright 2018 Canaan Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host_port.h"
+#include <cstring>
+#include <kernel/vectored_io.hpp>
+#include <vector>
+
+using namespace sys;
+
+/* A stream device that transfers at most the next of its limits per call,
+ * a negative limit fails the call. Reads return bytes counting up, writes
+ * append to the written bytes. */
+struct device_t
+{
+    std::vector<int> limits;
+    size_t calls = 0;
+    uint8_t next = 0;
+    std::vector<uint8_t> written;
+
+    int transfer_len(size_t len)
+    {
+        int limit = calls < limits.size() ? limits[calls] : INT32_MAX;
+        calls++;
+        if (limit < 0)
+            return limit;
+        return len < size_t(limit) ? int(len) : limit;
+    }
+
+    int read(gsl::span<uint8_t> buffer)
+    {
+        int len = transfer_len(buffer.size());
+        for (int i = 0; i < len; i++)
+            buffer[i] = next++;
+        return len;
+    }
+
+    int write(gsl::span<const uint8_t> buffer)
+    {
+        int len = transfer_len(buffer.size());
+        if (len > 0)
+            written.insert(written.end(), buffer.begin(), buffer.begin() + len);
+        return len;
+    }
+};
+
+static uint8_t s_buffers[3][8];
+
+/* Three buffers of 4, 0 and 8 bytes, the empty one must not stop the transfer */
+static std::vector<io_vec_t> make_vecs()
+{
+    memset(s_buffers, 0xff, sizeof(s_buffers));
+    return { { s_buffers[0], 4 }, { s_buffers[1], 0 }, { s_buffers[2], 8 } };
+}
+
+static void check_read(std::vector<int> limits, int expected, size_t expected_calls)
+{
+    device_t device;
+    device.limits = limits;
+    auto vecs = make_vecs();
+    HOST_ASSERT(io_readv_each(&device, { vecs.data(), std::ptrdiff_t(vecs.size()) }) == expected);
+    HOST_ASSERT(device.calls == expected_calls);
+
+    /* The bytes read land in order across the buffers, the rest is untouched */
+    int filled = expected < 0 ? 0 : expected;
+    for (int i = 0; i < 12; i++)
+    {
+        uint8_t value = i < 4 ? s_buffers[0][i] : s_buffers[2][i - 4];
+        HOST_ASSERT(value == (i < filled ? i : 0xff));
+    }
+}
+
+static void check_write(std::vector<int> limits, int expected, size_t expected_calls)
+{
+    device_t device;
+    device.limits = limits;
+    auto vecs = make_vecs();
+    for (int i = 0; i < 12; i++)
+        (i < 4 ? s_buffers[0][i] : s_buffers[2][i - 4]) = uint8_t(i);
+
+    HOST_ASSERT(io_writev_each(&device, { vecs.data(), std::ptrdiff_t(vecs.size()) }) == expected);
+    HOST_ASSERT(device.calls == expected_calls);
+    HOST_ASSERT(device.written.size() == size_t(expected < 0 ? 0 : expected));
+    for (size_t i = 0; i < device.written.size(); i++)
+        HOST_ASSERT(device.written[i] == i);
+}
+
+int main()
+{
+    /* Every buffer in full, one call each */
+    check_read({}, 12, 3);
+    check_write({}, 12, 3);
+
+    /* A short transfer ends it, the next buffers are not tried */
+    check_read({ 3 }, 3, 1);
+    check_write({ 3 }, 3, 1);
+    check_read({ 4, 0, 5 }, 9, 3);
+    check_write({ 4, 0, 5 }, 9, 3);
+
+    /* An error before any data is returned, after some data the data is */
+    check_read({ -1 }, -1, 1);
+    check_write({ -1 }, -1, 1);
+    check_read({ 4, 0, -1 }, 4, 3);
+    check_write({ 4, 0, -1 }, 4, 3);
+
+    /* No buffers, no calls */
+    device_t device;
+    HOST_ASSERT(io_readv_each(&device, gsl::span<const io_vec_t>()) == 0);
+    HOST_ASSERT(io_writev_each(&device, gsl::span<const io_vec_t>()) == 0);
+    HOST_ASSERT(device.calls == 0);
+
+    printf("vectored_io_test passed\n");
+    return 0;
+}
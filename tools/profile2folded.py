@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 Canaan Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Symbolize a profiler_write() dump and emit folded stacks.
+
+The output is one line per distinct stack, "task;outer;...;leaf count", as
+read by flamegraph.pl and speedscope.
+
+usage: profile2folded.py profile.bin firmware.elf [-o profile.folded]
+"""
+
+import argparse
+import collections
+import struct
+import subprocess
+import sys
+
+HEADER = struct.Struct('<8sIIIIQQ')
+NAME = struct.Struct('<I16s')
+SAMPLE = struct.Struct('<QIHH')
+
+
+def parse(data):
+    magic, version, depth, rate_hz, name_count, count, dropped = HEADER.unpack_from(data, 0)
+    if magic.rstrip(b'\0') != b'K210PRF' or version != 1:
+        raise ValueError('not a version 1 profile dump')
+
+    offset = HEADER.size
+    names = {}
+    for _ in range(name_count):
+        task, name = NAME.unpack_from(data, offset)
+        names[task] = name.split(b'\0', 1)[0].decode('ascii', 'replace')
+        offset += NAME.size
+
+    stride = SAMPLE.size + depth * 8
+    samples = []
+    for i in range(count):
+        pc, task, core, used = SAMPLE.unpack_from(data, offset + i * stride)
+        frames = struct.unpack_from('<%dQ' % used, data, offset + i * stride + SAMPLE.size)
+        samples.append((pc, task, core, frames))
+
+    return rate_hz, dropped, names, samples
+
+
+def symbolize(addr2line, elf, addresses):
+    addresses = sorted(addresses)
+    if not addresses:
+        return {}
+
+    out = subprocess.run([addr2line, '-f', '-C', '-e', elf] + ['0x%x' % a for a in addresses],
+                         check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout.splitlines()
+    symbols = {}
+    for i, address in enumerate(addresses):
+        function = out[i * 2] if i * 2 < len(out) else '??'
+        symbols[address] = function if function != '??' else '0x%x' % address
+    return symbols
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('profile', help='binary image written by profiler_write()')
+    parser.add_argument('elf', help='firmware ELF the profile was taken from')
+    parser.add_argument('-o', '--output', help='folded stacks output, stdout by default')
+    parser.add_argument('--addr2line', default='riscv64-unknown-elf-addr2line', help='addr2line of the toolchain')
+    parser.add_argument('--per-core', action='store_true', help='add the core as the outermost frame')
+    args = parser.parse_args()
+
+    with open(args.profile, 'rb') as f:
+        rate_hz, dropped, names, samples = parse(f.read())
+
+    # Return addresses point after the call, look up the call itself
+    addresses = set()
+    for pc, _, _, frames in samples:
+        addresses.add(pc)
+        addresses.update(ra - 1 for ra in frames)
+    symbols = symbolize(args.addr2line, args.elf, addresses)
+
+    stacks = collections.Counter()
+    for pc, task, core, frames in samples:
+        stack = [symbols[pc]] + [symbols[ra - 1] for ra in frames]
+        stack.append(names.get(task, 'task 0x%08x' % task))
+        if args.per_core:
+            stack.append('core %d' % core)
+        stacks[';'.join(reversed(stack))] += 1
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    for stack, count in sorted(stacks.items()):
+        out.write('%s %d\n' % (stack, count))
+    if args.output:
+        out.close()
+
+    print('%d samples at %d Hz, %d dropped' % (len(samples), rate_hz, dropped), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 Canaan Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Convert a trace_dump() image into Chrome trace event JSON.
+
+The output loads in chrome://tracing and ui.perfetto.dev. Each core gets a
+task track and an interrupt track, DMA channels and the KPU get their own
+processes.
+
+usage: trace2json.py trace.bin [-o trace.json]
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+HEADER = struct.Struct('<8sIIQII')
+NAME = struct.Struct('<I16s')
+CORE = struct.Struct('<IIQ')
+EVENT = struct.Struct('<QBBHI')
+
+(EV_NONE, EV_TASK_SWITCH_IN, EV_TASK_SWITCH_OUT, EV_TASK_READY,
+ EV_ISR_ENTER, EV_ISR_EXIT, EV_PIC_IRQ_ENTER, EV_PIC_IRQ_EXIT,
+ EV_QUEUE_BLOCK_SEND, EV_QUEUE_BLOCK_RECEIVE, EV_QUEUE_BLOCK_PEEK,
+ EV_DMA_START, EV_DMA_COMPLETE, EV_KPU_LAYER, EV_KPU_DONE) = range(15)
+EV_USER = 0x80
+
+IRQ_NAMES = {3: 'm_soft', 7: 'm_timer', 11: 'm_ext'}
+
+KPU_LAYER_NAMES = {
+    1: 'add', 2: 'quantized_add', 3: 'global_max_pool2d',
+    4: 'quantized_global_max_pool2d', 5: 'global_average_pool2d',
+    6: 'quantized_global_average_pool2d', 7: 'max_pool2d',
+    8: 'quantized_max_pool2d', 9: 'average_pool2d',
+    10: 'quantized_average_pool2d', 11: 'quantize', 12: 'dequantize',
+    13: 'requantize', 14: 'l2_normalization', 15: 'softmax', 16: 'concat',
+    17: 'quantized_concat', 18: 'fully_connected',
+    19: 'quantized_fully_connected', 20: 'tensorflow_flatten',
+    21: 'quantized_tensorflow_flatten', 22: 'resize_nearest_neighbor',
+    23: 'quantized_resize_nearest_neighbor', 10240: 'k210_conv',
+    10241: 'k210_add_padding', 10242: 'k210_remove_padding',
+    10243: 'k210_upload',
+}
+
+PID_DMA = 100
+PID_KPU = 101
+TID_TASKS = 0
+TID_IRQ = 1
+
+
+def parse(data):
+    magic, version, core_count, clock_hz, name_count, event_size = HEADER.unpack_from(data, 0)
+    if magic.rstrip(b'\0') != b'K210TRC' or version != 1 or event_size != EVENT.size:
+        raise ValueError('not a version 1 trace dump')
+
+    offset = HEADER.size
+    names = {}
+    for _ in range(name_count):
+        obj, name = NAME.unpack_from(data, offset)
+        names[obj] = name.split(b'\0', 1)[0].decode('ascii', 'replace')
+        offset += NAME.size
+
+    cores = []
+    for _ in range(core_count):
+        core, count, overwritten = CORE.unpack_from(data, offset)
+        offset += CORE.size
+        events = [EVENT.unpack_from(data, offset + i * EVENT.size) for i in range(count)]
+        offset += count * EVENT.size
+        cores.append((core, overwritten, events))
+
+    return clock_hz, names, cores
+
+
+class Converter:
+    def __init__(self, clock_hz, names, cores):
+        self.clock_hz = clock_hz
+        self.names = names
+        self.cores = cores
+        self.out = []
+        starts = [events[0][0] for _, _, events in cores if events]
+        self.t0 = min(starts) if starts else 0
+
+    def ts(self, time):
+        return (time - self.t0) * 1e6 / self.clock_hz
+
+    def name(self, obj, kind):
+        return self.names.get(obj, '%s 0x%08x' % (kind, obj))
+
+    def meta(self, pid, tid, what, name):
+        args = {'name': name}
+        entry = {'ph': 'M', 'pid': pid, 'name': what, 'args': args}
+        if tid is not None:
+            entry['tid'] = tid
+        self.out.append(entry)
+
+    def slice(self, pid, tid, name, start, end, args=None):
+        self.out.append({'ph': 'X', 'pid': pid, 'tid': tid, 'name': name,
+                         'ts': self.ts(start), 'dur': max(self.ts(end) - self.ts(start), 0),
+                         'args': args or {}})
+
+    def instant(self, pid, tid, name, time, args=None):
+        self.out.append({'ph': 'i', 's': 't', 'pid': pid, 'tid': tid, 'name': name,
+                         'ts': self.ts(time), 'args': args or {}})
+
+    def convert(self):
+        dma_open = {}
+        kpu_open = None
+        end_time = max((events[-1][0] for _, _, events in self.cores if events), default=0)
+
+        for core, overwritten, events in self.cores:
+            self.meta(core, None, 'process_name', 'Core %d' % core)
+            self.meta(core, TID_TASKS, 'thread_name', 'tasks')
+            self.meta(core, TID_IRQ, 'thread_name', 'interrupts')
+            if overwritten:
+                print('core %d: %d older events were overwritten' % (core, overwritten), file=sys.stderr)
+
+            running = None
+            irq_stack = []
+            for time, kind, arg8, arg16, arg32 in events:
+                if kind == EV_TASK_SWITCH_IN:
+                    running = (arg32, arg16, time)
+                elif kind == EV_TASK_SWITCH_OUT:
+                    if running and running[0] == arg32:
+                        self.slice(core, TID_TASKS, self.name(arg32, 'task'), running[2], time,
+                                   {'priority': running[1]})
+                    running = None
+                elif kind == EV_TASK_READY:
+                    self.instant(core, TID_TASKS, 'ready ' + self.name(arg32, 'task'), time,
+                                 {'priority': arg16})
+                elif kind in (EV_QUEUE_BLOCK_SEND, EV_QUEUE_BLOCK_RECEIVE, EV_QUEUE_BLOCK_PEEK):
+                    op = {EV_QUEUE_BLOCK_SEND: 'send', EV_QUEUE_BLOCK_RECEIVE: 'receive',
+                          EV_QUEUE_BLOCK_PEEK: 'peek'}[kind]
+                    self.instant(core, TID_TASKS, 'block %s %s' % (op, self.name(arg32, 'queue')), time)
+                elif kind in (EV_ISR_ENTER, EV_PIC_IRQ_ENTER):
+                    name = ('isr ' + IRQ_NAMES.get(arg8, str(arg8))) if kind == EV_ISR_ENTER else 'irq %d' % arg32
+                    irq_stack.append((name, time))
+                elif kind in (EV_ISR_EXIT, EV_PIC_IRQ_EXIT):
+                    if irq_stack:
+                        name, start = irq_stack.pop()
+                        self.slice(core, TID_IRQ, name, start, time)
+                elif kind >= EV_USER:
+                    self.instant(core, TID_TASKS, 'user %d' % kind, time,
+                                 {'arg8': arg8, 'arg16': arg16, 'arg32': arg32})
+
+            if running:
+                self.slice(core, TID_TASKS, self.name(running[0], 'task'), running[2], end_time,
+                           {'priority': running[1]})
+
+        # DMA and KPU events can be recorded on either core, pair them in time order
+        merged = sorted(event for _, _, events in self.cores for event in events
+                        if EV_DMA_START <= event[1] <= EV_KPU_DONE)
+        for time, kind, arg8, arg16, arg32 in merged:
+            if kind == EV_DMA_START:
+                dma_open[arg8] = (time, arg32, arg16)
+            elif kind == EV_DMA_COMPLETE:
+                if arg8 in dma_open:
+                    start, count, loop = dma_open[arg8]
+                    self.slice(PID_DMA, arg8, 'loop stage' if loop else 'transfer', start, time,
+                               {'count': count})
+                    if loop:
+                        dma_open[arg8] = (time, count, loop)
+                    else:
+                        del dma_open[arg8]
+                else:
+                    self.instant(PID_DMA, arg8, 'complete', time)
+            elif kind == EV_KPU_LAYER:
+                if kpu_open:
+                    self.slice(PID_KPU, 0, kpu_open[0], kpu_open[1], time)
+                kpu_open = ('layer %d %s' % (arg32, KPU_LAYER_NAMES.get(arg16, str(arg16))), time)
+            elif kind == EV_KPU_DONE:
+                if kpu_open:
+                    self.slice(PID_KPU, 0, kpu_open[0], kpu_open[1], time)
+                kpu_open = None
+                self.instant(PID_KPU, 0, 'done', time)
+
+        self.meta(PID_DMA, None, 'process_name', 'DMA')
+        for channel in range(6):
+            self.meta(PID_DMA, channel, 'thread_name', 'channel %d' % channel)
+        self.meta(PID_KPU, None, 'process_name', 'KPU')
+        return {'traceEvents': self.out, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('dump', help='binary image written by trace_dump()')
+    parser.add_argument('-o', '--output', help='JSON output, stdout by default')
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as f:
+        clock_hz, names, cores = parse(f.read())
+
+    trace = Converter(clock_hz, names, cores).convert()
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()